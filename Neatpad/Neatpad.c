@@ -33,6 +33,7 @@ HFONT		g_hFont;
 TCHAR		g_szFileName[MAX_PATH];
 TCHAR		g_szFileTitle[MAX_PATH];
 BOOL		g_fFileChanged = FALSE;
+BOOL		g_fFollowFile  = FALSE;
 
 TCHAR		*g_szEditMode[] = { _T("READ"), _T("INS"), _T("OVR") };
 
@@ -220,7 +221,8 @@ UINT NotifyHandler(HWND hwnd, NMHDR *nmhdr)
 	
 			TextView_SetEditMode(g_hwndTextView, nMode);
 		
-			SetStatusBarText(g_hwndStatusbar, 2, 0, g_szEditMode[nMode]);
+			// a compressed file stays read-only whatever the mode
+			SetStatusBarText(g_hwndStatusbar, 2, 0, g_szEditMode[TextView_GetEditMode(g_hwndTextView)]);
 		}
 
 		break;
@@ -238,6 +240,7 @@ UINT NotifyHandler(HWND hwnd, NMHDR *nmhdr)
 UINT CommandHandler(HWND hwnd, UINT nCtrlId, UINT nCtrlCode, HWND hwndFrom)
 {
 	RECT rect;
+	int  nFormat[2];
 
 	switch(nCtrlId)
 	{
@@ -249,6 +252,7 @@ UINT CommandHandler(HWND hwnd, UINT nCtrlId, UINT nCtrlCode, HWND hwndFrom)
 
 		g_szFileTitle[0] = '\0';
 		g_fFileChanged   = FALSE;
+		g_fFollowFile	 = FALSE;
 		return 0;
 		
 	case IDM_FILE_OPEN:
@@ -262,19 +266,37 @@ UINT CommandHandler(HWND hwnd, UINT nCtrlId, UINT nCtrlCode, HWND hwndFrom)
 		return 0;
 
 	case IDM_FILE_SAVE:
-		MessageBox(hwnd, _T("Not implemented"), APP_TITLE, MB_ICONINFORMATION);
-		return 0;
+
+		// keep the file's current encoding
+		if(g_szFileTitle[0])
+		{
+			DoSaveFile(hwnd, g_szFileName, g_szFileTitle, TextView_GetFormat(g_hwndTextView));
+			return 0;
+		}
+
+		// untitled, so ask for a name first
 
 	case IDM_FILE_SAVEAS:
 
-		// does nothing yet
-		if(ShowSaveFileDlg(hwnd, g_szFileName, g_szFileTitle))
+		nFormat[0] = TextView_GetFormat(g_hwndTextView);
+		nFormat[1] = 0;
+
+		if(ShowSaveFileDlg(hwnd, g_szFileName, g_szFileTitle, nFormat))
 		{
-			MessageBox(hwnd, _T("Not implemented"), APP_TITLE, MB_ICONINFORMATION);
+			TextView_SetLineEnding(g_hwndTextView, nFormat[1]);
+			DoSaveFile(hwnd, g_szFileName, g_szFileTitle, nFormat[0]);
 		}
 
 		return 0;
 		
+	case IDM_FILE_RELOAD:
+
+		// anything that hasn't been saved is lost, but the reload can be undone
+		if(g_szFileTitle[0])
+			TextView_ReloadFile(g_hwndTextView);
+
+		return 0;
+
 	case IDM_FILE_PRINT:
 		
 		DeleteDC(
@@ -342,6 +364,13 @@ UINT CommandHandler(HWND hwnd, UINT nCtrlId, UINT nCtrlCode, HWND hwndFrom)
 		TextView_SetStyleBool(g_hwndTextView, TXS_LONGLINES, g_fLongLines);
 		return 0;
 		
+	case IDM_VIEW_FOLLOW:
+		g_fFollowFile = !g_fFollowFile;
+
+		if(!TextView_FollowFile(g_hwndTextView, g_fFollowFile))
+			g_fFollowFile = FALSE;
+		return 0;
+		
 	case IDM_VIEW_STATUSBAR:
 		g_fShowStatusbar = !g_fShowStatusbar;
 		ShowWindow(g_hwndStatusbar, SW_HIDE);
@@ -427,6 +456,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		CheckMenuCommand((HMENU)wParam, IDM_VIEW_LONGLINES,		g_fLongLines);
 		CheckMenuCommand((HMENU)wParam, IDM_VIEW_SAVEEXIT,		g_fSaveOnExit);
 		CheckMenuCommand((HMENU)wParam, IDM_VIEW_STATUSBAR,		g_fShowStatusbar);
+		CheckMenuCommand((HMENU)wParam, IDM_VIEW_FOLLOW,		g_fFollowFile);
 		//CheckMenuCommand((HMENU)wParam, IDM_VIEW_SEARCHBAR,		g_hwndSearchBar ? TRUE : FALSE);
 
 		EnableMenuCommand((HMENU)wParam, IDM_EDIT_UNDO,		TextView_CanUndo(g_hwndTextView));
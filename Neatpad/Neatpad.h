@@ -48,6 +48,7 @@ extern HFONT	g_hFont;
 extern TCHAR	g_szFileName[];
 extern TCHAR	g_szFileTitle[];
 extern BOOL		g_fFileChanged;
+extern BOOL		g_fFollowFile;
 extern HINSTANCE g_hResourceModule;
 
 //
@@ -74,9 +75,9 @@ BOOL SetImageFileExecutionOptions(BOOL fReplaceWithCurrentApp);
 //	OpenSave.c functions
 //
 BOOL DoOpenFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle);
-BOOL DoSaveFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle);
+BOOL DoSaveFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle, int nFormat);
 BOOL ShowOpenFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName);
-BOOL ShowSaveFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName);
+BOOL ShowSaveFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName, int *pnFormat);
 void HandleDropFiles(HWND hwnd, HDROP hDrop);
 void NeatpadOpenFile(HWND hwnd, TCHAR *szFile);
 
@@ -140,15 +140,24 @@ BOOL ShowOpenFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName)
 //	Hook procedure for the SaveAs dialog,
 //	used to center the dialog on 1st invokation and manage the 'encoding' combobox
 //
+//	The encoding list is in the same order as the NCP_xxx formats, and the 
+//	selections are passed in and out through the OPENFILENAME's lCustData
+//
 UINT_PTR CALLBACK SaveHookProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
+	static int lineFmt[] = { 0, TXL_CRLF, TXL_LF, TXL_CR, TXL_LS };
+
 	HWND hwndCombo;
 	RECT rect;
+	int *pnFormat;
 
 	switch(msg)
 	{
 	case WM_INITDIALOG:
 
+		pnFormat = (int *)((OPENFILENAME *)lParam)->lCustData;
+		SetWindowLong(hwnd, GWL_USERDATA, (LONG)pnFormat);
+
 		if(g_fFirstTime)
 		{
 			CenterWindow(GetParent(hwnd));
@@ -159,7 +168,9 @@ UINT_PTR CALLBACK SaveHookProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
 		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_ADDSTRING, 0, (LPARAM)_T("Unicode (UTF-8)"));
 		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_ADDSTRING, 0, (LPARAM)_T("Unicode (UTF-16)"));
 		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_ADDSTRING, 0, (LPARAM)_T("Unicode (UTF-16, Big Endian)"));
-		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_SETCURSEL, 0, 0);
+		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_ADDSTRING, 0, (LPARAM)_T("Unicode (UTF-32)"));
+		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_ADDSTRING, 0, (LPARAM)_T("Unicode (UTF-32, Big Endian)"));
+		SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_SETCURSEL, *pnFormat, 0);
 
 		SendDlgItemMessage(hwnd, IDC_LINEFMTLIST, CB_ADDSTRING, 0, (LPARAM)_T("Keep Existing"));
 		SendDlgItemMessage(hwnd, IDC_LINEFMTLIST, CB_ADDSTRING, 0, (LPARAM)_T("Windows (CR/LF)"));
@@ -195,6 +206,18 @@ UINT_PTR CALLBACK SaveHookProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
 
 		return 0;
 
+	case WM_NOTIFY:
+
+		// remember the encoding and line-format once the user has chosen a file
+		if(((OFNOTIFY *)lParam)->hdr.code == CDN_FILEOK)
+		{
+			pnFormat	= (int *)GetWindowLong(hwnd, GWL_USERDATA);
+			pnFormat[0] = SendDlgItemMessage(hwnd, IDC_ENCODINGLIST, CB_GETCURSEL, 0, 0);
+			pnFormat[1] = lineFmt[SendDlgItemMessage(hwnd, IDC_LINEFMTLIST, CB_GETCURSEL, 0, 0)];
+		}
+
+		return 0;
+
 	default:
 		break;
 	}
@@ -205,7 +228,10 @@ UINT_PTR CALLBACK SaveHookProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
 //
 //	Show the GetSaveFileName common dialog
 //
-BOOL ShowSaveFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName)
+//	pnFormat - [in/out] the encoding to save in (NCP_xxx), followed by
+//			   [out]	the line-endings to use (TXL_xxx, or 0 to keep them)
+//
+BOOL ShowSaveFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName, int *pnFormat)
 {
 	TCHAR *szFilter		= _T("Text Files (*.txt)\0*.txt\0All Files (*.*)\0*.*\0\0");
 	
@@ -218,6 +244,7 @@ BOOL ShowSaveFileDlg(HWND hwnd, TCHAR *pstrFileName, TCHAR *pstrTitleName)
 	ofn.lpstrFileTitle	= pstrTitleName;
 	ofn.lpTemplateName	= MAKEINTRESOURCE(IDD_SAVEFILE);
 	ofn.lpfnHook		= SaveHookProc;
+	ofn.lCustData		= (LPARAM)pnFormat;
 	
 	ofn.nFilterIndex	= 1;
 	ofn.nMaxFile		= _MAX_PATH;
@@ -268,9 +295,13 @@ BOOL DoOpenFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle)
 {
 	int fmt, fmtlook[] = 
 	{
-		IDM_VIEW_ASCII, IDM_VIEW_UTF8, IDM_VIEW_UTF16, IDM_VIEW_UTF16BE 
+		IDM_VIEW_ASCII, IDM_VIEW_UTF8, IDM_VIEW_UTF16, IDM_VIEW_UTF16BE,
+		IDM_VIEW_UTF32, IDM_VIEW_UTF32BE
 	};
 
+	// opening a file stops following the last one
+	g_fFollowFile = FALSE;
+
 	if(TextView_OpenFile(g_hwndTextView, szFileName))
 	{
 		SetWindowFileName(hwndMain, szFileTitle, FALSE);
@@ -279,7 +310,7 @@ BOOL DoOpenFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle)
 		fmt = TextView_GetFormat(g_hwndTextView);
 
 		CheckMenuRadioItem(GetMenu(hwndMain), 
-			IDM_VIEW_ASCII, IDM_VIEW_UTF16BE, 
+			IDM_VIEW_ASCII, IDM_VIEW_UTF32BE, 
 			fmtlook[fmt], MF_BYCOMMAND);
 
 		NotifyFileChange(szFileName, hwndMain, 0);
@@ -294,6 +325,24 @@ BOOL DoOpenFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle)
 	}
 }
 
+//
+//	Save to the specified file, in the specified format
+//
+BOOL DoSaveFile(HWND hwndMain, TCHAR *szFileName, TCHAR *szFileTitle, int nFormat)
+{
+	if(TextView_SaveFile(g_hwndTextView, szFileName, nFormat))
+	{
+		SetWindowFileName(hwndMain, szFileTitle, FALSE);
+		g_fFileChanged = FALSE;
+		return TRUE;
+	}
+	else
+	{
+		FmtErrorMsg(hwndMain, MB_OK|MB_ICONWARNING, GetLastError(), _T("Error saving \'%s\'\r\n\r\n"), szFileName);
+		return FALSE;
+	}
+}
+
 void NeatpadOpenFile(HWND hwnd, TCHAR *szFile)
 {
 	TCHAR *name;
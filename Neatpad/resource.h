@@ -127,13 +127,17 @@
 #define IDM_EDIT_GOTO                   40030
 #define IDM_SCHEME_NORMAL               40032
 #define IDM_SCHEME_SAVE                 40033
+#define IDM_VIEW_UTF32                  40034
+#define IDM_VIEW_UTF32BE                40035
+#define IDM_VIEW_FOLLOW                 40036
+#define IDM_FILE_RELOAD                 40037
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        131
-#define _APS_NEXT_COMMAND_VALUE         40034
+#define _APS_NEXT_COMMAND_VALUE         40038
 #define _APS_NEXT_CONTROL_VALUE         1055
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
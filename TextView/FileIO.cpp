@@ -0,0 +1,1128 @@
+//
+//	MODULE:		FileIO.cpp
+//
+//	PURPOSE:	Platform file access for a TextDocument - plain reads,
+//				a read-ahead thread that loads a whole file in the 
+//				background, a double-buffered writer for saving, and
+//				change notification
+//
+//	NOTES:		www.catch22.net
+//
+
+#ifdef _WIN32
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+#include <string.h>
+#include "FileIO.h"
+#include "FileZip.h"
+#include "Unicode.h"
+
+// how often a file is looked at when there is no way of being told it has changed
+#define WATCH_POLLTIME	250
+
+static FILEHANDLE file_unzip(FILEHANDLE hFile);
+
+struct _FILEHANDLE
+{
+#ifdef _WIN32
+	HANDLE			hFile;
+#else
+	int				fd;
+#endif
+	ZIPFILE		   *zip;				// decompressor, if the file is compressed
+};
+
+struct _FILELOADER
+{
+	FILEHANDLE		hFile;
+	char		   *buffer;
+	unsigned long	length;
+	FILELOADFUNC	callback;
+	void		   *param;
+
+	volatile unsigned long	loaded;		// how much of the buffer has been filled so far
+	volatile bool			done;		// finished, or stopped by a read error
+
+#ifdef _WIN32
+	HANDLE			hThread;
+	HANDLE			hProgress;			// set each time more of the file arrives
+#else
+	pthread_t		thread;
+	bool			threadok;
+	pthread_mutex_t	lock;
+	pthread_cond_t	progress;
+#endif
+};
+
+struct _FILEWRITER
+{
+	FILEHANDLE		hFile;
+	unsigned char  *buf[2];
+	unsigned long	len[2];
+	int				cur;				// buffer currently being filled by the caller
+	bool			threaded;			// false if everything is written straight away
+
+	volatile unsigned long	error;		// the first thing that went wrong
+
+#ifdef _WIN32
+	HANDLE			hThread;
+	HANDLE			hFull[2];			// set when a buffer is ready to be written
+	HANDLE			hEmpty[2];			// set when a buffer has been written
+#else
+	pthread_t		thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+	bool			full[2];
+#endif
+};
+
+struct _FILEWATCH
+{
+#ifdef _WIN32
+	HANDLE			hChange;			// change-notification for the file's directory
+	HANDLE			hStop;
+#else
+	int				fd;					// inotify instance watching the file's directory, or -1
+	int				stopfd[2];			// pipe written to by file_watch_stop
+	char		   *name;				// the file's name within the directory
+#endif
+};
+
+#ifdef _WIN32
+
+//
+//	Win32 implementation
+//
+static FILEHANDLE file_attach(HANDLE hFile)
+{
+	FILEHANDLE handle;
+
+	if(hFile == INVALID_HANDLE_VALUE)
+		return INVALID_FILEHANDLE;
+
+	handle = new struct _FILEHANDLE;
+	handle->hFile = hFile;
+	handle->zip	  = 0;
+
+	return handle;
+}
+
+FILEHANDLE file_open(const char *filename)
+{
+	return file_unzip(file_attach(CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0)));
+}
+
+FILEHANDLE file_open(const wchar_t *filename)
+{
+	return file_unzip(file_attach(CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0)));
+}
+
+FILEHANDLE file_create(const char *filename)
+{
+	return file_attach(CreateFileA(filename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0));
+}
+
+FILEHANDLE file_create(const wchar_t *filename)
+{
+	return file_attach(CreateFileW(filename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0));
+}
+
+//
+//	Documents use 32bit offsets, so anything 4Gb or over can't be loaded
+//
+unsigned long file_size_raw(FILEHANDLE hFile)
+{
+	DWORD high = 0;
+	DWORD low  = GetFileSize(hFile->hFile, &high);
+
+	if(low == FILE_BADSIZE || high != 0)
+		return FILE_BADSIZE;
+
+	return low;
+}
+
+bool file_stamp(FILEHANDLE hFile, FILESTAMP *stamp)
+{
+	FILETIME ft;
+
+	if(!GetFileTime(hFile->hFile, 0, 0, &ft))
+		return false;
+
+	stamp->low	= ft.dwLowDateTime;
+	stamp->high = ft.dwHighDateTime;
+	return true;
+}
+
+unsigned long file_read_raw(FILEHANDLE hFile, unsigned long offset, void *buf, unsigned long length)
+{
+	LONG  high = 0;
+	DWORD numread;
+
+	// passing the high DWORD makes the low one unsigned
+	if(SetFilePointer(hFile->hFile, offset, &high, FILE_BEGIN) == 0xFFFFFFFF && GetLastError() != NO_ERROR)
+		return 0;
+
+	if(!ReadFile(hFile->hFile, buf, length, &numread, 0))
+		return 0;
+
+	return numread;
+}
+
+bool file_write(FILEHANDLE hFile, const void *buf, unsigned long length)
+{
+	DWORD written;
+
+	if(!WriteFile(hFile->hFile, buf, length, &written, 0))
+		return false;
+
+	if(written != length)
+	{
+		SetLastError(ERROR_HANDLE_DISK_FULL);
+		return false;
+	}
+
+	return true;
+}
+
+static unsigned long file_error()
+{
+	return GetLastError();
+}
+
+static void file_seterror(unsigned long error)
+{
+	SetLastError(error);
+}
+
+// why a write was abandoned by file_write_abort
+#define FILE_ABORTED	ERROR_INVALID_DATA
+
+// why a compressed file can't be loaded
+#define FILE_TOOBIG		ERROR_FILE_TOO_LARGE
+
+static void file_detach(FILEHANDLE hFile)
+{
+	CloseHandle(hFile->hFile);
+	delete hFile;
+}
+
+static void load_progress(FILELOADER *loader, unsigned long loaded, bool done)
+{
+	loader->loaded = loaded;
+	loader->done   = done;
+	SetEvent(loader->hProgress);
+}
+
+//
+//	Mark one of the writer's buffers as full (waiting to be written) or
+//	empty, and wait for it to become so
+//
+static void write_signal(FILEWRITER *writer, int i, bool full)
+{
+	SetEvent(full ? writer->hFull[i] : writer->hEmpty[i]);
+}
+
+static void write_wait(FILEWRITER *writer, int i, bool full)
+{
+	WaitForSingleObject(full ? writer->hFull[i] : writer->hEmpty[i], INFINITE);
+}
+
+//
+//	Win32 can only watch a directory, so anything written there wakes
+//	the waiting thread - it's up to the caller to look at the file again
+//
+static FILEWATCH *watch_alloc(HANDLE hChange)
+{
+	FILEWATCH *watch;
+
+	if(hChange == INVALID_HANDLE_VALUE)
+		return 0;
+
+	if((watch = new FILEWATCH) == 0)
+	{
+		FindCloseChangeNotification(hChange);
+		return 0;
+	}
+
+	watch->hChange = hChange;
+	watch->hStop   = CreateEvent(0, TRUE, FALSE, 0);
+
+	return watch;
+}
+
+#define WATCH_FILTER (FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME)
+
+FILEWATCH *file_watch_start(const char *filename)
+{
+	char  szDirectory[MAX_PATH];
+	char *slash;
+
+	lstrcpynA(szDirectory, filename, MAX_PATH);
+
+	// keep the trailing slash, so "C:\" stays the root directory
+	if((slash = strrchr(szDirectory, '\\')) != 0)
+		slash[1] = '\0';
+	else
+		lstrcpyA(szDirectory, ".");
+
+	return watch_alloc(FindFirstChangeNotificationA(szDirectory, FALSE, WATCH_FILTER));
+}
+
+FILEWATCH *file_watch_start(const wchar_t *filename)
+{
+	wchar_t  szDirectory[MAX_PATH];
+	wchar_t *slash;
+
+	lstrcpynW(szDirectory, filename, MAX_PATH);
+
+	if((slash = wcsrchr(szDirectory, L'\\')) != 0)
+		slash[1] = L'\0';
+	else
+		lstrcpyW(szDirectory, L".");
+
+	return watch_alloc(FindFirstChangeNotificationW(szDirectory, FALSE, WATCH_FILTER));
+}
+
+bool file_watch_wait(FILEWATCH *watch)
+{
+	HANDLE hEventList[2] = { watch->hStop, watch->hChange };
+
+	if(WaitForMultipleObjects(2, hEventList, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+		return false;
+
+	FindNextChangeNotification(watch->hChange);
+	return true;
+}
+
+void file_watch_stop(FILEWATCH *watch)
+{
+	SetEvent(watch->hStop);
+}
+
+void file_watch_close(FILEWATCH *watch)
+{
+	FindCloseChangeNotification(watch->hChange);
+	CloseHandle(watch->hStop);
+	delete watch;
+}
+
+#else
+
+//
+//	POSIX implementation
+//
+static FILEHANDLE file_attach(int fd)
+{
+	FILEHANDLE handle;
+
+	if(fd == -1)
+		return INVALID_FILEHANDLE;
+
+	handle = new struct _FILEHANDLE;
+	handle->fd	= fd;
+	handle->zip	= 0;
+
+	return handle;
+}
+
+//
+//	Wide filenames are converted to the multibyte form the filesystem
+//	uses, and UTF-16 ones to UTF-8. Both return 0 if that's not possible
+//
+static char *mb_filename(const wchar_t *filename)
+{
+	size_t len = wcstombs(0, filename, 0);
+	char  *mbname;
+
+	if(len == (size_t)-1)
+		return 0;
+
+	mbname = new char[len + 1];
+	wcstombs(mbname, filename, len + 1);
+
+	return mbname;
+}
+
+static char *mb_filename(const unsigned short *filename)
+{
+	size_t len = 0;
+	size_t mblen;
+	char  *mbname;
+
+	while(filename[len])
+		len++;
+
+	// no UTF-16 code-unit takes more than three UTF-8 BYTEs
+	mblen  = len * 3;
+	mbname = new char[mblen + 1];
+
+	if(utf16_to_utf8((UTF16 *)filename, len, (UTF8 *)mbname, &mblen) != len)
+	{
+		delete[] mbname;
+		return 0;
+	}
+
+	mbname[mblen] = '\0';
+	return mbname;
+}
+
+FILEHANDLE file_open(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+
+	if(fd == -1)
+		return INVALID_FILEHANDLE;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	// ask for a bigger read-ahead window
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	return file_unzip(file_attach(fd));
+}
+
+FILEHANDLE file_create(const char *filename)
+{
+	return file_attach(open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+}
+
+FILEHANDLE file_open(const wchar_t *filename)
+{
+	char	  *mbname = mb_filename(filename);
+	FILEHANDLE handle = mbname ? file_open(mbname) : INVALID_FILEHANDLE;
+
+	delete[] mbname;
+	return handle;
+}
+
+FILEHANDLE file_open(const unsigned short *filename)
+{
+	char	  *mbname = mb_filename(filename);
+	FILEHANDLE handle = mbname ? file_open(mbname) : INVALID_FILEHANDLE;
+
+	delete[] mbname;
+	return handle;
+}
+
+FILEHANDLE file_create(const wchar_t *filename)
+{
+	char	  *mbname = mb_filename(filename);
+	FILEHANDLE handle = mbname ? file_create(mbname) : INVALID_FILEHANDLE;
+
+	delete[] mbname;
+	return handle;
+}
+
+FILEHANDLE file_create(const unsigned short *filename)
+{
+	char	  *mbname = mb_filename(filename);
+	FILEHANDLE handle = mbname ? file_create(mbname) : INVALID_FILEHANDLE;
+
+	delete[] mbname;
+	return handle;
+}
+
+//
+//	Documents use 32bit offsets, so anything 4Gb or over can't be loaded
+//
+unsigned long file_size_raw(FILEHANDLE hFile)
+{
+	struct stat st;
+
+	if(fstat(hFile->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size >= FILE_BADSIZE)
+		return FILE_BADSIZE;
+
+	return (unsigned long)st.st_size;
+}
+
+bool file_stamp(FILEHANDLE hFile, FILESTAMP *stamp)
+{
+	struct stat st;
+
+	if(fstat(hFile->fd, &st) != 0)
+		return false;
+
+	stamp->low	= (unsigned long)st.st_mtim.tv_nsec;
+	stamp->high = (unsigned long)st.st_mtim.tv_sec;
+	return true;
+}
+
+unsigned long file_read_raw(FILEHANDLE hFile, unsigned long offset, void *buf, unsigned long length)
+{
+	unsigned long total = 0;
+	ssize_t		  len;
+
+	// pread can stop short, so keep going until it's all there
+	while(total < length)
+	{
+		len = pread(hFile->fd, (char *)buf + total, length - total, (off_t)offset + total);
+
+		if(len < 0 && errno == EINTR)
+			continue;
+
+		if(len <= 0)
+			break;
+
+		total += len;
+	}
+
+	return total;
+}
+
+bool file_write(FILEHANDLE hFile, const void *buf, unsigned long length)
+{
+	unsigned long total = 0;
+	ssize_t		  len;
+
+	while(total < length)
+	{
+		len = write(hFile->fd, (const char *)buf + total, length - total);
+
+		if(len < 0 && errno == EINTR)
+			continue;
+
+		if(len < 0)
+			return false;
+
+		if(len == 0)
+		{
+			errno = ENOSPC;
+			return false;
+		}
+
+		total += len;
+	}
+
+	return true;
+}
+
+static unsigned long file_error()
+{
+	return errno;
+}
+
+static void file_seterror(unsigned long error)
+{
+	errno = (int)error;
+}
+
+// why a write was abandoned by file_write_abort
+#define FILE_ABORTED	EINVAL
+
+// why a compressed file can't be loaded
+#define FILE_TOOBIG		EFBIG
+
+static void file_detach(FILEHANDLE hFile)
+{
+	close(hFile->fd);
+	delete hFile;
+}
+
+static void load_progress(FILELOADER *loader, unsigned long loaded, bool done)
+{
+	pthread_mutex_lock(&loader->lock);
+
+	loader->loaded = loaded;
+	loader->done   = done;
+
+	pthread_cond_signal(&loader->progress);
+	pthread_mutex_unlock(&loader->lock);
+}
+
+//
+//	Mark one of the writer's buffers as full (waiting to be written) or
+//	empty, and wait for it to become so
+//
+static void write_signal(FILEWRITER *writer, int i, bool full)
+{
+	pthread_mutex_lock(&writer->lock);
+
+	writer->full[i] = full;
+
+	pthread_cond_broadcast(&writer->changed);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+static void write_wait(FILEWRITER *writer, int i, bool full)
+{
+	pthread_mutex_lock(&writer->lock);
+
+	while(writer->full[i] != full)
+		pthread_cond_wait(&writer->changed, &writer->lock);
+
+	pthread_mutex_unlock(&writer->lock);
+}
+
+//
+//	The file's directory is watched rather than the file itself, so that
+//	a log which gets rotated (renamed and replaced) is still followed by 
+//	name. Without inotify the file is just looked at every so often
+//
+FILEWATCH *file_watch_start(const char *filename)
+{
+	FILEWATCH  *watch;
+	const char *slash = strrchr(filename, '/');
+
+	if((watch = new FILEWATCH) == 0)
+		return 0;
+
+	if(pipe(watch->stopfd) != 0)
+	{
+		delete watch;
+		return 0;
+	}
+
+	watch->name = new char[strlen(filename) + 1];
+	watch->fd	= -1;
+
+#ifdef __linux__
+	if(slash)
+	{
+		// keep the trailing slash, so "/" stays the root directory
+		strcpy(watch->name, filename);
+		watch->name[slash - filename + 1] = '\0';
+	}
+	else
+	{
+		strcpy(watch->name, ".");
+	}
+
+	if((watch->fd = inotify_init()) != -1 &&
+		inotify_add_watch(watch->fd, watch->name, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) == -1)
+	{
+		close(watch->fd);
+		watch->fd = -1;
+	}
+#endif
+
+	strcpy(watch->name, slash ? slash + 1 : filename);
+	return watch;
+}
+
+FILEWATCH *file_watch_start(const wchar_t *filename)
+{
+	char	   *mbname;
+	FILEWATCH  *watch;
+
+	if((mbname = mb_filename(filename)) == 0)
+		return 0;
+
+	watch = file_watch_start(mbname);
+
+	delete[] mbname;
+	return watch;
+}
+
+#ifdef __linux__
+//
+//	Read the pending events, and see if any of them are for our file
+//
+static bool watch_event(FILEWATCH *watch)
+{
+	union
+	{
+		struct inotify_event event;
+		char				 buf[4096];
+	} u;
+
+	ssize_t len = read(watch->fd, u.buf, sizeof(u.buf));
+	ssize_t pos;
+
+	for(pos = 0; pos + (ssize_t)sizeof(struct inotify_event) <= len; )
+	{
+		struct inotify_event *event = (struct inotify_event *)(u.buf + pos);
+
+		if(event->len && strcmp(event->name, watch->name) == 0)
+			return true;
+
+		pos += sizeof(struct inotify_event) + event->len;
+	}
+
+	return false;
+}
+#endif
+
+bool file_watch_wait(FILEWATCH *watch)
+{
+	struct pollfd pfd[2];
+	int	nfds = watch->fd != -1 ? 2 : 1;
+	int n;
+
+	pfd[0].fd	  = watch->stopfd[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd	  = watch->fd;
+	pfd[1].events = POLLIN;
+
+	for(;;)
+	{
+		n = poll(pfd, nfds, nfds == 2 ? -1 : WATCH_POLLTIME);
+
+		if(n < 0 && errno == EINTR)
+			continue;
+
+		if(n < 0 || pfd[0].revents)
+			return false;
+
+		if(n == 0)
+			return true;
+
+#ifdef __linux__
+		if(watch_event(watch))
+			return true;
+#endif
+	}
+}
+
+void file_watch_stop(FILEWATCH *watch)
+{
+	// the pipe stays readable, so every wait from now on returns straight away
+	while(write(watch->stopfd[1], "", 1) < 0 && errno == EINTR)
+		;
+}
+
+void file_watch_close(FILEWATCH *watch)
+{
+	if(watch->fd != -1)
+		close(watch->fd);
+
+	close(watch->stopfd[0]);
+	close(watch->stopfd[1]);
+
+	delete[] watch->name;
+	delete watch;
+}
+
+#endif
+
+//
+//	Look at the start of a newly opened file to see if it's compressed. 
+//	If it is (and the format is supported) reads are decompressed from then on
+//
+static FILEHANDLE file_unzip(FILEHANDLE hFile)
+{
+	unsigned char header[ZIP_HEADERSIZE];
+	unsigned long len;
+	int			  type;
+
+	if(hFile == INVALID_FILEHANDLE)
+		return INVALID_FILEHANDLE;
+
+	len	 = file_read_raw(hFile, 0, header, ZIP_HEADERSIZE);
+	type = zip_detect(header, len);
+
+	if(type != ZIP_NONE)
+		hFile->zip = zip_open(hFile, type);
+
+	return hFile;
+}
+
+bool file_compressed(FILEHANDLE hFile)
+{
+	return hFile->zip != 0;
+}
+
+bool file_stamp_equal(const FILESTAMP *a, const FILESTAMP *b)
+{
+	return a->low == b->low && a->high == b->high;
+}
+
+//
+//	The size of the uncompressed contents - the first time this is 
+//	called for a compressed file, the whole thing is decompressed
+//	(and the start of it kept for the reads that follow). One that
+//	decompresses to more than ZIP_MAXSIZE fails, with FILE_TOOBIG
+//
+unsigned long file_size(FILEHANDLE hFile)
+{
+	unsigned long size;
+
+	if(hFile->zip == 0)
+		return file_size_raw(hFile);
+
+	if((size = zip_size(hFile->zip)) > ZIP_MAXSIZE && size != FILE_BADSIZE)
+	{
+		file_seterror(FILE_TOOBIG);
+		size = FILE_BADSIZE;
+	}
+
+	return size;
+}
+
+//
+//	The size a compressed file says it is, without decompressing it. 
+//	Reading it from the start to that size then decompresses it as it goes,
+//	but fails at the end if the size was wrong. If the file doesn't say,
+//	this is the same as file_size
+//
+unsigned long file_size_hint(FILEHANDLE hFile)
+{
+	unsigned long size;
+
+	if(hFile->zip && (size = zip_size_hint(hFile->zip)) <= ZIP_MAXSIZE)
+		return size;
+	else
+		return file_size(hFile);
+}
+
+unsigned long file_read(FILEHANDLE hFile, unsigned long offset, void *buf, unsigned long length)
+{
+	if(hFile->zip)
+		return zip_read(hFile->zip, offset, buf, length);
+	else
+		return file_read_raw(hFile, offset, buf, length);
+}
+
+void file_close(FILEHANDLE hFile)
+{
+	if(hFile->zip)
+		zip_close(hFile->zip);
+
+	file_detach(hFile);
+}
+
+//
+//	Read the file from start to finish, a chunk at a time,
+//	announcing each chunk as it arrives
+//
+static void load_file(FILELOADER *loader)
+{
+	unsigned long offset;
+	unsigned long len;
+
+	for(offset = 0; offset < loader->length; offset += len)
+	{
+		len = loader->length - offset;
+
+		if(len > FILE_READAHEAD)
+			len = FILE_READAHEAD;
+
+		if(file_read(loader->hFile, offset, loader->buffer + offset, len) != len)
+			break;
+
+		if(loader->callback)
+			loader->callback(loader->param, loader->buffer + offset, len);
+
+		load_progress(loader, offset + len, false);
+	}
+
+	load_progress(loader, offset, true);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI LoaderThread(LPVOID param)
+{
+	load_file((FILELOADER *)param);
+	return 0;
+}
+#else
+static void *LoaderThread(void *param)
+{
+	load_file((FILELOADER *)param);
+	return 0;
+}
+#endif
+
+//
+//	Start reading the file into the specified buffer (which must hold
+//	'length' bytes). If a thread can't be created it is all read right now.
+//	The optional callback sees each block in turn, before anyone waiting 
+//	for it does
+//
+FILELOADER *file_load_start(FILEHANDLE hFile, void *buffer, unsigned long length, FILELOADFUNC callback, void *param)
+{
+	FILELOADER *loader;
+
+	if((loader = new FILELOADER) == 0)
+		return 0;
+
+	loader->hFile	 = hFile;
+	loader->buffer	 = (char *)buffer;
+	loader->length	 = length;
+	loader->callback = callback;
+	loader->param	 = param;
+	loader->loaded	 = 0;
+	loader->done	 = false;
+
+#ifdef _WIN32
+	DWORD dwThreadId;
+
+	loader->hProgress = CreateEvent(0, FALSE, FALSE, 0);
+	loader->hThread	  = CreateThread(0, 0, LoaderThread, loader, 0, &dwThreadId);
+
+	if(loader->hThread == 0)
+		load_file(loader);
+#else
+	pthread_mutex_init(&loader->lock, 0);
+	pthread_cond_init(&loader->progress, 0);
+
+	loader->threadok = pthread_create(&loader->thread, 0, LoaderThread, loader) == 0;
+
+	if(!loader->threadok)
+		load_file(loader);
+#endif
+
+	return loader;
+}
+
+//
+//	Wait until at least 'length' bytes from the start of the file have
+//	been loaded. Returns how much is available - which is less than was
+//	asked for only if the file couldn't be read
+//
+unsigned long file_load_wait(FILELOADER *loader, unsigned long length)
+{
+	unsigned long loaded;
+
+#ifdef _WIN32
+	while(loader->loaded < length && !loader->done)
+		WaitForSingleObject(loader->hProgress, INFINITE);
+
+	loaded = loader->loaded;
+#else
+	pthread_mutex_lock(&loader->lock);
+
+	while(loader->loaded < length && !loader->done)
+		pthread_cond_wait(&loader->progress, &loader->lock);
+
+	loaded = loader->loaded;
+	pthread_mutex_unlock(&loader->lock);
+#endif
+
+	return loaded;
+}
+
+//
+//	Wait for the whole file to be read, then clean up.
+//	Returns false if any of the file couldn't be read
+//
+bool file_load_finish(FILELOADER *loader)
+{
+	bool success;
+
+	success = file_load_wait(loader, loader->length) == loader->length;
+
+#ifdef _WIN32
+	if(loader->hThread)
+	{
+		WaitForSingleObject(loader->hThread, INFINITE);
+		CloseHandle(loader->hThread);
+	}
+
+	CloseHandle(loader->hProgress);
+#else
+	if(loader->threadok)
+		pthread_join(loader->thread, 0);
+
+	pthread_mutex_destroy(&loader->lock);
+	pthread_cond_destroy(&loader->progress);
+#endif
+
+	delete loader;
+	return success;
+}
+
+
+//
+//	Write out one of the buffers, unless something has already gone wrong
+//
+static void write_buffer(FILEWRITER *writer, int i)
+{
+	if(writer->error == 0 && !file_write(writer->hFile, writer->buf[i], writer->len[i]))
+		writer->error = file_error();
+}
+
+//
+//	Write each buffer in turn as it fills up. An empty buffer
+//	marks the end of the file
+//
+static void write_file(FILEWRITER *writer)
+{
+	int i;
+
+	for(i = 0; ; i ^= 1)
+	{
+		write_wait(writer, i, true);
+
+		if(writer->len[i] == 0)
+			break;
+
+		write_buffer(writer, i);
+		write_signal(writer, i, false);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WriterThread(LPVOID param)
+{
+	write_file((FILEWRITER *)param);
+	return 0;
+}
+#else
+static void *WriterThread(void *param)
+{
+	write_file((FILEWRITER *)param);
+	return 0;
+}
+#endif
+
+//
+//	Start writing to the file, through two buffers of 'bufsize' bytes.
+//	The first one is ready to be filled straight away
+//
+FILEWRITER *file_write_start(FILEHANDLE hFile, unsigned long bufsize)
+{
+	FILEWRITER *writer;
+	int			i;
+
+	if((writer = new FILEWRITER) == 0)
+		return 0;
+
+	writer->hFile = hFile;
+	writer->cur	  = 0;
+	writer->error = 0;
+
+	for(i = 0; i < 2; i++)
+	{
+		writer->buf[i] = new unsigned char[bufsize];
+		writer->len[i] = 0;
+	}
+
+#ifdef _WIN32
+	DWORD dwThreadId;
+
+	// the first buffer starts off in our hands, the second is free for later
+	for(i = 0; i < 2; i++)
+	{
+		writer->hFull[i]  = CreateEvent(0, FALSE, FALSE, 0);
+		writer->hEmpty[i] = CreateEvent(0, FALSE, i == 1, 0);
+	}
+
+	writer->hThread	 = CreateThread(0, 0, WriterThread, writer, 0, &dwThreadId);
+	writer->threaded = writer->hThread != 0;
+#else
+	pthread_mutex_init(&writer->lock, 0);
+	pthread_cond_init(&writer->changed, 0);
+
+	writer->full[0]	 = false;
+	writer->full[1]	 = false;
+	writer->threaded = pthread_create(&writer->thread, 0, WriterThread, writer) == 0;
+#endif
+
+	return writer;
+}
+
+//
+//	The buffer that is currently being filled
+//
+void *file_write_buffer(FILEWRITER *writer)
+{
+	return writer->buf[writer->cur];
+}
+
+//
+//	Hand the first 'length' bytes of the current buffer over to be written,
+//	and wait for the other buffer to become free. Without a writer thread
+//	the buffer is written straight away instead
+//
+void *file_write_next(FILEWRITER *writer, unsigned long length)
+{
+	int cur = writer->cur;
+
+	if(length == 0)
+		return writer->buf[cur];
+
+	writer->len[cur] = length;
+
+	if(!writer->threaded)
+	{
+		write_buffer(writer, cur);
+		return writer->buf[cur];
+	}
+
+	write_signal(writer, cur, true);
+	writer->cur = cur ^= 1;
+
+	write_wait(writer, cur, false);
+	return writer->buf[cur];
+}
+
+bool file_write_failed(FILEWRITER *writer)
+{
+	return writer->error != 0;
+}
+
+//
+//	Give up - nothing more is written, and file_write_finish fails
+//
+void file_write_abort(FILEWRITER *writer)
+{
+	if(writer->error == 0)
+		writer->error = FILE_ABORTED;
+}
+
+//
+//	Write the last 'length' bytes of the current buffer, wait for
+//	everything to reach the file, then clean up
+//
+bool file_write_finish(FILEWRITER *writer, unsigned long length)
+{
+	unsigned long error;
+	int			  i;
+
+	file_write_next(writer, length);
+
+	// an empty buffer tells the writer thread to finish
+	if(writer->threaded)
+	{
+		writer->len[writer->cur] = 0;
+		write_signal(writer, writer->cur, true);
+	}
+
+#ifdef _WIN32
+	if(writer->hThread)
+	{
+		WaitForSingleObject(writer->hThread, INFINITE);
+		CloseHandle(writer->hThread);
+	}
+
+	for(i = 0; i < 2; i++)
+	{
+		CloseHandle(writer->hFull[i]);
+		CloseHandle(writer->hEmpty[i]);
+	}
+#else
+	if(writer->threaded)
+		pthread_join(writer->thread, 0);
+
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->changed);
+#endif
+
+	for(i = 0; i < 2; i++)
+		delete[] writer->buf[i];
+
+	error = writer->error;
+	delete writer;
+
+	if(error)
+	{
+		file_seterror(error);
+		return false;
+	}
+
+	return true;
+}
\ No newline at end of file
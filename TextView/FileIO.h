@@ -0,0 +1,106 @@
+#ifndef FILEIO_INCLUDED
+#define FILEIO_INCLUDED
+
+//
+//	FileIO - the operating-system services needed to load and save a 
+//	TextDocument, so that the document engine itself isn't tied to Win32. 
+//	There is a Win32 implementation and a POSIX one (open/pread/pthreads)
+//
+//	gzip and zstd compressed files are decompressed as they are read, so 
+//	file_size and file_read see the original contents (see FileZip.cpp)
+//
+typedef struct _FILEHANDLE *FILEHANDLE;
+#define INVALID_FILEHANDLE	0
+
+// returned by file_size if the file can't be loaded (documents have 32bit offsets)
+#define FILE_BADSIZE		0xFFFFFFFF
+
+// size of each read made by the read-ahead thread
+#define FILE_READAHEAD		0x100000
+
+//
+//	Basic file access. Files are opened read-only, for sequential access
+//
+FILEHANDLE		file_open(const char *filename);
+FILEHANDLE		file_open(const wchar_t *filename);
+unsigned long	file_size(FILEHANDLE hFile);
+unsigned long	file_size_hint(FILEHANDLE hFile);
+unsigned long	file_read(FILEHANDLE hFile, unsigned long offset, void *buf, unsigned long length);
+void			file_close(FILEHANDLE hFile);
+
+//
+//	Files can also be created (replacing any that already exist) and
+//	written to. file_write fails unless the whole buffer was written
+//
+FILEHANDLE		file_create(const char *filename);
+FILEHANDLE		file_create(const wchar_t *filename);
+bool			file_write(FILEHANDLE hFile, const void *buf, unsigned long length);
+
+#ifndef _WIN32
+// UTF-16 filenames (a TCHAR string, where wchar_t is 32 bits)
+FILEHANDLE		file_open(const unsigned short *filename);
+FILEHANDLE		file_create(const unsigned short *filename);
+#endif
+
+// whether the file is being decompressed, and what is actually in it
+bool			file_compressed(FILEHANDLE hFile);
+unsigned long	file_size_raw(FILEHANDLE hFile);
+unsigned long	file_read_raw(FILEHANDLE hFile, unsigned long offset, void *buf, unsigned long length);
+
+//
+//	FILESTAMP - when a file was last written to. There is nothing to do
+//	with one except compare it against another
+//
+typedef struct _FILESTAMP
+{
+	unsigned long low;
+	unsigned long high;
+
+} FILESTAMP;
+
+bool			file_stamp(FILEHANDLE hFile, FILESTAMP *stamp);
+bool			file_stamp_equal(const FILESTAMP *a, const FILESTAMP *b);
+
+//
+//	FILELOADER - reads a whole file into memory on a separate thread,
+//	so that the start of the file can be used while the rest arrives
+//
+typedef struct _FILELOADER FILELOADER;
+
+// called on the loader thread as each block of the file arrives
+typedef void (*FILELOADFUNC)(void *param, const void *data, unsigned long length);
+
+FILELOADER *	file_load_start(FILEHANDLE hFile, void *buffer, unsigned long length, FILELOADFUNC callback = 0, void *param = 0);
+unsigned long	file_load_wait(FILELOADER *loader, unsigned long length);
+bool			file_load_finish(FILELOADER *loader);
+
+//
+//	FILEWRITER - writes a file out on a separate thread from a pair of 
+//	buffers, so that one can be filled while the other is being written.
+//	file_write_next hands over the current buffer and returns the other one
+//	once it is free. If something goes wrong the rest is thrown away, and
+//	file_write_finish returns false (with the reason in errno/GetLastError)
+//
+typedef struct _FILEWRITER FILEWRITER;
+
+FILEWRITER *	file_write_start(FILEHANDLE hFile, unsigned long bufsize);
+void *			file_write_buffer(FILEWRITER *writer);
+void *			file_write_next(FILEWRITER *writer, unsigned long length);
+bool			file_write_failed(FILEWRITER *writer);
+void			file_write_abort(FILEWRITER *writer);
+bool			file_write_finish(FILEWRITER *writer, unsigned long length);
+
+//
+//	FILEWATCH - lets a thread sleep until a file is written to (inotify on
+//	Linux, a change-notification on Win32's directory). file_watch_wait
+//	returns false once file_watch_stop has been called from another thread
+//
+typedef struct _FILEWATCH FILEWATCH;
+
+FILEWATCH *		file_watch_start(const char *filename);
+FILEWATCH *		file_watch_start(const wchar_t *filename);
+bool			file_watch_wait(FILEWATCH *watch);
+void			file_watch_stop(FILEWATCH *watch);
+void			file_watch_close(FILEWATCH *watch);
+
+#endif
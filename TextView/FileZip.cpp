@@ -0,0 +1,814 @@
+//
+//	MODULE:		FileZip.cpp
+//
+//	PURPOSE:	Random access to gzip and zstd compressed files
+//
+//	NOTES:		www.catch22.net
+//
+//	This is for compressed files that fit in memory: a document holds all
+//	of the uncompressed text, so a file can't be bigger than that however
+//	well it compresses (and anything over ZIP_MAXSIZE is turned away).
+//
+//	Most files record their uncompressed size (a gzip trailer, or a zstd 
+//	frame header), and a document is loaded by reading the file straight
+//	through - so it only gets decompressed the once, by the thread that is
+//	loading it. The recorded size covers only one member/frame, so it 
+//	might be wrong: reading straight through fails if it is.
+//
+//	The first time the real size is asked for, the whole file is decompressed
+//	to build an index of seek-points - places a decompressor can start
+//	from part-way through the file. The first ZIP_CACHESIZE BYTEs of the
+//	output are kept, so the document loads those without decompressing
+//	them all over again. A read after that only has to decompress from the
+//	nearest seek-point before it, and sequential reads carry on from where
+//	the last one finished.
+//
+//	gzip seek-points are at deflate block boundaries, and hold the last
+//	32Kb of output that the following blocks can refer back to (this is
+//	the method used by zlib's zran.c example). A zstd decompressor can't
+//	be restarted mid-frame, so its seek-points are at frame boundaries -
+//	a file compressed as a single frame has only the one at the start.
+//
+//	Define HAVE_ZLIB and/or HAVE_ZSTD, and link with the library, to
+//	enable each format
+//
+
+#ifdef _WIN32
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include <string.h>
+#include <vector>
+#include "FileIO.h"
+#include "FileZip.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// how much history a deflate stream can refer back to
+#define ZIP_WINSIZE		0x8000
+
+// the longest a zstd frame header can be (ZSTD_FRAMEHEADERSIZE_MAX)
+#define ZIP_ZSTDHEADER	18
+
+typedef struct
+{
+	unsigned long	out;			// uncompressed offset
+	unsigned long	in;				// offset in the file of the first (whole) BYTE
+	int				bits;			// gzip: how many bits of the BYTE before that still need decoding
+	unsigned char  *window;			// gzip: the preceding 32Kb of output
+
+} SEEKPOINT;
+
+struct _ZIPFILE
+{
+	FILEHANDLE		hFile;
+	int				type;
+	unsigned long	filelen;		// compressed size
+
+	bool			indexed;
+	unsigned long	size;			// uncompressed size, once indexed (FILE_BADSIZE if it couldn't be)
+	unsigned long	hint;			// the size recorded in the file, for reading it before it is indexed
+	std::vector<SEEKPOINT> points;
+
+	// the start of the output from indexing, ZIP_SPAN BYTEs per block
+	std::vector<unsigned char *> cache;
+	unsigned long	cached;
+
+	// the decompressor's current position
+	bool			active;
+	unsigned long	pos;			// uncompressed offset it has reached
+	unsigned long	in;				// next BYTE to read from the file
+	unsigned char  *inbuf;
+	unsigned char  *scratch;		// output that is being skipped over
+
+#ifdef HAVE_ZLIB
+	z_stream		strm;
+	bool			raw;			// started from a seek-point, so there is no gzip header until the next member
+#endif
+
+#ifdef HAVE_ZSTD
+	ZSTD_DStream   *dstream;
+	ZSTD_inBuffer	zin;
+#endif
+};
+
+//
+//	Identify a compressed file from its first few BYTEs
+//
+int zip_detect(const unsigned char *header, unsigned long length)
+{
+	if(length >= 3 && header[0] == 0x1F && header[1] == 0x8B && header[2] == 0x08)
+		return ZIP_GZIP;
+
+	if(length >= 4 && header[0] == 0x28 && header[1] == 0xB5 && header[2] == 0x2F && header[3] == 0xFD)
+		return ZIP_ZSTD;
+
+	return ZIP_NONE;
+}
+
+//
+//	Read the next block of the compressed file
+//
+static unsigned long zip_fill(ZIPFILE *zip)
+{
+	unsigned long len = zip->filelen - zip->in;
+
+	if(len > ZIP_INBUFSIZE)
+		len = ZIP_INBUFSIZE;
+
+	if(len)
+		len = file_read_raw(zip->hFile, zip->in, zip->inbuf, len);
+
+	zip->in += len;
+	return len;
+}
+
+//
+//	Keep some of the output from indexing, until ZIP_CACHESIZE BYTEs have been kept
+//
+static void zip_keep(ZIPFILE *zip, const unsigned char *data, unsigned long length)
+{
+	while(length > 0 && zip->cached < ZIP_CACHESIZE)
+	{
+		unsigned long off = zip->cached % ZIP_SPAN;
+		unsigned long len = ZIP_SPAN - off;
+
+		if(off == 0)
+			zip->cache.push_back(new unsigned char[ZIP_SPAN]);
+
+		if(len > length)
+			len = length;
+
+		memcpy(zip->cache.back() + off, data, len);
+
+		zip->cached += len;
+		data		+= len;
+		length		-= len;
+	}
+}
+
+static void zip_addpoint(ZIPFILE *zip, unsigned long out, unsigned long in, int bits, unsigned char *window, unsigned long left)
+{
+	SEEKPOINT pt;
+
+	pt.out	  = out;
+	pt.in	  = in;
+	pt.bits	  = bits;
+	pt.window = 0;
+
+	// unwrap the circular output window, so it ends with the latest output
+	if(window)
+	{
+		pt.window = new unsigned char[ZIP_WINSIZE];
+
+		if(left)
+			memcpy(pt.window, window + ZIP_WINSIZE - left, left);
+
+		if(left < ZIP_WINSIZE)
+			memcpy(pt.window + left, window, ZIP_WINSIZE - left);
+	}
+
+	zip->points.push_back(pt);
+}
+
+#ifdef HAVE_ZLIB
+
+//
+//	The size in the gzip trailer at the end of the file. This is only the
+//	last member's size, so a file with several members will be bigger
+//
+static unsigned long gzip_hint(ZIPFILE *zip)
+{
+	unsigned char trailer[4];
+
+	if(zip->filelen < 18 || file_read_raw(zip->hFile, zip->filelen - 4, trailer, 4) != 4)
+		return FILE_BADSIZE;
+
+	return trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned long)trailer[3] << 24);
+}
+
+//
+//	Decompress a gzip file from start to finish, adding a seek-point
+//	every ZIP_SPAN BYTEs. Files with several members (concatenated gzip
+//	files) are one long stream. Returns the uncompressed size, or stops
+//	as soon as it is more than ZIP_MAXSIZE
+//
+static unsigned long gzip_index(ZIPFILE *zip)
+{
+	unsigned char *window = new unsigned char[ZIP_WINSIZE];
+	unsigned char *out;
+	unsigned long  totin  = 0;
+	unsigned long  totout = 0;
+	unsigned long  last	  = 0;
+	unsigned long  len;
+	int			   members = 0;
+	int			   ret;
+
+	memset(window, 0, ZIP_WINSIZE);
+
+	// 47 = largest window, and expect a gzip header
+	inflateReset2(&zip->strm, 47);
+
+	zip->strm.avail_in	= 0;
+	zip->strm.avail_out = 0;
+	zip->in				= 0;
+
+	for(;;)
+	{
+		if(zip->strm.avail_in == 0)
+		{
+			// a truncated file keeps whatever could be decompressed
+			if((len = zip_fill(zip)) == 0)
+				break;
+
+			zip->strm.next_in  = zip->inbuf;
+			zip->strm.avail_in = len;
+		}
+
+		if(zip->strm.avail_out == 0)
+		{
+			zip->strm.next_out	= window;
+			zip->strm.avail_out = ZIP_WINSIZE;
+		}
+
+		// stop at the end of each deflate block
+		out		= zip->strm.next_out;
+		totin  += zip->strm.avail_in;
+		totout += zip->strm.avail_out;
+		ret		= inflate(&zip->strm, Z_BLOCK);
+		totin  -= zip->strm.avail_in;
+		totout -= zip->strm.avail_out;
+
+		zip_keep(zip, out, (unsigned long)(zip->strm.next_out - out));
+
+		if(ret == Z_STREAM_END)
+		{
+			// there might be another member after this one
+			inflateReset(&zip->strm);
+			members++;
+			continue;
+		}
+
+		// rubbish after the last member is ignored, as gzip does
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			if(members == 0)
+				totout = FILE_BADSIZE;
+
+			break;
+		}
+
+		// no need to find out exactly how big is too big
+		if(totout > ZIP_MAXSIZE)
+			break;
+
+		// at a block boundary (but not the end of a member)?
+		if((zip->strm.data_type & 128) && !(zip->strm.data_type & 64) &&
+			(zip->points.empty() || totout - last >= ZIP_SPAN))
+		{
+			zip_addpoint(zip, totout, totin, zip->strm.data_type & 7, window, zip->strm.avail_out);
+			last = totout;
+		}
+	}
+
+	delete[] window;
+	zip->active = false;
+
+	return totout;
+}
+
+//
+//	Get ready to decompress from the specified seek-point
+//
+static bool gzip_seek(ZIPFILE *zip, SEEKPOINT *pt)
+{
+	unsigned char ch;
+
+	// the very start, where there is a gzip header to read
+	if(pt->window == 0)
+	{
+		inflateReset2(&zip->strm, 47);
+		zip->strm.avail_in = 0;
+		zip->in	 = 0;
+		zip->raw = false;
+		return true;
+	}
+
+	inflateReset2(&zip->strm, -15);
+	zip->strm.avail_in = 0;
+	zip->in = pt->in;
+
+	// the seek-point is part-way through a BYTE
+	if(pt->bits)
+	{
+		if(file_read_raw(zip->hFile, pt->in - 1, &ch, 1) != 1)
+			return false;
+
+		inflatePrime(&zip->strm, pt->bits, ch >> (8 - pt->bits));
+	}
+
+	inflateSetDictionary(&zip->strm, pt->window, ZIP_WINSIZE);
+
+	zip->raw = true;
+	return true;
+}
+
+//
+//	Move on to the next gzip member, if there is one
+//
+static bool gzip_member(ZIPFILE *zip)
+{
+	unsigned long trailer = 8;
+
+	if(!zip->raw)
+		return inflateReset(&zip->strm) == Z_OK;
+
+	// a raw stream stops in front of the CRC/size trailer
+	while(trailer > 0)
+	{
+		unsigned long len;
+
+		if(zip->strm.avail_in == 0)
+		{
+			if((len = zip_fill(zip)) == 0)
+				return false;
+
+			zip->strm.next_in  = zip->inbuf;
+			zip->strm.avail_in = len;
+		}
+
+		len = trailer < zip->strm.avail_in ? trailer : zip->strm.avail_in;
+
+		zip->strm.next_in  += len;
+		zip->strm.avail_in -= len;
+		trailer			   -= len;
+	}
+
+	zip->raw = false;
+	return inflateReset2(&zip->strm, 31) == Z_OK;
+}
+
+static unsigned long gzip_decode(ZIPFILE *zip, void *buf, unsigned long length)
+{
+	unsigned long len;
+	int			  ret;
+
+	zip->strm.next_out	= (unsigned char *)buf;
+	zip->strm.avail_out = length;
+
+	while(zip->strm.avail_out == length)
+	{
+		if(zip->strm.avail_in == 0)
+		{
+			if((len = zip_fill(zip)) == 0)
+				break;
+
+			zip->strm.next_in  = zip->inbuf;
+			zip->strm.avail_in = len;
+		}
+
+		ret = inflate(&zip->strm, Z_NO_FLUSH);
+
+		if(ret == Z_STREAM_END)
+		{
+			if(!gzip_member(zip))
+				break;
+		}
+		else if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			break;
+		}
+	}
+
+	return length - zip->strm.avail_out;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+//
+//	The size in the first frame's header, if the compressor put it there.
+//	A file with several frames will be bigger
+//
+static unsigned long zstd_hint(ZIPFILE *zip)
+{
+	unsigned char		header[ZIP_ZSTDHEADER];
+	unsigned long		len;
+	unsigned long long	size;
+
+	len	 = file_read_raw(zip->hFile, 0, header, ZIP_ZSTDHEADER);
+	size = ZSTD_getFrameContentSize(header, len);
+
+	if(size >= FILE_BADSIZE)
+		return FILE_BADSIZE;
+
+	return (unsigned long)size;
+}
+
+//
+//	Decompress a zstd file from start to finish, adding a seek-point at
+//	the first frame boundary after each ZIP_SPAN BYTEs. Returns the
+//	uncompressed size, or stops as soon as it is more than ZIP_MAXSIZE
+//
+static unsigned long zstd_index(ZIPFILE *zip)
+{
+	unsigned long totout = 0;
+	unsigned long last	 = 0;
+	unsigned long inbase = 0;
+	unsigned long len;
+	int			  frames	 = 0;
+	bool		  framestart = false;
+	size_t		  ret;
+
+	ZSTD_initDStream(zip->dstream);
+
+	zip->zin.src  = zip->inbuf;
+	zip->zin.size = 0;
+	zip->zin.pos  = 0;
+	zip->in		  = 0;
+
+	zip_addpoint(zip, 0, 0, 0, 0, 0);
+
+	for(;;)
+	{
+		if(zip->zin.pos == zip->zin.size)
+		{
+			inbase = zip->in;
+
+			if((len = zip_fill(zip)) == 0)
+				break;
+
+			zip->zin.size = len;
+			zip->zin.pos  = 0;
+		}
+
+		// the next frame starts here
+		if(framestart && totout - last >= ZIP_SPAN)
+		{
+			zip_addpoint(zip, totout, inbase + (unsigned long)zip->zin.pos, 0, 0, 0);
+			last = totout;
+		}
+
+		ZSTD_outBuffer zout = { zip->scratch, ZIP_INBUFSIZE, 0 };
+
+		ret = ZSTD_decompressStream(zip->dstream, &zout, &zip->zin);
+
+		// rubbish after the last frame is ignored
+		if(ZSTD_isError(ret))
+		{
+			if(frames == 0)
+				totout = FILE_BADSIZE;
+
+			break;
+		}
+
+		zip_keep(zip, zip->scratch, (unsigned long)zout.pos);
+
+		totout	  += (unsigned long)zout.pos;
+		framestart = ret == 0;
+
+		if(framestart)
+			frames++;
+
+		if(totout > ZIP_MAXSIZE)
+			break;
+	}
+
+	zip->active = false;
+	return totout;
+}
+
+static bool zstd_seek(ZIPFILE *zip, SEEKPOINT *pt)
+{
+	ZSTD_initDStream(zip->dstream);
+
+	zip->zin.size = 0;
+	zip->zin.pos  = 0;
+	zip->in		  = pt->in;
+
+	return true;
+}
+
+static unsigned long zstd_decode(ZIPFILE *zip, void *buf, unsigned long length)
+{
+	ZSTD_outBuffer zout = { buf, length, 0 };
+	unsigned long  len;
+
+	while(zout.pos == 0)
+	{
+		if(zip->zin.pos == zip->zin.size)
+		{
+			if((len = zip_fill(zip)) == 0)
+				break;
+
+			zip->zin.size = len;
+			zip->zin.pos  = 0;
+		}
+
+		if(ZSTD_isError(ZSTD_decompressStream(zip->dstream, &zout, &zip->zin)))
+			break;
+	}
+
+	return (unsigned long)zout.pos;
+}
+
+#endif
+
+//
+//	Returns 0 if the format isn't supported
+//
+ZIPFILE *zip_open(FILEHANDLE hFile, int type)
+{
+	ZIPFILE *zip;
+
+	switch(type)
+	{
+#ifdef HAVE_ZLIB
+	case ZIP_GZIP: break;
+#endif
+#ifdef HAVE_ZSTD
+	case ZIP_ZSTD: break;
+#endif
+	default: return 0;
+	}
+
+	if((zip = new ZIPFILE) == 0)
+		return 0;
+
+	zip->hFile	 = hFile;
+	zip->type	 = type;
+	zip->filelen = file_size_raw(hFile);
+	zip->indexed = false;
+	zip->size	 = FILE_BADSIZE;
+	zip->hint	 = FILE_BADSIZE;
+	zip->cached	 = 0;
+	zip->active	 = false;
+	zip->pos	 = 0;
+	zip->in		 = 0;
+	zip->inbuf	 = new unsigned char[ZIP_INBUFSIZE];
+	zip->scratch = new unsigned char[ZIP_INBUFSIZE];
+
+#ifdef HAVE_ZLIB
+	memset(&zip->strm, 0, sizeof(zip->strm));
+	zip->raw = false;
+
+	if(type == ZIP_GZIP)
+		inflateInit2(&zip->strm, 47);
+#endif
+
+#ifdef HAVE_ZSTD
+	zip->dstream = type == ZIP_ZSTD ? ZSTD_createDStream() : 0;
+#endif
+
+	return zip;
+}
+
+//
+//	The uncompressed size. The seek-points are found at the same time.
+//	Anything over ZIP_MAXSIZE means the file is too big, but not how big
+//
+unsigned long zip_size(ZIPFILE *zip)
+{
+	if(zip->indexed)
+		return zip->size;
+
+	zip->indexed = true;
+
+	if(zip->filelen == FILE_BADSIZE)
+		return zip->size;
+
+#ifdef HAVE_ZLIB
+	if(zip->type == ZIP_GZIP)
+		zip->size = gzip_index(zip);
+#endif
+
+#ifdef HAVE_ZSTD
+	if(zip->type == ZIP_ZSTD)
+		zip->size = zstd_index(zip);
+#endif
+
+	// nothing to start from
+	if(zip->points.empty())
+		zip->size = FILE_BADSIZE;
+
+	return zip->size;
+}
+
+//
+//	The size recorded in the file (or the real one, if that is known). 
+//	Until the file is indexed it can then be read from start to finish,
+//	without decompressing it all first
+//
+unsigned long zip_size_hint(ZIPFILE *zip)
+{
+	if(zip->indexed)
+		return zip->size;
+
+#ifdef HAVE_ZLIB
+	if(zip->type == ZIP_GZIP)
+		zip->hint = gzip_hint(zip);
+#endif
+
+#ifdef HAVE_ZSTD
+	if(zip->type == ZIP_ZSTD)
+		zip->hint = zstd_hint(zip);
+#endif
+
+	return zip->hint;
+}
+
+static bool zip_seek(ZIPFILE *zip, SEEKPOINT *pt)
+{
+	bool success = false;
+
+#ifdef HAVE_ZLIB
+	if(zip->type == ZIP_GZIP)
+		success = gzip_seek(zip, pt);
+#endif
+
+#ifdef HAVE_ZSTD
+	if(zip->type == ZIP_ZSTD)
+		success = zstd_seek(zip, pt);
+#endif
+
+	zip->active = success;
+	zip->pos	= pt->out;
+
+	return success;
+}
+
+static unsigned long zip_decode(ZIPFILE *zip, void *buf, unsigned long length)
+{
+	unsigned long len = 0;
+
+#ifdef HAVE_ZLIB
+	if(zip->type == ZIP_GZIP)
+		len = gzip_decode(zip, buf, length);
+#endif
+
+#ifdef HAVE_ZSTD
+	if(zip->type == ZIP_ZSTD)
+		len = zstd_decode(zip, buf, length);
+#endif
+
+	zip->pos += len;
+	return len;
+}
+
+//
+//	Read a file that hasn't been indexed from start to finish, trusting
+//	the size it says it is. If there is more to it than that, the read 
+//	which reaches the end fails
+//
+static unsigned long zip_stream(ZIPFILE *zip, unsigned long offset, void *buf, unsigned long length)
+{
+	SEEKPOINT	  start = { 0, 0, 0, 0 };
+	unsigned long total = 0;
+	unsigned long len;
+
+	if(!zip->active || zip->pos != offset)
+	{
+		if(!zip_seek(zip, &start))
+			return 0;
+	}
+
+	if(length > zip->hint - offset)
+		length = zip->hint - offset;
+
+	while(total < length)
+	{
+		if((len = zip_decode(zip, (char *)buf + total, length - total)) == 0)
+		{
+			zip->active = false;
+			return total;
+		}
+
+		total += len;
+	}
+
+	if(zip->pos == zip->hint && zip_decode(zip, zip->scratch, 1) != 0)
+	{
+		zip->active = false;
+		return 0;
+	}
+
+	return total;
+}
+
+//
+//	Read from any part of the uncompressed file
+//
+unsigned long zip_read(ZIPFILE *zip, unsigned long offset, void *buf, unsigned long length)
+{
+	SEEKPOINT	 *pt;
+	unsigned long total = 0;
+	unsigned long len;
+	size_t		  lo, hi, mid;
+
+	// reading straight through, before the file has been indexed
+	if(!zip->indexed && zip->hint <= ZIP_MAXSIZE && (offset == 0 || (zip->active && zip->pos == offset)))
+		return zip_stream(zip, offset, buf, length);
+
+	if(zip_size(zip) > ZIP_MAXSIZE || offset >= zip->size)
+		return 0;
+
+	if(length > zip->size - offset)
+		length = zip->size - offset;
+
+	// as much as possible from the output kept while indexing
+	while(total < length && offset < zip->cached)
+	{
+		len = ZIP_SPAN - offset % ZIP_SPAN;
+
+		if(len > length - total)
+			len = length - total;
+
+		if(len > zip->cached - offset)
+			len = zip->cached - offset;
+
+		memcpy((char *)buf + total, zip->cache[offset / ZIP_SPAN] + offset % ZIP_SPAN, len);
+
+		offset += len;
+		total  += len;
+	}
+
+	if(total == length)
+		return total;
+
+	// find the last seek-point at or before the offset
+	for(lo = 0, hi = zip->points.size(); hi - lo > 1; )
+	{
+		mid = (lo + hi) / 2;
+
+		if(zip->points[mid].out <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	pt = &zip->points[lo];
+
+	// carry on from the last read if that is nearer
+	if(!zip->active || zip->pos > offset || zip->pos < pt->out)
+	{
+		if(!zip_seek(zip, pt))
+			return 0;
+	}
+
+	while(zip->pos < offset)
+	{
+		len = offset - zip->pos;
+
+		if(zip_decode(zip, zip->scratch, len < ZIP_INBUFSIZE ? len : ZIP_INBUFSIZE) == 0)
+		{
+			zip->active = false;
+			return 0;
+		}
+	}
+
+	while(total < length)
+	{
+		if((len = zip_decode(zip, (char *)buf + total, length - total)) == 0)
+		{
+			zip->active = false;
+			break;
+		}
+
+		total += len;
+	}
+
+	return total;
+}
+
+void zip_close(ZIPFILE *zip)
+{
+	size_t i;
+
+	for(i = 0; i < zip->points.size(); i++)
+		delete[] zip->points[i].window;
+
+	for(i = 0; i < zip->cache.size(); i++)
+		delete[] zip->cache[i];
+
+#ifdef HAVE_ZLIB
+	if(zip->type == ZIP_GZIP)
+		inflateEnd(&zip->strm);
+#endif
+
+#ifdef HAVE_ZSTD
+	if(zip->dstream)
+		ZSTD_freeDStream(zip->dstream);
+#endif
+
+	delete[] zip->inbuf;
+	delete[] zip->scratch;
+	delete zip;
+}
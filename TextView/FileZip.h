@@ -0,0 +1,38 @@
+#ifndef FILEZIP_INCLUDED
+#define FILEZIP_INCLUDED
+
+//
+//	FileZip - random access to the contents of a gzip or zstd compressed
+//	file, used by FileIO so compressed files can be loaded like any other.
+//	Only the formats whose library is available are understood (HAVE_ZLIB,
+//	HAVE_ZSTD) - anything else is loaded as it is. The document still holds
+//	all of the uncompressed text, so the file has to fit in memory
+//
+typedef struct _ZIPFILE ZIPFILE;
+
+#define ZIP_NONE	0
+#define ZIP_GZIP	1
+#define ZIP_ZSTD	2
+
+// number of BYTEs needed by zip_detect
+#define ZIP_HEADERSIZE	4
+
+// distance between seek-points (in uncompressed BYTEs), and size of each read from the file
+#define ZIP_SPAN		0x200000
+#define ZIP_INBUFSIZE	0x10000
+
+// how much of the output from indexing is kept (a multiple of ZIP_SPAN)
+#define ZIP_CACHESIZE	0x10000000
+
+// the most a file may decompress to - a small file can expand into 
+// something enormous, and the whole of it has to fit in memory
+#define ZIP_MAXSIZE		0x40000000
+
+int				zip_detect(const unsigned char *header, unsigned long length);
+ZIPFILE *		zip_open(FILEHANDLE hFile, int type);
+unsigned long	zip_size(ZIPFILE *zip);
+unsigned long	zip_size_hint(ZIPFILE *zip);
+unsigned long	zip_read(ZIPFILE *zip, unsigned long offset, void *buf, unsigned long length);
+void			zip_close(ZIPFILE *zip);
+
+#endif
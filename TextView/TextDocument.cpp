@@ -6,12 +6,9 @@
 //	NOTES:		www.catch22.net
 //
 
-#define STRICT
-#define WIN32_LEAN_AND_MEAN
-
-#include <windows.h>
+#include "portable.h"
+#include <algorithm>
 #include "TextDocument.h"
-#include "TextView.h"
 #include "Unicode.h"
 
 struct _BOM_LOOKUP BOMLOOK[] = 
@@ -25,6 +22,8 @@ struct _BOM_LOOKUP BOMLOOK[] =
 	{ 0,          0, NCP_ASCII	  },
 };
 
+static ULONG sniff_offset(ULONG block, ULONG doclen);
+
 //
 //	TextDocument constructor
 //
@@ -35,12 +34,37 @@ TextDocument::TextDocument()
 	m_nDocLength_bytes  = 0;
 	m_nDocLength_chars  = 0;
 
-	m_pLineBuf_byte		= 0;
-	m_pLineBuf_char		= 0;
+	m_pIndex			= new LINEINDEX;
+	m_pIndex->refcount	= 1;
+
 	m_nNumLines			= 0;
+	m_nTabWidth			= 4;
+	m_nWidthTabs[0]		= 4;
+	m_nWidthTabs[1]		= 0;
+
+	m_nNumWords			= 0;
+	m_nNumCodePoints	= 0;
+	memset(m_nLineEndings, 0, sizeof(m_nLineEndings));
+
+	m_nLineEnding		= EOL_NONE;
 
 	m_nFileFormat		= NCP_ASCII;
+	m_nFormatConfidence	= 100;
 	m_nHeaderSize		= 0;
+
+	m_pLoader			= 0;
+	m_nFileLength		= 0;
+	m_fChunksValid		= false;
+	memset(&m_FileStamp, 0, sizeof(m_FileStamp));
+	m_fReadOnly			= false;
+
+	m_nRefCount			= 1;
+	m_nRevision			= 0;
+	m_nRestoreOffset	= 0;
+	m_nRestoreLength	= 0;
+	m_nRestoreChars		= 0;
+
+	m_seq.restore_callback(restore_event, this);
 }
 
 //
@@ -48,7 +72,147 @@ TextDocument::TextDocument()
 //
 TextDocument::~TextDocument()
 {
+	m_Listeners.clear();
 	clear();
+	release_index();
+}
+
+ULONG TextDocument::AddRef()
+{
+	return ++m_nRefCount;
+}
+
+ULONG TextDocument::Release()
+{
+	ULONG count = --m_nRefCount;
+
+	if(count == 0)
+		delete this;
+
+	return count;
+}
+
+void TextDocument::subscribe(DOCCHANGEFUNC func, void *param)
+{
+	DOCLISTENER dl = { func, param };
+	m_Listeners.push_back(dl);
+}
+
+void TextDocument::unsubscribe(DOCCHANGEFUNC func, void *param)
+{
+	for(size_t i = 0; i < m_Listeners.size(); i++)
+	{
+		if(m_Listeners[i].func == func && m_Listeners[i].param == param)
+		{
+			m_Listeners.erase(m_Listeners.begin() + i);
+			break;
+		}
+	}
+}
+
+markers::marker TextDocument::add_marker(ULONG offset_chars, void *param)
+{
+	return m_Markers.add(offset_chars, param);
+}
+
+void TextDocument::remove_marker(markers::marker marker)
+{
+	m_Markers.remove(marker);
+}
+
+ULONG TextDocument::marker_offset(markers::marker marker)
+{
+	return m_Markers.position(marker);
+}
+
+//
+//	Markers in order, starting with the first at or after offset_chars
+//
+markers::marker TextDocument::first_marker(ULONG offset_chars)
+{
+	return m_Markers.first(offset_chars);
+}
+
+markers::marker TextDocument::next_marker(markers::marker marker)
+{
+	return m_Markers.next(marker);
+}
+
+//
+//	Bring the indexes up-to-date after the sequence has been edited, and
+//	tell everyone who is interested exactly what changed
+//
+void TextDocument::update_document(ULONG offset_bytes, ULONG erase_bytes, ULONG erase_chars, ULONG insert_bytes, ULONG insert_chars)
+{
+	DOCCHANGE change;
+
+	// malformed UTF-8 either side of the change can decode differently now 
+	// that it is next to something else - a stray lead-byte and the trail-bytes
+	// after it join up into one character, or are split apart again. So the 
+	// change is widened to whole characters (which were whole before it too)
+	if(m_nFileFormat == NCP_UTF8)
+	{
+		ULONG start  = offset_bytes;
+		ULONG length = insert_bytes;
+
+		char_boundaries(&start, &length);
+
+		if(start != offset_bytes || length != insert_bytes)
+		{
+			ULONG before = offset_bytes - start;
+			ULONG after	 = start + length - offset_bytes - insert_bytes;
+
+			erase_chars += utf8_count(start, before) + utf8_count(offset_bytes + insert_bytes, after);
+			insert_chars = -1;
+			scan_chars(start, length, &insert_chars);
+
+			offset_bytes  = start;
+			erase_bytes	 += before + after;
+			insert_bytes  = length;
+		}
+	}
+
+	update_checkpoints(offset_bytes, erase_bytes, erase_chars, insert_bytes, insert_chars);
+	update_linebuffer(offset_bytes, erase_bytes, insert_bytes, &change);
+
+	change.offset_bytes = offset_bytes;
+	change.erase_bytes	= erase_bytes;
+	change.insert_bytes	= insert_bytes;
+
+	// nothing before the edit has moved
+	change.offset_chars	= byteoffset_to_charoffset(offset_bytes);
+	change.erase_chars	= erase_chars;
+	change.insert_chars	= insert_chars;
+	change.reset		= false;
+
+	m_Markers.update(change.offset_chars, erase_chars, insert_chars);
+	notify(&change);
+}
+
+void TextDocument::notify(DOCCHANGE *change)
+{
+	change->revision = ++m_nRevision;
+
+	for(size_t i = 0; i < m_Listeners.size(); i++)
+		m_Listeners[i].func(m_Listeners[i].param, change);
+}
+
+//
+//	The whole document is different
+//
+void TextDocument::notify_reset()
+{
+	DOCCHANGE change;
+
+	memset(&change, 0, sizeof(change));
+
+	change.insert_bytes = m_nDocLength_bytes - m_nHeaderSize;
+	change.insert_chars = m_nDocLength_chars;
+	change.insert_lines = m_nNumLines;
+	change.reset		= true;
+
+	m_Markers.clamp(m_nDocLength_chars);
+	notify(&change);
 }
 
 //
@@ -56,65 +220,171 @@ TextDocument::~TextDocument()
 //
 bool TextDocument::init(TCHAR *filename)
 {
-	HANDLE hFile;
+	FILEHANDLE hFile;
 	
-	hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	hFile = file_open(filename);
 
-	if(hFile == INVALID_HANDLE_VALUE)
+	if(hFile == INVALID_FILEHANDLE)
 		return false;
 
 	return init(hFile);
 }
 
 //
-//	Initialize using a file-handle
+//	Initialize using a file-handle (which is closed afterwards)
 //
-bool TextDocument::init(HANDLE hFile)
+//	The file is read straight into the piece-table by a separate thread.
+//	Only the blocks needed to detect the format are read up-front - the 
+//	line-buffer is then built as the rest of the file arrives (see scanchar)
+//
+bool TextDocument::init(FILEHANDLE hFile)
 {
-	ULONG numread;
-	char *buffer;
+	ULONG length;
+	bool  success;
 
-	if((m_nDocLength_bytes = GetFileSize(hFile, 0)) == 0)
+	if(hFile == INVALID_FILEHANDLE)
 		return false;
 
-	// allocate new file-buffer
-	if((buffer = new char[m_nDocLength_bytes]) == 0)
-		return false;
+	// a compressed file is decompressed as it loads, going by the size it
+	// says it is. If that was wrong, find out the real size and start again
+	length	= file_size_hint(hFile);
+	success = load_file(hFile, length);
 
-	// read entire file into memory
-	ReadFile(hFile, buffer, m_nDocLength_bytes, &numread, 0);
+	if(!success && file_compressed(hFile) && file_size(hFile) != length)
+		success = load_file(hFile, file_size(hFile));
 
-	m_seq.init((BYTE *)buffer, m_nDocLength_bytes);
+	if(!success)
+	{
+		file_close(hFile);
+		return false;
+	}
 
-	// try to detect if this is an ascii/unicode/utf8 file
-	m_nFileFormat = detect_file_format(&m_nHeaderSize);
+	// a compressed file can be looked at, but not changed
+	m_fReadOnly = file_compressed(hFile);
+	file_stamp(hFile, &m_FileStamp);
+	file_close(hFile);
 
-	// work out where each line of text starts
-	if(!init_linebuffer())
-		clear();
+	m_nFileLength = m_nDocLength_bytes;
+	notify_reset();
 
-	CloseHandle(hFile);
-	delete[] buffer;
 	return true;
 }
 
-//	Initialize the TextDocument with the specified file
 //
-/*bool TextDocument::save(TCHAR *filename)
+//	Read a file of the specified length into the document. The file is
+//	left open, and the document empty if it doesn't all load
+//
+bool TextDocument::load_file(FILEHANDLE hFile, ULONG length)
 {
-	HANDLE hFile;
-	
-	hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	BYTE *buffer;
+	ULONG offset;
+	ULONG sampled;
+	bool  success;
+
+	m_nDocLength_bytes = length;
+
+	if(length == 0 || length == FILE_BADSIZE || (buffer = m_seq.init_buffer(length)) == 0)
+	{
+		m_nDocLength_bytes = 0;
+		return false;
+	}
 
-	if(hFile == INVALID_HANDLE_VALUE)
+	// try to detect if this is an ascii/unicode/utf8 file. Only the start
+	// of a compressed file can be read without decompressing all of it
+	sampled = file_compressed(hFile) ? min(length, SNIFF_BLOCKS * SNIFF_BLOCKSIZE) : length;
+
+	for(int i = 0; i < SNIFF_BLOCKS; i++)
+	{
+		if((offset = sniff_offset(i, sampled)) < sampled)
+			file_read(hFile, offset, buffer + offset, min(sampled - offset, SNIFF_BLOCKSIZE));
+	}
+
+	m_nFileFormat = detect_file_format(&m_nHeaderSize, sampled);
+	chunk_start();
+
+	// work out where each line of text starts (and divide the file 
+	// into chunks for reloading) while the file is loading
+	if((m_pLoader = file_load_start(hFile, buffer, length, load_chunks, this)) == 0)
+	{
+		clear();
 		return false;
+	}
 
+	success = init_linebuffer();
+	success = file_load_finish(m_pLoader) && success;
+	m_pLoader = 0;
 
+	chunk_done(success);
+
+	if(!success || !init_checkpoints())
+	{
+		clear();
+		return false;
+	}
 
-	CloseHandle(hFile);
 	return true;
-}*/
+}
+
+//
+//	Follow a file that is being appended to (a log file, say). Whatever has 
+//	been added to the end of the file since it was loaded is read straight 
+//	onto the end of the document, and only the end of the line-buffer is
+//	rescanned - so each append costs the same however big the file gets.
+//
+//	A character which hasn't been completely written yet is left until next
+//	time. Whatever is added can't be undone, and neither can anything before
+//	it - but the undo history is kept (see sequence::extend)
+//
+//	Returns the number of BYTEs added, or FILE_BADSIZE if the file needs 
+//	reloading instead - it is shorter than before (truncated or replaced), 
+//	or was empty to begin with, so the format is still unknown
+//
+ULONG TextDocument::append_file(FILEHANDLE hFile)
+{
+	ULONG filelen = file_size(hFile);
+	ULONG offset  = m_nDocLength_bytes - m_nHeaderSize;
+	ULONG total   = 0;
+	ULONG chars   = -1;
+
+	if(filelen == FILE_BADSIZE || filelen < m_nFileLength)
+		return FILE_BADSIZE;
+
+	if(m_nFileLength == 0 && filelen > 0)
+		return FILE_BADSIZE;
+
+	while(m_nFileLength + total < filelen)
+	{
+		ULONG len = min(filelen - m_nFileLength - total, FILE_READAHEAD);
+		BYTE *buf;
 
+		if((buf = m_seq.extend_reserve(len)) == 0)
+			break;
+
+		len = file_read(hFile, m_nFileLength + total, buf, len);
+		len = rawdata_complete_len(buf, len);
+
+		if(len == 0 || !m_seq.extend(len))
+			break;
+
+		total += len;
+	}
+
+	if(total == 0)
+		return 0;
+
+	file_stamp(hFile, &m_FileStamp);
+	m_nFileLength	  += total;
+	m_nDocLength_bytes = m_seq.size();
+
+	scan_chars(offset, total, &chars);
+	update_document(offset, 0, 0, total, chars);
+
+	// the last chunk probably ends somewhere else now
+	if(m_fChunksValid)
+		chunk_document(m_FileChunks.size() ? m_FileChunks.back().offset : 0);
+
+	return total;
+}
 
 //
 //	Parse the file lo
@@ -131,7 +401,7 @@ bool TextDocument::init(HANDLE hFile)
 //	Match the first x bytes of the file against the
 //  Byte-Order-Mark (BOM) lookup table
 //
-int TextDocument::detect_file_format(int *m_nHeaderSize)
+int TextDocument::detect_file_format(int *m_nHeaderSize, ULONG sampled)
 {
 	BYTE header[4] = { 0 };
 	m_seq.render(0, header, 4);
@@ -142,12 +412,172 @@ int TextDocument::detect_file_format(int *m_nHeaderSize)
 		   memcmp(header, &BOMLOOK[i].bom, BOMLOOK[i].len) == 0)
 		{
 			*m_nHeaderSize = BOMLOOK[i].len;
+			m_nFormatConfidence = 100;
 			return BOMLOOK[i].type;
 		}
 	}
 
 	*m_nHeaderSize = 0;
-	return NCP_ASCII;	// default to ASCII
+
+	// no BOM, so have a guess
+	return sniff_file_format(&m_nFormatConfidence, sampled);
+}
+
+//
+//	Count the surrogates in a block of UTF-16 text which are not part
+//	of a valid pair. The block may start/end in the middle of a pair
+//
+static ULONG count_bad_surrogates(UTF16 *text, size_t len, bool bigendian)
+{
+	ULONG bad = 0;
+
+	for(size_t i = 0; i < len; i++)
+	{
+		UTF16 ch = bigendian ? SWAPWORD(text[i]) : text[i];
+
+		if(ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_HIGH_END)
+		{
+			UTF16 ch2 = 0;
+
+			if(i + 1 == len)
+				break;
+
+			ch2 = bigendian ? SWAPWORD(text[i+1]) : text[i+1];
+
+			if(ch2 >= UNI_SUR_LOW_START && ch2 <= UNI_SUR_LOW_END)
+				i++;
+			else
+				bad++;
+		}
+		else if(ch >= UNI_SUR_LOW_START && ch <= UNI_SUR_LOW_END && i > 0)
+		{
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+//
+//	Return the offset of the specified block of a file that is examined 
+//	when guessing its format. Small files are read contiguously, larger 
+//	ones are sampled
+//
+static ULONG sniff_offset(ULONG block, ULONG doclen)
+{
+	if(doclen <= SNIFF_BLOCKS * SNIFF_BLOCKSIZE)
+		return block * SNIFF_BLOCKSIZE;
+	else
+		return (ULONG)((ULONGLONG)(doclen - SNIFF_BLOCKSIZE) * block / (SNIFF_BLOCKS - 1)) & ~3;
+}
+
+//
+//	Guess the format of a file which has no byte-order-mark.
+//
+//	Only a few blocks spread evenly through the file are examined, so 
+//	this takes the same (very short) time regardless of the file size:
+//
+//	1. UTF-16 text has NULs in the high byte of every ASCII character
+//	   (spaces, newlines etc), so NULs at mostly-odd or mostly-even 
+//	   offsets give away the byte-order. Unpaired surrogates count against it.
+//	2. Otherwise, 8-bit text which validates as UTF-8 and contains some
+//	   multi-byte sequences is almost certainly UTF-8
+//	3. Everything else is left as ASCII (i.e. the ANSI codepage)
+//
+//	confidence - [out] how sure we are, from 0 (a wild guess) to 100
+//	sampled    - how much of the start of the document can be looked at
+//
+int TextDocument::sniff_file_format(int *confidence, ULONG sampled)
+{
+	BYTE	buf[SNIFF_BLOCKSIZE];
+	ULONG	doclen	  = m_nDocLength_bytes;
+	ULONG	zeros[2]  = { 0, 0 };	// NULs at even/odd offsets
+	ULONG	badsur[2] = { 0, 0 };	// unpaired surrogates if LE/BE
+	ULONG	total	  = 0;
+	size_t	errors	  = 0;
+	size_t	multibyte = 0;
+
+	for(ULONG i = 0; i < SNIFF_BLOCKS; i++)
+	{
+		ULONG  offset = sniff_offset(i, sampled);
+		size_t len;
+		size_t skip = 0;
+		size_t mb;
+
+		if(offset >= sampled)
+			break;
+
+		len = min(sampled - offset, SNIFF_BLOCKSIZE);
+		m_seq.render(offset, buf, len);
+
+		for(size_t j = 0; j < len; j++)
+		{
+			if(buf[j] == 0)
+				zeros[j & 1]++;
+		}
+
+		badsur[0] += count_bad_surrogates((UTF16 *)buf, len / 2, false);
+		badsur[1] += count_bad_surrogates((UTF16 *)buf, len / 2, true);
+		total	  += len;
+
+		// blocks from the middle of the file can start and end mid-sequence
+		while(offset > 0 && skip < 3 && skip < len && (buf[skip] & 0xC0) == 0x80)
+			skip++;
+
+		if(offset + len < doclen)
+			len = utf8_complete_len(buf, len);
+
+		errors	  += utf8_validate(buf + skip, len - skip, &mb);
+		multibyte += mb;
+	}
+
+	ULONG pairs = total / 2;
+
+	//
+	//	UTF-16: NULs appear on one side only
+	//
+	for(int be = 0; be < 2; be++)
+	{
+		ULONG high = zeros[be ? 0 : 1];	// NULs in the high byte of each UTF16
+		ULONG low  = zeros[be ? 1 : 0];	// NULs in the low byte
+		
+		if(pairs > 0 && high > pairs / 50 && low <= high / 10)
+		{
+			if(badsur[be] > 0)
+				*confidence = 40;
+			else if(high > pairs / 4)
+				*confidence = 95;
+			else
+				*confidence = 75;
+
+			return be ? NCP_UTF16BE : NCP_UTF16;
+		}
+	}
+
+	// NULs with no pattern - probably not text at all
+	if(zeros[0] + zeros[1] > 0)
+	{
+		*confidence = 10;
+		return NCP_ASCII;
+	}
+
+	//
+	//	UTF-8: well-formed multibyte sequences, and few (if any) errors
+	//
+	if(multibyte > 0 && errors == 0)
+	{
+		*confidence = min(99, 70 + multibyte * 3);
+		return NCP_UTF8;
+	}
+	else if(multibyte > errors * 10)
+	{
+		*confidence = 50;
+		return NCP_UTF8;
+	}
+
+	// plain 7-bit ASCII looks the same either way
+	*confidence = errors ? min(95, 50 + errors * 5) : 100;
+	return NCP_ASCII;
 }
 
 
@@ -159,36 +589,118 @@ bool TextDocument::clear()
 	m_seq.clear();
 	m_nDocLength_bytes = 0;
 
-	if(m_pLineBuf_byte)
+	// a forked document keeps the line-index to itself
+	if(m_pIndex->refcount > 1)
 	{
-		delete[] m_pLineBuf_byte;
-		m_pLineBuf_byte = 0;
+		release_index();
+		m_pIndex = new LINEINDEX;
+		m_pIndex->refcount = 1;
 	}
 
-	if(m_pLineBuf_char)
-	{
-		delete[] m_pLineBuf_char;
-		m_pLineBuf_char = 0;
-	}
-		
+	m_pIndex->lines.clear();
+	m_pIndex->widths[0].clear();
+	m_pIndex->widths[1].clear();
+	m_LineSegs.clear();
 	m_nNumLines = 0;
+
+	m_nNumWords		 = 0;
+	m_nNumCodePoints = 0;
+	memset(m_nLineEndings, 0, sizeof(m_nLineEndings));
+
+	m_pIndex->checkpoints.clear();
+	m_nDocLength_chars = 0;
+	m_nHeaderSize	   = 0;
+	m_nLineEnding	   = EOL_NONE;
+	m_nFileLength	   = 0;
+	memset(&m_FileStamp, 0, sizeof(m_FileStamp));
+
+	m_FileChunks.clear();
+	m_fChunksValid	   = false;
+	m_fReadOnly		   = false;
+
+	notify_reset();
 	return true;
 }
 
+//
+//	Make an independent, editable copy of the document. The copy shares the
+//	text (see sequence::fork) and the line-index with this document, so it 
+//	is quick to make however big the document is - whichever of the two is 
+//	edited first takes its own copy of the line-index at that point.
+//
+//	The copy starts with no undo history, views or markers, and isn't
+//	attached to a file. Release it when finished with
+//
+TextDocument *TextDocument::fork()
+{
+	TextDocument *doc = new TextDocument;
+
+	if(!m_seq.fork(doc->m_seq))
+	{
+		doc->Release();
+		return 0;
+	}
+
+	doc->release_index();
+	doc->m_pIndex = m_pIndex;
+	InterlockedIncrement(&m_pIndex->refcount);
+
+	doc->m_nDocLength_bytes		= m_nDocLength_bytes;
+	doc->m_nDocLength_chars		= m_nDocLength_chars;
+	doc->m_nNumLines			= m_nNumLines;
+	doc->m_nTabWidth			= m_nTabWidth;
+	doc->m_nWidthTabs[0]		= m_nWidthTabs[0];
+	doc->m_nWidthTabs[1]		= m_nWidthTabs[1];
+	doc->m_nNumWords			= m_nNumWords;
+	doc->m_nNumCodePoints		= m_nNumCodePoints;
+	memcpy(doc->m_nLineEndings, m_nLineEndings, sizeof(m_nLineEndings));
+
+	doc->m_nLineEnding			= m_nLineEnding;
+	doc->m_nFileFormat			= m_nFileFormat;
+	doc->m_nFormatConfidence	= m_nFormatConfidence;
+	doc->m_nHeaderSize			= m_nHeaderSize;
+	doc->m_nRevision			= m_nRevision;
+
+	return doc;
+}
+
+//
+//	Take a private copy of the line-index before changing it, if a fork
+//	is still sharing it. The copy is made before letting go of the shared
+//	one, so the last document to let go is the one that deletes it
+//
+void TextDocument::unshare_index()
+{
+	if(m_pIndex->refcount > 1)
+	{
+		LINEINDEX *index = new LINEINDEX(*m_pIndex);
+
+		index->refcount = 1;
+		release_index();
+		m_pIndex = index;
+	}
+}
+
+void TextDocument::release_index()
+{
+	if(InterlockedDecrement(&m_pIndex->refcount) == 0)
+		delete m_pIndex;
+
+	m_pIndex = 0;
+}
+
 bool TextDocument::EmptyDoc()
 {
+	bool success;
+
 	clear();
 	m_seq.init();
+	m_fChunksValid = true;
 
-	// this is not robust. it's just to get the thing
-	// up-and-running until I write a proper line-buffer mananger
-	m_pLineBuf_byte = new ULONG[0x1000];
-	m_pLineBuf_char = new ULONG[0x1000];
-
-	m_pLineBuf_byte[0] = 0;
-	m_pLineBuf_char[0] = 0;
+	success = init_linebuffer() && init_checkpoints();
+	notify_reset();
 
-	return true;
+	return success;
 }
 
 
@@ -203,16 +715,72 @@ int TextDocument::getchar(ULONG offset, ULONG lenbytes, ULONG *pch32)
 	lenbytes = min(16, lenbytes);
 	m_seq.render(offset+ m_nHeaderSize, rawdata, lenbytes);
 
+	return decodechar(rawdata, lenbytes, pch32);
+}
+
+//
+//	As getchar, but reads through a SCANBUF so that a sequential scan 
+//	doesn't have to go to the piece-table for each character
+//
+int TextDocument::scanchar(SCANBUF *sb, ULONG offset, ULONG *pch32)
+{
+	ULONG doclen = m_nDocLength_bytes - m_nHeaderSize;
+
+	// refill the buffer if the next character could run off the end
+	if(offset < sb->offset || (offset + 16 > sb->offset + sb->length && sb->offset + sb->length < doclen))
+	{
+		sb->offset = offset;
+		sb->length = min(doclen - offset, sizeof(sb->buf));
+
+		// the file might still be loading
+		if(m_pLoader)
+			file_load_wait(m_pLoader, offset + m_nHeaderSize + sb->length);
+
+		m_seq.render(offset + m_nHeaderSize, sb->buf, sb->length);
+	}
+
+	return decodechar(sb->buf + (offset - sb->offset), min(16, sb->offset + sb->length - offset), pch32);
+}
+
+//
+//	The reverse of scanchar - decode the character that finishes at the 
+//	specified offset. The buffer is refilled so that the offset ends up in
+//	the middle, as a scan might turn round and head forwards again
+//
+int TextDocument::scanprev(SCANBUF *sb, ULONG offset, ULONG *pch32)
+{
+	ULONG doclen = m_nDocLength_bytes - m_nHeaderSize;
+
+	if(offset == 0)
+		return 0;
+
+	// refill the buffer if the previous character could start before it
+	if(offset <= sb->offset || offset > sb->offset + sb->length || (offset - sb->offset < 16 && sb->offset > 0))
+	{
+		sb->offset = offset > sizeof(sb->buf) / 2 ? offset - sizeof(sb->buf) / 2 : 0;
+		sb->length = min(doclen - sb->offset, sizeof(sb->buf));
+		m_seq.render(sb->offset + m_nHeaderSize, sb->buf, sb->length);
+	}
+
+	return decodeprev(sb->buf + (offset - sb->offset), offset - sb->offset, offset, pch32);
+}
+
+//
+//	Decode a single UTF-32 character from raw document data
+//
+int TextDocument::decodechar(BYTE *rawdata, ULONG lenbytes, ULONG *pch32)
+{
 #ifdef UNICODE
 
 	UTF16   *rawdata_w = (UTF16 *)rawdata;//(WCHAR*)(buffer + offset + m_nHeaderSize);
-	WCHAR     ch16;
+	UTF16    ch16;
 	size_t   ch32len = 1;
+	size_t   ch16len = 1;
 
 	switch(m_nFileFormat)
 	{
 	case NCP_ASCII:
-		MultiByteToWideChar(CP_ACP, 0, (CCHAR*)rawdata, 1, &ch16, 1);
+		ascii_to_utf16(rawdata, 1, &ch16, &ch16len);
 		*pch32 = ch16;
 		return 1;
 
@@ -225,6 +793,23 @@ int TextDocument::getchar(ULONG offset, ULONG lenbytes, ULONG *pch32)
 	case NCP_UTF8:
 		return utf8_to_utf32(rawdata, lenbytes, pch32);
 
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+
+		// stray bytes at the end of the file
+		if(lenbytes < sizeof(UTF32))
+		{
+			*pch32 = UNI_REPLACEMENT_CHAR;
+			return lenbytes;
+		}
+
+		*pch32 = *(UTF32 *)rawdata;
+
+		if(m_nFileFormat == NCP_UTF32BE)
+			*pch32 = SWAPDWORD(*pch32);
+
+		return sizeof(UTF32);
+
 	default:
 		return 0;
 	}
@@ -238,7 +823,112 @@ int TextDocument::getchar(ULONG offset, ULONG lenbytes, ULONG *pch32)
 }
 
 //
-//	Fetch a buffer of UTF-16 text from the specified byte offset - 
+//	Decode the single UTF-32 character which finishes just before rawdata,
+//	stepping backwards over exactly the same number of bytes that 
+//	decodechar would have stepped forwards
+//
+//	rawdata  - points just past the end of the character
+//	lenbytes - number of bytes available before rawdata
+//	offset   - BYTE offset of rawdata within the document
+//
+//	returns  - length of the character in BYTEs
+//
+int TextDocument::decodeprev(BYTE *rawdata, ULONG lenbytes, ULONG offset, ULONG *pch32)
+{
+#ifdef UNICODE
+
+	UTF16   *rawdata_w = (UTF16 *)rawdata;
+	UTF16    ch16;
+	size_t   ch16len = 1;
+	UTF32	 lo, hi;
+	ULONG	 i;
+
+	if(lenbytes == 0)
+		return 0;
+
+	switch(m_nFileFormat)
+	{
+	case NCP_ASCII:
+		ascii_to_utf16(rawdata - 1, 1, &ch16, &ch16len);
+		*pch32 = ch16;
+		return 1;
+
+	// low-surrogate preceded by a high-surrogate, or a single UTF-16
+	case NCP_UTF16:
+	case NCP_UTF16BE:
+
+		lo = rawdata_w[-1];
+		hi = lenbytes >= 4 ? rawdata_w[-2] : 0;
+
+		if(m_nFileFormat == NCP_UTF16BE)
+		{
+			lo = SWAPWORD(lo);
+			hi = SWAPWORD(hi);
+		}
+
+		if(lo >= UNI_SUR_LOW_START && lo <= UNI_SUR_LOW_END && hi >= UNI_SUR_HIGH_START && hi <= UNI_SUR_HIGH_END)
+		{
+			*pch32 = ((hi - UNI_SUR_HIGH_START) << 10) + (lo - UNI_SUR_LOW_START) + 0x10000;
+			return 2 * sizeof(WCHAR);
+		}
+
+		// a high-surrogate without its pair is only illegal if something follows it
+		if(lo >= UNI_SUR_HIGH_START && lo <= UNI_SUR_HIGH_END && offset < m_nDocLength_bytes - m_nHeaderSize)
+			*pch32 = UNI_REPLACEMENT_CHAR;
+		else
+			*pch32 = lo;
+
+		return sizeof(WCHAR);
+
+	// find the nearest byte that isn't a trail-byte (a sequence is never more than
+	// 6 bytes long), then make sure that its sequence really does finish here
+	case NCP_UTF8:
+		for(i = 1; i <= min(6, lenbytes); i++)
+		{
+			if((rawdata[-(int)i] & 0xC0) != 0x80)
+			{
+				if(utf8_to_utf32(rawdata - i, i, pch32) == i)
+					return i;
+
+				break;
+			}
+		}
+
+		// a stray trail-byte by itself
+		*pch32 = UNI_REPLACEMENT_CHAR;
+		return 1;
+
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+
+		// stray bytes at the end of the file
+		if(offset % sizeof(UTF32) != 0 || lenbytes < sizeof(UTF32))
+		{
+			*pch32 = UNI_REPLACEMENT_CHAR;
+			return min(offset % sizeof(UTF32), lenbytes);
+		}
+
+		*pch32 = *(UTF32 *)(rawdata - sizeof(UTF32));
+
+		if(m_nFileFormat == NCP_UTF32BE)
+			*pch32 = SWAPDWORD(*pch32);
+
+		return sizeof(UTF32);
+
+	default:
+		return 0;
+	}
+
+#else
+
+	*pch32 = (ULONG)(BYTE)rawdata[-1];
+	return lenbytes ? 1 : 0;
+
+#endif
+}
+
+//
+//	Fetch a buffer of UTF-16 text from the specified byte offset - 
 //  returns the number of characters stored in buf
 //
 //	Depending on how Neatpad was compiled (UNICODE vs ANSI) this function
@@ -250,6 +940,10 @@ int TextDocument::getchar(ULONG offset, ULONG lenbytes, ULONG *pch32)
 //		  make sure that combining chars kept together
 //		  make sure that bidirectional text kep together (will be *hard*) 
 //
+//	The text is converted straight out of the piece-table's spans, 
+//	without copying it anywhere first. Only a character which is split 
+//	across two spans gets gathered up into a temporary buffer
+//
 //	offset   - BYTE offset within underlying data sequence
 //	lenbytes - max number of bytes to process (i.e. to limit to a line)
 //  buf		 - UTF16/ASCII output buffer
@@ -264,24 +958,46 @@ ULONG TextDocument::gettext(ULONG offset, ULONG lenbytes, TCHAR *buf, ULONG *buf
 	ULONG chars_copied = 0;
 	ULONG bytes_processed = 0;
 
+	sequence::iterator itor;
+
 	if(offset >= m_nDocLength_bytes)
 	{
 		*buflen = 0;
 		return 0;
 	}
 
-	while(lenbytes > 0 && *buflen > 0)
+	itor = m_seq.iterate(offset + m_nHeaderSize);
+
+	while(lenbytes > 0 && *buflen > 0 && itor)
 	{
-		BYTE   rawdata[0x100];
-		size_t rawlen = min(lenbytes, 0x100);
+		BYTE   joined[8];
+		BYTE  *rawdata = (BYTE *)itor.data();
+		size_t rawlen  = min(lenbytes, itor.length());
+		size_t tmplen  = *buflen;
+
+		// don't let the span boundary split a character in two
+		if(rawlen < lenbytes)
+			rawlen = rawdata_complete_len(rawdata, rawlen);
+
+		// a character straddles the boundary - piece it back together
+		if(rawlen == 0)
+		{
+			rawlen  = m_seq.render(offset + m_nHeaderSize, joined, min(lenbytes, sizeof(joined)));
+			rawdata = joined;
 
-		// get next block of data from the piece-table
-		m_seq.render(offset + m_nHeaderSize, rawdata, rawlen);
+			if(rawlen < lenbytes)
+				rawlen = max(rawdata_complete_len(joined, rawlen), 1);
+		}
 
 		// convert to UTF-16 
-		size_t tmplen = *buflen;
 		rawlen = rawdata_to_utf16(rawdata, rawlen, buf, &tmplen);
 
+		// no room for the next character
+		if(rawlen == 0)
+			break;
+
+		itor.advance(rawlen);
+
 		lenbytes		-= rawlen;
 		offset			+= rawlen;
 		bytes_processed += rawlen;
@@ -365,264 +1081,640 @@ ULONG TextDocument::getdata(ULONG offset, BYTE *buf, size_t len)
 }
 
 //
-//	Initialize the line-buffer
+//	Scan a single line of text, starting at the specified offsets (which must
+//	be the start of a line). The offsets of the following line are returned
+//	in next_bytes/next_chars. The line's tab-expanded display widths (at both
+//	tab-sizes) and the words, code-points and type of line-ending it contains
+//	are filled in, but not its length
 //
 //	With Unicode a newline sequence is defined as any of the following:
 //
 //	\u000A | \u000B | \u000C | \u000D | \u0085 | \u2028 | \u2029 | \u000D\u000A
 //
-bool TextDocument::init_linebuffer()
+//	returns true if the line runs up to the end of the document
+//
+bool TextDocument::scan_line(SCANBUF *sb, ULONG offset_bytes, ULONG offset_chars, ULONG *next_bytes, ULONG *next_chars, DOCLINE *line)
 {
-	ULONG offset_bytes		= 0;
-	ULONG offset_chars		= 0;
-	ULONG linestart_bytes	= 0;
-	ULONG linestart_chars	= 0;
-	ULONG bytes_left	    = m_nDocLength_bytes - m_nHeaderSize;
-
-	ULONG buflen  = m_nDocLength_bytes - m_nHeaderSize;
-
-	// allocate the line-buffer for storing each line's BYTE offset
-	if((m_pLineBuf_byte = new ULONG[buflen+1]) == 0)
-		return false;
-
-	// allocate the line-buffer for storing each line's CHARACTER offset
-	if((m_pLineBuf_char = new ULONG[buflen+1]) == 0)
-		return false;
+	ULONG doclen	 = m_nDocLength_bytes - m_nHeaderSize;
+	int	  tabwidth	 = m_nWidthTabs[1] ? m_nWidthTabs[1] : 1;
+	ULONG xpos		 = 0;
+	ULONG xpos2		 = 0;
+	ULONG words		 = 0;
+	ULONG codepoints = 0;
+	BYTE  eol		 = EOL_NONE;
+	int   lastspace	 = 1;
+	int   space;
+	ULONG ch32;
+
+	while(offset_bytes < doclen)
+	{
+		// runs of printable ASCII in a UTF-8 (or ANSI) document can be counted straight 
+		// from the buffer - every code-page leaves the bottom half of the table alone
+		if((m_nFileFormat == NCP_UTF8 || m_nFileFormat == NCP_ASCII) && offset_bytes >= sb->offset && offset_bytes < sb->offset + sb->length && 
+			sb->buf[offset_bytes - sb->offset] >= ' ' && sb->buf[offset_bytes - sb->offset] < 0x7F)
+		{
+			BYTE *start = sb->buf + (offset_bytes - sb->offset);
+			BYTE *end	= sb->buf + sb->length;
+			BYTE *ptr;
 
-	m_nNumLines = 0;
+			for(ptr = start; ptr < end && *ptr >= ' ' && *ptr < 0x7F; ptr++)
+			{
+				space	   = *ptr == ' ';
+				words	  += lastspace & !space;
+				lastspace  = space;
+			}
 
+			offset_bytes += ptr - start;
+			offset_chars += ptr - start;
+			codepoints	 += ptr - start;
+			xpos		 += ptr - start;
+			xpos2		 += ptr - start;
+			continue;
+		}
 
-	// loop through every byte in the file
-	for(offset_bytes = 0; offset_bytes < buflen; )
-	{
-		ULONG ch32;
+		offset_bytes += scanchar(sb, offset_bytes, &ch32);
+		codepoints++;
 
-		// get a UTF-32 character from the underlying file format.
-		// this needs serious thought. Currently 
-		ULONG len = getchar(offset_bytes, buflen - offset_bytes, &ch32);
-		offset_bytes += len;
-		offset_chars += 1;
+		// characters outside the BMP take up a surrogate pair
+		offset_chars += (ch32 > UNI_MAX_BMP && ch32 <= UNI_MAX_UTF16) ? 2 : 1;
 
 		if(ch32 == '\r')
 		{
-			// record where the line starts
-			m_pLineBuf_byte[m_nNumLines] = linestart_bytes;
-			m_pLineBuf_char[m_nNumLines] = linestart_chars;
-			linestart_bytes				= offset_bytes;
-			linestart_chars				= offset_chars;
-
-			// look ahead to next char
-			len = getchar(offset_bytes, buflen - offset_bytes, &ch32);
-			offset_bytes += len;
-			offset_chars += 1;
+			eol = EOL_CR;
 
 			// carriage-return / line-feed combination
-			if(ch32 == '\n')
+			if(offset_bytes < doclen)
 			{
-				linestart_bytes		= offset_bytes;
-				linestart_chars		= offset_chars;
+				int len = scanchar(sb, offset_bytes, &ch32);
+
+				if(ch32 == '\n')
+				{
+					offset_bytes += len;
+					offset_chars += 1;
+					codepoints	 += 1;
+					eol			  = EOL_CRLF;
+				}
 			}
-			
-			m_nNumLines++;
+
+			break;
 		}
-		else if(ch32 == '\n' || ch32 == '\x0b' || ch32 == '\x0c' || ch32 == 0x0085 || ch32 == 0x2029 || ch32 == 0x2028)
+		else if(ch32 == '\n')
 		{
-			// record where the line starts
-			m_pLineBuf_byte[m_nNumLines] = linestart_bytes;
-			m_pLineBuf_char[m_nNumLines] = linestart_chars;
-			linestart_bytes				= offset_bytes;
-			linestart_chars				= offset_chars;
-			m_nNumLines++;
+			eol = EOL_LF;
+			break;
 		}
-		// force a 'hard break' 
-		else if(offset_chars - linestart_chars > 128)
+		else if(ch32 == '\x0b' || ch32 == '\x0c' || ch32 == 0x0085 || ch32 == 0x2029 || ch32 == 0x2028)
 		{
-			m_pLineBuf_byte[m_nNumLines] = linestart_bytes;
-			m_pLineBuf_char[m_nNumLines] = linestart_chars;
-			linestart_bytes				= offset_bytes;
-			linestart_chars				= offset_chars;
-			m_nNumLines++;
+			eol = EOL_OTHER;
+			break;
 		}
-	}
 
-	if(buflen > 0)
-	{
-		m_pLineBuf_byte[m_nNumLines] = linestart_bytes;
-		m_pLineBuf_char[m_nNumLines] = linestart_chars;
-		m_nNumLines++;
+		// a word starts wherever anything but white-space follows white-space 
+		// (the line-breaks have already been dealt with)
+		space  = ch32 == ' ' || ch32 == '\t' || (ch32 >= 0x85 && is_whitespace(ch32));
+		words += lastspace & !space;
+		lastspace = space;
+
+		if(ch32 == '\t')
+		{
+			xpos  += m_nWidthTabs[0] - (xpos % m_nWidthTabs[0]);
+			xpos2 += tabwidth - (xpos2 % tabwidth);
+		}
+		else
+		{
+			xpos++;
+			xpos2++;
+		}
 	}
 
-	m_pLineBuf_byte[m_nNumLines] = buflen;
-	m_pLineBuf_char[m_nNumLines] = offset_chars;
+	*next_bytes = offset_bytes;
+	*next_chars = offset_chars;
 
-	return true;
+	line->width			   = xpos;
+	line->width2		   = m_nWidthTabs[1] ? xpos2 : 0;
+	line->stats.words	   = words;
+	line->stats.codepoints = codepoints;
+	line->stats.eol		   = eol;
+
+	return eol == EOL_NONE;
+}
+
+//
+//	Keep track of how many lines there are of each display width
+//
+void TextDocument::add_linewidth(const DOCLINE *line)
+{
+	m_pIndex->widths[0][line->width]++;
+
+	if(m_nWidthTabs[1])
+		m_pIndex->widths[1][line->width2]++;
 }
 
+void TextDocument::remove_linewidth(const DOCLINE *line)
+{
+	std::map<ULONG, ULONG>::iterator it = m_pIndex->widths[0].find(line->width);
+
+	if(it != m_pIndex->widths[0].end() && --it->second == 0)
+		m_pIndex->widths[0].erase(it);
+
+	if(m_nWidthTabs[1] && (it = m_pIndex->widths[1].find(line->width2)) != m_pIndex->widths[1].end() && --it->second == 0)
+		m_pIndex->widths[1].erase(it);
+}
 
 //
-//	Return the number of lines
+//	Keep the document's word/code-point/line-ending totals up-to-date
 //
-ULONG TextDocument::linecount()
+void TextDocument::add_linestats(const LINESTATS *stats)
 {
-	return m_nNumLines;
+	m_nNumWords		 += stats->words;
+	m_nNumCodePoints += stats->codepoints;
+	m_nLineEndings[stats->eol]++;
+}
+
+void TextDocument::remove_linestats(const LINESTATS *stats)
+{
+	m_nNumWords		 -= stats->words;
+	m_nNumCodePoints -= stats->codepoints;
+	m_nLineEndings[stats->eol]--;
 }
 
 //
-//	Return the length of longest line
+//	Normalise the document's line-endings - CR, LF and CR/LF all become the 
+//	specified type (EOL_OTHER means the Unicode line-separator). Nothing is
+//	changed here, the new line-endings are only written out by save()
 //
-ULONG TextDocument::longestline(int tabwidth)
+void TextDocument::setlineending(int eol)
 {
-	//ULONG i;
-	ULONG longest = 0;
-	ULONG xpos = 0;
-//	char *bufptr = (char *)(buffer + m_nHeaderSize);
-/*
-	for(i = 0; i < length_bytes; i++)
-	{
-		if(bufptr[i] == '\r')
-		{
-			if(bufptr[i+1] == '\n')
-				 i++;
+	m_nLineEnding = (eol > EOL_NONE && eol < EOL_TYPES) ? eol : EOL_NONE;
+}
 
-			longest = max(longest, xpos);
-			xpos = 0;
-		}
-		else if(bufptr[i] == '\n')
-		{
-			longest = max(longest, xpos);
-			xpos = 0;
-		}
-		else if(bufptr[i] == '\t')
-		{
-			xpos += tabwidth - (xpos % tabwidth);
-		}
-		else
-		{
-			xpos ++;
-		}
-	}
+//
+//	Return how the specified line ends (EOL_xxx) once any normalisation has 
+//	been applied, along with the length of its line-break as it stands now
+//
+int TextDocument::getlineending(ULONG lineno, ULONG *length_chars)
+{
+	int eol = lineno < m_nNumLines ? m_pIndex->lines.line(lineno)->stats.eol : EOL_NONE;
 
-	longest = max(longest, xpos);*/
-	return 100;//longest;
+	if(length_chars)
+		*length_chars = eol == EOL_CRLF ? 2 : eol == EOL_NONE ? 0 : 1;
+
+	return replace_lineending(eol) ? m_nLineEnding : eol;
 }
 
 //
-//	Return information about specified line
+//	Does a line-ending of the specified type get replaced when saving?
+//	Page-breaks and the other Unicode line-endings are always left alone
 //
-bool TextDocument::lineinfo_from_lineno(ULONG lineno, ULONG *lineoff_chars,  ULONG *linelen_chars, ULONG *lineoff_bytes, ULONG *linelen_bytes)
+bool TextDocument::replace_lineending(int eol)
 {
-	if(lineno < m_nNumLines)
+	return m_nLineEnding != EOL_NONE && m_nLineEnding != eol && 
+		(eol == EOL_CRLF || eol == EOL_LF || eol == EOL_CR);
+}
+
+//
+//	Starting at the specified line, find the next line-ending that gets
+//	replaced when saving. Returns the BYTE offset of the line-break (or 
+//	the end of the document), and the line it belongs to in *lineno
+//
+ULONG TextDocument::next_lineending(ULONG *lineno, lineindex::cursor *cur)
+{
+	const DOCLINE *line;
+	ULONG offset;
+	ULONG unit;
+
+	switch(m_nFileFormat)
 	{
-		if(linelen_chars) *linelen_chars  = m_pLineBuf_char[lineno+1] - m_pLineBuf_char[lineno];
-		if(lineoff_chars) *lineoff_chars  = m_pLineBuf_char[lineno];
+	case NCP_UTF16:	case NCP_UTF16BE: unit = sizeof(UTF16); break;
+	case NCP_UTF32:	case NCP_UTF32BE: unit = sizeof(UTF32); break;
+	default:						  unit = 1;				break;
+	}
 
-		if(linelen_bytes) *linelen_bytes  = m_pLineBuf_byte[lineno+1] - m_pLineBuf_byte[lineno];
-		if(lineoff_bytes) *lineoff_bytes  = m_pLineBuf_byte[lineno];
+	for( ; m_nLineEnding != EOL_NONE && *lineno < m_nNumLines; (*lineno)++)
+	{
+		line = m_pIndex->lines.line(*lineno, &offset, 0, cur);
 
-		return true;
+		if(replace_lineending(line->stats.eol))
+			return offset + line->length_bytes - (line->stats.eol == EOL_CRLF ? 2 : 1) * unit;
 	}
-	else
+
+	return m_nDocLength_bytes - m_nHeaderSize;
+}
+
+//
+//	Initialize the line-buffer
+//
+//	The whole document is scanned - every line's BYTE and CHARACTER
+//	offset is recorded, along with the width and contents of each line
+//
+bool TextDocument::init_linebuffer()
+{
+	ULONG	offset_bytes = 0;
+	ULONG	offset_chars = 0;
+	ULONG	next_bytes, next_chars;
+	std::vector<DOCLINE> lines;
+	DOCLINE	line;
+	SCANBUF	sb;
+	bool	eof;
+
+	unshare_index();
+
+	m_pIndex->widths[0].clear();
+	m_pIndex->widths[1].clear();
+	m_LineSegs.clear();
+
+	m_nNumWords		 = 0;
+	m_nNumCodePoints = 0;
+	memset(m_nLineEndings, 0, sizeof(m_nLineEndings));
+
+	sb.offset = 0;
+	sb.length = 0;
+
+	// an empty document has no lines at all
+	if(m_nDocLength_bytes > (ULONG)m_nHeaderSize)
 	{
-		return false;
+		do
+		{
+			eof = scan_line(&sb, offset_bytes, offset_chars, &next_bytes, &next_chars, &line);
+
+			line.length_bytes = next_bytes - offset_bytes;
+			line.length_chars = next_chars - offset_chars;
+			lines.push_back(line);
+
+			add_linewidth(&line);
+			add_linestats(&line.stats);
+
+			offset_bytes = next_bytes;
+			offset_chars = next_chars;
+		}
+		while(!eof);
 	}
+
+	m_pIndex->lines.assign(lines);
+	m_nNumLines = m_pIndex->lines.count();
+
+	return true;
 }
 
 //
-//	Perform a reverse lookup - file-offset to line number
+//	Return the line containing the specified BYTE offset
 //
-bool TextDocument::lineinfo_from_offset(ULONG offset_chars, ULONG *lineno, ULONG *lineoff_chars, ULONG *linelen_chars, ULONG *lineoff_bytes, ULONG *linelen_bytes)
+ULONG TextDocument::lineno_from_byteoffset(ULONG offset_bytes)
 {
-	ULONG low  = 0;
-	ULONG high = m_nNumLines-1;
-	ULONG line = 0;
+	return m_pIndex->lines.lineno_from_bytes(offset_bytes);
+}
 
-	if(m_nNumLines == 0)
+//
+//	Bring the line-buffer up-to-date after an edit. Only the lines
+//	touched by the edit are rescanned - scanning stops as soon as a
+//	new line-start lines up with one from before the edit, and the
+//	remaining lines are left as they are
+//
+void TextDocument::update_linebuffer(ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes, DOCCHANGE *change)
+{
+	std::vector<DOCLINE> lines;
+	ULONG	delta_bytes = insert_bytes - erase_bytes;
+	ULONG	edit_end	= offset_bytes + insert_bytes;
+	ULONG	first, last, last_bytes, i;
+	ULONG	offset_chars, next_bytes, next_chars;
+	const DOCLINE *old;
+	DOCLINE	line;
+	SCANBUF	sb;
+	bool	eof;
+
+	lineindex::cursor cur;
+
+	memset(&cur, 0, sizeof(cur));
+
+	// nothing to go on, rebuild from scratch
+	if(m_nNumLines == 0 || m_nDocLength_bytes == (ULONG)m_nHeaderSize)
 	{
-		if(lineno)			*lineno			= 0;
-		if(lineoff_chars)	*lineoff_chars	= 0;
-		if(linelen_chars)	*linelen_chars  = 0;
-		if(lineoff_bytes)	*lineoff_bytes	= 0;
-		if(linelen_bytes)	*linelen_bytes  = 0;
+		change->lineno		 = 0;
+		change->erase_lines	 = m_nNumLines;
 
-		return false;
+		init_linebuffer();
+
+		change->insert_lines = m_nNumLines;
+		return;
 	}
 
-	while(low <= high)
+	unshare_index();
+
+	// start with the line containing the edit - or the line before if the edit is
+	// right at the start of the line, because it might continue a CR/LF sequence
+	first = lineno_from_byteoffset(offset_bytes);
+
+	if(first > 0 && m_pIndex->lines.offset_bytes(first) == offset_bytes)
+		first--;
+
+	old = m_pIndex->lines.line(first, &offset_bytes, &offset_chars, &cur);
+
+	// where the old line 'last' started, before the edit
+	last	   = first + 1;
+	last_bytes = offset_bytes + old->length_bytes;
+
+	sb.offset = 0;
+	sb.length = 0;
+
+	for(;;)
 	{
-		line = (high + low) / 2;
+		eof = scan_line(&sb, offset_bytes, offset_chars, &next_bytes, &next_chars, &line);
 
-		if(offset_chars >= m_pLineBuf_char[line] && offset_chars < m_pLineBuf_char[line+1])
+		line.length_bytes = next_bytes - offset_bytes;
+		line.length_chars = next_chars - offset_chars;
+		lines.push_back(line);
+
+		if(eof)
 		{
+			last = m_nNumLines;
 			break;
 		}
-		else if(offset_chars < m_pLineBuf_char[line])
+
+		offset_bytes = next_bytes;
+		offset_chars = next_chars;
+
+		// once past the edit, stop when we reach a line that started in the same place before
+		if(offset_bytes >= edit_end)
 		{
-			high = line-1;
+			ULONG old_bytes = offset_bytes - delta_bytes;
+
+			while(last < m_nNumLines && last_bytes < old_bytes)
+				last_bytes += m_pIndex->lines.line(last++, 0, 0, &cur)->length_bytes;
+
+			if(last < m_nNumLines && last_bytes == old_bytes)
+				break;
 		}
-		else
+	}
+
+	// swap the rescanned lines' widths and contents for the new ones - the
+	// lines after them don't need moving, they only know their own lengths
+	for(i = first; i < last; i++)
+	{
+		old = m_pIndex->lines.line(i, 0, 0, &cur);
+		remove_linewidth(old);
+		remove_linestats(&old->stats);
+	}
+
+	for(i = 0; i < lines.size(); i++)
+	{
+		add_linewidth(&lines[i]);
+		add_linestats(&lines[i].stats);
+	}
+
+	m_pIndex->lines.replace(first, last, lines);
+
+	// line-segments are relative to the start of their line, so only the
+	// rescanned lines lose theirs - the rest are just renumbered
+	if(!m_LineSegs.empty())
+	{
+		std::map<ULONG, std::vector<LINESEG> > segs;
+		std::map<ULONG, std::vector<LINESEG> >::iterator it;
+
+		for(it = m_LineSegs.begin(); it != m_LineSegs.end(); ++it)
 		{
-			low = line+1;
+			if(it->first < first)
+				segs[it->first].swap(it->second);
+			else if(it->first >= last)
+				segs[it->first - last + first + lines.size()].swap(it->second);
 		}
+
+		m_LineSegs.swap(segs);
 	}
 
-	if(lineno)			*lineno			= line;
-	if(lineoff_bytes)	*lineoff_bytes	= m_pLineBuf_byte[line];
-	if(linelen_bytes)	*linelen_bytes  = m_pLineBuf_byte[line+1] - m_pLineBuf_byte[line];
-	if(lineoff_chars)	*lineoff_chars  = m_pLineBuf_char[line];
-	if(linelen_chars)	*linelen_chars  = m_pLineBuf_char[line+1] - m_pLineBuf_char[line];
+	m_nNumLines = m_pIndex->lines.count();
 
-	return true;
+	change->lineno		 = first;
+	change->erase_lines	 = last - first;
+	change->insert_lines = lines.size();
 }
 
-int TextDocument::getformat()
+
+//
+//	Return the number of lines
+//
+ULONG TextDocument::linecount()
 {
-	return m_nFileFormat;
+	return m_nNumLines;
 }
 
-ULONG TextDocument::size()
+//
+//	Return the number of words and code-points, and how many lines
+//	end with each type of line-ending (lineendings holds EOL_TYPES)
+//
+void TextDocument::getstats(ULONG *words, ULONG *codepoints, ULONG *lineendings)
 {
-	return m_nDocLength_bytes;
+	*words		= m_nNumWords;
+	*codepoints = m_nNumCodePoints;
+	memcpy(lineendings, m_nLineEndings, sizeof(m_nLineEndings));
 }
 
-TextIterator TextDocument::iterate(ULONG offset_chars)
+//
+//	Return the length of longest line, with tabs expanded to
+//	the specified width (0 for the last one asked for)
+//
+//	Each line's width is kept for two tab-sizes. Asking for a third one
+//	works out every line's width with it in place of the second size,
+//	but nothing else about the lines has to be scanned again
+//
+ULONG TextDocument::longestline(int tabwidth)
 {
-	ULONG off_bytes = charoffset_to_byteoffset(offset_chars);
-	ULONG len_bytes = m_nDocLength_bytes - off_bytes;
+	int slot = 0;
 
-	//if(!lineinfo_from_offset(offset_chars, 0, linelen, &offset_bytes, &length_bytes))
-	//	return TextIterator();
+	if(tabwidth <= 0)
+		tabwidth = m_nTabWidth;
 
-	return TextIterator(off_bytes, len_bytes, this);
-}
+	// the line-segments' columns depend on the tab-size as well
+	if(tabwidth != m_nTabWidth)
+	{
+		m_nTabWidth = tabwidth;
+		m_LineSegs.clear();
+	}
+
+	if(tabwidth != m_nWidthTabs[0])
+	{
+		slot = 1;
 
+		if(tabwidth != m_nWidthTabs[1])
+			init_linewidths(tabwidth);
+	}
+
+	return m_pIndex->widths[slot].empty() ? 0 : m_pIndex->widths[slot].rbegin()->first;
+}
 
 //
+//	Work out the width of every line with the specified tab-size, as 
+//	the document's second size. Only the widths are changed, the lines 
+//	stay where they are in the index
 //
-//
-TextIterator TextDocument::iterate_line(ULONG lineno, ULONG *linestart, ULONG *linelen)
+bool TextDocument::init_linewidths(int tabwidth)
 {
-	ULONG offset_bytes;
-	ULONG length_bytes;
+	ULONG	offset_bytes, offset_chars;
+	ULONG	next_bytes, next_chars;
+	DOCLINE	line;
+	SCANBUF	sb;
 
-	if(!lineinfo_from_lineno(lineno, linestart, linelen, &offset_bytes, &length_bytes))
-		return TextIterator();
-	
-	return TextIterator(offset_bytes, length_bytes, this);
-}
+	lineindex::cursor cur;
 
-TextIterator TextDocument::iterate_line_offset(ULONG offset_chars, ULONG *lineno, ULONG *linestart)
-{
-	ULONG offset_bytes;
-	ULONG length_bytes;
+	unshare_index();
 
-	if(!lineinfo_from_offset(offset_chars, lineno, linestart, 0, &offset_bytes, &length_bytes))
-		return TextIterator();
-	
-	return TextIterator(offset_bytes, length_bytes, this);
-}
+	m_nWidthTabs[1] = tabwidth;
+	m_pIndex->widths[1].clear();
 
-ULONG TextDocument::lineno_from_offset(ULONG offset)
-{
+	memset(&cur, 0, sizeof(cur));
+	sb.offset = 0;
+	sb.length = 0;
+
+	for(ULONG i = 0; i < m_nNumLines; i++)
+	{
+		DOCLINE *old = m_pIndex->lines.modify(i, &offset_bytes, &offset_chars, &cur);
+
+		scan_line(&sb, offset_bytes, offset_chars, &next_bytes, &next_chars, &line);
+
+		old->width2 = line.width2;
+		m_pIndex->widths[1][line.width2]++;
+	}
+
+	return true;
+}
+
+//
+//	Return information about specified line
+//
+bool TextDocument::lineinfo_from_lineno(ULONG lineno, ULONG *lineoff_chars,  ULONG *linelen_chars, ULONG *lineoff_bytes, ULONG *linelen_bytes)
+{
+	if(lineno < m_nNumLines)
+	{
+		const DOCLINE *line = m_pIndex->lines.line(lineno, lineoff_bytes, lineoff_chars);
+
+		if(linelen_chars) *linelen_chars  = line->length_chars;
+		if(linelen_bytes) *linelen_bytes  = line->length_bytes;
+
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+//
+//	Perform a reverse lookup - file-offset to line number
+//
+bool TextDocument::lineinfo_from_offset(ULONG offset_chars, ULONG *lineno, ULONG *lineoff_chars, ULONG *linelen_chars, ULONG *lineoff_bytes, ULONG *linelen_bytes)
+{
+	const DOCLINE *line;
+	ULONG line_no;
+
+	if(m_nNumLines == 0)
+	{
+		if(lineno)			*lineno			= 0;
+		if(lineoff_chars)	*lineoff_chars	= 0;
+		if(linelen_chars)	*linelen_chars  = 0;
+		if(lineoff_bytes)	*lineoff_bytes	= 0;
+		if(linelen_bytes)	*linelen_bytes  = 0;
+
+		return false;
+	}
+
+	line_no = m_pIndex->lines.lineno_from_chars(offset_chars);
+	line	= m_pIndex->lines.line(line_no, lineoff_bytes, lineoff_chars);
+
+	if(lineno)			*lineno			= line_no;
+	if(linelen_bytes)	*linelen_bytes  = line->length_bytes;
+	if(linelen_chars)	*linelen_chars  = line->length_chars;
+
+	return true;
+}
+
+//
+//	Return the document's format (NCP_xxx), and optionally how
+//	confident the detection was (0-100)
+//
+int TextDocument::getformat(int *confidence)
+{
+	if(confidence)
+		*confidence = m_nFormatConfidence;
+
+	return m_nFileFormat;
+}
+
+ULONG TextDocument::size()
+{
+	return m_nDocLength_bytes;
+}
+
+ULONG TextDocument::revision()
+{
+	return m_nRevision;
+}
+
+//
+//	Documents loaded from a compressed file can't be edited
+//
+bool TextDocument::readonly()
+{
+	return m_fReadOnly;
+}
+
+TextIterator TextDocument::iterate(ULONG offset_chars)
+{
+	ULONG off_bytes = charoffset_to_byteoffset(offset_chars);
+	ULONG len_bytes = m_nDocLength_bytes - off_bytes;
+
+	//if(!lineinfo_from_offset(offset_chars, 0, linelen, &offset_bytes, &length_bytes))
+	//	return TextIterator();
+
+	return TextIterator(off_bytes, len_bytes, this);
+}
+
+
+//
+//
+//
+TextIterator TextDocument::iterate_line(ULONG lineno, ULONG *linestart, ULONG *linelen)
+{
+	ULONG offset_bytes;
+	ULONG length_bytes;
+
+	if(!lineinfo_from_lineno(lineno, linestart, linelen, &offset_bytes, &length_bytes))
+		return TextIterator();
+	
+	return TextIterator(offset_bytes, length_bytes, this);
+}
+
+TextIterator TextDocument::iterate_line_offset(ULONG offset_chars, ULONG *lineno, ULONG *linestart)
+{
+	ULONG offset_bytes;
+	ULONG length_bytes;
+
+	if(!lineinfo_from_offset(offset_chars, lineno, linestart, 0, &offset_bytes, &length_bytes))
+		return TextIterator();
+	
+	return TextIterator(offset_bytes, length_bytes, this);
+}
+
+//
+//	Bidirectional iterators, starting at the specified position
+//
+CharIterator TextDocument::iterate_chars(ULONG offset_chars)
+{
+	ULONG off_bytes = charoffset_to_byteoffset(offset_chars);
+	return CharIterator(this, off_bytes, byteoffset_to_charoffset(off_bytes));
+}
+
+GraphemeIterator TextDocument::iterate_graphemes(ULONG offset_chars)
+{
+	ULONG off_bytes = charoffset_to_byteoffset(offset_chars);
+	return GraphemeIterator(this, off_bytes, byteoffset_to_charoffset(off_bytes));
+}
+
+LineIterator TextDocument::iterate_lines(ULONG lineno, ULONG count)
+{
+	return LineIterator(this, min(lineno, m_nNumLines), count);
+}
+
+ULONG TextDocument::lineno_from_offset(ULONG offset)
+{
 	ULONG lineno = 0;
 	lineinfo_from_offset(offset, &lineno, 0, 0, 0, 0);
 	return lineno;
@@ -657,6 +1749,136 @@ ULONG TextDocument::getline(ULONG nLineNo, TCHAR *buf, ULONG buflen, ULONG *off_
 	return buflen;
 }
 
+//
+//	Fetch part of a line, starting at (or a little before) the specified 
+//	character position within the line. Only the requested part of the line 
+//	is decoded, no matter how long the line is
+//
+//	off_chars	- [out] CHARACTER offset (within the document) of the first character stored
+//	column		- [out] display column (within the line) of the first character stored
+//
+ULONG TextDocument::getline(ULONG nLineNo, ULONG nStartPos, TCHAR *buf, ULONG buflen, ULONG *off_chars, ULONG *column)
+{
+	ULONG	offset_bytes;
+	ULONG	length_bytes;
+	ULONG	offset_chars;
+	LINESEG	seg;
+
+	if(!lineinfo_from_lineno(nLineNo, &offset_chars, 0, &offset_bytes, &length_bytes) ||
+	   !lineseg_from_offset(nLineNo, nStartPos, &seg))
+	{
+		*off_chars	= 0;
+		*column		= 0;
+		return 0;
+	}
+
+	gettext(offset_bytes + seg.off_bytes, length_bytes - seg.off_bytes, buf, &buflen);
+
+	*off_chars	= offset_chars + seg.off_chars;
+	*column		= seg.column;
+	return buflen;
+}
+
+//
+//	Return the segment-index for the specified line, scanning
+//	the line to create one if it hasn't been looked at before
+//
+std::vector<LINESEG> *TextDocument::init_linesegs(ULONG lineno)
+{
+	std::map<ULONG, std::vector<LINESEG> >::iterator it = m_LineSegs.find(lineno);
+
+	ULONG	offset_bytes, length_bytes, ch32;
+	LINESEG	seg = { 0, 0, 0 };
+	SCANBUF	sb;
+
+	if(it != m_LineSegs.end())
+		return &it->second;
+
+	std::vector<LINESEG> &segs = m_LineSegs[lineno];
+
+	length_bytes = m_pIndex->lines.line(lineno, &offset_bytes)->length_bytes;
+
+	sb.offset = 0;
+	sb.length = 0;
+
+	segs.push_back(seg);
+
+	while(seg.off_bytes < length_bytes)
+	{
+		// don't start a segment in the middle of a character
+		if(seg.off_chars - segs.back().off_chars >= LINESEG_INTERVAL)
+			segs.push_back(seg);
+
+		seg.off_bytes += scanchar(&sb, offset_bytes + seg.off_bytes, &ch32);
+		seg.off_chars += (ch32 > UNI_MAX_BMP && ch32 <= UNI_MAX_UTF16) ? 2 : 1;
+
+		if(ch32 == '\t')
+			seg.column += m_nTabWidth - (seg.column % m_nTabWidth);
+		else
+			seg.column++;
+	}
+
+	return &segs;
+}
+
+static bool seg_offset_less(ULONG offset_chars, const LINESEG &seg)
+{
+	return offset_chars < seg.off_chars;
+}
+
+static bool seg_column_less(ULONG column, const LINESEG &seg)
+{
+	return column < seg.column;
+}
+
+//
+//	Find the last line-segment that starts at or before the specified
+//	CHARACTER offset (relative to the start of the line)
+//
+bool TextDocument::lineseg_from_offset(ULONG lineno, ULONG offset_chars, LINESEG *seg)
+{
+	std::vector<LINESEG> *segs;
+
+	if(lineno >= m_nNumLines)
+		return false;
+
+	// short lines don't need an index
+	if(m_pIndex->lines.line(lineno)->length_chars < LINESEG_INTERVAL * 2)
+	{
+		seg->off_bytes	= 0;
+		seg->off_chars	= 0;
+		seg->column		= 0;
+		return true;
+	}
+
+	segs = init_linesegs(lineno);
+	*seg = *(std::upper_bound(segs->begin(), segs->end(), offset_chars, seg_offset_less) - 1);
+	return true;
+}
+
+//
+//	Find the last line-segment that starts at or before the specified display column
+//
+bool TextDocument::lineseg_from_column(ULONG lineno, ULONG column, LINESEG *seg)
+{
+	std::vector<LINESEG> *segs;
+
+	if(lineno >= m_nNumLines)
+		return false;
+
+	if(m_pIndex->lines.line(lineno)->length_chars < LINESEG_INTERVAL * 2)
+	{
+		seg->off_bytes	= 0;
+		seg->off_chars	= 0;
+		seg->column		= 0;
+		return true;
+	}
+
+	segs = init_linesegs(lineno);
+	*seg = *(std::upper_bound(segs->begin(), segs->end(), column, seg_column_less) - 1);
+	return true;
+}
+
 //
 //	Convert the RAW buffer in underlying file-format to UTF-16
 //
@@ -687,6 +1909,10 @@ size_t TextDocument::rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16
 		rawlen /= sizeof(TCHAR);
 		return swap_utf16((UTF16 *)rawdata, rawlen, (UTF16 *)utf16str, utf16len) * sizeof(TCHAR);
 
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		return utf32_rawdata_to_utf16(rawdata, rawlen, utf16str, utf16len);
+
 	// error! we should *never* reach this point
 	default:
 		*utf16len = 0;
@@ -694,6 +1920,72 @@ size_t TextDocument::rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16
 	}
 }
 
+//
+//	Return how much of the raw data (in BYTEs) consists of complete characters, 
+//	i.e. how much can be converted without needing the data that follows it
+//
+size_t TextDocument::rawdata_complete_len(BYTE *rawdata, size_t rawlen)
+{
+	UTF16 ch16;
+
+	switch(m_nFileFormat)
+	{
+	case NCP_UTF8:
+		return utf8_complete_len(rawdata, rawlen);
+
+	// keep surrogate pairs together
+	case NCP_UTF16:
+	case NCP_UTF16BE:
+		
+		rawlen &= ~1;
+
+		if(rawlen >= sizeof(UTF16))
+		{
+			ch16 = *(UTF16 *)(rawdata + rawlen - sizeof(UTF16));
+
+			if(m_nFileFormat == NCP_UTF16BE)
+				ch16 = SWAPWORD(ch16);
+
+			if(ch16 >= UNI_SUR_HIGH_START && ch16 <= UNI_SUR_HIGH_END)
+				rawlen -= sizeof(UTF16);
+		}
+
+		return rawlen;
+
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		return rawlen & ~3;
+
+	default:
+		return rawlen;
+	}
+}
+
+//
+//	UTF-32 needs a little extra work, because a file that has been truncated
+//	(or is not really UTF-32) can end with a partial character. Those stray 
+//	bytes are shown as a single replacement character, just like getchar does
+//
+size_t TextDocument::utf32_rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16str, size_t *utf16len)
+{
+	size_t utf32len = rawlen / sizeof(UTF32);
+	size_t room     = *utf16len;
+	size_t len;
+
+	if(m_nFileFormat == NCP_UTF32)
+		len = utf32_to_utf16((UTF32 *)rawdata, utf32len, (UTF16 *)utf16str, utf16len);
+	else
+		len = utf32be_to_utf16((UTF32 *)rawdata, utf32len, (UTF16 *)utf16str, utf16len);
+
+	if(len == utf32len && rawlen % sizeof(UTF32) && *utf16len < room)
+	{
+		utf16str[(*utf16len)++] = UNI_REPLACEMENT_CHAR;
+		return rawlen;
+	}
+
+	return len * sizeof(UTF32);
+}
+
 //
 //	Converts specified UTF16 string to the underlying RAW format of the text-document
 //	(i.e. UTF-16 -> UTF-8
@@ -703,7 +1995,16 @@ size_t TextDocument::rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16
 //
 size_t TextDocument::utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *rawdata, size_t *rawlen)
 {
-	switch(m_nFileFormat)
+	return utf16_to_rawdata(utf16str, utf16len, rawdata, rawlen, m_nFileFormat);
+}
+
+//
+//	As above, but convert to any of the supported formats
+//	(used when saving the document in a different encoding)
+//
+size_t TextDocument::utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *rawdata, size_t *rawlen, int format)
+{
+	switch(format)
 	{
 	// convert from UTF16 -> ASCII
 	case NCP_ASCII:
@@ -727,6 +2028,19 @@ size_t TextDocument::utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *ra
 		*rawlen *= sizeof(TCHAR);
 		return utf16len;
 
+	// convert from UTF16 -> UTF32
+	case NCP_UTF32:
+		*rawlen /= sizeof(UTF32);
+		utf16len = utf16_to_utf32((UTF16 *)utf16str, utf16len, (UTF32 *)rawdata, rawlen);
+		*rawlen *= sizeof(UTF32);
+		return utf16len;
+
+	case NCP_UTF32BE:
+		*rawlen /= sizeof(UTF32);
+		utf16len = utf16_to_utf32be((UTF16 *)utf16str, utf16len, (UTF32 *)rawdata, rawlen);
+		*rawlen *= sizeof(UTF32);
+		return utf16len;
+
 	// error! we should *never* reach this point
 	default:
 		*rawlen = 0;
@@ -735,66 +2049,90 @@ size_t TextDocument::utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *ra
 
 }
 
+//
+//	Return the most BYTEs that the specified number of UTF16s
+//	could need once converted to the document's raw format
+//
+size_t TextDocument::rawdata_maxlen(size_t utf16len)
+{
+	switch(m_nFileFormat)
+	{
+	case NCP_ASCII:
+		return utf16len;
+
+	// a surrogate pair takes 4 bytes, anything else at most 3
+	case NCP_UTF8:
+		return utf16len * 3;
+
+	case NCP_UTF16:
+	case NCP_UTF16BE:
+		return utf16len * sizeof(WCHAR);
+
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		return utf16len * sizeof(UTF32);
+
+	default:
+		return 0;
+	}
+}
+
 //
 //	Insert UTF-16 text at specified BYTE offset
 //
+//	The text is converted straight into the sequence's modify-buffer,
+//	so the whole lot goes in with a single piece-table insertion
+//
 //	returns number of BYTEs stored
 //
 ULONG TextDocument::insert_raw(ULONG offset_bytes, TCHAR *text, ULONG length)
 {
-	BYTE  buf[0x100];
-	ULONG buflen;
-	ULONG copied;
-	ULONG rawlen = 0;
-	ULONG offset = offset_bytes+ m_nHeaderSize;
+	BYTE  *rawdata;
+	size_t rawlen = rawdata_maxlen(length);
+	size_t copied;
 
-	while(length)
-	{
-		buflen = 0x100;
-		copied = utf16_to_rawdata(text, length, buf, (size_t *)&buflen);
+	if((rawdata = m_seq.reserve(rawlen)) == 0)
+		return 0;
 
-		// do the piece-table insertion!
-		if(!m_seq.insert(offset, buf, buflen))
-			break;
+	copied = utf16_to_rawdata(text, length, rawdata, &rawlen);
 
-		text   += copied;
-		length -= copied;
-		rawlen += buflen;
-		offset += buflen;
-	}
+	// do the piece-table insertion!
+	if(rawlen == 0 || !m_seq.insert(offset_bytes + m_nHeaderSize, rawdata, rawlen))
+		return 0;
 
 	m_nDocLength_bytes = m_seq.size();
+	update_chunks(offset_bytes, 0, rawlen);
+	update_document(offset_bytes, 0, 0, rawlen, copied);
+
 	return rawlen;
 }
 
+//
+//	Overwrite text at specified BYTE offset
+//
+//	returns number of BYTEs stored
+//
 ULONG TextDocument::replace_raw(ULONG offset_bytes, TCHAR *text, ULONG length, ULONG erase_chars)
 {
-	BYTE  buf[0x100];
-	ULONG buflen;
-	ULONG copied;
-	ULONG rawlen = 0;
-	ULONG offset = offset_bytes + m_nHeaderSize;
-
-	ULONG erase_bytes = count_chars(offset_bytes, erase_chars);
+	BYTE  *rawdata;
+	size_t rawlen = rawdata_maxlen(length);
+	size_t copied;
 
-	while(length)
-	{
-		buflen = 0x100;
-		copied = utf16_to_rawdata(text, length, buf, (size_t *)&buflen);
+	ULONG erase_bytes = scan_chars(offset_bytes, -1, &erase_chars);
 
-		// do the piece-table replacement!
-		if(!m_seq.replace(offset, buf, buflen, erase_bytes))
-			break;
+	if((rawdata = m_seq.reserve(rawlen)) == 0)
+		return 0;
 
-		text   += copied;
-		length -= copied;
-		rawlen += buflen;
-		offset += buflen;
+	copied = utf16_to_rawdata(text, length, rawdata, &rawlen);
 
-		erase_bytes = 0;
-	}
+	// do the piece-table replacement!
+	if(rawlen == 0 || !m_seq.replace(offset_bytes + m_nHeaderSize, rawdata, rawlen, erase_bytes))
+		return 0;
 
 	m_nDocLength_bytes = m_seq.size();
+	update_chunks(offset_bytes, erase_bytes, rawlen);
+	update_document(offset_bytes, erase_bytes, erase_chars, rawlen, copied);
+
 	return rawlen;
 }
 
@@ -827,11 +2165,13 @@ ULONG TextDocument::erase_raw(ULONG offset_bytes, ULONG length)
 		return length;
 	}*/
 
-	ULONG erase_bytes  = count_chars(offset_bytes, length);
+	ULONG erase_bytes  = scan_chars(offset_bytes, -1, &length);
 	
 	if(m_seq.erase(offset_bytes + m_nHeaderSize, erase_bytes))
 	{
 		m_nDocLength_bytes = m_seq.size();
+		update_chunks(offset_bytes, erase_bytes, 0);
+		update_document(offset_bytes, erase_bytes, length, 0, 0);
 		return length;
 	}
 		
@@ -857,23 +2197,388 @@ ULONG TextDocument::count_chars(ULONG offset_bytes, ULONG length_chars)
 		break;
 	}
 
-	ULONG offset_start = offset_bytes;
+	return scan_chars(offset_bytes, -1, &length_chars);
+}
+
+//
+//	Walk forwards from the specified BYTE offset (which must be on a
+//	character boundary), counting UTF-16 code-units in the raw data
+//
+//	offset_bytes	- BYTE offset within the document
+//	length_bytes	- max number of bytes to process
+//	length_chars	- [in]  max number of UTF-16 code-units to count
+//					  [out] number of code-units actually counted
+//
+//	A character which straddles the end of the range is only counted if
+//	it is also at the end of the document, so the scan always finishes
+//	on a character boundary
+//
+//	returns number of bytes processed
+//
+ULONG TextDocument::scan_chars(ULONG offset_bytes, ULONG length_bytes, ULONG *length_chars)
+{
+	ULONG doclen = m_nDocLength_bytes - m_nHeaderSize;
+	ULONG limit  = *length_chars;
+	ULONG bytes  = 0;
+	ULONG chars  = 0;
+
+	if(offset_bytes >= doclen)
+	{
+		*length_chars = 0;
+		return 0;
+	}
+
+	length_bytes = min(length_bytes, doclen - offset_bytes);
+
+	switch(m_nFileFormat)
+	{
+	case NCP_ASCII:
+		*length_chars = min(length_bytes, limit);
+		return *length_chars;
+
+	case NCP_UTF16:
+	case NCP_UTF16BE:
+		*length_chars = min(length_bytes / sizeof(WCHAR), limit);
+		return *length_chars * sizeof(WCHAR);
+
+	case NCP_UTF8:
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		break;
+
+	default:
+		*length_chars = 0;
+		return 0;
+	}
+
+	while(bytes < length_bytes && chars < limit)
+	{
+		BYTE   rawdata[0x1000];
+		size_t rawlen = min(length_bytes - bytes, sizeof(rawdata));
+		size_t count  = limit - chars;
+		size_t len;
+
+		m_seq.render(offset_bytes + bytes + m_nHeaderSize, rawdata, rawlen);
+
+		if(m_nFileFormat == NCP_UTF8)
+		{
+			// don't decode a character that is split by the end of the block
+			if(offset_bytes + bytes + rawlen < doclen)
+				rawlen = utf8_block_len(offset_bytes + bytes, rawdata, rawlen);
+
+			len = utf8_count_utf16(rawdata, rawlen, &count);
+		}
+		else
+		{
+			len = utf32_count_utf16((UTF32 *)rawdata, rawlen / sizeof(UTF32), &count, 
+						m_nFileFormat == NCP_UTF32BE) * sizeof(UTF32);
+
+			// stray bytes at the end of the file are a single character
+			if(rawlen - len < sizeof(UTF32) && rawlen > len && 
+				count < limit - chars && offset_bytes + bytes + rawlen == doclen)
+			{
+				len = rawlen;
+				count++;
+			}
+		}
+
+		bytes += len;
+		chars += count;
+
+		// stopped short of the block - must be finished
+		if(len < rawlen || len == 0)
+			break;
+	}
+
+	*length_chars = chars;
+	return bytes;
+}
+
+//
+//	The length of a block of UTF-8 from the middle of the document, excluding
+//	a character at the end which carries on into the next block. A lead-byte
+//	that is short of trail-bytes only carries on if the bytes after the block
+//	really are trail-bytes - otherwise it is a (malformed) character by itself
+//
+size_t TextDocument::utf8_block_len(ULONG offset_bytes, BYTE *rawdata, size_t rawlen)
+{
+	ULONG  doclen = m_nDocLength_bytes - m_nHeaderSize;
+	size_t len	  = utf8_complete_len(rawdata, rawlen);
+	BYTE   seq[12];
+	size_t seqlen = rawlen - len;
+	size_t more;
+	UTF32  ch32;
+
+	if(len == rawlen || seqlen > 6)
+		return len;
+
+	more = min(6, doclen - (offset_bytes + rawlen));
+
+	memcpy(seq, rawdata + len, seqlen);
+	m_seq.render(offset_bytes + rawlen + m_nHeaderSize, seq + seqlen, more);
+
+	if(utf8_to_utf32(seq, seqlen + more, &ch32) <= seqlen)
+		return rawlen;
+
+	return len;
+}
+
+//
+//	Is there a UTF-8 character which starts before the specified BYTE offset
+//	and ends after it? If so, return where it starts and ends. A sequence is
+//	never more than six bytes long, even an illegal one, and a byte which
+//	isn't a trail-byte always starts a new character
+//
+bool TextDocument::utf8_straddle(ULONG offset_bytes, ULONG *start, ULONG *end)
+{
+	ULONG doclen = m_nDocLength_bytes - m_nHeaderSize;
+	ULONG first	 = offset_bytes > 5 ? offset_bytes - 5 : 0;
+	BYTE  rawdata[12];
+	ULONG rawlen;
+	ULONG i, len;
+	UTF32 ch32;
+
+	if(offset_bytes == 0 || offset_bytes >= doclen)
+		return false;
+
+	rawlen = min(doclen - first, sizeof(rawdata));
+	m_seq.render(first + m_nHeaderSize, rawdata, rawlen);
+
+	if((rawdata[offset_bytes - first] & 0xC0) != 0x80)
+		return false;
+
+	// find the lead-byte - only stray trail-bytes otherwise
+	for(i = offset_bytes - first; i > 0; i--)
+	{
+		if((rawdata[i - 1] & 0xC0) != 0x80)
+			break;
+	}
+
+	if(i-- == 0)
+		return false;
+
+	len = (ULONG)utf8_to_utf32(rawdata + i, rawlen - i, &ch32);
+
+	if(first + i + len <= offset_bytes)
+		return false;
+
+	*start = first + i;
+	*end   = first + i + len;
+	return true;
+}
+
+//
+//	Widen a range of BYTEs so that it doesn't start or finish part-way
+//	through a character. Only UTF-8 needs anything doing
+//
+void TextDocument::char_boundaries(ULONG *offset_bytes, ULONG *length_bytes)
+{
+	ULONG start, end;
+
+	if(m_nFileFormat != NCP_UTF8)
+		return;
+
+	if(utf8_straddle(*offset_bytes + *length_bytes, &start, &end))
+		*length_bytes = end - *offset_bytes;
+
+	if(utf8_straddle(*offset_bytes, &start, &end))
+	{
+		*length_bytes += *offset_bytes - start;
+		*offset_bytes  = start;
+	}
+}
+
+//
+//	The number of UTF-16 code-units in a few BYTEs of UTF-8, decoded by
+//	themselves - a lead-byte at the end counts whether or not it is
+//	followed by trail-bytes in the document
+//
+ULONG TextDocument::utf8_count(ULONG offset_bytes, ULONG length_bytes)
+{
+	BYTE   rawdata[16];
+	size_t count = -1;
+
+	length_bytes = min(length_bytes, sizeof(rawdata));
+
+	if(length_bytes == 0)
+		return 0;
+
+	m_seq.render(offset_bytes + m_nHeaderSize, rawdata, length_bytes);
+	utf8_count_utf16(rawdata, length_bytes, &count);
+
+	return (ULONG)count;
+}
+
+//
+//	Build the checkpoint index for the entire document
+//
+//	Only variable-width formats need checkpoints, all other formats
+//	map between character and byte offsets with simple arithmetic
+//
+bool TextDocument::init_checkpoints()
+{
+	CHECKPOINT			 cp = { 0, 0 };
+	ULONG				 doclen = m_nDocLength_bytes - m_nHeaderSize;
+	std::vector<DOCLINE> gaps;
+
+	unshare_index();
+
+	switch(m_nFileFormat)
+	{
+	case NCP_UTF8:
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		break;
+	
+	default:
+		// a single gap, so there is still a checkpoint at the start
+		gaps.resize(1);
+		memset(&gaps[0], 0, sizeof(DOCLINE));
+
+		m_pIndex->checkpoints.assign(gaps);
+		m_nDocLength_chars = byteoffset_to_charoffset(doclen);
+		return true;
+	}
+
+	// add a checkpoint every 4Kb of the file
+	split_checkpoints(cp, doclen, -1, gaps);
+	m_pIndex->checkpoints.assign(gaps);
+
+	m_nDocLength_chars = m_pIndex->checkpoints.total_chars();
+	return true;
+}
+
+//
+//	Divide the gap which starts at the specified checkpoint into pieces
+//	of about CHECKPOINT_INTERVAL bytes, and add them to 'gaps'. If the 
+//	length of the gap in characters isn't known (-1) the last piece is 
+//	counted as well
+//
+void TextDocument::split_checkpoints(CHECKPOINT cp, ULONG length_bytes, ULONG length_chars, std::vector<DOCLINE> &gaps)
+{
+	ULONG	end_bytes = cp.off_bytes + length_bytes;
+	ULONG	end_chars = cp.off_chars + length_chars;
+	DOCLINE gap;
+
+	memset(&gap, 0, sizeof(gap));
+
+	while(end_bytes - cp.off_bytes > CHECKPOINT_INTERVAL)
+	{
+		ULONG chars = -1;
+		ULONG bytes = scan_chars(cp.off_bytes, CHECKPOINT_INTERVAL, &chars);
+
+		if(bytes == 0)
+			break;
+
+		gap.length_bytes = bytes;
+		gap.length_chars = chars;
+		gaps.push_back(gap);
+
+		cp.off_bytes += bytes;
+		cp.off_chars += chars;
+	}
+
+	// whatever is left up to the end of the gap
+	gap.length_bytes = end_bytes - cp.off_bytes;
+	gap.length_chars = end_chars - cp.off_chars;
 
-	while(length_chars && offset_bytes < m_nDocLength_bytes)
+	if(length_chars == (ULONG)-1)
 	{
-		TCHAR buf[0x100];
-		ULONG charlen = min(length_chars, 0x100);
-		ULONG bytelen;
+		gap.length_chars = -1;
+		scan_chars(cp.off_bytes, gap.length_bytes, &gap.length_chars);
+	}
+
+	gaps.push_back(gap);
+}
+
+//
+//	Keep the checkpoint index in step with an edit to the document. 
+//	Must be called *after* the sequence has been modified
+//
+//	The gaps that the erased range starts and finishes in (the same one
+//	unless checkpoints were erased) are joined together and take up the 
+//	change in length. That one gap is re-divided if it has grown too big.
+//	Where the gaps after it start is worked out from the index's subtree
+//	totals, so none of them are touched and an edit costs O(log n)
+//
+void TextDocument::update_checkpoints(ULONG offset_bytes, ULONG erase_bytes, ULONG erase_chars, ULONG insert_bytes, ULONG insert_chars)
+{
+	std::vector<DOCLINE> gaps;
+	CHECKPOINT			 cp;
+	DOCLINE				 gap;
+	ULONG				 first;
+	ULONG				 last;
+	ULONG				 end_bytes;
+	ULONG				 end_chars;
+
+	m_nDocLength_chars += insert_chars - erase_chars;
 
-		bytelen = gettext(offset_bytes, m_nDocLength_bytes - offset_bytes, buf, &charlen);
+	// only the variable-width formats have checkpoints
+	switch(m_nFileFormat)
+	{
+	case NCP_UTF8:
+	case NCP_UTF32:
+	case NCP_UTF32BE:
+		break;
 
-		length_chars -= charlen;
-		offset_bytes += bytelen;
+	default:
+		return;
 	}
 
-	return offset_bytes - offset_start;
+	if(m_pIndex->checkpoints.count() == 0)
+		return;
+
+	unshare_index();
+
+	// the index still describes the document as it was before the edit
+	first = m_pIndex->checkpoints.lineno_from_bytes(offset_bytes);
+	last  = m_pIndex->checkpoints.lineno_from_bytes(offset_bytes + erase_bytes);
+
+	m_pIndex->checkpoints.line(first,	 &cp.off_bytes, &cp.off_chars);
+	m_pIndex->checkpoints.line(last + 1, &end_bytes,	&end_chars);
+
+	memset(&gap, 0, sizeof(gap));
+	gap.length_bytes = end_bytes - cp.off_bytes - erase_bytes + insert_bytes;
+	gap.length_chars = end_chars - cp.off_chars - erase_chars + insert_chars;
+
+	// make sure the scan from any checkpoint stays short
+	if(gap.length_bytes > CHECKPOINT_INTERVAL * 2)
+		split_checkpoints(cp, gap.length_bytes, gap.length_chars, gaps);
+
+	// a checkpoint at the very end of the document is redundant
+	else if(gap.length_bytes > 0 || first == 0)
+		gaps.push_back(gap);
+
+	m_pIndex->checkpoints.replace(first, last + 1, gaps);
 }
 
+//
+//	The last checkpoint at or before the specified offset
+//
+CHECKPOINT TextDocument::checkpoint_from_chars(ULONG offset_chars)
+{
+	CHECKPOINT cp;
+	ULONG	   idx = m_pIndex->checkpoints.lineno_from_chars(offset_chars);
+
+	m_pIndex->checkpoints.line(idx, &cp.off_bytes, &cp.off_chars);
+	return cp;
+}
+
+CHECKPOINT TextDocument::checkpoint_from_bytes(ULONG offset_bytes)
+{
+	CHECKPOINT cp;
+	ULONG	   idx = m_pIndex->checkpoints.lineno_from_bytes(offset_bytes);
+
+	m_pIndex->checkpoints.line(idx, &cp.off_bytes, &cp.off_chars);
+	return cp;
+}
+
+//
+//	Convert a BYTE offset into a UTF-16 character offset.
+//
+//	Variable-width formats start from the nearest checkpoint, so at
+//	most a couple of CHECKPOINT_INTERVALs of data are ever decoded
+//
 ULONG TextDocument::byteoffset_to_charoffset(ULONG offset_bytes)
 {
 	switch(m_nFileFormat)
@@ -888,14 +2593,25 @@ ULONG TextDocument::byteoffset_to_charoffset(ULONG offset_bytes)
 	case NCP_UTF8:
 	case NCP_UTF32:
 	case NCP_UTF32BE:
-		// bug bug! need to implement this. 
-	default:
 		break;
+
+	default:
+		return 0;
 	}
 
-	return 0;
+	if(m_pIndex->checkpoints.count() == 0)
+		return 0;
+
+	CHECKPOINT cp = checkpoint_from_bytes(offset_bytes);
+	ULONG	   chars = -1;
+
+	scan_chars(cp.off_bytes, offset_bytes - cp.off_bytes, &chars);
+	return cp.off_chars + chars;
 }
 
+//
+//	Convert a UTF-16 character offset into a BYTE offset
+//
 ULONG TextDocument::charoffset_to_byteoffset(ULONG offset_chars)
 {
 	switch(m_nFileFormat)
@@ -910,22 +2626,19 @@ ULONG TextDocument::charoffset_to_byteoffset(ULONG offset_chars)
 	case NCP_UTF8:
 	case NCP_UTF32:
 	case NCP_UTF32BE:
-	default:
 		break;
-	}
-
-	ULONG lineoff_chars;
-	ULONG lineoff_bytes;
 
-	if(lineinfo_from_offset(offset_chars, 0, &lineoff_chars, 0, &lineoff_bytes, 0))
-	{
-		return count_chars(lineoff_bytes, offset_chars - lineoff_chars) 
-				+ lineoff_bytes;
-	}
-	else
-	{
+	default:
 		return 0;
 	}
+
+	if(m_pIndex->checkpoints.count() == 0)
+		return 0;
+
+	CHECKPOINT cp = checkpoint_from_chars(offset_chars);
+	ULONG	   chars = offset_chars - cp.off_chars;
+
+	return cp.off_bytes + scan_chars(cp.off_bytes, -1, &chars);
 }
 
 //
@@ -933,7 +2646,12 @@ ULONG TextDocument::charoffset_to_byteoffset(ULONG offset_chars)
 //
 ULONG TextDocument::insert_text(ULONG offset_chars, TCHAR *text, ULONG length)
 {
-	ULONG offset_bytes = charoffset_to_byteoffset(offset_chars);
+	ULONG offset_bytes;
+
+	if(m_fReadOnly)
+		return 0;
+
+	offset_bytes = charoffset_to_byteoffset(offset_chars);
 	return insert_raw(offset_bytes, text, length);
 }
 
@@ -942,7 +2660,12 @@ ULONG TextDocument::insert_text(ULONG offset_chars, TCHAR *text, ULONG length)
 //
 ULONG TextDocument::replace_text(ULONG offset_chars, TCHAR *text, ULONG length, ULONG erase_len)
 {
-	ULONG offset_bytes = charoffset_to_byteoffset(offset_chars);
+	ULONG offset_bytes;
+
+	if(m_fReadOnly)
+		return 0;
+
+	offset_bytes = charoffset_to_byteoffset(offset_chars);
 	return replace_raw(offset_bytes, text, length, erase_len);
 }
 
@@ -951,42 +2674,112 @@ ULONG TextDocument::replace_text(ULONG offset_chars, TCHAR *text, ULONG length,
 //
 ULONG TextDocument::erase_text(ULONG offset_chars, ULONG length)
 {
-	ULONG offset_bytes = charoffset_to_byteoffset(offset_chars);
+	ULONG offset_bytes;
+
+	if(m_fReadOnly)
+		return 0;
+
+	offset_bytes = charoffset_to_byteoffset(offset_chars);
 	return erase_raw(offset_bytes, length);
 }
 
 bool TextDocument::Undo(ULONG *offset_start, ULONG *offset_end)
 {
-	ULONG start, length;
-
 	if(!m_seq.undo())
 		return false;
 
-	start  = m_seq.event_index() - m_nHeaderSize;
-	length = m_seq.event_length();
-
-	*offset_start = byteoffset_to_charoffset(start);
-	*offset_end   = byteoffset_to_charoffset(start+length);
-
-	m_nDocLength_bytes = m_seq.size();
-	
+	undo_range(offset_start, offset_end);
 	return true;
 }
 
 bool TextDocument::Redo(ULONG *offset_start, ULONG *offset_end)
 {
-	ULONG start, length;
-
 	if(!m_seq.redo())
 		return false;
 
-	start  = m_seq.event_index() - m_nHeaderSize;
-	length = m_seq.event_length();
+	undo_range(offset_start, offset_end);
+	return true;
+}
 
-	*offset_start = byteoffset_to_charoffset(start);
-	*offset_end   = byteoffset_to_charoffset(start+length);
-	
-	m_nDocLength_bytes = m_seq.size();
+//
+//	The undo history keeps every branch, so the document can be put back 
+//	the way it was after any edit - even one that has since been undone 
+//	and edited over. Revision 0 is the document before any of the edits 
+//	in the history (see sequence::goto_revision)
+//
+bool TextDocument::GotoRevision(ULONG revision, ULONG *offset_start, ULONG *offset_end)
+{
+	if(!m_seq.goto_revision(revision))
+		return false;
 
+	undo_range(offset_start, offset_end);
 	return true;
 }
+
+ULONG TextDocument::UndoRevision()
+{
+	return m_seq.revision();
+}
+
+ULONG TextDocument::UndoRevisionCount()
+{
+	return m_seq.revision_count();
+}
+
+//
+//	Called by the sequence for each event that an undo/redo/goto puts back.
+//	The erased text is measured while it is still there, and afterwards 
+//	the event goes through update_document just like an edit - so only
+//	the lines it touched are rescanned, markers move with the text, and
+//	everyone is told exactly what changed
+//
+void TextDocument::restore_event(void *param, bool done, size_w index, size_w erase_length, size_w insert_length)
+{
+	TextDocument *doc = (TextDocument *)param;
+
+	doc->restore_event(done, (ULONG)index - doc->m_nHeaderSize, (ULONG)erase_length, (ULONG)insert_length);
+}
+
+void TextDocument::restore_event(bool done, ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes)
+{
+	ULONG insert_chars = -1;
+
+	// the event may start or finish part-way through a character (if
+	// it joined up malformed UTF-8), so it is measured in whole ones
+	if(!done)
+	{
+		m_nRestoreOffset = offset_bytes;
+		m_nRestoreLength = erase_bytes;
+		char_boundaries(&m_nRestoreOffset, &m_nRestoreLength);
+
+		m_nRestoreChars	 = m_nRestoreLength ? byteoffset_to_charoffset(m_nRestoreOffset + m_nRestoreLength) - byteoffset_to_charoffset(m_nRestoreOffset) : 0;
+		return;
+	}
+
+	if(erase_bytes == 0 && insert_bytes == 0)
+		return;
+
+	m_nDocLength_bytes = m_seq.size();
+	update_chunks(offset_bytes, erase_bytes, insert_bytes);
+
+	insert_bytes += m_nRestoreLength - erase_bytes;
+
+	if(insert_bytes)
+		scan_chars(m_nRestoreOffset, insert_bytes, &insert_chars);
+	else
+		insert_chars = 0;
+
+	update_document(m_nRestoreOffset, m_nRestoreLength, m_nRestoreChars, insert_bytes, insert_chars);
+}
+
+//
+//	The range of the last event put back by an undo/redo
+//
+void TextDocument::undo_range(ULONG *offset_start, ULONG *offset_end)
+{
+	ULONG start  = m_seq.event_index() - m_nHeaderSize;
+	ULONG length = m_seq.event_length();
+
+	*offset_start = byteoffset_to_charoffset(start);
+	*offset_end   = byteoffset_to_charoffset(start + length);
+}
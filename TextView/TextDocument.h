@@ -1,29 +1,228 @@
 #ifndef TEXTDOC_INCLUDED
 #define TEXTDOC_INCLUDED
 
+#include <map>
 #include "codepages.h"
 #include "sequence.h"
+#include "markers.h"
+#include "lineindex.h"
+#include "FileIO.h"
 
 class TextIterator;
+class CharIterator;
+class GraphemeIterator;
+class LineIterator;
+
+//
+//	CHECKPOINT - a known character boundary in a variable-width
+//	(UTF-8 or UTF-32) document, used to map between UTF-16 character 
+//	offsets and BYTE offsets without decoding from the start of the file
+//
+typedef struct
+{
+	ULONG	off_bytes;
+	ULONG	off_chars;
+
+} CHECKPOINT;
+
+// approximate distance (in bytes) between each checkpoint
+#define CHECKPOINT_INTERVAL 0x1000
+
+//
+//	LINESEG - a known position part-way along a very long line, so 
+//	text can be fetched from the middle of the line without decoding
+//	everything before it. All values are relative to the start of the line
+//
+typedef struct
+{
+	ULONG	off_bytes;
+	ULONG	off_chars;
+	ULONG	column;			// tab-expanded display column
+
+} LINESEG;
+
+#define EOL_NONE	0		// last line of the document
+#define EOL_CRLF	1
+#define EOL_LF		2
+#define EOL_CR		3
+#define EOL_OTHER	4		// VT, FF, NEL, LS or PS
+#define EOL_TYPES	5
+
+//
+//	LINEINDEX - where each line starts, what it contains, and the char/byte
+//	checkpoints. A forked document shares its parent's until one of them 
+//	changes it (see TextDocument::fork)
+//
+typedef struct
+{
+	LONG	refcount;
+
+	// each line's length, display width and contents
+	lineindex				lines;
+
+	// how many lines there are of each width (the last entry is the longest),
+	// with tabs expanded to each of the document's two tab-sizes
+	std::map<ULONG, ULONG>	widths[2];
+
+	// the gaps between the checkpoints, kept as if each one were a line
+	// so that an edit only has to touch the gaps it falls in
+	lineindex				checkpoints;
+
+} LINEINDEX;
+
+// approximate distance (in characters) between each line-segment
+#define LINESEG_INTERVAL 0x400
+
+// size of the LineIterator's prefetch windows (in characters / BYTEs)
+#define LINEITER_WINDOW 0x10000
+
+// size of each of the two output buffers used when saving (in BYTEs), 
+// and of the chunks the document is decoded in when changing format (in UTF16s)
+#define SAVE_BUFSIZE	0x100000
+#define SAVE_CHUNKSIZE	0x10000
+
+// amount of data examined when guessing a file's format
+#define SNIFF_BLOCKS		4
+#define SNIFF_BLOCKSIZE		0x1000
+
+//
+//	SCANBUF - read-ahead buffer used when scanning sequentially 
+//	through the document, to save going back to the piece-table
+//	for every single character
+//
+typedef struct
+{
+	BYTE	buf[0x1000];
+	ULONG	offset;			// BYTE offset of buf[0] within the document
+	ULONG	length;			// number of valid bytes in buf
+
+} SCANBUF;
+
+//
+//	FILECHUNK - a content-defined piece of the file, used to work out
+//	what has changed when the file is reloaded (see TextDocumentReload.cpp)
+//
+typedef struct
+{
+	ULONG	offset;			// BYTE offset in the sequence (including the header)
+	ULONG	length;
+	ULONG	hash;			// zero if the chunk has been edited
+
+} FILECHUNK;
+
+// chunk-size limits, and the rolling-hash bits that must be clear for a chunk to end
+#define CHUNK_MINSIZE	0x800
+#define CHUNK_MAXSIZE	0x10000
+#define CHUNK_MASK		0xFFF80000
+
+//
+//	CHUNKER - divides data into FILECHUNKs as it streams past
+//
+typedef struct
+{
+	ULONG	gear;			// rolling hash (decides where chunks end)
+	ULONG	hash;			// hash of the current chunk
+	ULONG	start;
+	ULONG	offset;
+	ULONG	recent;			// the last few BYTEs
+	int		unit;			// chunks end on a multiple of this many BYTEs
+	int		format;
+
+	std::vector<FILECHUNK> *chunks;
+
+} CHUNKER;
+
+//
+//	DOCCHANGE - describes an edit to everyone looking at the document, so
+//	that anything they have worked out from the text only needs updating
+//	where it changed. BYTE offsets don't include the byte-order-mark
+//
+typedef struct
+{
+	ULONG	revision;		// goes up by one with every change
+
+	ULONG	offset_bytes;
+	ULONG	erase_bytes;
+	ULONG	insert_bytes;
+
+	ULONG	offset_chars;	// the same, in UTF-16 characters
+	ULONG	erase_chars;
+	ULONG	insert_chars;
+
+	ULONG	lineno;			// the lines from here...
+	ULONG	erase_lines;	// ...were replaced by this many new ones
+	ULONG	insert_lines;
+
+	bool	reset;			// too much changed to say what (loaded or cleared)
+
+} DOCCHANGE;
+
+typedef void (*DOCCHANGEFUNC)(void *param, DOCCHANGE *change);
+
+typedef struct
+{
+	DOCCHANGEFUNC	func;
+	void		   *param;
+
+} DOCLISTENER;
 
 class TextDocument
 {
 	friend class TextIterator;
+	friend class CharIterator;
+	friend class GraphemeIterator;
+	friend class LineIterator;
 	friend class TextView;
 
 public:
 	TextDocument();
 	~TextDocument();
 
-	bool  init(HANDLE hFile);
+	// documents can be shared by several views, and are
+	// deleted when the last one lets go (starts at 1)
+	ULONG AddRef();
+	ULONG Release();
+
+	// be told about every change to the document
+	void  subscribe(DOCCHANGEFUNC func, void *param);
+	void  unsubscribe(DOCCHANGEFUNC func, void *param);
+
+	// positions (UTF-16 offsets) which move with the text as it is edited
+	markers::marker add_marker(ULONG offset_chars, void *param = 0);
+	void  remove_marker(markers::marker marker);
+	ULONG marker_offset(markers::marker marker);
+	markers::marker first_marker(ULONG offset_chars);
+	markers::marker next_marker(markers::marker marker);
+
+	bool  init(FILEHANDLE hFile);
 	bool  init(TCHAR *filename);
+	ULONG append_file(FILEHANDLE hFile);
+	bool  reload(TCHAR *filename);
+
+	bool  save(FILEHANDLE hFile, int format, bool bom);
+	bool  save(TCHAR *filename, int format, bool bom);
+
+	// line-ending normalisation (applied when saving)
+	void  setlineending(int eol);
+	int   getlineending(ULONG lineno, ULONG *length_chars = 0);
 	
 	bool  clear();
 	bool EmptyDoc();
 
+	// an independent copy of the document, which shares everything 
+	// with this one until either of them is edited
+	TextDocument *fork();
+	bool  readonly();
+	ULONG revision();
+
 	bool	Undo(ULONG *offset_start, ULONG *offset_end);
 	bool	Redo(ULONG *offset_start, ULONG *offset_end);
 
+	// every state in the (branching) undo history, numbered in order
+	bool	GotoRevision(ULONG revision, ULONG *offset_start, ULONG *offset_end);
+	ULONG	UndoRevision();
+	ULONG	UndoRevisionCount();
+
 	// UTF-16 text-editing interface
 	ULONG	insert_text(ULONG offset_chars, TCHAR *text, ULONG length);
 	ULONG	replace_text(ULONG offset_chars, TCHAR *text, ULONG length, ULONG erase_len);
@@ -39,46 +238,158 @@ public:
 	TextIterator iterate_line(ULONG lineno, ULONG *linestart = 0, ULONG *linelen = 0);
 	TextIterator iterate_line_offset(ULONG offset_chars, ULONG *lineno, ULONG *linestart = 0);
 
+	CharIterator	 iterate_chars(ULONG offset_chars);
+	GraphemeIterator iterate_graphemes(ULONG offset_chars);
+	LineIterator	 iterate_lines(ULONG lineno, ULONG count = -1);
+
 	ULONG getdata(ULONG offset, BYTE *buf, size_t len);
 	ULONG getline(ULONG nLineNo, TCHAR *buf, ULONG buflen, ULONG *off_chars);
+	ULONG getline(ULONG nLineNo, ULONG nStartPos, TCHAR *buf, ULONG buflen, ULONG *off_chars, ULONG *column);
+
+	bool  lineseg_from_offset(ULONG lineno, ULONG offset_chars, LINESEG *seg);
+	bool  lineseg_from_column(ULONG lineno, ULONG column, LINESEG *seg);
 
-	int   getformat();
+	int   getformat(int *confidence = 0);
 	ULONG linecount();
+	void  getstats(ULONG *words, ULONG *codepoints, ULONG *lineendings);
 	ULONG longestline(int tabwidth);
 	ULONG size();
 
 private:
 	
-	bool init_linebuffer();
+	bool  load_file(FILEHANDLE hFile, ULONG length);
+
+	// line-buffer management
+	bool  init_linebuffer();
+	void  update_linebuffer(ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes, DOCCHANGE *change);
+	bool  init_linewidths(int tabwidth);
+	bool  scan_line(SCANBUF *sb, ULONG offset_bytes, ULONG offset_chars, ULONG *next_bytes, ULONG *next_chars, DOCLINE *line);
+	ULONG lineno_from_byteoffset(ULONG offset_bytes);
+	void  add_linewidth(const DOCLINE *line);
+	void  remove_linewidth(const DOCLINE *line);
+	void  add_linestats(const LINESTATS *stats);
+	void  remove_linestats(const LINESTATS *stats);
+	bool  replace_lineending(int eol);
+	ULONG next_lineending(ULONG *lineno, lineindex::cursor *cur);
+	std::vector<LINESEG> *init_linesegs(ULONG lineno);
 
 	ULONG charoffset_to_byteoffset(ULONG offset_chars);
 	ULONG byteoffset_to_charoffset(ULONG offset_bytes);
 
 	ULONG count_chars(ULONG offset_bytes, ULONG length_chars);
+	ULONG scan_chars(ULONG offset_bytes, ULONG length_bytes, ULONG *length_chars);
+
+	// line-index sharing
+	void  unshare_index();
+	void  release_index();
+
+	// char<->byte offset checkpoints
+	bool   init_checkpoints();
+	void   split_checkpoints(CHECKPOINT cp, ULONG length_bytes, ULONG length_chars, std::vector<DOCLINE> &gaps);
+	void   update_checkpoints(ULONG offset_bytes, ULONG erase_bytes, ULONG erase_chars, ULONG insert_bytes, ULONG insert_chars);
+	CHECKPOINT checkpoint_from_chars(ULONG offset_chars);
+	CHECKPOINT checkpoint_from_bytes(ULONG offset_bytes);
+
+	// malformed UTF-8 decodes differently depending on what is next to it
+	size_t utf8_block_len(ULONG offset_bytes, BYTE *rawdata, size_t rawlen);
+	bool   utf8_straddle(ULONG offset_bytes, ULONG *start, ULONG *end);
+	void   char_boundaries(ULONG *offset_bytes, ULONG *length_bytes);
+	ULONG  utf8_count(ULONG offset_bytes, ULONG length_bytes);
 
 	size_t utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *rawdata, size_t *rawlen);
+	size_t utf16_to_rawdata(TCHAR *utf16str, size_t utf16len, BYTE *rawdata, size_t *rawlen, int format);
+	size_t rawdata_maxlen(size_t utf16len);
 	size_t rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16str, size_t *utf16len);
+	size_t rawdata_complete_len(BYTE *rawdata, size_t rawlen);
+	size_t utf32_rawdata_to_utf16(BYTE *rawdata, size_t rawlen, TCHAR *utf16str, size_t *utf16len);
 
-	int   detect_file_format(int *headersize);
+	int   detect_file_format(int *headersize, ULONG sampled);
+	int   sniff_file_format(int *confidence, ULONG sampled);
 	ULONG	  gettext(ULONG offset, ULONG lenbytes, TCHAR *buf, ULONG *len);
 	int   getchar(ULONG offset, ULONG lenbytes, ULONG *pch32);
+	int   scanchar(SCANBUF *sb, ULONG offset, ULONG *pch32);
+	int   scanprev(SCANBUF *sb, ULONG offset, ULONG *pch32);
+	int   decodechar(BYTE *rawdata, ULONG lenbytes, ULONG *pch32);
+	int   decodeprev(BYTE *rawdata, ULONG lenbytes, ULONG offset, ULONG *pch32);
 
 	// UTF-16 text-editing interface
 	ULONG	insert_raw(ULONG offset_bytes, TCHAR *text, ULONG length);
 	ULONG	replace_raw(ULONG offset_bytes, TCHAR *text, ULONG length, ULONG erase_len);
 	ULONG	erase_raw(ULONG offset_bytes, ULONG length);
 
+	// change notification
+	void  update_document(ULONG offset_bytes, ULONG erase_bytes, ULONG erase_chars, ULONG insert_bytes, ULONG insert_chars);
+	void  notify(DOCCHANGE *change);
+	void  notify_reset();
+
+	// undo/redo - each event that is put back is a change like any other edit
+	static void restore_event(void *param, bool done, size_w index, size_w erase_length, size_w insert_length);
+	void  restore_event(bool done, ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes);
+	void  undo_range(ULONG *offset_start, ULONG *offset_end);
+
+	// incremental reloading
+	static void load_chunks(void *param, const void *data, unsigned long length);
+	void  chunk_start();
+	void  chunk_done(bool success);
+	void  chunk_document(ULONG offset);
+	void  update_chunks(ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes);
+	void  reload_region(ULONG offset, ULONG erase_bytes, BYTE *data, ULONG insert_bytes);
+	bool  reload_file(FILEHANDLE hFile);
 
 	sequence m_seq;
 
+	// while a file is being loaded, the part of m_seq that has been read so far
+	FILELOADER *m_pLoader;
+
+	// the text that an undo/redo event is about to erase (in whole characters)
+	ULONG  m_nRestoreOffset;
+	ULONG  m_nRestoreLength;
+	ULONG  m_nRestoreChars;
+
+	// how much of the file has been loaded (see append_file), and when it was written
+	ULONG  m_nFileLength;
+	FILESTAMP m_FileStamp;
+
 	ULONG  m_nDocLength_chars;
 	ULONG  m_nDocLength_bytes;
 
-	ULONG *m_pLineBuf_byte;
-	ULONG *m_pLineBuf_char;
+	// the line-index (shared copy-on-write with any forks)
+	LINEINDEX *m_pIndex;
 	ULONG  m_nNumLines;
+
+	// the tab-size used for the line-segments (the last one asked for), and
+	// the two that each line's widths are kept for - so that two views with
+	// different tab-sizes don't each have to keep scanning the document
+	int    m_nTabWidth;
+	int    m_nWidthTabs[2];
+
+	// running totals of the line contents, for the whole document
+	ULONG  m_nNumWords;
+	ULONG  m_nNumCodePoints;
+	ULONG  m_nLineEndings[EOL_TYPES];
+
+	// what CR, LF and CR/LF get turned into when saving (EOL_NONE leaves them alone)
+	int    m_nLineEnding;
+
+	// segment index for each very long line that has been looked at
+	std::map<ULONG, std::vector<LINESEG> > m_LineSegs;
+	
+	// the views sharing the document
+	ULONG  m_nRefCount;
+	ULONG  m_nRevision;
+	std::vector<DOCLISTENER> m_Listeners;
+	markers m_Markers;
+
+	// loaded from a compressed file, so it can't be edited
+	bool   m_fReadOnly;
+
+	// the document divided into chunks, for reloading
+	std::vector<FILECHUNK>	m_FileChunks;
+	bool   m_fChunksValid;
+	CHUNKER m_Chunker;
 	
 	int	   m_nFileFormat;
+	int	   m_nFormatConfidence;
 	int    m_nHeaderSize;
 };
 
@@ -196,13 +507,130 @@ private:
 	ULONG len_bytes;
 };
 
+//
+//	CharIterator - moves through the document one code-point at a time, in
+//	either direction. Raw data is read a block at a time into a SCANBUF, so
+//	each step only decodes a single character
+//
+class CharIterator
+{
+public:
+	CharIterator();
+	CharIterator(TextDocument *td, ULONG off_bytes, ULONG off_chars);
+
+	// return the character after the current position and move past it
+	bool  next(ULONG *pch32);
+
+	// move back before the previous character and return it
+	bool  prev(ULONG *pch32);
+
+	// current position, in UTF-16 code-units and in BYTEs
+	ULONG offset()		 { return off_chars; }
+	ULONG offset_bytes() { return off_bytes; }
+
+	operator bool()
+	{
+		return text_doc ? true : false;
+	}
+
+private:
+
+	TextDocument *text_doc;
+	
+	ULONG	off_bytes;
+	ULONG	off_chars;
+	SCANBUF	sb;
+};
+
+//
+//	GraphemeIterator - moves through the document a grapheme-cluster (i.e. 
+//	a user-perceived character, such as a letter with its accents, an emoji 
+//	sequence or a CR/LF pair) at a time, in either direction
+//
+class GraphemeIterator
+{
+public:
+	GraphemeIterator();
+	GraphemeIterator(TextDocument *td, ULONG off_bytes, ULONG off_chars);
+
+	// move past the next / previous cluster, returning its 
+	// position and length (in UTF-16 code-units)
+	bool  next(ULONG *offset_chars = 0, ULONG *length_chars = 0);
+	bool  prev(ULONG *offset_chars = 0, ULONG *length_chars = 0);
+
+	ULONG offset()		 { return char_itor.offset(); }
+	ULONG offset_bytes() { return char_itor.offset_bytes(); }
+
+	operator bool()
+	{
+		return char_itor ? true : false;
+	}
+
+private:
+
+	ULONG regional_before();
+
+	CharIterator char_itor;
+};
+
+//
+//	LineIterator - moves through a range of lines in the document, in
+//	either direction, using the document's line-index
+//
+//	The text of each line can be streamed out as well, either as raw 
+//	document data or as UTF-16. Lines are fetched a window at a time, 
+//	so the returned pointers refer to the iterator's own buffers - they 
+//	are only valid until the next call (or until the document changes), 
+//	and nothing is allocated per-line
+//
 class LineIterator
 {
 public:
 	LineIterator();
+	LineIterator(TextDocument *td, ULONG lineno, ULONG count = -1);
+
+	// return the line after the current position and move past it
+	bool  next(ULONG *lineno, ULONG *offset_chars = 0, ULONG *length_chars = 0);
+
+	// move back to the previous line and return it
+	bool  prev(ULONG *lineno, ULONG *offset_chars = 0, ULONG *length_chars = 0);
+
+	// as next/prev, but also return the line's contents (including the line-break)
+	bool  next_text(ULONG *lineno, ULONG *offset_chars, const TCHAR **text, ULONG *length_chars);
+	bool  prev_text(ULONG *lineno, ULONG *offset_chars, const TCHAR **text, ULONG *length_chars);
+	bool  next_raw(ULONG *lineno, ULONG *offset_bytes, const BYTE **data, ULONG *length_bytes);
+	bool  prev_raw(ULONG *lineno, ULONG *offset_bytes, const BYTE **data, ULONG *length_bytes);
+
+	ULONG lineno() { return m_nLineNo; }
+
+	operator bool()
+	{
+		return m_pTextDoc ? true : false;
+	}
 
 private:
+
+	const TCHAR *fetch_text(ULONG lineno, bool forwards);
+	const BYTE  *fetch_raw(ULONG lineno, bool forwards);
+
 	TextDocument *m_pTextDoc;
+	ULONG		  m_nLineNo;
+	ULONG		  m_nFirstLine;
+	ULONG		  m_nEndLine;
+
+	// the last line looked up, so the next one is found straight away
+	lineindex::cursor m_Cursor;
+
+	// window of decoded lines [m_nTextLine, m_nTextEnd)
+	std::vector<TCHAR>	m_TextBuf;
+	ULONG				m_nTextLine;
+	ULONG				m_nTextEnd;
+	ULONG				m_nTextLineChars;
+
+	// window of raw document data
+	std::vector<BYTE>	m_RawBuf;
+	ULONG				m_nRawOffset;
+	ULONG				m_nRawLength;
 };
 
 struct _BOM_LOOKUP
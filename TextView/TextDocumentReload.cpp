@@ -0,0 +1,634 @@
+//
+//	MODULE:		TextDocumentReload.cpp
+//
+//	PURPOSE:	Reload a TextDocument from a file that has been changed by
+//				someone else, only replacing the parts that are different
+//
+//	NOTES:		www.catch22.net
+//
+//	The document is divided into content-defined chunks - a rolling hash
+//	of the last few BYTEs decides where each chunk ends, so an insertion
+//	or deletion only alters the chunks either side of it. When the file
+//	is reloaded it is chunked the same way, and any chunk which is already
+//	in the document (in the same order) is left where it is. Everything in
+//	between is replaced using the normal editing operations, so the
+//	line-buffer is patched rather than rebuilt, and the reload can be undone
+//
+
+#include "portable.h"
+#include <algorithm>
+#include "TextDocument.h"
+
+extern struct _BOM_LOOKUP BOMLOOK[];
+
+#define FNV_OFFSET	2166136261
+#define FNV_PRIME	16777619
+
+// random values for the rolling hash, one for each BYTE value
+static ULONG GEAR[256];
+
+//
+//	A region of the new file which is already in the document
+//
+typedef struct
+{
+	ULONG	old_offset;
+	ULONG	new_offset;
+	ULONG	length;
+
+} CHUNKMATCH;
+
+//
+//	A region of the document which has to be replaced
+//
+typedef struct
+{
+	ULONG	offset;
+	ULONG	erase_bytes;
+	ULONG	data;			// offset of the replacement in RELOAD::newdata
+	ULONG	insert_bytes;
+
+} RELOADGAP;
+
+//
+//	State kept while the new file is matched against the document
+//
+typedef struct
+{
+	std::vector<FILECHUNK>	index;		// unedited chunks of the document, by hash
+	std::vector<CHUNKMATCH>	matches;	// parts of the file already in the document
+	std::vector<BYTE>		newdata;	// and everything else, in file order
+	std::vector<BYTE>		chunk;		// the chunk currently being read
+	std::vector<BYTE>		olddata;
+	ULONG					minoffset;	// where the next match may start
+
+} RELOAD;
+
+//
+//	Order chunks by hash, and then by position
+//
+static bool chunk_less(const FILECHUNK &a, const FILECHUNK &b)
+{
+	return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset);
+}
+
+static bool chunk_offset_less(const FILECHUNK &a, const FILECHUNK &b)
+{
+	return a.offset < b.offset;
+}
+
+//
+//	Get ready to divide data that starts at the specified offset
+//
+static void chunk_init(CHUNKER *ck, int format, std::vector<FILECHUNK> *chunks, ULONG offset)
+{
+	// fill in the rolling-hash table the first time through (xorshift)
+	if(GEAR[0] == 0)
+	{
+		ULONG x = 0x9E3779B9;
+
+		for(int i = 0; i < 256; i++)
+		{
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			GEAR[i] = x;
+		}
+	}
+
+	ck->gear	= 0;
+	ck->hash	= FNV_OFFSET;
+	ck->start	= offset;
+	ck->offset	= offset;
+	ck->recent	= 0;
+	ck->format	= format;
+	ck->chunks	= chunks;
+
+	switch(format)
+	{
+	case NCP_UTF16: case NCP_UTF16BE:	ck->unit = 2; break;
+	case NCP_UTF32: case NCP_UTF32BE:	ck->unit = 4; break;
+	default:							ck->unit = 1; break;
+	}
+}
+
+//
+//	Finish the current chunk. Zero marks a chunk that has been edited,
+//	so real chunks never have that hash
+//
+static void chunk_end(CHUNKER *ck)
+{
+	FILECHUNK fc;
+
+	fc.offset = ck->start;
+	fc.length = ck->offset - ck->start;
+	fc.hash	  = ck->hash ? ck->hash : 1;
+
+	ck->chunks->push_back(fc);
+
+	ck->gear  = 0;
+	ck->hash  = FNV_OFFSET;
+	ck->start = ck->offset;
+}
+
+//
+//	Can a chunk end in front of this BYTE? Not in the middle of a character
+//
+static bool chunk_boundary(CHUNKER *ck, BYTE b)
+{
+	if(ck->offset % ck->unit != 0)
+		return false;
+
+	switch(ck->format)
+	{
+	case NCP_UTF8:		return (b & 0xC0) != 0x80;
+	case NCP_UTF16:		return (ck->recent & 0xFC) != 0xD8;
+	case NCP_UTF16BE:	return ((ck->recent >> 8) & 0xFC) != 0xD8;
+	default:			return true;
+	}
+}
+
+//
+//	Feed data into the chunker. Returns as soon as a chunk ends, with
+//	the number of BYTEs that went into it - the rest belong to the next one
+//
+//	Chunks only end on a character boundary, so that the parts of a
+//	document which get replaced during a reload are whole characters
+//
+static size_t chunk_feed(CHUNKER *ck, const BYTE *data, size_t length)
+{
+	size_t i;
+
+	for(i = 0; i < length; i++)
+	{
+		BYTE  b	   = data[i];
+		ULONG size = ck->offset - ck->start;
+
+		// see if the chunk ends in front of this BYTE
+		if(size >= CHUNK_MINSIZE && ((ck->gear & CHUNK_MASK) == 0 || size >= CHUNK_MAXSIZE) &&
+			chunk_boundary(ck, b))
+		{
+			chunk_end(ck);
+			return i;
+		}
+
+		ck->gear = (ck->gear << 1) + GEAR[b];
+		ck->hash = (ck->hash ^ b) * FNV_PRIME;
+		ck->recent = (ck->recent << 8) | b;
+		ck->offset++;
+	}
+
+	return length;
+}
+
+//
+//	The data has run out, so whatever is left is the last chunk
+//
+static void chunk_finish(CHUNKER *ck)
+{
+	if(ck->offset > ck->start)
+		chunk_end(ck);
+}
+
+//
+//	Start chunking a file that is about to be loaded
+//
+void TextDocument::chunk_start()
+{
+	m_FileChunks.clear();
+	chunk_init(&m_Chunker, m_nFileFormat, &m_FileChunks, 0);
+}
+
+//
+//	Called by the loader thread as each block of the file is read in
+//
+void TextDocument::load_chunks(void *param, const void *data, unsigned long length)
+{
+	TextDocument *doc  = (TextDocument *)param;
+	const BYTE	 *ptr  = (const BYTE *)data;
+	size_t		  len;
+
+	for( ; length > 0; ptr += len, length -= len)
+		len = chunk_feed(&doc->m_Chunker, ptr, length);
+}
+
+//
+//	The file has finished loading
+//
+void TextDocument::chunk_done(bool success)
+{
+	chunk_finish(&m_Chunker);
+	m_fChunksValid = success;
+
+	if(!success)
+		m_FileChunks.clear();
+}
+
+//
+//	(Re)divide the document into chunks, from the start of the
+//	chunk at the specified BYTE offset (in the sequence) to the end
+//
+void TextDocument::chunk_document(ULONG offset)
+{
+	std::vector<FILECHUNK>::iterator it;
+	sequence::iterator itor;
+	CHUNKER ck;
+	ULONG	len;
+
+	FILECHUNK fc = { offset, 0, 0 };
+
+	it = std::lower_bound(m_FileChunks.begin(), m_FileChunks.end(), fc, chunk_offset_less);
+	m_FileChunks.erase(it, m_FileChunks.end());
+
+	chunk_init(&ck, m_nFileFormat, &m_FileChunks, offset);
+
+	for(itor = m_seq.iterate(offset); offset < m_nDocLength_bytes && itor; )
+	{
+		len = chunk_feed(&ck, (BYTE *)itor.data(), min(itor.length(), m_nDocLength_bytes - offset));
+		itor.advance(len);
+		offset += len;
+	}
+
+	chunk_finish(&ck);
+	m_fChunksValid = true;
+}
+
+//
+//	Keep the chunks in step with an edit (BYTE offsets relative to the
+//	start of the text). The chunks which the edit touches are merged into
+//	one which can't match anything, and the rest are moved along
+//
+void TextDocument::update_chunks(ULONG offset_bytes, ULONG erase_bytes, ULONG insert_bytes)
+{
+	ULONG  offset = offset_bytes + m_nHeaderSize;
+	ULONG  end	  = offset + erase_bytes;
+	ULONG  start, stop;
+	size_t first, last, i;
+
+	FILECHUNK fc = { offset, 0, 0 };
+
+	if(!m_fChunksValid)
+		return;
+
+	// the chunk that the edit starts in
+	first = std::upper_bound(m_FileChunks.begin(), m_FileChunks.end(), fc, chunk_offset_less) - m_FileChunks.begin();
+
+	if(first > 0 && m_FileChunks[first - 1].offset + m_FileChunks[first - 1].length > offset)
+		first--;
+
+	// and the ones it overlaps - an insertion exactly between two chunks leaves both alone
+	for(last = first; last < m_FileChunks.size() && m_FileChunks[last].offset < end; last++)
+		;
+
+	start = offset;
+	stop  = end;
+
+	if(first < last)
+	{
+		start = min(start, m_FileChunks[first].offset);
+		stop  = max(stop,  m_FileChunks[last - 1].offset + m_FileChunks[last - 1].length);
+	}
+
+	// join up with edited chunks either side
+	if(first > 0 && m_FileChunks[first - 1].hash == 0)
+		start = m_FileChunks[--first].offset;
+
+	if(last < m_FileChunks.size() && m_FileChunks[last].hash == 0)
+	{
+		stop = m_FileChunks[last].offset + m_FileChunks[last].length;
+		last++;
+	}
+
+	m_FileChunks.erase(m_FileChunks.begin() + first, m_FileChunks.begin() + last);
+
+	if(stop - start - erase_bytes + insert_bytes > 0)
+	{
+		fc.offset = start;
+		fc.length = stop - start - erase_bytes + insert_bytes;
+		fc.hash	  = 0;
+
+		m_FileChunks.insert(m_FileChunks.begin() + first, fc);
+		first++;
+	}
+
+	for(i = first; i < m_FileChunks.size(); i++)
+		m_FileChunks[i].offset += insert_bytes - erase_bytes;
+}
+
+//
+//	Look for a chunk of the new file in the document, no earlier than the
+//	last one found so the chunks which are kept stay in order. A matching
+//	hash isn't taken on trust - the contents are compared as well
+//
+static void match_chunk(sequence &seq, RELOAD *rl, FILECHUNK &nc)
+{
+	FILECHUNK fc = { rl->minoffset, 0, nc.hash };
+	std::vector<FILECHUNK>::iterator it;
+
+	for(it = std::lower_bound(rl->index.begin(), rl->index.end(), fc, chunk_less); it != rl->index.end() && it->hash == nc.hash; ++it)
+	{
+		if(it->length != nc.length)
+			continue;
+
+		rl->olddata.resize(it->length);
+		seq.render(it->offset, &rl->olddata[0], it->length);
+
+		if(memcmp(&rl->olddata[0], &rl->chunk[0], it->length) != 0)
+			continue;
+
+		// carry on from the previous match if possible
+		if(!rl->matches.empty() && rl->matches.back().old_offset + rl->matches.back().length == it->offset &&
+			rl->matches.back().new_offset + rl->matches.back().length == nc.offset)
+		{
+			rl->matches.back().length += nc.length;
+		}
+		else
+		{
+			CHUNKMATCH cm = { it->offset, nc.offset, nc.length };
+			rl->matches.push_back(cm);
+		}
+
+		rl->minoffset = it->offset + it->length;
+		rl->chunk.clear();
+		return;
+	}
+
+	rl->newdata.insert(rl->newdata.end(), rl->chunk.begin(), rl->chunk.end());
+	rl->chunk.clear();
+}
+
+//
+//	Replace one region of the document (BYTE offsets in the sequence)
+//
+void TextDocument::reload_region(ULONG offset, ULONG erase_bytes, BYTE *data, ULONG insert_bytes)
+{
+	ULONG erase_chars  = -1;
+	ULONG insert_chars = -1;
+	ULONG start, length;
+
+	offset -= m_nHeaderSize;
+
+	// the region can start or finish part-way through a character
+	start  = offset;
+	length = erase_bytes;
+	char_boundaries(&start, &length);
+
+	if(length)
+		scan_chars(start, length, &erase_chars);
+	else
+		erase_chars = 0;
+
+	if(erase_bytes && insert_bytes)
+		m_seq.replace(offset + m_nHeaderSize, data, insert_bytes, erase_bytes);
+	else if(insert_bytes)
+		m_seq.insert(offset + m_nHeaderSize, data, insert_bytes);
+	else
+		m_seq.erase(offset + m_nHeaderSize, erase_bytes);
+
+	m_nDocLength_bytes = m_seq.size();
+	insert_bytes += length - erase_bytes;
+
+	if(insert_bytes)
+		scan_chars(start, insert_bytes, &insert_chars);
+	else
+		insert_chars = 0;
+
+	update_document(start, length, erase_chars, insert_bytes, insert_chars);
+}
+
+//
+//	Bring the document into line with the file, changing only the parts
+//	that are different. If the file is the same size and hasn't been written
+//	to since it was loaded, and the document hasn't been edited, there is 
+//	nothing to do. Otherwise the whole file still has to be read, and it is
+//	hashed from the first chunk that differs from the document - but nothing 
+//	that is unchanged gets copied, rescanned or indexed again.
+//	Edits made since the last load or reload are overwritten like anything
+//	else, and the whole reload is a single undo action
+//
+//	Returns false if the document needs loading from scratch instead
+//	(the file has a different byte-order-mark or looks like a different 
+//	format now, or couldn't be read). The document may have been half 
+//	changed by then, so it must be cleared
+//
+bool TextDocument::reload_file(FILEHANDLE hFile)
+{
+	std::vector<FILECHUNK> newchunks;
+	std::vector<RELOADGAP> gaps;
+	RELOAD	rl;
+	CHUNKER	ck;
+	BYTE   *block;
+	BYTE	header[4] = { 0 };
+	ULONG	filelen = file_size(hFile);
+	ULONG	offset, len, pos, n;
+	FILESTAMP stamp;
+	ULONG	old_prev, new_prev, data;
+	size_t	i, count;
+	int		headersize = 0;
+	int		confidence;
+
+	if(filelen == FILE_BADSIZE)
+		return false;
+
+	// an edit leaves a chunk without a hash, so if they all still have one
+	// the document is exactly what was loaded
+	if(filelen == m_nFileLength && m_fChunksValid && file_stamp(hFile, &stamp) && file_stamp_equal(&stamp, &m_FileStamp))
+	{
+		for(i = 0; i < m_FileChunks.size() && m_FileChunks[i].hash != 0; i++)
+			;
+
+		if(i == m_FileChunks.size())
+			return true;
+	}
+
+	// the format has to stay the same, so the byte-order-mark must match
+	file_read(hFile, 0, header, min(filelen, 4));
+
+	for(i = 0; BOMLOOK[i].len; i++)
+	{
+		if(filelen >= BOMLOOK[i].len && memcmp(header, &BOMLOOK[i].bom, BOMLOOK[i].len) == 0)
+		{
+			headersize = BOMLOOK[i].len;
+			break;
+		}
+	}
+
+	if(headersize != m_nHeaderSize || (headersize && BOMLOOK[i].type != m_nFileFormat))
+		return false;
+
+	// the chunks are out of date after an undo/redo
+	if(!m_fChunksValid)
+		chunk_document(0);
+
+	for(i = 0; i < m_FileChunks.size(); i++)
+	{
+		if(m_FileChunks[i].hash != 0)
+			rl.index.push_back(m_FileChunks[i]);
+	}
+
+	std::sort(rl.index.begin(), rl.index.end(), chunk_less);
+
+	// the start of the file is often just as it was, so the document's
+	// chunks are compared with it directly until one is different - only
+	// the rest of the file has to be hashed. A chunk always starts afresh, 
+	// so the file is divided up exactly as if it had all been hashed
+	for(i = 0, offset = 0; i < m_FileChunks.size(); i++)
+	{
+		FILECHUNK fc = m_FileChunks[i];
+
+		// the last chunk only ended where it did because the file did
+		if(fc.hash == 0 || fc.offset + fc.length > filelen || 
+		  (fc.offset + fc.length == m_nDocLength_bytes && filelen != m_nDocLength_bytes))
+			break;
+
+		rl.chunk.resize(fc.length);
+		rl.olddata.resize(fc.length);
+
+		if(file_read(hFile, fc.offset, &rl.chunk[0], fc.length) != fc.length)
+			return false;
+
+		m_seq.render(fc.offset, &rl.olddata[0], fc.length);
+
+		if(memcmp(&rl.chunk[0], &rl.olddata[0], fc.length) != 0)
+			break;
+
+		newchunks.push_back(fc);
+		offset += fc.length;
+	}
+
+	if(offset > 0)
+	{
+		CHUNKMATCH cm = { 0, 0, offset };
+		rl.matches.push_back(cm);
+	}
+
+	rl.chunk.clear();
+	rl.minoffset = offset;
+
+	// divide the rest of the file into chunks, keeping hold of the ones that aren't already in the document
+	chunk_init(&ck, m_nFileFormat, &newchunks, offset);
+	block = new BYTE[FILE_READAHEAD];
+
+	for( ; offset < filelen; offset += len)
+	{
+		len = min(filelen - offset, FILE_READAHEAD);
+
+		if(file_read(hFile, offset, block, len) != len)
+		{
+			delete[] block;
+			return false;
+		}
+
+		for(pos = 0; pos < len; pos += n)
+		{
+			count = newchunks.size();
+			n	  = chunk_feed(&ck, block + pos, len - pos);
+
+			rl.chunk.insert(rl.chunk.end(), block + pos, block + pos + n);
+
+			if(newchunks.size() > count)
+				match_chunk(m_seq, &rl, newchunks.back());
+		}
+	}
+
+	delete[] block;
+
+	count = newchunks.size();
+	chunk_finish(&ck);
+
+	if(newchunks.size() > count)
+		match_chunk(m_seq, &rl, newchunks.back());
+
+	// everything between the matches is different - the header
+	// is the same in both, so that is left alone
+	CHUNKMATCH last = { m_nDocLength_bytes, filelen, 0 };
+	rl.matches.push_back(last);
+
+	for(i = 0, old_prev = 0, new_prev = 0, data = 0; i < rl.matches.size(); i++)
+	{
+		ULONG old_len = rl.matches[i].old_offset - old_prev;
+		ULONG new_len = rl.matches[i].new_offset - new_prev;
+		ULONG skip	  = old_prev < (ULONG)m_nHeaderSize ? min(min(old_len, new_len), m_nHeaderSize - old_prev) : 0;
+
+		if(old_len != new_len || skip < old_len)
+		{
+			RELOADGAP gap = { old_prev + skip, old_len - skip, data + skip, new_len - skip };
+
+			// nothing can be changed in front of the header
+			if(gap.offset < (ULONG)m_nHeaderSize)
+				return false;
+
+			gaps.push_back(gap);
+		}
+
+		data	+= new_len;
+		old_prev = rl.matches[i].old_offset + rl.matches[i].length;
+		new_prev = rl.matches[i].new_offset + rl.matches[i].length;
+	}
+
+	// replace each gap, from the end backwards so the offsets stay put
+	m_seq.group();
+
+	for(i = gaps.size(); i > 0; i--)
+	{
+		RELOADGAP &gap = gaps[i - 1];
+
+		if(gap.erase_bytes || gap.insert_bytes)
+			reload_region(gap.offset, gap.erase_bytes, gap.insert_bytes ? &rl.newdata[gap.data] : 0, gap.insert_bytes);
+	}
+
+	m_seq.ungroup();
+
+	// without a byte-order-mark the format was only a guess, and the new
+	// contents might suggest something else - in which case start again
+	if(m_nHeaderSize == 0 && gaps.size() && sniff_file_format(&confidence, m_nDocLength_bytes) != m_nFileFormat)
+		return false;
+
+	m_FileChunks.swap(newchunks);
+	m_fChunksValid = true;
+	m_nFileLength  = filelen;
+	file_stamp(hFile, &m_FileStamp);
+
+	return true;
+}
+
+//
+//	Reload the document from the named file. Falls back to loading it
+//	from scratch if it can't be done incrementally. Returns false if
+//	the file couldn't be opened or read (the document is left empty)
+//
+//	The whole file is read every time it has changed, however little
+//	has changed - there is no way of telling which parts are the same 
+//	without looking. Only the part after the first difference is hashed
+//
+bool TextDocument::reload(TCHAR *filename)
+{
+	FILEHANDLE hFile;
+	ULONG	   filelen;
+	bool	   success = false;
+
+	if((hFile = file_open(filename)) == INVALID_FILEHANDLE)
+	{
+		clear();
+		EmptyDoc();
+		return false;
+	}
+
+	filelen = file_size(hFile);
+	success = reload_file(hFile);
+	file_close(hFile);
+
+	if(!success)
+	{
+		clear();
+
+		// an empty file is fine, it just can't be init'd
+		if((success = init(filename)) == false)
+		{
+			EmptyDoc();
+			success = filelen == 0;
+		}
+	}
+
+	return success;
+}
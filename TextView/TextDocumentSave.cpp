@@ -0,0 +1,215 @@
+//
+//	MODULE:		TextDocumentSave.cpp
+//
+//	PURPOSE:	Write a TextDocument back to disk, converting it
+//				to a different encoding on the way if necessary
+//
+//	NOTES:		www.catch22.net
+//
+
+#include "portable.h"
+#include <algorithm>
+#include "TextDocument.h"
+#include "Unicode.h"
+
+extern struct _BOM_LOOKUP BOMLOOK[];
+
+// what each type of line-ending is written as, when normalising them
+static UTF16 EOLSTR[EOL_TYPES][2] = 
+{
+	{ 0 }, { '\r', '\n' }, { '\n' }, { '\r' }, { 0x2028 }
+};
+
+static ULONG EOLLEN[EOL_TYPES] = 
+{
+	0, 2, 1, 1, 1
+};
+
+//
+//	SAVEBUFFER - the output buffer being filled. The document is converted
+//	into one of a FILEWRITER's pair of buffers while the other is being 
+//	written out by a separate thread, so the conversion and the I/O overlap
+//
+typedef struct
+{
+	FILEWRITER *writer;
+	BYTE	   *buf;
+	ULONG		len;
+
+} SAVEBUFFER;
+
+//
+//	Hand the current buffer over to the writer thread and
+//	wait for the other one to become free
+//
+static void flush_buffer(SAVEBUFFER *sb)
+{
+	sb->buf = (BYTE *)file_write_next(sb->writer, sb->len);
+	sb->len = 0;
+}
+
+//
+//	Save the document to the specified file
+//
+bool TextDocument::save(TCHAR *filename, int format, bool bom)
+{
+	FILEHANDLE hFile;
+	bool	   success;
+
+	if((hFile = file_create(filename)) == INVALID_FILEHANDLE)
+		return false;
+
+	success = save(hFile, format, bom);
+
+	file_close(hFile);
+	return success;
+}
+
+//
+//	Save the document using a file-handle, in any of the NCP_xxx formats
+//	(with or without a byte-order-mark).
+//
+//	The piece-table's spans are read in turn and written straight out if
+//	the format isn't changing. Otherwise they are decoded to UTF-16 a chunk
+//	at a time and re-encoded in the new format. Only the two output buffers
+//	and the UTF-16 chunk are needed, however big the document is
+//
+//	Any line-endings being normalised (see setlineending) are swapped for 
+//	the new type along the way - the line-buffer says where they all are
+//
+bool TextDocument::save(FILEHANDLE hFile, int format, bool bom)
+{
+	SAVEBUFFER	sb;
+	TCHAR	   *utf16buf;
+	ULONG		offset	 = m_nHeaderSize;
+	ULONG		doclen	 = m_nDocLength_bytes;
+	ULONG		lineno	 = 0;
+	ULONG		linestart;
+	ULONG		stop;
+	int			i;
+
+	sequence::iterator itor;
+	lineindex::cursor  cur;
+
+	if(format < NCP_ASCII || format > NCP_UTF32BE)
+		return false;
+
+	if((sb.writer = file_write_start(hFile, SAVE_BUFSIZE)) == 0)
+		return false;
+
+	sb.buf	 = (BYTE *)file_write_buffer(sb.writer);
+	sb.len	 = 0;
+	utf16buf = new TCHAR[SAVE_CHUNKSIZE];
+
+	memset(&cur, 0, sizeof(cur));
+
+	// the ASCII entry has no BOM
+	for(i = 0; bom && BOMLOOK[i].len; i++)
+	{
+		if(BOMLOOK[i].type == format)
+		{
+			memcpy(sb.buf, &BOMLOOK[i].bom, BOMLOOK[i].len);
+			sb.len = BOMLOOK[i].len;
+			break;
+		}
+	}
+
+	// text is copied/converted up to the next line-ending that needs replacing
+	stop = next_lineending(&lineno, &cur) + m_nHeaderSize;
+
+	for(itor = m_seq.iterate(offset); offset < doclen && itor && !file_write_failed(sb.writer); )
+	{
+		BYTE   joined[8];
+		BYTE  *rawdata = (BYTE *)itor.data();
+		size_t rawlen;
+		size_t utf16len;
+		size_t room;
+		size_t pos;
+
+		// write the new line-ending and skip over the old one
+		if(offset == stop)
+		{
+			if(SAVE_BUFSIZE - sb.len < 16)
+				flush_buffer(&sb);
+
+			room = SAVE_BUFSIZE - sb.len;
+			utf16_to_rawdata((TCHAR *)EOLSTR[m_nLineEnding], EOLLEN[m_nLineEnding], sb.buf + sb.len, &room, format);
+			sb.len += room;
+
+			rawlen = m_pIndex->lines.line(lineno, &linestart, 0, &cur)->length_bytes + linestart + m_nHeaderSize - offset;
+			itor.advance(rawlen);
+			offset += rawlen;
+
+			lineno++;
+			stop = next_lineending(&lineno, &cur) + m_nHeaderSize;
+			continue;
+		}
+
+		// same format, just copy the raw data
+		if(format == m_nFileFormat)
+		{
+			rawlen = min(min(itor.length(), SAVE_BUFSIZE - sb.len), stop - offset);
+
+			memcpy(sb.buf + sb.len, rawdata, rawlen);
+			sb.len += rawlen;
+
+			if(sb.len == SAVE_BUFSIZE)
+				flush_buffer(&sb);
+
+			itor.advance(rawlen);
+			offset += rawlen;
+			continue;
+		}
+
+		// no more than SAVE_CHUNKSIZE BYTEs of any format will fit in the
+		// UTF-16 chunk, and don't let the span boundary split a character
+		rawlen = min(min(itor.length(), SAVE_CHUNKSIZE), stop - offset);
+
+		if(rawlen < stop - offset)
+			rawlen = rawdata_complete_len(rawdata, rawlen);
+
+		// a character straddles the boundary - piece it back together
+		if(rawlen == 0)
+		{
+			rawlen  = m_seq.render(offset, joined, min(stop - offset, sizeof(joined)));
+			rawdata = joined;
+
+			if(rawlen < stop - offset)
+				rawlen = max(rawdata_complete_len(joined, rawlen), 1);
+		}
+
+		utf16len = SAVE_CHUNKSIZE;
+		rawlen   = rawdata_to_utf16(rawdata, rawlen, utf16buf, &utf16len);
+
+		// only a stray odd BYTE at the end of UTF-16 data can't be converted
+		if(rawlen == 0)
+			break;
+
+		itor.advance(rawlen);
+		offset += rawlen;
+
+		// encode into the output buffer, handing it over each time it fills up
+		for(pos = 0; pos < utf16len; )
+		{
+			room = SAVE_BUFSIZE - sb.len;
+			pos += utf16_to_rawdata(utf16buf + pos, utf16len - pos, sb.buf + sb.len, &room, format);
+
+			// nothing would go into an empty buffer
+			if(room == 0 && sb.len == 0)
+			{
+				file_write_abort(sb.writer);
+				break;
+			}
+
+			sb.len += room;
+
+			if(pos < utf16len)
+				flush_buffer(&sb);
+		}
+	}
+
+	delete[] utf16buf;
+
+	// write what's left, and wait for it all to reach the file
+	return file_write_finish(sb.writer, sb.len);
+}
\ No newline at end of file
@@ -0,0 +1,380 @@
+//
+//	MODULE:		TextIterator.cpp
+//
+//	PURPOSE:	Bidirectional iterators over a TextDocument - by
+//				code-point, by grapheme-cluster and by line
+//
+//	NOTES:		www.catch22.net
+//
+
+#include "portable.h"
+#include <algorithm>
+#include "TextDocument.h"
+#include "Unicode.h"
+
+//
+//	CharIterator
+//
+CharIterator::CharIterator()
+	: text_doc(0), off_bytes(0), off_chars(0)
+{
+	sb.offset = 0;
+	sb.length = 0;
+}
+
+CharIterator::CharIterator(TextDocument *td, ULONG off_b, ULONG off_c)
+	: text_doc(td), off_bytes(off_b), off_chars(off_c)
+{
+	sb.offset = 0;
+	sb.length = 0;
+}
+
+//
+//	Return the character at the current position and move past it.
+//	Returns false at the end of the document
+//
+bool CharIterator::next(ULONG *pch32)
+{
+	int len;
+
+	if(text_doc == 0 || off_bytes >= text_doc->m_nDocLength_bytes - text_doc->m_nHeaderSize)
+		return false;
+
+	// plain ASCII in a UTF-8 document can be taken straight from the buffer
+	if(off_bytes >= sb.offset && off_bytes < sb.offset + sb.length && 
+		sb.buf[off_bytes - sb.offset] < 0x80 && text_doc->m_nFileFormat == NCP_UTF8)
+	{
+		*pch32 = sb.buf[off_bytes - sb.offset];
+		off_bytes++;
+		off_chars++;
+		return true;
+	}
+
+	if((len = text_doc->scanchar(&sb, off_bytes, pch32)) == 0)
+		return false;
+
+	off_bytes += len;
+	off_chars += (*pch32 > UNI_MAX_BMP && *pch32 <= UNI_MAX_UTF16) ? 2 : 1;
+
+	return true;
+}
+
+//
+//	Move back before the previous character and return it.
+//	Returns false at the start of the document
+//
+bool CharIterator::prev(ULONG *pch32)
+{
+	int len;
+
+	if(text_doc == 0 || off_bytes == 0)
+		return false;
+
+	// plain ASCII in a UTF-8 document can be taken straight from the buffer
+	if(off_bytes > sb.offset && off_bytes <= sb.offset + sb.length && 
+		sb.buf[off_bytes - sb.offset - 1] < 0x80 && text_doc->m_nFileFormat == NCP_UTF8)
+	{
+		*pch32 = sb.buf[off_bytes - sb.offset - 1];
+		off_bytes--;
+		off_chars--;
+		return true;
+	}
+
+	if((len = text_doc->scanprev(&sb, off_bytes, pch32)) == 0)
+		return false;
+
+	off_bytes -= len;
+	off_chars -= (*pch32 > UNI_MAX_BMP && *pch32 <= UNI_MAX_UTF16) ? 2 : 1;
+
+	return true;
+}
+
+//
+//	GraphemeIterator
+//
+GraphemeIterator::GraphemeIterator()
+{
+}
+
+GraphemeIterator::GraphemeIterator(TextDocument *td, ULONG off_bytes, ULONG off_chars)
+	: char_itor(td, off_bytes, off_chars)
+{
+}
+
+//
+//	Move past the next grapheme-cluster
+//
+bool GraphemeIterator::next(ULONG *offset_chars, ULONG *length_chars)
+{
+	ULONG start = char_itor.offset();
+	ULONG ch32, next32;
+	ULONG regional;
+
+	if(!char_itor.next(&ch32))
+		return false;
+
+	regional = UNI_IS_REGIONAL(ch32) ? 1 : 0;
+
+	while(char_itor.next(&next32))
+	{
+		// a third regional-indicator starts a new flag
+		if(grapheme_break(ch32, next32) || (UNI_IS_REGIONAL(next32) && regional == 2))
+		{
+			char_itor.prev(&next32);
+			break;
+		}
+
+		regional = UNI_IS_REGIONAL(next32) ? regional + 1 : 0;
+		ch32	 = next32;
+	}
+
+	if(offset_chars) *offset_chars = start;
+	if(length_chars) *length_chars = char_itor.offset() - start;
+
+	return true;
+}
+
+//
+//	Move back before the previous grapheme-cluster
+//
+bool GraphemeIterator::prev(ULONG *offset_chars, ULONG *length_chars)
+{
+	ULONG end = char_itor.offset();
+	ULONG ch32, prev32;
+
+	if(!char_itor.prev(&ch32))
+		return false;
+
+	while(char_itor.prev(&prev32))
+	{
+		// regional-indicators pair up from the start of a run of them
+		if(grapheme_break(prev32, ch32) || (UNI_IS_REGIONAL(ch32) && regional_before() % 2 == 1))
+		{
+			char_itor.next(&prev32);
+			break;
+		}
+
+		ch32 = prev32;
+	}
+
+	if(offset_chars) *offset_chars = char_itor.offset();
+	if(length_chars) *length_chars = end - char_itor.offset();
+
+	return true;
+}
+
+//
+//	Count the regional-indicators immediately before the current position
+//
+ULONG GraphemeIterator::regional_before()
+{
+	ULONG count = 0;
+	ULONG ch32, i;
+
+	while(char_itor.prev(&ch32))
+	{
+		if(!UNI_IS_REGIONAL(ch32))
+		{
+			char_itor.next(&ch32);
+			break;
+		}
+
+		count++;
+	}
+
+	// put the iterator back where it was
+	for(i = 0; i < count; i++)
+		char_itor.next(&ch32);
+
+	return count;
+}
+
+//
+//	LineIterator
+//
+LineIterator::LineIterator()
+	: m_pTextDoc(0), m_nLineNo(0), m_nFirstLine(0), m_nEndLine(0),
+	  m_nTextLine(0), m_nTextEnd(0), m_nTextLineChars(0), m_nRawOffset(0), m_nRawLength(0)
+{
+	memset(&m_Cursor, 0, sizeof(m_Cursor));
+}
+
+LineIterator::LineIterator(TextDocument *td, ULONG lineno, ULONG count)
+	: m_pTextDoc(td), m_nLineNo(lineno), m_nFirstLine(lineno), 
+	  m_nTextLine(0), m_nTextEnd(0), m_nTextLineChars(0), m_nRawOffset(0), m_nRawLength(0)
+{
+	memset(&m_Cursor, 0, sizeof(m_Cursor));
+	m_nEndLine = lineno + min(count, td->m_nNumLines - lineno);
+}
+
+//
+//	Return the line at the current position and move past it
+//
+bool LineIterator::next(ULONG *lineno, ULONG *offset_chars, ULONG *length_chars)
+{
+	const DOCLINE *line;
+
+	if(m_pTextDoc == 0 || m_nLineNo >= m_nEndLine)
+		return false;
+
+	line = m_pTextDoc->m_pIndex->lines.line(m_nLineNo, 0, offset_chars, &m_Cursor);
+
+	if(lineno)		 *lineno	   = m_nLineNo;
+	if(length_chars) *length_chars = line->length_chars;
+
+	m_nLineNo++;
+	return true;
+}
+
+//
+//	Move back to the previous line and return it
+//
+bool LineIterator::prev(ULONG *lineno, ULONG *offset_chars, ULONG *length_chars)
+{
+	const DOCLINE *line;
+
+	if(m_pTextDoc == 0 || m_nLineNo <= m_nFirstLine)
+		return false;
+
+	m_nLineNo--;
+
+	line = m_pTextDoc->m_pIndex->lines.line(m_nLineNo, 0, offset_chars, &m_Cursor);
+
+	if(lineno)		 *lineno	   = m_nLineNo;
+	if(length_chars) *length_chars = line->length_chars;
+
+	return true;
+}
+
+//
+//	As next/prev, but return the line's UTF-16 text as well
+//
+bool LineIterator::next_text(ULONG *lineno, ULONG *offset_chars, const TCHAR **text, ULONG *length_chars)
+{
+	if(!next(lineno, offset_chars, length_chars))
+		return false;
+
+	*text = fetch_text(m_nLineNo - 1, true);
+	return true;
+}
+
+bool LineIterator::prev_text(ULONG *lineno, ULONG *offset_chars, const TCHAR **text, ULONG *length_chars)
+{
+	if(!prev(lineno, offset_chars, length_chars))
+		return false;
+
+	*text = fetch_text(m_nLineNo, false);
+	return true;
+}
+
+//
+//	As next/prev, but return the line's raw data (in the document's own format)
+//
+bool LineIterator::next_raw(ULONG *lineno, ULONG *offset_bytes, const BYTE **data, ULONG *length_bytes)
+{
+	ULONG line = m_nLineNo;
+
+	if(!next(lineno))
+		return false;
+
+	*length_bytes = m_pTextDoc->m_pIndex->lines.line(line, offset_bytes, 0, &m_Cursor)->length_bytes;
+	*data		  = fetch_raw(line, true);
+	return true;
+}
+
+bool LineIterator::prev_raw(ULONG *lineno, ULONG *offset_bytes, const BYTE **data, ULONG *length_bytes)
+{
+	if(!prev(lineno))
+		return false;
+
+	*length_bytes = m_pTextDoc->m_pIndex->lines.line(m_nLineNo, offset_bytes, 0, &m_Cursor)->length_bytes;
+	*data		  = fetch_raw(m_nLineNo, false);
+	return true;
+}
+
+//
+//	Return a pointer to the specified line's text, decoding a whole window
+//	of lines in one go if it isn't in the buffer already. The window extends 
+//	ahead of the line when moving forwards, and behind it when moving backwards
+//
+const TCHAR *LineIterator::fetch_text(ULONG lineno, bool forwards)
+{
+	lineindex &lines = m_pTextDoc->m_pIndex->lines;
+	ULONG first, last, len;
+	ULONG start_bytes, start_chars, end_bytes, end_chars;
+
+	if(lineno < m_nTextLine || lineno >= m_nTextEnd)
+	{
+		lines.line(lineno, 0, &start_chars, &m_Cursor);
+
+		if(forwards)
+		{
+			first = lineno;
+			last  = start_chars + LINEITER_WINDOW >= lines.total_chars() ? lines.count() : lines.lineno_from_chars(start_chars + LINEITER_WINDOW);
+			last  = min(last, m_nEndLine);
+		}
+		else
+		{
+			last  = lineno + 1;
+			lines.line(last, 0, &end_chars);
+
+			first = lines.lineno_from_chars(end_chars - min(end_chars, LINEITER_WINDOW));
+
+			// the line that the window starts part-way through isn't included
+			if(lines.offset_chars(first) < end_chars - min(end_chars, LINEITER_WINDOW))
+				first++;
+
+			first = max(first, m_nFirstLine);
+		}
+
+		// always at least one line, however long it is
+		if(last <= lineno)	last  = lineno + 1;
+		if(first > lineno)	first = lineno;
+
+		lines.line(first, &start_bytes, &start_chars);
+		lines.line(last, &end_bytes, &end_chars);
+
+		len = end_chars - start_chars;
+
+		if(m_TextBuf.size() < len + 1)
+			m_TextBuf.resize(max(len + 1, LINEITER_WINDOW));
+
+		m_pTextDoc->gettext(start_bytes, end_bytes - start_bytes, &m_TextBuf[0], &len);
+
+		m_nTextLine		 = first;
+		m_nTextEnd		 = last;
+		m_nTextLineChars = start_chars;
+	}
+
+	return &m_TextBuf[0] + (lines.offset_chars(lineno) - m_nTextLineChars);
+}
+
+//
+//	Return a pointer to the specified line's raw data, reading in 
+//	a whole window at a time if it isn't in the buffer already
+//
+const BYTE *LineIterator::fetch_raw(ULONG lineno, bool forwards)
+{
+	ULONG offset;
+	ULONG length = m_pTextDoc->m_pIndex->lines.line(lineno, &offset, 0, &m_Cursor)->length_bytes;
+	ULONG doclen = m_pTextDoc->m_nDocLength_bytes - m_pTextDoc->m_nHeaderSize;
+	ULONG start;
+
+	if(offset < m_nRawOffset || offset + length > m_nRawOffset + m_nRawLength || m_RawBuf.empty())
+	{
+		if(m_RawBuf.size() < length + 1)
+			m_RawBuf.resize(max(length + 1, LINEITER_WINDOW));
+
+		// start at the line, or finish at the end of it
+		if(forwards || offset + length < m_RawBuf.size())
+			start = offset;
+		else
+			start = offset + length - m_RawBuf.size();
+
+		m_nRawOffset = start;
+		m_nRawLength = m_pTextDoc->m_seq.render(start + m_pTextDoc->m_nHeaderSize, &m_RawBuf[0], 
+							min(m_RawBuf.size(), doclen - start));
+	}
+
+	return &m_RawBuf[0] + (offset - m_nRawOffset);
+}
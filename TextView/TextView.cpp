@@ -47,6 +47,13 @@ TextView::TextView(HWND hwnd)
 	// File-related data
 	m_nLineCount   = 0;
 	m_nLongestLine = 0;	
+	m_szFileName[0] = '\0';
+
+	// not following any file
+	m_pFileWatch	 = 0;
+	m_hFollowThread	 = 0;
+	m_lFollowPending = 0;
+	m_fDocChangePending = FALSE;
 	
 
 	// Scrollbar related data
@@ -60,7 +67,6 @@ TextView::TextView(HWND hwnd)
 	m_uStyleFlags	 = 0;
 	m_nCaretWidth	 = 0;
 	m_nLongLineLimit = 80;
-	m_nLineInfoCount = 0;
 	m_nCRLFMode		 = TXL_CRLF;//ALL;
 
 	// allocate the USPDATA cache
@@ -116,6 +122,7 @@ TextView::TextView(HWND hwnd)
 	//SetRect(&m_rcBorder, 2, 2, 2, 2);
 
 	m_pTextDoc = new TextDocument();
+	m_pTextDoc->subscribe(DocChangeProc, this);
 
 	m_hMarginCursor = CreateCursor(GetModuleHandle(0), 21, 5, 32, 32, XORMask, ANDMask);
 	
@@ -138,8 +145,16 @@ TextView::TextView(HWND hwnd)
 //
 TextView::~TextView()
 {
+	StopFollowing();
+
 	if(m_pTextDoc)
-		delete m_pTextDoc;
+	{
+		m_pTextDoc->unsubscribe(DocChangeProc, this);
+		m_pTextDoc->Release();
+	}
+
+	for(markers::marker m = m_LineInfo.first(); m; m = m_LineInfo.next(m))
+		delete (LINEINFO *)m_LineInfo.param(m);
 
 	DestroyCursor(m_hMarginCursor);
 
@@ -256,55 +271,77 @@ LONG TextView::SetLongLine(int nLength)
 	return oldlen;
 }
 
-int CompareLineInfo(LINEINFO *elem1, LINEINFO *elem2)
-{
-	if(elem1->nLineNo < elem2->nLineNo)
-		return -1;
-	if(elem1->nLineNo > elem2->nLineNo)
-		return 1;
-	else
-		return 0;
-}
-
+//
+//	Set the image shown in the margin next to a line (-1 removes it)
+//
 int TextView::SetLineImage(ULONG nLineNo, ULONG nImageIdx)
 {
-	LINEINFO *linfo = GetLineInfo(nLineNo);
+	markers::marker m = m_LineInfo.first(nLineNo);
+	markers::marker next;
+	LINEINFO *linfo = 0;
 
-	// if already a line with an image
-	if(linfo)
+	// lines which were joined together can end up with more than one
+	while(m && m_LineInfo.position(m) == nLineNo)
 	{
-		linfo->nImageIdx = nImageIdx;
+		next = m_LineInfo.next(m);
+
+		if(linfo == 0 && nImageIdx != -1)
+		{
+			linfo = (LINEINFO *)m_LineInfo.param(m);
+		}
+		else
+		{
+			delete (LINEINFO *)m_LineInfo.param(m);
+			m_LineInfo.remove(m);
+		}
+
+		m = next;
 	}
-	else
-	{
-		linfo = &m_LineInfo[m_nLineInfoCount++];
-		linfo->nLineNo = nLineNo;
-		linfo->nImageIdx = nImageIdx;
-
-		// sort the array
-		qsort(
-			m_LineInfo, 
-			m_nLineInfoCount, 
-			sizeof(LINEINFO), 
-			(COMPAREPROC)CompareLineInfo
-			);
 
+	InvalidateLine(nLineNo, false);
+
+	if(nImageIdx == -1)
+		return 0;
+
+	if(linfo == 0)
+	{
+		linfo = new LINEINFO;
+		m_LineInfo.add(nLineNo, linfo);
 	}
+
+	linfo->nImageIdx = nImageIdx;
 	return 0;
 }
 
 LINEINFO* TextView::GetLineInfo(ULONG nLineNo)
 {
-	LINEINFO key = { nLineNo, 0 };
-
-	// perform the binary search
-	return (LINEINFO *)	bsearch(
-							&key, 
-							m_LineInfo,
-							m_nLineInfoCount, 
-							sizeof(LINEINFO), 
-							(COMPAREPROC)CompareLineInfo
-							);
+	markers::marker m = m_LineInfo.first(nLineNo);
+
+	if(m && m_LineInfo.position(m) == nLineNo)
+		return (LINEINFO *)m_LineInfo.param(m);
+	else
+		return 0;
+}
+
+//
+//	Move the line information up or down after an edit. Only the lines that
+//	started inside the erased text are lost (they end up on the edited line)
+//
+void TextView::UpdateLineInfo(DOCCHANGE *pChange)
+{
+	ULONG nLineNo;
+	ULONG nInserted;
+	LONG  nErased;
+
+	if(m_LineInfo.size() == 0)
+		return;
+
+	// how many line-breaks went in, and how many must have come out
+	nLineNo	  = m_pTextDoc->lineno_from_offset(pChange->offset_chars);
+	nInserted = m_pTextDoc->lineno_from_offset(pChange->offset_chars + pChange->insert_chars) - nLineNo;
+	nErased	  = nInserted - (pChange->insert_lines - pChange->erase_lines);
+
+	m_LineInfo.update(nLineNo, max(nErased, 0), nInserted);
 }
 
 ULONG TextView::SelectionSize()
@@ -328,7 +365,7 @@ ULONG TextView::SelectAll()
 //
 //	Public memberfunction 
 //
-LONG WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
+LRESULT WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	switch(msg)
 	{
@@ -402,6 +439,12 @@ LONG WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
 	case TXM_CANREDO: case EM_CANREDO:
 		return CanRedo();
 
+	case TXM_GETREVISION:
+		return GetRevision((ULONG *)lParam);
+
+	case TXM_GOTOREVISION:
+		return GotoRevision(wParam);
+
 	case WM_CHAR:
 		return OnChar(wParam, lParam);
 
@@ -434,6 +477,9 @@ LONG WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
 	case TXM_OPENFILE:
 		return OpenFile((TCHAR *)lParam);
 
+	case TXM_SAVEFILE:
+		return SaveFile((TCHAR *)lParam, (int)wParam);
+
 	case TXM_CLEAR:
 		return ClearFile();
 
@@ -462,7 +508,31 @@ LONG WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
 		return SetLineImage(wParam, lParam);
 
 	case TXM_GETFORMAT:
-		return m_pTextDoc->getformat();
+		return m_pTextDoc->getformat((int *)lParam);
+
+	case TXM_GETSTATS:
+		return GetStats((TVSTATS *)lParam);
+
+	case TXM_SETLINEENDING:
+		return SetLineEnding((UINT)wParam);
+
+	case TXM_FOLLOWFILE:
+		return FollowFile((BOOL)wParam);
+
+	case TXM_FILECHANGED:
+		return OnFileChanged();
+
+	case TXM_RELOADFILE:
+		return ReloadFile();
+
+	case TXM_GETDOCUMENT:
+		return (LRESULT)m_pTextDoc;
+
+	case TXM_SETDOCUMENT:
+		return SetDocument((TextDocument *)lParam);
+
+	case TXM_DOCCHANGED:
+		return OnDocChanged();
 
 	case TXM_GETSELSIZE:
 		return SelectionSize();
@@ -478,11 +548,11 @@ LONG WINAPI TextView::WndProc(UINT msg, WPARAM wParam, LPARAM lParam)
 
 	case TXM_GETCURCOL:
 		ULONG nOffset;
-		GetUspData(0, m_nCurrentLine, &nOffset);
+		m_pTextDoc->lineinfo_from_lineno(m_nCurrentLine, &nOffset, 0, 0, 0);
 		return m_nCursorOffset - nOffset;
 
 	case TXM_GETEDITMODE:
-		return m_nEditMode;
+		return m_pTextDoc->readonly() ? MODE_READONLY : m_nEditMode;
 
 	case TXM_SETEDITMODE:
 		lParam		= m_nEditMode;
@@ -516,7 +586,7 @@ LRESULT WINAPI TextViewWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
 		if((ptv = new TextView(hwnd)) == 0)
 			return FALSE;
 
-		SetWindowLongPtr(hwnd, 0, (LONG)ptv);
+		SetWindowLongPtr(hwnd, 0, (LONG_PTR)ptv);
 		return TRUE;
 
 	// Last message received by any window - delete the TextView object
@@ -135,6 +135,22 @@ LIB32=link.exe -lib
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=.\FileIO.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\FileZip.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\lineindex.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\markers.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\sequence.cpp
 # End Source File
 # Begin Source File
@@ -143,6 +159,18 @@ SOURCE=.\TextDocument.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\TextDocumentReload.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\TextDocumentSave.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\TextIterator.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\TextView.cpp
 # End Source File
 # Begin Source File
@@ -195,6 +223,26 @@ SOURCE=.\codepages.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\FileIO.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\FileZip.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\lineindex.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\markers.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\portable.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\sequence.h
 # End Source File
 # Begin Source File
@@ -20,16 +20,8 @@ BOOL	 InitTextView();
 HWND	 CreateTextView(HWND hwndParent);
 COLORREF RealizeColour(COLORREF col);
 
-
-//
-// currently supported Neatpad Codepages
-//
-#define NCP_ASCII		0
-#define NCP_UTF8		1
-#define NCP_UTF16		2
-#define NCP_UTF16BE		3
-#define NCP_UTF32		4
-#define NCP_UTF32BE		5
+// currently supported Neatpad Codepages (NCP_xxx)
+#include "codepages.h"
 
 //
 //	TextView edit modes
@@ -67,6 +59,15 @@ COLORREF RealizeColour(COLORREF col);
 #define TXM_SETEDITMODE			(TXM_BASE + 22)
 #define TXM_GETEDITMODE			(TXM_BASE + 23)
 #define TXM_SETCONTEXTMENU		(TXM_BASE + 24)
+#define TXM_SAVEFILE			(TXM_BASE + 25)
+#define TXM_GETSTATS			(TXM_BASE + 26)
+#define TXM_SETLINEENDING		(TXM_BASE + 27)
+#define TXM_FOLLOWFILE			(TXM_BASE + 28)
+#define TXM_RELOADFILE			(TXM_BASE + 29)
+#define TXM_GETDOCUMENT			(TXM_BASE + 30)
+#define TXM_SETDOCUMENT			(TXM_BASE + 31)
+#define TXM_GETREVISION			(TXM_BASE + 32)
+#define TXM_GOTOREVISION		(TXM_BASE + 33)
 
 //
 //	TextView Notification Messages defined here - 
@@ -77,6 +78,7 @@ COLORREF RealizeColour(COLORREF col);
 #define TVN_SELECTION_CHANGE	(TVN_BASE + 1)
 #define TVN_EDITMODE_CHANGE		(TVN_BASE + 2)
 #define TVN_CHANGED				(TVN_BASE + 3)
+#define TVN_EDIT				(TVN_BASE + 4)
 
 typedef struct
 {
@@ -86,6 +88,40 @@ typedef struct
 	ULONG	nOffset;
 } TVNCURSORINFO;
 
+//
+//	Sent with TVN_EDIT as soon as the document changes (by any view
+//	that shares it), so that anything worked out from the text only
+//	needs redoing where it changed. TVN_CHANGED follows later on
+//
+typedef struct
+{
+	NMHDR	hdr;
+	ULONG	nRevision;		// goes up by one with every change
+	ULONG	nOffset;		// where the change was, in UTF-16 characters
+	ULONG	nErased;
+	ULONG	nInserted;
+	ULONG	nLineNo;		// the lines from here...
+	ULONG	nLinesErased;	// ...were replaced by this many new ones
+	ULONG	nLinesInserted;
+	BOOL	fReset;			// the whole document is different
+} TVNEDITINFO;
+
+//
+//	Document statistics (returned by TXM_GETSTATS)
+//
+typedef struct
+{
+	ULONG	nBytes;			// size of the file, including any byte-order-mark
+	ULONG	nChars;			// length in UTF-16 code-units
+	ULONG	nCodePoints;
+	ULONG	nWords;			// runs of anything but white-space
+	ULONG	nLines;
+	ULONG	nCRLF;			// number of each type of line-ending
+	ULONG	nLF;
+	ULONG	nCR;
+	ULONG	nOtherEOL;		// VT, FF, NEL, LS and PS
+} TVSTATS;
+
 //
 //	TextView Window Styles defined here
 //	(set using TXM_SETSTYLE)
@@ -103,6 +139,7 @@ typedef struct
 #define TXL_CR				2		// carriage-return
 #define TXL_CRLF			4		// carriage-return, line-feed (default)
 #define TXL_ALL				7		// allow all forms regardless
+#define TXL_LS				8		// unicode line-separator (TXM_SETLINEENDING only)
 
 //
 //	TextView Macros defined here
@@ -142,6 +179,35 @@ typedef struct
 #define TextView_OpenFile(hwndTV, szFile)	\
 	SendMessage((hwndTV), TXM_OPENFILE, 0, (LPARAM)(TCHAR *)(szFile))
 
+#define TextView_SaveFile(hwndTV, szFile, nFormat)	\
+	SendMessage((hwndTV), TXM_SAVEFILE, (WPARAM)(int)(nFormat), (LPARAM)(TCHAR *)(szFile))
+
+#define TextView_GetStats(hwndTV, pStats) \
+	SendMessage((hwndTV), TXM_GETSTATS, 0, (LPARAM)(TVSTATS *)(pStats))
+
+#define TextView_SetLineEnding(hwndTV, nMode) \
+	SendMessage((hwndTV), TXM_SETLINEENDING, (WPARAM)(UINT)(nMode), 0)
+
+#define TextView_FollowFile(hwndTV, fFollow) \
+	SendMessage((hwndTV), TXM_FOLLOWFILE, (WPARAM)(BOOL)(fFollow), 0)
+
+#define TextView_ReloadFile(hwndTV) \
+	SendMessage((hwndTV), TXM_RELOADFILE, 0, 0)
+
+// the document can be shared with other TextViews, and lives until the last one lets go
+#define TextView_GetDocument(hwndTV) \
+	(HANDLE)SendMessage((hwndTV), TXM_GETDOCUMENT, 0, 0)
+
+#define TextView_SetDocument(hwndTV, hDoc) \
+	SendMessage((hwndTV), TXM_SETDOCUMENT, 0, (LPARAM)(HANDLE)(hDoc))
+
+// the undo history is a tree - every edit is numbered, and any of them can be gone back to
+#define TextView_GetRevision(hwndTV, pnCount) \
+	SendMessage((hwndTV), TXM_GETREVISION, 0, (LPARAM)(ULONG *)(pnCount))
+
+#define TextView_GotoRevision(hwndTV, nRevision) \
+	SendMessage((hwndTV), TXM_GOTOREVISION, (WPARAM)(ULONG)(nRevision), 0)
+
 #define TextView_Clear(hwndTV)	\
 	SendMessage((hwndTV), TXM_CLEAR, 0, 0)
 
@@ -169,12 +235,16 @@ typedef struct
 #define TextView_SetLongLine(hwndTV, nLength) \
 	SendMessage((hwndTV), TXM_SETLONGLINE, (WPARAM)(0), (LPARAM)(nLength))
 
+// the image stays with its line as lines are added and removed above it (-1 removes it)
 #define TextView_SetLineImage(hwndTV, nLineNo, nImageIdx) \
 	SendMessage((hwndTV), TXM_SETLINEIMAGE, (WPARAM)(ULONG)(nLineNo), (LPARAM)(ULONG)nImageIdx)
 
 #define TextView_GetFormat(hwndTV) \
 	SendMessage((hwndTV), TXM_GETFORMAT, 0, 0)
 
+#define TextView_GetFormatEx(hwndTV, pnConfidence) \
+	SendMessage((hwndTV), TXM_GETFORMAT, 0, (LPARAM)(int *)(pnConfidence))
+
 #define TextView_Undo(hwndTV) \
 	SendMessage((hwndTV), TXM_UNDO, 0, 0)
 
@@ -21,6 +21,9 @@ LONG TextView::OpenFile(TCHAR *szFileName)
 {
 	ClearFile();
 
+	// kept even if it can't be loaded yet, so an empty file can still be followed
+	lstrcpyn(m_szFileName, szFileName, MAX_PATH);
+
 	if(m_pTextDoc->init(szFileName))
 	{
 		m_nLineCount   = m_pTextDoc->linecount();
@@ -43,16 +46,371 @@ LONG TextView::OpenFile(TCHAR *szFileName)
 }
 
 //
+//	Save the document in the specified format (NCP_xxx). The existing
+//	byte-order-mark is kept when the format isn't changing, otherwise
+//	one is only added for UTF-16 and UTF-32, which can't do without
+//
+LONG TextView::SaveFile(TCHAR *szFileName, int nFormat)
+{
+	int  nCurrent = m_pTextDoc->getformat();
+	bool fBOM;
+
+	if(nFormat == nCurrent)
+		fBOM = m_pTextDoc->m_nHeaderSize > 0;
+	else
+		fBOM = nFormat != NCP_ASCII && nFormat != NCP_UTF8;
+
+	return m_pTextDoc->save(szFileName, nFormat, fBOM) ? TRUE : FALSE;
+}
+
 //
+//	Return the document statistics. The TextDocument keeps these 
+//	up-to-date as it is edited, so nothing needs to be scanned here
 //
-LONG TextView::ClearFile()
+LONG TextView::GetStats(TVSTATS *pStats)
+{
+	ULONG eols[EOL_TYPES];
+
+	m_pTextDoc->getstats(&pStats->nWords, &pStats->nCodePoints, eols);
+
+	pStats->nBytes		= m_pTextDoc->m_nDocLength_bytes;
+	pStats->nChars		= m_pTextDoc->m_pIndex->lines.total_chars();
+	pStats->nLines		= m_pTextDoc->linecount();
+	pStats->nCRLF		= eols[EOL_CRLF];
+	pStats->nLF			= eols[EOL_LF];
+	pStats->nCR			= eols[EOL_CR];
+	pStats->nOtherEOL	= eols[EOL_OTHER];
+
+	return TRUE;
+}
+
+//
+//	Choose what CR, LF and CR/LF are all turned into the next time 
+//	the file is saved (TXL_xxx, or zero to leave them as they are)
+//
+LONG TextView::SetLineEnding(UINT nMode)
+{
+	switch(nMode)
+	{
+	case TXL_CRLF:	m_pTextDoc->setlineending(EOL_CRLF);	break;
+	case TXL_LF:	m_pTextDoc->setlineending(EOL_LF);		break;
+	case TXL_CR:	m_pTextDoc->setlineending(EOL_CR);		break;
+	case TXL_LS:	m_pTextDoc->setlineending(EOL_OTHER);	break;
+	default:		m_pTextDoc->setlineending(EOL_NONE);	break;
+	}
+
+	return TRUE;
+}
+
+//
+//	Follow the file that was opened, like "tail -f" - anything appended to
+//	it is added to the end of the document as it arrives (see OnFileChanged)
+//
+LONG TextView::FollowFile(BOOL fFollow)
 {
-	if(m_pTextDoc)
+	DWORD dwThreadId;
+
+	if(!fFollow)
+	{
+		StopFollowing();
+		return TRUE;
+	}
+
+	if(m_pFileWatch)
+		return TRUE;
+
+	if(m_szFileName[0] == '\0' || (m_pFileWatch = file_watch_start(m_szFileName)) == 0)
+		return FALSE;
+
+	m_lFollowPending = 0;
+	m_hFollowThread  = CreateThread(0, 0, FollowThread, this, 0, &dwThreadId);
+
+	if(m_hFollowThread == 0)
+	{
+		file_watch_close(m_pFileWatch);
+		m_pFileWatch = 0;
+		return FALSE;
+	}
+
+	// catch up with anything written since the file was opened
+	OnFileChanged();
+	return TRUE;
+}
+
+void TextView::StopFollowing()
+{
+	if(m_pFileWatch == 0)
+		return;
+
+	file_watch_stop(m_pFileWatch);
+
+	WaitForSingleObject(m_hFollowThread, INFINITE);
+	CloseHandle(m_hFollowThread);
+
+	file_watch_close(m_pFileWatch);
+
+	m_pFileWatch	= 0;
+	m_hFollowThread = 0;
+}
+
+//
+//	Wait for the file to change, and tell the window about it. Only one 
+//	message is posted at a time, so a file that is written to faster than
+//	it can be displayed doesn't flood the message queue
+//
+DWORD WINAPI TextView::FollowThread(LPVOID param)
+{
+	TextView *ptv = (TextView *)param;
+
+	while(file_watch_wait(ptv->m_pFileWatch))
+	{
+		if(InterlockedExchange(&ptv->m_lFollowPending, 1) == 0)
+			PostMessage(ptv->m_hWnd, TXM_FILECHANGED, 0, 0);
+	}
+
+	return 0;
+}
+
+//
+//	The file being followed has changed - add whatever has been appended
+//	to the document. If the last line was in view it stays in view
+//
+LONG TextView::OnFileChanged()
+{
+	FILEHANDLE hFile;
+	ULONG	   nAdded;
+	bool	   fAtEnd = m_nVScrollPos + m_nWindowLines >= m_nLineCount;
+
+	// the message might have been on its way when following stopped
+	if(m_pFileWatch == 0)
+		return 0;
+
+	// anything written from now on needs another look
+	InterlockedExchange(&m_lFollowPending, 0);
+
+	// the file isn't kept open in between, so it can still be rotated or deleted
+	if((hFile = file_open(m_szFileName)) == INVALID_FILEHANDLE)
+		return 0;
+
+	nAdded = m_pTextDoc->append_file(hFile);
+	file_close(hFile);
+
+	if(nAdded == 0)
+		return 0;
+
+	// truncated or replaced - load it again from scratch, still following it
+	if(nAdded == FILE_BADSIZE)
 	{
 		m_pTextDoc->clear();
-		m_pTextDoc->EmptyDoc();
+
+		if(!m_pTextDoc->init(m_szFileName))
+			m_pTextDoc->EmptyDoc();
+
+		m_nVScrollPos		= 0;
+		m_nHScrollPos		= 0;
+		m_nSelectionStart	= 0;
+		m_nSelectionEnd		= 0;
+		m_nCursorOffset		= 0;
+		m_nCurrentLine		= 0;
+		m_nCaretPosX		= 0;
+		fAtEnd				= true;
 	}
 
+	// only the new lines need drawing (see OnDocumentChange)
+	UpdateLineCount();
+
+	if(fAtEnd && m_nVScrollPos + m_nWindowLines < m_nLineCount)
+	{
+		m_nVScrollPos = m_nLineCount - m_nWindowLines;
+
+		SetupScrollbars();
+		RefreshWindow();
+		RepositionCaret();
+	}
+
+	NotifyParent(TVN_CHANGED);
+	return TRUE;
+}
+
+//
+//	Reload the current file after it has been changed elsewhere. Only the
+//	parts which are different get replaced, so the view stays where it is
+//
+LONG TextView::ReloadFile()
+{
+	ULONG nLength;
+	BOOL  fSuccess;
+
+	if(m_szFileName[0] == '\0')
+		return FALSE;
+
+	fSuccess = m_pTextDoc->reload(m_szFileName) ? TRUE : FALSE;
+	nLength  = m_pTextDoc->m_nDocLength_chars;
+
+	m_nSelectionStart	= min(m_nSelectionStart, nLength);
+	m_nSelectionEnd		= min(m_nSelectionEnd,	 nLength);
+	m_nCursorOffset		= min(m_nCursorOffset,	 nLength);
+
+	UpdateLineCount();
+
+	UpdateCaretOffset(m_nCursorOffset, FALSE, &m_nCaretPosX, &m_nCurrentLine);
+	m_nAnchorPosX = m_nCaretPosX;
+	RepositionCaret();
+
+	NotifyParent(TVN_CHANGED);
+	return fSuccess;
+}
+
+//
+//	Look at a document which belongs to another TextView. Both views
+//	can edit it, and each keeps its own caret, selection and scroll position
+//
+LONG TextView::SetDocument(TextDocument *pTextDoc)
+{
+	if(pTextDoc == 0)
+		return FALSE;
+
+	if(pTextDoc == m_pTextDoc)
+		return TRUE;
+
+	// following belongs to whichever view opened the file
+	StopFollowing();
+	m_szFileName[0] = '\0';
+
+	pTextDoc->AddRef();
+
+	m_pTextDoc->unsubscribe(DocChangeProc, this);
+	m_pTextDoc->Release();
+
+	m_pTextDoc = pTextDoc;
+	m_pTextDoc->subscribe(DocChangeProc, this);
+
+	m_nVScrollPos		= 0;
+	m_nHScrollPos		= 0;
+	m_nSelectionStart	= 0;
+	m_nSelectionEnd		= 0;
+	m_nCursorOffset		= 0;
+
+	ResetLineCache();
+	RefreshWindow();
+
+	OnDocChanged();
+	return TRUE;
+}
+
+//
+//	Called by the document whenever it is changed, by this view or any other.
+//	Positions after the change move with the text around them, and anything
+//	inside a part that was erased moves to where it was. A view's own edits
+//	set its caret afterwards, and are unaffected because positions at the
+//	start of the change stay where they are
+//
+void TextView::DocChangeProc(void *param, DOCCHANGE *pChange)
+{
+	((TextView *)param)->OnDocumentChange(pChange);
+}
+
+static ULONG ShiftOffset(ULONG nOffset, DOCCHANGE *pChange)
+{
+	ULONG nEnd = pChange->offset_chars + pChange->erase_chars;
+
+	if(nOffset <= pChange->offset_chars)
+		return nOffset;
+	else if(nOffset <= nEnd)
+		return pChange->offset_chars;
+	else
+		return nOffset - pChange->erase_chars + pChange->insert_chars;
+}
+
+void TextView::OnDocumentChange(DOCCHANGE *pChange)
+{
+	ULONG		nLength = m_pTextDoc->m_nDocLength_chars;
+	TVNEDITINFO	tvnEdit;
+
+	if(pChange->reset)
+	{
+		m_nSelectionStart	= min(m_nSelectionStart, nLength);
+		m_nSelectionEnd		= min(m_nSelectionEnd,	 nLength);
+		m_nCursorOffset		= min(m_nCursorOffset,	 nLength);
+
+		ResetLineCache();
+		RefreshWindow();
+	}
+	else
+	{
+		m_nSelectionStart	= ShiftOffset(m_nSelectionStart, pChange);
+		m_nSelectionEnd		= ShiftOffset(m_nSelectionEnd,	 pChange);
+		m_nCursorOffset		= ShiftOffset(m_nCursorOffset,	 pChange);
+
+		// only the lines that were rescanned need analyzing and drawing again,
+		// unless the number of lines changed and the rest have moved as well
+		UpdateLineCache(pChange->lineno, pChange->erase_lines, pChange->insert_lines, 
+						pChange->insert_chars - pChange->erase_chars);
+
+		UpdateLineInfo(pChange);
+
+		if(pChange->erase_lines == pChange->insert_lines)
+			InvalidateLines(pChange->lineno, pChange->insert_lines);
+		else
+			InvalidateLines(pChange->lineno, -1);
+	}
+
+	tvnEdit.nRevision		= pChange->revision;
+	tvnEdit.nOffset			= pChange->offset_chars;
+	tvnEdit.nErased			= pChange->erase_chars;
+	tvnEdit.nInserted		= pChange->insert_chars;
+	tvnEdit.nLineNo			= pChange->lineno;
+	tvnEdit.nLinesErased	= pChange->erase_lines;
+	tvnEdit.nLinesInserted	= pChange->insert_lines;
+	tvnEdit.fReset			= pChange->reset;
+
+	NotifyParent(TVN_EDIT, (NMHDR *)&tvnEdit);
+
+	// the line and scrollbar information is worked out once the edit has finished
+	if(!m_fDocChangePending)
+	{
+		m_fDocChangePending = TRUE;
+		PostMessage(m_hWnd, TXM_DOCCHANGED, 0, 0);
+	}
+}
+
+LONG TextView::OnDocChanged()
+{
+	m_fDocChangePending = FALSE;
+
+	UpdateLineCount();
+
+	UpdateCaretOffset(m_nCursorOffset, FALSE, &m_nCaretPosX, &m_nCurrentLine);
+	m_nAnchorPosX = m_nCaretPosX;
+	RepositionCaret();
+
+	NotifyParent(TVN_CHANGED);
+	return TRUE;
+}
+
+//
+//
+//
+LONG TextView::ClearFile()
+{
+	StopFollowing();
+	m_szFileName[0] = '\0';
+
+	// a shared document is left alone - this view gets one of its own
+	if(m_pTextDoc->m_nRefCount > 1)
+	{
+		TextDocument *pTextDoc = new TextDocument();
+
+		m_pTextDoc->unsubscribe(DocChangeProc, this);
+		m_pTextDoc->Release();
+
+		m_pTextDoc = pTextDoc;
+		m_pTextDoc->subscribe(DocChangeProc, this);
+	}
+
+	m_pTextDoc->clear();
+	m_pTextDoc->EmptyDoc();
+
 	ResetLineCache();
 
 	m_nLineCount		= m_pTextDoc->linecount();
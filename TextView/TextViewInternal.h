@@ -1,7 +1,6 @@
 #ifndef TEXTVIEW_INTERNAL_INCLUDED
 #define TEXTVIEW_INTERNAL_INCLUDED
 
-#define TEXTBUFSIZE  128
 #define LINENO_FMT  _T(" %2d ")
 #define LINENO_PAD	 8
 
@@ -22,35 +21,51 @@ typedef struct
 {
 	USPDATA *uspData;
 	ULONG	 lineno;		// line#
-	ULONG	 offset;		// offset (in WCHAR's) of this line
+	ULONG	 offset;		// offset (in WCHAR's) of the analyzed text - the start
+							// of the line, or of the window into a very long line
 	ULONG	 usage;			// cache-count
 
 	int		 length;		// length in chars INCLUDING CR/LF
 	int		 length_CRLF;	// length in chars EXCLUDING CR/LF
 
+	int		 xoffset;		// x-coordinate of the analyzed text within the line
+	ULONG	 lineoff;		// offset (in WCHAR's) of the whole line
+	ULONG	 linelen;		// length of the whole line INCLUDING CR/LF
+
 } USPCACHE;
 
 typedef const SCRIPT_LOGATTR CSCRIPT_LOGATTR;
 
 #define USP_CACHE_SIZE 200
 
+// posted by the thread that watches a file being followed
+#define TXM_FILECHANGED		(TXM_BASE + 0x100)
+
+// posted when a shared document has been changed (see OnDocumentChange)
+#define TXM_DOCCHANGED		(TXM_BASE + 0x101)
+
 //
-//	LINEINFO - information about a specific line
+//	Lines longer than USP_WINDOW_SIZE are only ever analyzed a 
+//	window at a time. The caret is kept at least USP_WINDOW_MARGIN 
+//	characters away from the edges of a window (unless that's the end
+//	of the line), so that keyboard navigation never falls off the edge
+//
+#define USP_WINDOW_SIZE		0x2000
+#define USP_WINDOW_MARGIN	0x400
+
+//
+//	LINEINFO - information about a specific line. These are kept in a
+//	markers tree by line number (m_LineInfo), so there can be any number
+//	of them, and they move up and down as lines are added and removed
 //
 typedef struct
 {
-	ULONG	nLineNo;
 	int		nImageIdx;
 
 	// more here in the future?
 
 } LINEINFO;
 
-typedef int (__cdecl * COMPAREPROC) (const void *, const void *);
-
-// maximum number of lines that we can hold info for at one time
-#define MAX_LINE_INFO 128	
-
 // maximum fonts that a TextView can hold
 #define MAX_FONTS 32
 
@@ -73,7 +88,7 @@ public:
 	TextView(HWND hwnd);
 	~TextView();
 
-	LONG WINAPI WndProc(UINT msg, WPARAM wParam, LPARAM lParam);
+	LRESULT WINAPI WndProc(UINT msg, WPARAM wParam, LPARAM lParam);
 
 private:
 
@@ -88,6 +103,8 @@ private:
 	LONG OnHScroll(UINT nSBCode, UINT nPos);
 	LONG OnMouseWheel(int nDelta);
 	LONG OnTimer(UINT nTimer);
+	LONG OnFileChanged();
+	LONG OnDocChanged();
 
 	LONG OnMouseActivate(HWND hwndTop, UINT nHitTest, UINT nMessage);
 	LONG OnContextMenu(HWND wParam, int x, int y);
@@ -114,8 +131,16 @@ private:
 	//	Internal private functions
 	//
 	LONG		OpenFile(TCHAR *szFileName);
+	LONG		SaveFile(TCHAR *szFileName, int nFormat);
+	LONG		GetStats(TVSTATS *pStats);
+	LONG		SetLineEnding(UINT nMode);
+	LONG		FollowFile(BOOL fFollow);
+	void		StopFollowing();
+	LONG		ReloadFile();
+	LONG		SetDocument(TextDocument *pTextDoc);
 	LONG		ClearFile();
 	void		ResetLineCache();
+	void		UpdateLineCache(ULONG nLineNo, ULONG nErased, ULONG nInserted, ULONG nDelta);
 	ULONG		GetText(TCHAR *szDest, ULONG nStartOffset, ULONG nLength);
 	
 	//
@@ -137,11 +162,12 @@ private:
 
 	LONG		InvalidateRange(ULONG nStart, ULONG nFinish);
 	LONG		InvalidateLine(ULONG nLineNo, bool forceAnalysis);
+	LONG		InvalidateLines(ULONG nLineNo, ULONG nCount);
 	VOID		UpdateLine(ULONG nLineNo);
 
 	
 	int			ApplyTextAttributes(ULONG nLineNo, ULONG offset, ULONG &nColumn, TCHAR *szText, int nTextLen, ATTR *attr);
-	int			ApplySelection(USPDATA *uspData, ULONG nLineNo, ULONG nOffset, ULONG nTextLen);
+	int			ApplySelection(USPDATA *uspData, ULONG nLineNo, ULONG nOffset, ULONG nTextLen, int xoffset);
 	int			SyntaxColour(TCHAR *szText, ULONG nTextLen, ATTR *attr);
 	int			StripCRLF(TCHAR *szText, ATTR *attrList, int nLength, bool fAllow);
 	void		MarkCRLF(USPDATA *uspData, TCHAR *szText, int nLength, ATTR *attr);
@@ -163,6 +189,7 @@ private:
 	//int		TabWidth();
 	int			LeftMarginWidth();
 	void		UpdateMarginWidth();
+	void		UpdateLineCount();
 	int			SetCaretWidth(int nWidth);
 	BOOL		SetImageList(HIMAGELIST hImgList);
 	int			SetLineImage(ULONG nLineNo, ULONG nImageIdx);
@@ -200,6 +227,8 @@ private:
 	BOOL		Redo();
 	BOOL		CanUndo();
 	BOOL		CanRedo();
+	ULONG		GetRevision(ULONG *pnCount);
+	BOOL		GotoRevision(ULONG nRevision);
 	BOOL		ForwardDelete();
 	BOOL		BackDelete();
 	ULONG		EnterText(TCHAR *szText, ULONG nLength);
@@ -248,6 +277,13 @@ private:
 
 	// File-related data
 	ULONG		m_nLineCount;
+	TCHAR		m_szFileName[MAX_PATH];
+
+	// Following a file that is being appended to
+	FILEWATCH  *m_pFileWatch;
+	HANDLE		m_hFollowThread;
+	LONG		m_lFollowPending;
+	static DWORD WINAPI FollowThread(LPVOID param);
 
 	// Font-related data	
 	USPFONT		m_uspFontList[MAX_FONTS];
@@ -290,8 +326,8 @@ private:
 	int			m_nLongLineLimit;
 	int			m_nCRLFMode;
 	
-	LINEINFO	m_LineInfo[MAX_LINE_INFO];
-	int			m_nLineInfoCount;
+	markers		m_LineInfo;
+	void		UpdateLineInfo(DOCCHANGE *pChange);
 
 	// Margin information
 	int			m_nLinenoWidth;
@@ -311,10 +347,15 @@ private:
 	// Cache for USPDATA objects
 	USPCACHE    *m_uspCache;
 	USPDATA		*GetUspData(HDC hdc, ULONG nLineNo, ULONG *nOffset=0);
-	USPCACHE    *GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset=0);
-	bool		 GetLogAttr(ULONG nLineNo, USPCACHE **puspCache, CSCRIPT_LOGATTR **plogAttr=0, ULONG *pnOffset=0);
+	USPCACHE    *GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset=0, ULONG nNearOffset=-1);
+	bool		 GetLogAttr(ULONG nLineNo, USPCACHE **puspCache, CSCRIPT_LOGATTR **plogAttr=0, ULONG *pnOffset=0, ULONG nNearOffset=-1);
+	ULONG		 ColumnToOffset(ULONG nLineNo, ULONG nColumn);
 
+	// the document, which other TextViews might be looking at too
 	TextDocument *m_pTextDoc;
+	BOOL		  m_fDocChangePending;
+	void		  OnDocumentChange(DOCCHANGE *pChange);
+	static void	  DocChangeProc(void *param, DOCCHANGE *pChange);
 };
 
 #endif
\ No newline at end of file
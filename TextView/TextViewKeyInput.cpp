@@ -62,7 +62,7 @@ ULONG TextView::EnterText(TCHAR *szText, ULONG nLength)
 		else
 		{
 			ULONG lineoff;
-			USPCACHE *uspCache = GetUspCache(0, m_nCurrentLine, &lineoff);
+			USPCACHE *uspCache = GetUspCache(0, m_nCurrentLine, &lineoff, m_nCursorOffset);
 
 			// single-character overwrite - must behave like 'forward delete'
 			// and remove a whole character-cluster (i.e. maybe more than 1 char)
@@ -97,9 +97,7 @@ ULONG TextView::EnterText(TCHAR *szText, ULONG nLength)
 	m_nSelectionEnd   = m_nCursorOffset;
 
 	// we altered the document, recalculate line+scrollbar information
-	ResetLineCache();
-	RefreshWindow();
-	
+	// (the lines that changed were invalidated by OnDocumentChange)
 	Smeg(TRUE);
 	NotifyParent(TVN_CURSOR_CHANGE);
 
@@ -155,8 +153,6 @@ BOOL TextView::ForwardDelete()
 	m_nSelectionStart = m_nCursorOffset;
 	m_nSelectionEnd   = m_nCursorOffset;
 
-	ResetLineCache();
-	RefreshWindow();
 	Smeg(FALSE);
 
 	return TRUE;
@@ -187,8 +183,6 @@ BOOL TextView::BackDelete()
 	m_nSelectionStart = m_nCursorOffset;
 	m_nSelectionEnd   = m_nCursorOffset;
 
-	ResetLineCache();
-	RefreshWindow();
 	Smeg(FALSE);
 
 	return TRUE;
@@ -196,13 +190,7 @@ BOOL TextView::BackDelete()
 
 void TextView::Smeg(BOOL fAdvancing)
 {
-	m_pTextDoc->init_linebuffer();
-
-	m_nLineCount   = m_pTextDoc->linecount();
-
-	UpdateMetrics();
-	UpdateMarginWidth();
-	SetupScrollbars();
+	UpdateLineCount();
 
 	UpdateCaretOffset(m_nCursorOffset, fAdvancing, &m_nCaretPosX, &m_nCurrentLine);
 	
@@ -216,13 +204,16 @@ BOOL TextView::Undo()
 	if(m_nEditMode == MODE_READONLY)
 		return FALSE;
 
+	// the old selection is drawn normally again
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
+
 	if(!m_pTextDoc->Undo(&m_nSelectionStart, &m_nSelectionEnd))
 		return FALSE;
 
 	m_nCursorOffset = m_nSelectionEnd;
 
-	ResetLineCache();
-	RefreshWindow();
+	// each event that was put back has redrawn the lines it changed
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
 
 	Smeg(m_nSelectionStart != m_nSelectionEnd);
 
@@ -234,18 +225,52 @@ BOOL TextView::Redo()
 	if(m_nEditMode == MODE_READONLY)
 		return FALSE;
 
+	// the old selection is drawn normally again
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
+
 	if(!m_pTextDoc->Redo(&m_nSelectionStart, &m_nSelectionEnd))
 		return FALSE;
 
 	m_nCursorOffset = m_nSelectionEnd;
-				
-	ResetLineCache();
-	RefreshWindow();
+
+	// each event that was put back has redrawn the lines it changed
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
+	Smeg(m_nSelectionStart != m_nSelectionEnd);
+
+	return TRUE;
+}
+
+//
+//	Put the document back to how it was after any edit in the undo history
+//
+BOOL TextView::GotoRevision(ULONG nRevision)
+{
+	if(m_nEditMode == MODE_READONLY)
+		return FALSE;
+
+	// the old selection is drawn normally again
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
+
+	if(!m_pTextDoc->GotoRevision(nRevision, &m_nSelectionStart, &m_nSelectionEnd))
+		return FALSE;
+
+	m_nCursorOffset = m_nSelectionEnd;
+
+	// each event that was put back has redrawn the lines it changed
+	InvalidateRange(m_nSelectionStart, m_nSelectionEnd);
 	Smeg(m_nSelectionStart != m_nSelectionEnd);
 
 	return TRUE;
 }
 
+ULONG TextView::GetRevision(ULONG *pnCount)
+{
+	if(pnCount)
+		*pnCount = m_pTextDoc->UndoRevisionCount();
+
+	return m_pTextDoc->UndoRevision();
+}
+
 BOOL TextView::CanUndo()
 {
 	return m_pTextDoc->m_seq.canundo() ? TRUE : FALSE;
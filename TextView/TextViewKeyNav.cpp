@@ -33,9 +33,9 @@ bool IsKeyPressed(UINT nVirtKey)
 //
 //	Get the UspCache and logical attributes for specified line
 //
-bool TextView::GetLogAttr(ULONG nLineNo, USPCACHE **puspCache, CSCRIPT_LOGATTR **plogAttr, ULONG *pnOffset)
+bool TextView::GetLogAttr(ULONG nLineNo, USPCACHE **puspCache, CSCRIPT_LOGATTR **plogAttr, ULONG *pnOffset, ULONG nNearOffset)
 {
-	if((*puspCache = GetUspCache(0, nLineNo, pnOffset)) == 0)
+	if((*puspCache = GetUspCache(0, nLineNo, pnOffset, nNearOffset)) == 0)
 		return false;
 
 	if(plogAttr && (*plogAttr = UspGetLogAttr((*puspCache)->uspData)) == 0)
@@ -49,7 +49,7 @@ bool TextView::GetLogAttr(ULONG nLineNo, USPCACHE **puspCache, CSCRIPT_LOGATTR *
 //
 VOID TextView::MoveLineUp(int numLines)
 {
-	USPDATA			* uspData;
+	USPCACHE		* uspCache;
 	ULONG			  lineOffset;
 	
 	int				  charPos;
@@ -58,10 +58,10 @@ VOID TextView::MoveLineUp(int numLines)
 	m_nCurrentLine -= min(m_nCurrentLine, (unsigned)numLines);
 
 	// get Uniscribe data for prev line
-	uspData = GetUspData(0, m_nCurrentLine, &lineOffset);
+	uspCache = GetUspCache(0, m_nCurrentLine, &lineOffset, ColumnToOffset(m_nCurrentLine, m_nAnchorPosX / m_nFontWidth));
 
 	// move up to character nearest the caret-anchor positions
-	UspXToOffset(uspData, m_nAnchorPosX, &charPos, &trailing, 0);
+	UspXToOffset(uspCache->uspData, m_nAnchorPosX - uspCache->xoffset, &charPos, &trailing, 0);
 
 	m_nCursorOffset = lineOffset + charPos + trailing;
 }
@@ -71,7 +71,7 @@ VOID TextView::MoveLineUp(int numLines)
 //
 VOID TextView::MoveLineDown(int numLines)
 {
-	USPDATA			* uspData;
+	USPCACHE		* uspCache;
 	ULONG			  lineOffset;
 	
 	int				  charPos;
@@ -80,10 +80,10 @@ VOID TextView::MoveLineDown(int numLines)
 	m_nCurrentLine += min(m_nLineCount-m_nCurrentLine-1, (unsigned)numLines);
 
 	// get Uniscribe data for prev line
-	uspData = GetUspData(0, m_nCurrentLine, &lineOffset);
+	uspCache = GetUspCache(0, m_nCurrentLine, &lineOffset, ColumnToOffset(m_nCurrentLine, m_nAnchorPosX / m_nFontWidth));
 
 	// move down to character nearest the caret-anchor position
-	UspXToOffset(uspData, m_nAnchorPosX, &charPos, &trailing, 0);
+	UspXToOffset(uspCache->uspData, m_nAnchorPosX - uspCache->xoffset, &charPos, &trailing, 0);
 
 	m_nCursorOffset = lineOffset + charPos + trailing;
 }
@@ -99,7 +99,7 @@ VOID TextView::MoveWordPrev()
 	int				  charPos;
 
 	// get Uniscribe data for current line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	// move 1 character to left
@@ -142,7 +142,7 @@ VOID TextView::MoveWordNext()
 	int				  charPos;
 
 	// get Uniscribe data for current line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	charPos = m_nCursorOffset - lineOffset;
@@ -185,7 +185,7 @@ VOID TextView::MoveWordStart()
 	int				  charPos;
 
 	// get Uniscribe data for current line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	charPos  = m_nCursorOffset - lineOffset;
@@ -207,7 +207,7 @@ VOID TextView::MoveWordEnd()
 	int				  charPos;
 
 	// get Uniscribe data for current line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	charPos  = m_nCursorOffset - lineOffset;
@@ -229,7 +229,7 @@ VOID TextView::MoveCharPrev()
 	int				  charPos;
 
 	// get Uniscribe data for current line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	charPos = m_nCursorOffset - lineOffset;
@@ -268,7 +268,7 @@ VOID TextView::MoveCharNext()
 	int				  charPos;
 
 	// get Uniscribe data for specified line
-	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset))
+	if(!GetLogAttr(m_nCurrentLine, &uspCache, &logAttr, &lineOffset, m_nCursorOffset))
 		return;
 
 	charPos = m_nCursorOffset - lineOffset;
@@ -303,8 +303,8 @@ VOID TextView::MoveLineStart(ULONG lineNo)
 	CSCRIPT_LOGATTR * logAttr;
 	int				  charPos;
 	
-	// get Uniscribe data for current line
-	if(!GetLogAttr(lineNo, &uspCache, &logAttr, &lineOffset))
+	// get Uniscribe data for the start of the line
+	if(!GetLogAttr(lineNo, &uspCache, &logAttr, &lineOffset, m_pTextDoc->offset_from_lineno(lineNo)))
 		return;
 
 	charPos  = m_nCursorOffset - lineOffset;
@@ -329,8 +329,13 @@ VOID TextView::MoveLineStart(ULONG lineNo)
 VOID TextView::MoveLineEnd(ULONG lineNo)
 {
 	USPCACHE *uspCache;
+	ULONG	  lineoff = 0;
+	ULONG	  linelen = 0;
+
+	m_pTextDoc->lineinfo_from_lineno(lineNo, &lineoff, &linelen, 0, 0);
 	
-	if((uspCache = GetUspCache(0, lineNo)) == 0)
+	// get Uniscribe data for the end of the line
+	if((uspCache = GetUspCache(0, lineNo, 0, lineoff + linelen)) == 0)
 		return;
 
 	m_nCursorOffset = uspCache->offset + uspCache->length_CRLF;
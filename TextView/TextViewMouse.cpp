@@ -504,14 +504,14 @@ BOOL TextView::MouseCoordToFilePos(	int		 mx,			// [in]  mouse x-coord
 
 	mx += m_nHScrollPos * m_nFontWidth;
 
-	// get the USPDATA object for the selected line!!
-	USPDATA *uspData = GetUspData(0, nLineNo);
+	// get the USPCACHE object for the selected line!!
+	USPCACHE *uspCache = GetUspCache(0, nLineNo, &off_chars);
 
 	// convert mouse-x coordinate to a character-offset relative to start of line
-	UspSnapXToOffset(uspData, mx, &mx, &cp, 0);
+	UspSnapXToOffset(uspCache->uspData, mx - uspCache->xoffset, &mx, &cp, 0);
+	mx += uspCache->xoffset;
 	
 	// return coords!
-	TextIterator itor = m_pTextDoc->iterate_line(nLineNo, &off_chars);
 	*pnLineNo		= nLineNo;
 	*pnFileOffset	= cp + off_chars;
 	*psnappedX		= mx;// - m_nHScrollPos * m_nFontWidth;
@@ -538,16 +538,44 @@ LONG TextView::InvalidateLine(ULONG nLineNo, bool forceAnalysis)
 	{
 		for(int i = 0; i < USP_CACHE_SIZE; i++)
 		{
+			// a very long line can have several entries
 			if(nLineNo == m_uspCache[i].lineno)
-			{
 				m_uspCache[i].usage = 0;
-				break;
-			}
 		}
 	}
 
 	return 0;
 }
+
+//
+//	Redraw nCount lines starting at nLineNo - or every line from nLineNo
+//	to the bottom of the window when nCount is -1 (the rest have moved)
+//
+LONG TextView::InvalidateLines(ULONG nLineNo, ULONG nCount)
+{
+	RECT  rect;
+	ULONG nLast = m_nVScrollPos + m_nWindowLines + 1;
+
+	if(nCount != -1 && nCount < nLast - nLineNo)
+		nLast = nLineNo + nCount;
+
+	if(nLineNo < m_nVScrollPos)
+		nLineNo = m_nVScrollPos;
+
+	if(nLineNo >= nLast)
+		return 0;
+
+	GetClientRect(m_hWnd, &rect);
+
+	rect.top = (nLineNo - m_nVScrollPos) * m_nLineHeight;
+
+	if(nCount != -1)
+		rect.bottom = (nLast - m_nVScrollPos) * m_nLineHeight;
+
+	InvalidateRect(m_hWnd, &rect, FALSE);
+	return 0;
+}
+
 //
 //	Redraw any line which spans the specified range of text
 //
@@ -680,21 +708,23 @@ VOID TextView::UpdateCaretOffset(ULONG offset, BOOL fTrailing, int *outx, ULONG
 	ULONG		lineno = 0;
 	int			xpos = 0;
 	ULONG		off_chars;
-	USPDATA	  * uspData;
+	USPCACHE  * uspCache;
 
 	// get line information from cursor-offset
 	if(m_pTextDoc->lineinfo_from_offset(offset, &lineno, &off_chars, 0, 0, 0))
 	{
-		// locate the USPDATA for this line
-		if((uspData = GetUspData(NULL, lineno)) != 0)
+		// locate the USPDATA for this line (or the part of it around the cursor)
+		if((uspCache = GetUspCache(NULL, lineno, &off_chars, m_nCursorOffset)) != 0)
 		{	
 			// convert character-offset to x-coordinate
 			off_chars = m_nCursorOffset - off_chars;
 			
 			if(fTrailing && off_chars > 0)
-				UspOffsetToX(uspData, off_chars-1, TRUE, &xpos);
+				UspOffsetToX(uspCache->uspData, off_chars-1, TRUE, &xpos);
 			else
-				UspOffsetToX(uspData, off_chars, FALSE, &xpos);
+				UspOffsetToX(uspCache->uspData, off_chars, FALSE, &xpos);
+
+			xpos += uspCache->xoffset;
 
 			// update caret position
 			UpdateCaretXY(xpos, lineno);
@@ -29,12 +29,57 @@ VOID TextView::RefreshWindow()
 	InvalidateRect(m_hWnd, NULL, FALSE);
 }
 
-USPCACHE *TextView::GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset/*=0*/)
+//
+//	Does the cached window onto a very long line cover the specified
+//	offset, and leave enough room either side for the caret to move?
+//
+static bool WindowContains(USPCACHE *uspCache, ULONG nOffset)
+{
+	ULONG start = uspCache->offset;
+	ULONG end   = uspCache->offset + uspCache->length;
+
+	// the edges of the line itself don't need any margin
+	if(start > uspCache->lineoff)
+		start += USP_WINDOW_MARGIN;
+
+	if(end < uspCache->lineoff + uspCache->linelen)
+		end -= USP_WINDOW_MARGIN;
+
+	return nOffset >= start && nOffset <= end;
+}
+
+//
+//	Return (approximately) the offset of the specified display-column within 
+//	a line. This is only used to decide which part of a very long line to analyze
+//
+ULONG TextView::ColumnToOffset(ULONG nLineNo, ULONG nColumn)
+{
+	ULONG	lineoff = 0;
+	LINESEG	seg;
+
+	m_pTextDoc->lineinfo_from_lineno(nLineNo, &lineoff, 0, 0, 0);
+
+	if(!m_pTextDoc->lineseg_from_column(nLineNo, nColumn, &seg))
+		return lineoff;
+
+	return lineoff + seg.off_chars + min(nColumn - seg.column, LINESEG_INTERVAL);
+}
+
+//
+//	Return the analyzed USPCACHE entry for the specified line. Very long
+//	lines are only analyzed a window at a time - nNearOffset says which part
+//	of the line is wanted, otherwise whatever is visible in the viewport is used
+//
+USPCACHE *TextView::GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset/*=0*/, ULONG nNearOffset/*=-1*/)
 {
-	TCHAR	 buff[TEXTBUFSIZE];
-	ATTR	 attr[TEXTBUFSIZE];
+	TCHAR	*buff;
+	ATTR	*attr;
 	ULONG	 colno = 0;
 	ULONG	 off_chars = 0;
+	ULONG	 lineoff = 0;
+	ULONG	 linelen = 0;
+	ULONG	 startpos = 0;
+	ULONG	 buflen;
 	int		 len;
 	HDC		 hdcTemp;
 	
@@ -57,6 +102,16 @@ USPCACHE *TextView::GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset/*=0*/)
 		// match the line#
 		if(m_uspCache[i].usage > 0 && m_uspCache[i].lineno == nLineNo)
 		{
+			// only part of the line was analyzed - is it the right part?
+			if((ULONG)m_uspCache[i].length < m_uspCache[i].linelen)
+			{
+				if(nNearOffset == -1)
+					nNearOffset = ColumnToOffset(nLineNo, m_nHScrollPos + m_nWindowColumns / 2);
+
+				if(!WindowContains(&m_uspCache[i], nNearOffset))
+					continue;
+			}
+
 			if(nOffset)
 				*nOffset = m_uspCache[i].offset;
 
@@ -72,18 +127,49 @@ USPCACHE *TextView::GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset/*=0*/)
 	m_uspCache[lru_index].usage		= 1;
 	uspData = m_uspCache[lru_index].uspData;
 
+	m_pTextDoc->lineinfo_from_lineno(nLineNo, &lineoff, &linelen, 0, 0);
+	buflen = linelen;
+
+	//
+	//	Very long lines get a window centred on the part we're interested in
+	//
+	if(linelen > USP_WINDOW_SIZE)
+	{
+		if(nNearOffset == -1)
+			nNearOffset = ColumnToOffset(nLineNo, m_nHScrollPos + m_nWindowColumns / 2);
+
+		nNearOffset = min(max(nNearOffset, lineoff), lineoff + linelen);
+		startpos	= nNearOffset - lineoff;
+		startpos	= startpos > USP_WINDOW_SIZE / 2 ? startpos - USP_WINDOW_SIZE / 2 : 0;
+		buflen		= USP_WINDOW_SIZE;
+	}
+
 	if(hdc == 0)	hdcTemp = GetDC(m_hWnd);
 	else			hdcTemp = hdc;
+
+	buff = new TCHAR[buflen + 1];
+	attr = new ATTR[buflen + 1];
 	
 	//
-	// get the text for the entire line and apply style attributes
+	// get the text for the line (or the window) and apply style attributes
 	//
-	len = m_pTextDoc->getline(nLineNo, buff, TEXTBUFSIZE, &off_chars);
+	len = m_pTextDoc->getline(nLineNo, startpos, buff, buflen, &off_chars, &colno);
 	
 	// cache the line's offset and length information
 	m_uspCache[lru_index].offset		= off_chars;
 	m_uspCache[lru_index].length		= len;
-	m_uspCache[lru_index].length_CRLF	= len - CRLF_size(buff, len);
+	m_uspCache[lru_index].length_CRLF	= len;
+	m_uspCache[lru_index].xoffset		= colno * m_nFontWidth;
+	m_uspCache[lru_index].lineoff		= lineoff;
+	m_uspCache[lru_index].linelen		= linelen;
+
+	// only the end of the line has a CR/LF - the line-buffer knows how long it is
+	if(off_chars + len == lineoff + linelen)
+	{
+		ULONG eollen;
+		m_pTextDoc->getlineending(nLineNo, &eollen);
+		m_uspCache[lru_index].length_CRLF -= min(eollen, (ULONG)len);
+	}
 
 	len = ApplyTextAttributes(nLineNo, off_chars, colno, buff, len, attr);
 	
@@ -124,11 +210,14 @@ USPCACHE *TextView::GetUspCache(HDC hdc, ULONG nLineNo, ULONG *nOffset/*=0*/)
 	//
 	//	Apply the selection
 	//
-	ApplySelection(uspData, nLineNo, off_chars, len);
+	ApplySelection(uspData, nLineNo, off_chars, len, m_uspCache[lru_index].xoffset);
 
 	if(hdc == 0)
 		ReleaseDC(m_hWnd, hdcTemp);
 
+	delete[] buff;
+	delete[] attr;
+
 	if(nOffset) 
 		*nOffset = off_chars;
 
@@ -160,6 +249,33 @@ void TextView::ResetLineCache()
 	}
 }
 
+//
+//	nErased lines starting at nLineNo have been replaced by nInserted new
+//	ones. Only those lines are thrown away - the ones after are renumbered,
+//	and moved along by nDelta characters
+//
+void TextView::UpdateLineCache(ULONG nLineNo, ULONG nErased, ULONG nInserted, ULONG nDelta)
+{
+	for(int i = 0; i < USP_CACHE_SIZE; i++)
+	{
+		USPCACHE *uspCache = &m_uspCache[i];
+
+		if(uspCache->usage == 0 || uspCache->lineno < nLineNo)
+			continue;
+
+		if(uspCache->lineno < nLineNo + nErased)
+		{
+			uspCache->usage = 0;
+		}
+		else
+		{
+			uspCache->lineno  += nInserted - nErased;
+			uspCache->offset  += nDelta;
+			uspCache->lineoff += nDelta;
+		}
+	}
+}
+
 //
 //	Painting procedure for TextView objects
 //
@@ -337,6 +453,28 @@ void TextView::UpdateMarginWidth()
 	ReleaseDC(m_hWnd, hdc);
 }
 
+//
+//	Pick up the new number of lines after the document has been edited.
+//	Unlike UpdateMetrics the window is only redrawn completely if the 
+//	margin has changed width - the edit itself invalidates what it touched
+//
+void TextView::UpdateLineCount()
+{
+	int  nOldWidth = m_nLinenoWidth;
+	RECT rect;
+
+	m_nLineCount   = m_pTextDoc->linecount();
+	m_nLongestLine = m_pTextDoc->longestline(m_nTabWidthChars);
+
+	UpdateMarginWidth();
+
+	if(m_nLinenoWidth != nOldWidth)
+		RefreshWindow();
+
+	GetClientRect(m_hWnd, &rect);
+	OnSize(0, rect.right, rect.bottom);
+}
+
 //
 //	Draw the specified line's margin into the area described by *margin*
 //
@@ -445,11 +583,13 @@ int TextView::PaintMargin(HDC hdc, ULONG nLineNo, int xpos, int ypos)
 //
 void TextView::PaintText(HDC hdc, ULONG nLineNo, int xpos, int ypos, RECT *bounds)
 {
+	USPCACHE* uspCache;
 	USPDATA * uspData;
 	ULONG	  lineOffset;
 
-	// grab the USPDATA for this line
-	uspData = GetUspData(hdc, nLineNo, &lineOffset);
+	// grab the USPDATA for this line (or the visible part of it)
+	uspCache = GetUspCache(hdc, nLineNo, &lineOffset);
+	uspData  = uspCache->uspData;
 
 	// set highlight-colours depending on window-focus
 	if(GetFocus() == m_hWnd)
@@ -460,13 +600,13 @@ void TextView::PaintText(HDC hdc, ULONG nLineNo, int xpos, int ypos, RECT *bound
 	// update selection-attribute information for the line
 	UspApplySelection(uspData, m_nSelectionStart - lineOffset, m_nSelectionEnd - lineOffset);
 
-	ApplySelection(uspData, nLineNo, lineOffset, uspData->stringLen);
+	ApplySelection(uspData, nLineNo, lineOffset, uspData->stringLen, uspCache->xoffset);
 
 	// draw the text!
-	UspTextOut(uspData, hdc, xpos, ypos, m_nLineHeight, m_nHeightAbove, bounds);
+	UspTextOut(uspData, hdc, xpos + uspCache->xoffset, ypos, m_nLineHeight, m_nHeightAbove, bounds);
 }
 
-int	TextView::ApplySelection(USPDATA *uspData, ULONG nLine, ULONG nOffset, ULONG nTextLen)
+int	TextView::ApplySelection(USPDATA *uspData, ULONG nLine, ULONG nOffset, ULONG nTextLen, int xoffset)
 {
 	int selstart = 0;
 	int selend   = 0;
@@ -478,10 +618,10 @@ int	TextView::ApplySelection(USPDATA *uspData, ULONG nLine, ULONG nOffset, ULONG
 	{
 		int trailing;
 		
-		UspXToOffset(uspData, m_cpBlockStart.xpos, &selstart, &trailing, 0);
+		UspXToOffset(uspData, m_cpBlockStart.xpos - xoffset, &selstart, &trailing, 0);
 		selstart += trailing;
 		
-		UspXToOffset(uspData, m_cpBlockEnd.xpos, &selend, &trailing, 0);
+		UspXToOffset(uspData, m_cpBlockEnd.xpos - xoffset, &selend, &trailing, 0);
 		selend += trailing;
 
 		if(selstart > selend)
@@ -7,12 +7,20 @@
 //	Written by J Brown 2006
 //	
 
-#define STRICT
-#define WIN32_LEAN_AND_MEAN
-
-#include <windows.h>
+#include "portable.h"
 #include "Unicode.h"
 
+//
+//	SSE2 is used for the bulk scanning/conversion loops whenever the
+//	compiler is allowed to assume it (always true for x64 builds), 
+//	unless UNICODE_NO_SSE2 is defined
+//
+#if defined(UNICODE_NO_SSE2)
+#elif defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define UNICODE_SSE2
+#include <emmintrin.h>
+#endif
+
 //
 //	utf8_to_utf32
 //
@@ -167,18 +175,18 @@ size_t utf32_to_utf8(UTF8 *utf8str, size_t utf8len, UTF32 ch32)
 	// 3-byte sequence
 	else if(ch32 < 0x10000 && utf8len >= 3)
 	{
-		*utf8str++ = (UTF8)((ch32 >> 12)        | 0xE0);
-		*utf8str++ = (UTF8)((ch32 >> 6) & 0x3f  | 0x80);
-		*utf8str++ = (UTF8)((ch32 & 0x3f)       | 0x80);
+		*utf8str++ = (UTF8)((ch32 >> 12)          | 0xE0);
+		*utf8str++ = (UTF8)(((ch32 >> 6) & 0x3f)  | 0x80);
+		*utf8str++ = (UTF8)((ch32 & 0x3f)         | 0x80);
 		len = 3;
 	}
 	// 4-byte sequence
 	else if(ch32 <= UNI_MAX_LEGAL_UTF32 && utf8len >= 4)
 	{
-		*utf8str++ = (UTF8)((ch32 >> 18)        | 0xF0);
-		*utf8str++ = (UTF8)((ch32 >> 12) & 0x3f | 0x80);
-		*utf8str++ = (UTF8)((ch32 >> 6) & 0x3f  | 0x80);
-		*utf8str++ = (UTF8)((ch32 & 0x3f)       | 0x80);
+		*utf8str++ = (UTF8)((ch32 >> 18)          | 0xF0);
+		*utf8str++ = (UTF8)(((ch32 >> 12) & 0x3f) | 0x80);
+		*utf8str++ = (UTF8)(((ch32 >> 6) & 0x3f)  | 0x80);
+		*utf8str++ = (UTF8)((ch32 & 0x3f)         | 0x80);
 		len = 4;
 	}
 
@@ -196,6 +204,12 @@ size_t utf32_to_utf8(UTF8 *utf8str, size_t utf8len, UTF32 ch32)
 //	2. Illegal sequences are converted to the unicode replacement character
 //	3. Returns the number of bytes processeed from utf8str
 //
+//	Runs of ASCII are widened 16 bytes at a time, and well-formed 2 and 3-byte 
+//	sequences are decoded inline. Everything else (supplementary planes and 
+//	illegal forms) goes through utf8_to_utf32 so the results are identical. 
+//	A surrogate pair is never split: if only one UTF16 of space remains the 
+//	conversion stops before the 4-byte sequence.
+//
 //	utf8str		- [in]		buffer containing utf-8 text
 //	utf8len		- [in]		number of code-units (bytes) in buffer
 //	utf16str	- [out]		receives resulting utf-16 text
@@ -208,23 +222,86 @@ size_t utf8_to_utf16(UTF8 *utf8str, size_t utf8len, UTF16 *utf16str, size_t *utf
 {
 	UTF16 *utf16start = utf16str;
 	UTF8  *utf8start  = utf8str;
+	UTF16 *utf16end   = utf16str + *utf16len;
+	UTF8  *utf8end    = utf8str  + utf8len;
 
 	size_t len;
 	size_t tmp16len;
 	UTF32  ch32;
+	UTF16  ch16;
+	UTF8   ch;
 
-	while(utf8len > 0 && *utf16len > 0)
+	while(utf8str < utf8end && utf16str < utf16end)
 	{
-		// convert to utf-32
-		len		     = utf8_to_utf32(utf8str, utf8len, &ch32);
-		utf8str     += len;
-		utf8len     -= len;
-
-		// convert to utf-16
-		tmp16len     = *utf16len;
-		len          = utf32_to_utf16(&ch32, 1, utf16str, &tmp16len);
-		utf16str    += len;
-		(*utf16len) -= len;
+		ch = *utf8str;
+
+		// plain ASCII
+		if(ch < 0x80)
+		{
+#ifdef UNICODE_SSE2
+			__m128i zero = _mm_setzero_si128();
+
+			while(utf8end - utf8str >= 16 && utf16end - utf16str >= 16)
+			{
+				__m128i ascii = _mm_loadu_si128((__m128i *)utf8str);
+				int		mask  = _mm_movemask_epi8(ascii);
+
+				// copy the ASCII up to the first non-ASCII BYTE, rather than 
+				// trying another 16 BYTEs for each character of it
+				if(mask != 0)
+				{
+					for( ; (mask & 1) == 0; mask >>= 1)
+						*utf16str++ = *utf8str++;
+
+					break;
+				}
+
+				_mm_storeu_si128((__m128i *)utf16str,       _mm_unpacklo_epi8(ascii, zero));
+				_mm_storeu_si128((__m128i *)(utf16str + 8), _mm_unpackhi_epi8(ascii, zero));
+
+				utf8str  += 16;
+				utf16str += 16;
+			}
+
+			if(utf8str == utf8end || utf16str == utf16end || *utf8str >= 0x80)
+				continue;
+#endif
+			*utf16str++ = *utf8str++;
+			continue;
+		}
+
+		// 2-byte sequence: C2-DF 80-BF
+		if(ch >= 0xC2 && ch <= 0xDF && utf8end - utf8str >= 2 && (utf8str[1] & 0xC0) == 0x80)
+		{
+			*utf16str++ = (UTF16)(((ch & 0x1F) << 6) | (utf8str[1] & 0x3F));
+			utf8str += 2;
+			continue;
+		}
+
+		// 3-byte sequence, excluding non-shortest forms, surrogates and FFFE/FFFF
+		if((ch & 0xF0) == 0xE0 && utf8end - utf8str >= 3 && 
+			(utf8str[1] & 0xC0) == 0x80 && (utf8str[2] & 0xC0) == 0x80)
+		{
+			ch16 = (UTF16)(((ch & 0x0F) << 12) | ((utf8str[1] & 0x3F) << 6) | (utf8str[2] & 0x3F));
+
+			if(ch16 >= 0x800 && ch16 < 0xFFFE && (ch16 < UNI_SUR_HIGH_START || ch16 > UNI_SUR_LOW_END))
+			{
+				*utf16str++ = ch16;
+				utf8str += 3;
+				continue;
+			}
+		}
+
+		// anything else is decoded the long way
+		len		 = utf8_to_utf32(utf8str, utf8end - utf8str, &ch32);
+		tmp16len = utf16end - utf16str;
+
+		// no room to store a surrogate pair
+		if(utf32_to_utf16(&ch32, 1, utf16str, &tmp16len) == 0)
+			break;
+
+		utf8str  += len;
+		utf16str += tmp16len;
 	}
 
 	*utf16len = utf16str - utf16start;
@@ -239,6 +316,10 @@ size_t utf8_to_utf16(UTF8 *utf8str, size_t utf8len, UTF16 *utf16str, size_t *utf
 //	1. As many whole codepoints as possible are stored in utf8str 
 //	2. Illegal sequences are converted to the unicode replacement character
 //
+//	Blocks of 8 characters which are all ASCII, or all 2-byte sequences, are
+//	encoded with SSE2. Other BMP characters are encoded inline, and only 
+//	surrogates go through utf16_to_utf32/utf32_to_utf8.
+//
 //	utf16str		- [in]		buffer containing utf-16 text
 //	utf16len		- [in]		number of code-units (UTF16s) in buffer
 //	utf8str			- [out]		receives resulting utf-8 text
@@ -251,22 +332,94 @@ size_t utf16_to_utf8(UTF16 *utf16str, size_t utf16len, UTF8 *utf8str, size_t *ut
 {
 	UTF16 * utf16start = utf16str;
 	UTF8  * utf8start  = utf8str;
+	UTF16 * utf16end   = utf16str + utf16len;
+	UTF8  * utf8end    = utf8str  + *utf8len;
 	size_t  len;
+	size_t	room;
 	UTF32	ch32;
 	size_t	ch32len;
+	UTF16	ch;
+
+#ifdef UNICODE_SSE2
+	__m128i zero   = _mm_setzero_si128();
+	__m128i not7   = _mm_set1_epi16((short)0xFF80);
+	__m128i not11  = _mm_set1_epi16((short)0xF800);
+	__m128i mask6  = _mm_set1_epi16(0x3F);
+	__m128i lead2  = _mm_set1_epi16(0xC0);
+	__m128i trail  = _mm_set1_epi16(0x80);
+#endif
 
-	while(utf16len > 0 && *utf8len > 0)
+	while(utf16str < utf16end && utf8str < utf8end)
 	{
-		// convert to utf-32
+		ch   = *utf16str;
+		room = utf8end - utf8str;
+
+#ifdef UNICODE_SSE2
+		if(ch < 0x800 && utf16end - utf16str >= 8 && room >= 16)
+		{
+			__m128i v = _mm_loadu_si128((__m128i *)utf16str);
+			int ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not7), zero));
+
+			// 8 ASCII characters: narrow to bytes
+			if(ascii == 0xFFFF)
+			{
+				_mm_storel_epi64((__m128i *)utf8str, _mm_packus_epi16(v, v));
+				utf16str += 8;
+				utf8str  += 8;
+				continue;
+			}
+
+			// 8 characters in the range 0x80-0x7FF: each UTF16 becomes a lead+trail byte pair
+			if(ascii == 0 && _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not11), zero)) == 0xFFFF)
+			{
+				__m128i lo = _mm_or_si128(_mm_srli_epi16(v, 6), lead2);
+				__m128i hi = _mm_or_si128(_mm_and_si128(v, mask6), trail);
+
+				_mm_storeu_si128((__m128i *)utf8str, _mm_or_si128(lo, _mm_slli_epi16(hi, 8)));
+				utf16str += 8;
+				utf8str  += 16;
+				continue;
+			}
+		}
+#endif
+
+		// 1-byte sequence
+		if(ch < 0x80)
+		{
+			*utf8str++ = (UTF8)ch;
+			utf16str++;
+			continue;
+		}
+
+		// 2-byte sequence
+		if(ch < 0x800 && room >= 2)
+		{
+			*utf8str++ = (UTF8)((ch >> 6)	| 0xC0);
+			*utf8str++ = (UTF8)((ch & 0x3f)	| 0x80);
+			utf16str++;
+			continue;
+		}
+
+		// 3-byte sequence for anything in the BMP that isn't a surrogate
+		if(ch >= 0x800 && (ch < UNI_SUR_HIGH_START || ch > UNI_SUR_LOW_END) && room >= 3)
+		{
+			*utf8str++ = (UTF8)((ch >> 12)			| 0xE0);
+			*utf8str++ = (UTF8)(((ch >> 6) & 0x3f)	| 0x80);
+			*utf8str++ = (UTF8)((ch & 0x3f)			| 0x80);
+			utf16str++;
+			continue;
+		}
+
+		// surrogates: convert to utf-32 first
 		ch32len	    = 1;
-		len		    = utf16_to_utf32(utf16str, utf16len, &ch32, &ch32len);
-		utf16str   += len;
-		utf16len   -= len;
+		len		    = utf16_to_utf32(utf16str, utf16end - utf16str, &ch32, &ch32len);
 
-		// convert to utf-8
-		len		    = utf32_to_utf8(utf8str, *utf8len, ch32);
-		utf8str    += len;
-		(*utf8len) -= len;
+		// convert to utf-8, leaving the character for next time if it won't fit
+		if((ch32len = utf32_to_utf8(utf8str, room, ch32)) == 0)
+			break;
+
+		utf16str   += len;
+		utf8str    += ch32len;
 	}
 
 	*utf8len = utf8str - utf8start;
@@ -290,7 +443,15 @@ size_t ascii_to_utf16(UTF8 *asciistr, size_t asciilen, UTF16 *utf16str, size_t *
 {
 	size_t len = min(*utf16len, asciilen);
 		
+#ifdef _WIN32
 	MultiByteToWideChar(CP_ACP, 0, (CCHAR*)asciistr, len, (WCHAR *)utf16str, len);
+#else
+	// without an ANSI codepage, treat the text as Latin-1
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		utf16str[i] = asciistr[i];
+#endif
 	*utf16len = len;
 	return len;
 }
@@ -312,7 +473,14 @@ size_t utf16_to_ascii(UTF16 *utf16str, size_t utf16len, UTF8 *asciistr, size_t *
 {
 	size_t len = min(utf16len, *asciilen);
 	
+#ifdef _WIN32
 	WideCharToMultiByte(CP_ACP, 0, utf16str, len, asciistr, *asciilen, 0, 0);
+#else
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		asciistr[i] = utf16str[i] < 0x100 ? (UTF8)utf16str[i] : '?';
+#endif
 	*asciilen = len;
 	return len;
 }
@@ -345,6 +513,9 @@ size_t copy_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen)
 //	Copies UTF-16 string from src to dest, performing endianess swap
 //	for each code-unit
 //
+//	src and dest may be the same buffer, so text can be swapped in place 
+//	(but they must not otherwise overlap)
+//
 //	src			- [in]		buffer containing utf-16 text
 //	srclen		- [in]		number of code-units in src
 //	dest		- [out]		receives resulting word-swapped string
@@ -356,36 +527,96 @@ size_t copy_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen)
 size_t swap_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen)
 {
 	size_t len = min(*destlen, srclen);
-	size_t i;
+	size_t i   = 0;
+
+#ifdef UNICODE_SSE2
+	// 16 UTF16s per iteration, both blocks are loaded before anything is stored
+	for( ; i + 16 <= len; i += 16)
+	{
+		__m128i lo = _mm_loadu_si128((__m128i *)(src + i));
+		__m128i hi = _mm_loadu_si128((__m128i *)(src + i + 8));
+
+		lo = _mm_or_si128(_mm_slli_epi16(lo, 8), _mm_srli_epi16(lo, 8));
+		hi = _mm_or_si128(_mm_slli_epi16(hi, 8), _mm_srli_epi16(hi, 8));
+
+		_mm_storeu_si128((__m128i *)(dest + i),     lo);
+		_mm_storeu_si128((__m128i *)(dest + i + 8), hi);
+	}
+#endif
 	
-	for(i = 0; i < len; i++)
+	for( ; i < len; i++)
 		dest[i] = SWAPWORD(src[i]);
 
 	*destlen = len;
 	return len;
 }
 
+#ifdef UNICODE_SSE2
 //
-//	utf32_to_utf16
-//
-//	Converts the specified UTF-32 stream of text to UTF-16
+//	Reverse the byte-order of each UTF32 in a 128bit vector
 //
-//	utf32str	- [in]		buffer containing utf-32 text
-//	utf32len	- [in]		number of characters (UTF32s) in utf32str
-//	utf16str	- [out]		receives resulting utf-16 text
-//	utf16len	- [in/out]	on input, specifies the size (in UTF16s) of utf16str
-//							on output, holds actual number of UTF16 values stored in utf16str
+static __m128i swap_utf32_sse2(__m128i v)
+{
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+	v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
 //
-//	returns number of UTF32s processed from utf32str
+//	Common worker for utf32_to_utf16 and utf32be_to_utf16. Blocks of 8
+//	characters below the surrogate range are narrowed with SSE2, 
+//	everything else is converted one character at a time
 //
-size_t utf32_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t *utf16len)
+static size_t utf32_to_utf16_worker(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t *utf16len, int bigendian)
 {
 	UTF16 *utf16start = utf16str;
 	UTF32 *utf32start = utf32str;
 
+#ifdef UNICODE_SSE2
+	__m128i bias32 = _mm_set1_epi32(0x80000000);
+	__m128i limit  = _mm_set1_epi32(0x80000000 | UNI_SUR_HIGH_START);
+	__m128i bias16 = _mm_set1_epi32(0x8000);
+	__m128i flip16 = _mm_set1_epi16((short)0x8000);
+#endif
+
 	while(utf32len > 0 && *utf16len > 0)
 	{
-		UTF32 ch32 = *utf32str++;
+		UTF32 ch32;
+
+#ifdef UNICODE_SSE2
+		if(utf32len >= 8 && *utf16len >= 8)
+		{
+			__m128i lo = _mm_loadu_si128((__m128i *)utf32str);
+			__m128i hi = _mm_loadu_si128((__m128i *)utf32str + 1);
+
+			if(bigendian)
+			{
+				lo = swap_utf32_sse2(lo);
+				hi = swap_utf32_sse2(hi);
+			}
+
+			// unsigned compare against the start of the surrogate range
+			if(_mm_movemask_epi8(_mm_and_si128(
+					_mm_cmplt_epi32(_mm_xor_si128(lo, bias32), limit),
+					_mm_cmplt_epi32(_mm_xor_si128(hi, bias32), limit))) == 0xFFFF)
+			{
+				// packs_epi32 saturates signed values, so shift into signed range first
+				lo = _mm_sub_epi32(lo, bias16);
+				hi = _mm_sub_epi32(hi, bias16);
+				_mm_storeu_si128((__m128i *)utf16str, _mm_xor_si128(_mm_packs_epi32(lo, hi), flip16));
+
+				utf32str    += 8;
+				utf32len    -= 8;
+				utf16str    += 8;
+				(*utf16len) -= 8;
+				continue;
+			}
+		}
+#endif
+
+		ch32 = bigendian ? SWAPDWORD(*utf32str) : *utf32str;
+		utf32str++;
 		utf32len--;
 
 		// target is a character <= 0xffff
@@ -429,6 +660,7 @@ size_t utf32_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t
 		else
 		{
 			// no room to store result
+			utf32str--;
 			break;
 		}
 	}
@@ -438,26 +670,81 @@ size_t utf32_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t
 }
 
 //
-//	utf16_to_utf32
+//	utf32_to_utf16
 //
-//	Converts the specified UTF-16 stream of text to UTF-32
+//	Converts the specified UTF-32 stream of text to UTF-16
 //
-//	utf16str	- [in]		buffer containing utf-16 text
-//	utf16len	- [in]		number of code-units (UTF16s) in utf16str
-//	utf32str	- [out]		receives resulting utf-32 text
-//	utf32len	- [in/out]	on input, specifies the size (in UTF32s) of utf32str
-//							on output, holds actual number of UTF32 values stored in utf32str
+//	utf32str	- [in]		buffer containing utf-32 text
+//	utf32len	- [in]		number of characters (UTF32s) in utf32str
+//	utf16str	- [out]		receives resulting utf-16 text
+//	utf16len	- [in/out]	on input, specifies the size (in UTF16s) of utf16str
+//							on output, holds actual number of UTF16 values stored in utf16str
 //
-//	returns number of UTF16s processed from utf16str
+//	returns number of UTF32s processed from utf32str
 //
-size_t utf16_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len)
+size_t utf32_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t *utf16len)
+{
+	return utf32_to_utf16_worker(utf32str, utf32len, utf16str, utf16len, FALSE);
+}
+
+//
+//	utf32be_to_utf16
+//
+//	Converts the specified big-endian UTF-32 stream of text to UTF-16
+//
+size_t utf32be_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t *utf16len)
+{
+	return utf32_to_utf16_worker(utf32str, utf32len, utf16str, utf16len, TRUE);
+}
+
+//
+//	Common worker for utf16_to_utf32 and utf16_to_utf32be. Blocks of 8
+//	characters with no surrogates are widened with SSE2
+//
+static size_t utf16_to_utf32_worker(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len, int bigendian)
 {
 	UTF16 *utf16start = utf16str;
 	UTF32 *utf32start = utf32str;
 
+#ifdef UNICODE_SSE2
+	__m128i zero	= _mm_setzero_si128();
+	__m128i surmask = _mm_set1_epi16((short)0xF800);
+	__m128i surval  = _mm_set1_epi16((short)0xD800);
+#endif
+
 	while(utf16len > 0 && *utf32len > 0)
 	{
-		UTF32 ch = *utf16str;
+		UTF32 ch;
+
+#ifdef UNICODE_SSE2
+		if(utf16len >= 8 && *utf32len >= 8)
+		{
+			__m128i v = _mm_loadu_si128((__m128i *)utf16str);
+
+			if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, surmask), surval)) == 0)
+			{
+				__m128i lo = _mm_unpacklo_epi16(v, zero);
+				__m128i hi = _mm_unpackhi_epi16(v, zero);
+
+				if(bigendian)
+				{
+					lo = swap_utf32_sse2(lo);
+					hi = swap_utf32_sse2(hi);
+				}
+
+				_mm_storeu_si128((__m128i *)utf32str,     lo);
+				_mm_storeu_si128((__m128i *)utf32str + 1, hi);
+
+				utf16str    += 8;
+				utf16len    -= 8;
+				utf32str    += 8;
+				(*utf32len) -= 8;
+				continue;
+			}
+		}
+#endif
+
+		ch = *utf16str;
 
 		// first of a surrogate pair?
 		if(ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_HIGH_END && utf16len >= 2)
@@ -481,7 +768,7 @@ size_t utf16_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t
 			}
 		}
 
-		*utf32str++ = ch;
+		*utf32str++ = bigendian ? SWAPDWORD(ch) : ch;
 		(*utf32len)--;		
 		
 		utf16str++;
@@ -492,6 +779,34 @@ size_t utf16_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t
 	return utf16str - utf16start;
 }
 
+//
+//	utf16_to_utf32
+//
+//	Converts the specified UTF-16 stream of text to UTF-32
+//
+//	utf16str	- [in]		buffer containing utf-16 text
+//	utf16len	- [in]		number of code-units (UTF16s) in utf16str
+//	utf32str	- [out]		receives resulting utf-32 text
+//	utf32len	- [in/out]	on input, specifies the size (in UTF32s) of utf32str
+//							on output, holds actual number of UTF32 values stored in utf32str
+//
+//	returns number of UTF16s processed from utf16str
+//
+size_t utf16_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len)
+{
+	return utf16_to_utf32_worker(utf16str, utf16len, utf32str, utf32len, FALSE);
+}
+
+//
+//	utf16_to_utf32be
+//
+//	Converts the specified UTF-16 stream of text to big-endian UTF-32
+//
+size_t utf16_to_utf32be(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len)
+{
+	return utf16_to_utf32_worker(utf16str, utf16len, utf32str, utf32len, TRUE);
+}
+
 //
 //	utf16be_to_utf32
 //
@@ -544,4 +859,538 @@ size_t utf16be_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_
 
 	*utf32len = utf32str - utf32start;
 	return utf16str - utf16start;
-}
\ No newline at end of file
+}
+
+#ifdef UNICODE_SSE2
+//
+//	Number of bits set in a 16bit movemask
+//
+static size_t popcount16(int mask)
+{
+	mask = (mask & 0x5555) + ((mask >> 1) & 0x5555);
+	mask = (mask & 0x3333) + ((mask >> 2) & 0x3333);
+	mask = (mask & 0x0F0F) + ((mask >> 4) & 0x0F0F);
+	return (mask & 0xFF) + (mask >> 8);
+}
+
+//
+//	Count the UTF-16 code-units in a block of 16 UTF-8 bytes, which must
+//	start on a character boundary. Every byte that isn't a trail-byte
+//	starts one character, and each F0-F3 lead-byte adds the second half 
+//	of a surrogate pair. A sequence that runs off the end of the block is
+//	left for next time (at most 3 bytes), so the block is never split
+//
+//	This only holds for well-formed text - if any trail-byte is missing or
+//	out of place, or there is a lead-byte whose value might not fit in
+//	UTF-16, nothing is counted and the caller must decode the hard way
+//
+//	Returns the number of bytes counted (13-16), or zero
+//
+static size_t utf8_count_block_sse2(UTF8 *utf8str, size_t *utf16len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i v    = _mm_loadu_si128((__m128i *)utf8str);
+	__m128i next = _mm_srli_si128(v, 1);
+	__m128i need, trail, pairs, bad;
+	int		mask, len;
+
+	// positions that must hold trail-bytes, based on the 3 bytes before each
+	need  = _mm_or_si128(_mm_subs_epu8(_mm_slli_si128(v, 1), _mm_set1_epi8((char)0xBF)),
+			_mm_or_si128(_mm_subs_epu8(_mm_slli_si128(v, 2), _mm_set1_epi8((char)0xDF)),
+						 _mm_subs_epu8(_mm_slli_si128(v, 3), _mm_set1_epi8((char)0xEF))));
+
+	// positions that actually do
+	trail = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8((char)0xC0)), _mm_set1_epi8((char)0x80));
+
+	// F0-F3 lead-bytes always form a surrogate pair, except for F0 80-8F (non-shortest)
+	pairs = _mm_subs_epu8(v, _mm_set1_epi8((char)0xEF));
+	bad   = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xF0)), 
+						  _mm_cmpeq_epi8(_mm_subs_epu8(next, _mm_set1_epi8((char)0x8F)), zero));
+
+	// F4-FF might be out of range (or are illegal)
+	bad   = _mm_or_si128(bad, _mm_subs_epu8(v, _mm_set1_epi8((char)0xF3)));
+
+	if((_mm_movemask_epi8(_mm_cmpeq_epi8(need, zero)) ^ 0xFFFF) != _mm_movemask_epi8(trail))
+		return 0;
+
+	// leave any sequence that is cut off by the end of the block
+	if(utf8str[15] >= 0xC0)			len = 15;
+	else if(utf8str[14] >= 0xE0)	len = 14;
+	else if(utf8str[13] >= 0xF0)	len = 13;
+	else							len = 16;
+
+	mask = (1 << len) - 1;
+
+	if((_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) ^ 0xFFFF) & mask)
+		return 0;
+
+	*utf16len = len - popcount16(_mm_movemask_epi8(trail) & mask)
+					+ popcount16((_mm_movemask_epi8(_mm_cmpeq_epi8(pairs, zero)) ^ 0xFFFF) & mask);
+
+	return len;
+}
+#endif
+
+//
+//	utf8_count_utf16
+//
+//	Counts the number of UTF-16 code-units the specified UTF-8 text
+//	would convert to, without storing the result anywhere. The count
+//	matches utf8_to_utf16 exactly, including the handling of illegal
+//	sequences (each one counts as a single replacement character)
+//
+//	Surrogate pairs are never split - if only one code-unit remains
+//	of the limit then counting stops before the pair
+//
+//	utf8str		- [in]		buffer containing utf-8 text
+//	utf8len		- [in]		number of code-units (bytes) in buffer
+//	utf16len	- [in/out]	on input, specifies the max number of UTF16s to count
+//							on output, holds actual number of UTF16s counted
+//
+//	Returns the number of bytes processed from utf8str
+//
+size_t utf8_count_utf16(UTF8 *utf8str, size_t utf8len, size_t *utf16len)
+{
+	size_t pos   = 0;
+	size_t count = 0;
+	size_t limit = *utf16len;
+	size_t len;
+	size_t units;
+	UTF32  ch32;
+
+	while(pos < utf8len && count < limit)
+	{
+#ifdef UNICODE_SSE2
+		// skip runs of plain ASCII sixteen bytes at a time
+		while(utf8len - pos >= 16 && limit - count >= 16 &&
+			  _mm_movemask_epi8(_mm_loadu_si128((__m128i *)(utf8str + pos))) == 0)
+		{
+			pos   += 16;
+			count += 16;
+		}
+
+		if(pos == utf8len || count == limit)
+			break;
+
+		// anything else is counted sixteen bytes at a time as well, 
+		// until something unusual turns up
+		if(utf8len - pos >= 16 && limit - count >= 16)
+		{
+			len = utf8_count_block_sse2(utf8str + pos, &units);
+
+			if(len != 0)
+			{
+				pos   += len;
+				count += units;
+				continue;
+			}
+		}
+#endif
+		// decode one character - utf32_to_utf16 would store
+		// 0x10000-0x10FFFF as a pair, anything else as one unit
+		len   = utf8_to_utf32(utf8str + pos, utf8len - pos, &ch32);
+		units = (ch32 > UNI_MAX_BMP && ch32 <= UNI_MAX_UTF16) ? 2 : 1;
+
+		if(count + units > limit)
+			break;
+
+		pos   += len;
+		count += units;
+	}
+
+	*utf16len = count;
+	return pos;
+}
+
+//
+//	utf8_complete_len
+//
+//	Returns the length of the specified UTF-8 buffer, excluding any
+//	incomplete sequence at the very end. Used when a stream of UTF-8 is
+//	processed in blocks, so that characters straddling two blocks are 
+//	not decoded as illegal sequences
+//
+//	utf8str		- [in]		buffer containing utf-8 text
+//	utf8len		- [in]		number of code-units (bytes) in buffer
+//
+size_t utf8_complete_len(UTF8 *utf8str, size_t utf8len)
+{
+	size_t i;
+	size_t trailing;
+
+	// find the last byte that isn't a continuation byte (at most
+	// five trail-bytes can follow a lead-byte, even illegally)
+	for(i = utf8len; i > 0 && utf8len - i < 6; i--)
+	{
+		UTF8 ch = utf8str[i - 1];
+
+		if((ch & 0xC0) != 0x80)
+		{
+			if((ch & 0xE0) == 0xC0)			trailing = 1;
+			else if((ch & 0xF0) == 0xE0)	trailing = 2;
+			else if((ch & 0xF8) == 0xF0)	trailing = 3;
+			else if((ch & 0xFC) == 0xF8)	trailing = 4;
+			else if((ch & 0xFE) == 0xFC)	trailing = 5;
+			else							trailing = 0;
+
+			// not enough trail-bytes - exclude the sequence
+			return (utf8len - i < trailing) ? i - 1 : utf8len;
+		}
+	}
+
+	return utf8len;
+}
+
+//
+//	utf32_count_utf16
+//
+//	Counts the number of UTF-16 code-units the specified UTF-32 text
+//	would convert to (see utf32_to_utf16), without storing the result 
+//
+//	utf32str	- [in]		buffer containing utf-32 text
+//	utf32len	- [in]		number of characters (UTF32s) in buffer
+//	utf16len	- [in/out]	on input, the maximum number of UTF16s to count
+//							on output, holds the actual number counted
+//	bigendian	- [in]		TRUE if the text is big-endian
+//
+//	Returns the number of UTF32s processed from utf32str
+//
+size_t utf32_count_utf16(UTF32 *utf32str, size_t utf32len, size_t *utf16len, int bigendian)
+{
+	UTF32 *utf32start = utf32str;
+	size_t count	  = 0;
+	size_t limit	  = *utf16len;
+
+#ifdef UNICODE_SSE2
+	__m128i bias32 = _mm_set1_epi32(0x80000000);
+	__m128i bmp    = _mm_set1_epi32(0x80000000 | 0x10000);
+#endif
+
+	while(utf32len > 0 && count < limit)
+	{
+		UTF32 ch32;
+
+#ifdef UNICODE_SSE2
+		// 4 characters which are all in the BMP count as 4 UTF16s
+		if(utf32len >= 4 && limit - count >= 4)
+		{
+			__m128i v = _mm_loadu_si128((__m128i *)utf32str);
+
+			if(bigendian)
+				v = swap_utf32_sse2(v);
+
+			if(_mm_movemask_epi8(_mm_cmplt_epi32(_mm_xor_si128(v, bias32), bmp)) == 0xFFFF)
+			{
+				utf32str += 4;
+				utf32len -= 4;
+				count	 += 4;
+				continue;
+			}
+		}
+#endif
+
+		ch32 = bigendian ? SWAPDWORD(*utf32str) : *utf32str;
+
+		// characters outside the BMP need a surrogate pair
+		if(ch32 > UNI_MAX_BMP && ch32 <= UNI_MAX_UTF16)
+		{
+			if(limit - count < 2)
+				break;
+
+			count += 2;
+		}
+		else
+		{
+			count += 1;
+		}
+
+		utf32str++;
+		utf32len--;
+	}
+
+	*utf16len = count;
+	return utf32str - utf32start;
+}
+
+//
+//	utf8_validate
+//
+//	Checks the specified buffer for well-formed UTF-8: shortest-form 
+//	sequences only, no encoded surrogates and nothing above U+10FFFF.
+//	Used to sniff the format of files which don't have a byte-order-mark
+//
+//	utf8str		- [in]		buffer containing utf-8 text
+//	utf8len		- [in]		number of code-units (bytes) in buffer
+//	multibyte	- [out]		receives the number of valid multi-byte sequences
+//
+//	Returns the number of illegal sequences found
+//
+size_t utf8_validate(UTF8 *utf8str, size_t utf8len, size_t *multibyte)
+{
+	UTF8  *utf8end = utf8str + utf8len;
+	size_t errors  = 0;
+	size_t count   = 0;
+	size_t trailing;
+	size_t i;
+	UTF8   ch, lo, hi;
+
+	while(utf8str < utf8end)
+	{
+		ch = *utf8str;
+
+		if(ch < 0x80)
+		{
+#ifdef UNICODE_SSE2
+			// skip over runs of ASCII 16 bytes at a time
+			while(utf8end - utf8str >= 16 && 
+				_mm_movemask_epi8(_mm_loadu_si128((__m128i *)utf8str)) == 0)
+			{
+				utf8str += 16;
+			}
+
+			if(utf8str == utf8end || *utf8str >= 0x80)
+				continue;
+#endif
+			utf8str++;
+			continue;
+		}
+
+		// the first trail-byte has a restricted range after some lead-bytes
+		lo = 0x80;
+		hi = 0xBF;
+
+		if(ch >= 0xC2 && ch <= 0xDF)		trailing = 1;
+		else if(ch == 0xE0)					{ trailing = 2; lo = 0xA0; }
+		else if(ch == 0xED)					{ trailing = 2; hi = 0x9F; }
+		else if(ch >= 0xE1 && ch <= 0xEF)	trailing = 2;
+		else if(ch == 0xF0)					{ trailing = 3; lo = 0x90; }
+		else if(ch == 0xF4)					{ trailing = 3; hi = 0x8F; }
+		else if(ch >= 0xF1 && ch <= 0xF3)	trailing = 3;
+		else								trailing = 0;
+
+		// illegal lead-byte, or the sequence is cut short
+		if(trailing == 0 || (size_t)(utf8end - utf8str) <= trailing ||
+			utf8str[1] < lo || utf8str[1] > hi)
+		{
+			errors++;
+			utf8str++;
+			continue;
+		}
+
+		for(i = 2; i <= trailing; i++)
+		{
+			if((utf8str[i] & 0xC0) != 0x80)
+				break;
+		}
+
+		if(i <= trailing)
+		{
+			errors++;
+			utf8str++;
+			continue;
+		}
+
+		utf8str += trailing + 1;
+		count++;
+	}
+
+	*multibyte = count;
+	return errors;
+}
+
+//
+//	Ranges of characters that never start a grapheme cluster of their own:
+//	combining marks (and the spacing marks of the Indic scripts), variation 
+//	selectors, emoji skin-tone modifiers and tag characters
+//
+static const UTF32 extend_table[][2] = 
+{
+	{ 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, 
+	{ 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, 
+	{ 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 }, 
+	{ 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 }, { 0x0730, 0x074A }, 
+	{ 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 }, { 0x0816, 0x0819 }, { 0x081B, 0x0823 }, 
+	{ 0x0825, 0x0827 }, { 0x0829, 0x082D }, { 0x0859, 0x085B }, { 0x08D3, 0x08E1 }, 
+	{ 0x08E3, 0x0903 }, { 0x093A, 0x093C }, { 0x093E, 0x094F }, { 0x0951, 0x0957 }, 
+	{ 0x0962, 0x0963 }, { 0x0981, 0x0983 }, { 0x09BC, 0x09BC }, { 0x09BE, 0x09C4 }, 
+	{ 0x09C7, 0x09C8 }, { 0x09CB, 0x09CD }, { 0x09D7, 0x09D7 }, { 0x09E2, 0x09E3 }, 
+	{ 0x0A01, 0x0A03 }, { 0x0A3C, 0x0A51 }, { 0x0A70, 0x0A71 }, { 0x0A75, 0x0A75 }, 
+	{ 0x0A81, 0x0A83 }, { 0x0ABC, 0x0ACD }, { 0x0AE2, 0x0AE3 }, { 0x0B01, 0x0B03 }, 
+	{ 0x0B3C, 0x0B57 }, { 0x0B62, 0x0B63 }, { 0x0B82, 0x0B82 }, { 0x0BBE, 0x0BCD }, 
+	{ 0x0BD7, 0x0BD7 }, { 0x0C00, 0x0C04 }, { 0x0C3E, 0x0C56 }, { 0x0C62, 0x0C63 }, 
+	{ 0x0C81, 0x0C83 }, { 0x0CBC, 0x0CD6 }, { 0x0CE2, 0x0CE3 }, { 0x0D00, 0x0D03 }, 
+	{ 0x0D3B, 0x0D3C }, { 0x0D3E, 0x0D4D }, { 0x0D57, 0x0D57 }, { 0x0D62, 0x0D63 }, 
+	{ 0x0D82, 0x0D83 }, { 0x0DCA, 0x0DDF }, { 0x0DF2, 0x0DF3 }, { 0x0E31, 0x0E31 }, 
+	{ 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EBC }, 
+	{ 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 }, 
+	{ 0x0F39, 0x0F39 }, { 0x0F3E, 0x0F3F }, { 0x0F71, 0x0F84 }, { 0x0F86, 0x0F87 }, 
+	{ 0x0F8D, 0x0FBC }, { 0x0FC6, 0x0FC6 }, { 0x102B, 0x103E }, { 0x1056, 0x1059 }, 
+	{ 0x105E, 0x1060 }, { 0x1062, 0x1064 }, { 0x1067, 0x106D }, { 0x1071, 0x1074 }, 
+	{ 0x1082, 0x108D }, { 0x108F, 0x108F }, { 0x109A, 0x109D }, { 0x135D, 0x135F }, 
+	{ 0x1712, 0x1714 }, { 0x1732, 0x1734 }, { 0x1752, 0x1753 }, { 0x1772, 0x1773 }, 
+	{ 0x17B4, 0x17D3 }, { 0x17DD, 0x17DD }, { 0x180B, 0x180D }, { 0x1885, 0x1886 }, 
+	{ 0x18A9, 0x18A9 }, { 0x1920, 0x193B }, { 0x1A17, 0x1A1B }, { 0x1A55, 0x1A7F }, 
+	{ 0x1AB0, 0x1AFF }, { 0x1B00, 0x1B04 }, { 0x1B34, 0x1B44 }, { 0x1B6B, 0x1B73 }, 
+	{ 0x1B80, 0x1B82 }, { 0x1BA1, 0x1BAD }, { 0x1BE6, 0x1BF3 }, { 0x1C24, 0x1C37 }, 
+	{ 0x1CD0, 0x1CD2 }, { 0x1CD4, 0x1CE8 }, { 0x1CED, 0x1CED }, { 0x1CF4, 0x1CF4 }, 
+	{ 0x1CF7, 0x1CF9 }, { 0x1DC0, 0x1DFF }, { 0x200C, 0x200D }, { 0x20D0, 0x20F0 }, 
+	{ 0x2CEF, 0x2CF1 }, { 0x2D7F, 0x2D7F }, { 0x2DE0, 0x2DFF }, { 0x302A, 0x302F }, 
+	{ 0x3099, 0x309A }, { 0xA66F, 0xA672 }, { 0xA674, 0xA67D }, { 0xA69E, 0xA69F }, 
+	{ 0xA6F0, 0xA6F1 }, { 0xA802, 0xA802 }, { 0xA806, 0xA806 }, { 0xA80B, 0xA80B }, 
+	{ 0xA823, 0xA827 }, { 0xA880, 0xA881 }, { 0xA8B4, 0xA8C5 }, { 0xA8E0, 0xA8F1 }, 
+	{ 0xA8FF, 0xA8FF }, { 0xA926, 0xA92D }, { 0xA947, 0xA953 }, { 0xA980, 0xA983 }, 
+	{ 0xA9B3, 0xA9C0 }, { 0xA9E5, 0xA9E5 }, { 0xAA29, 0xAA36 }, { 0xAA43, 0xAA43 }, 
+	{ 0xAA4C, 0xAA4D }, { 0xAA7B, 0xAA7D }, { 0xAAB0, 0xAAB0 }, { 0xAAB2, 0xAAB4 }, 
+	{ 0xAAB7, 0xAAB8 }, { 0xAABE, 0xAABF }, { 0xAAC1, 0xAAC1 }, { 0xAAEB, 0xAAEF }, 
+	{ 0xAAF5, 0xAAF6 }, { 0xABE3, 0xABEA }, { 0xABEC, 0xABED }, { 0xFB1E, 0xFB1E }, 
+	{ 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFF9E, 0xFF9F }, { 0x101FD, 0x101FD }, 
+	{ 0x1D165, 0x1D169 }, { 0x1D16D, 0x1D172 }, { 0x1D17B, 0x1D182 }, { 0x1D185, 0x1D18B }, 
+	{ 0x1D1AA, 0x1D1AD }, { 0x1F3FB, 0x1F3FF }, { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF }, 
+};
+
+//
+//	Ranges of pictographic characters (emoji) which can be joined together 
+//	into a single cluster with a zero-width-joiner
+//
+static const UTF32 pictographic_table[][2] = 
+{
+	{ 0x00A9, 0x00A9 }, { 0x00AE, 0x00AE }, { 0x203C, 0x203C }, { 0x2049, 0x2049 }, 
+	{ 0x2122, 0x2122 }, { 0x2139, 0x2139 }, { 0x2194, 0x21AA }, { 0x231A, 0x23FF }, 
+	{ 0x24C2, 0x24C2 }, { 0x25AA, 0x25FE }, { 0x2600, 0x27BF }, { 0x2934, 0x2935 }, 
+	{ 0x2B05, 0x2B55 }, { 0x3030, 0x3030 }, { 0x303D, 0x303D }, { 0x3297, 0x3299 }, 
+	{ 0x1F000, 0x1FFFD }, 
+};
+
+//
+//	Binary search of a table of character ranges
+//
+static int in_range_table(const UTF32 table[][2], size_t count, UTF32 ch32)
+{
+	size_t lo = 0;
+	size_t hi = count;
+	size_t mid;
+
+	if(ch32 < table[0][0] || ch32 > table[count-1][1])
+		return 0;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+
+		if(ch32 < table[mid][0])
+			hi = mid;
+		else if(ch32 > table[mid][1])
+			lo = mid + 1;
+		else
+			return 1;
+	}
+
+	return 0;
+}
+
+//
+//	Hangul syllables and conjoining jamo
+//
+#define HANGUL_L	1
+#define HANGUL_V	2
+#define HANGUL_T	3
+#define HANGUL_LV	4
+#define HANGUL_LVT	5
+
+static int hangul_type(UTF32 ch32)
+{
+	if((ch32 >= 0x1100 && ch32 <= 0x115F) || (ch32 >= 0xA960 && ch32 <= 0xA97C))
+		return HANGUL_L;
+
+	if((ch32 >= 0x1160 && ch32 <= 0x11A7) || (ch32 >= 0xD7B0 && ch32 <= 0xD7C6))
+		return HANGUL_V;
+
+	if((ch32 >= 0x11A8 && ch32 <= 0x11FF) || (ch32 >= 0xD7CB && ch32 <= 0xD7FB))
+		return HANGUL_T;
+
+	if(ch32 >= 0xAC00 && ch32 <= 0xD7A3)
+		return (ch32 - 0xAC00) % 28 == 0 ? HANGUL_LV : HANGUL_LVT;
+
+	return 0;
+}
+
+static int is_control(UTF32 ch32)
+{
+	return ch32 < 0x20 || (ch32 >= 0x7F && ch32 <= 0x9F) || ch32 == 0x2028 || ch32 == 0x2029;
+}
+
+//
+//	grapheme_break
+//
+//	Decides whether there is a grapheme-cluster boundary between two 
+//	adjacent characters. This follows the rules of UAX #29, but with a
+//	simplified set of character properties (see the tables above)
+//
+//	Pairs of regional-indicators are NOT dealt with here, because that 
+//	depends on how many came before - two regional-indicators in a row 
+//	are reported as not having a break between them
+//
+//	before		- [in]	the character before the position in question
+//	after		- [in]	the character after the position
+//
+//	Returns non-zero if there is a boundary between the two characters
+//
+int grapheme_break(UTF32 before, UTF32 after)
+{
+	int h1, h2;
+
+	// CR/LF are never split
+	if(before == '\r' && after == '\n')
+		return 0;
+
+	// otherwise always break either side of a control character
+	if(is_control(before) || is_control(after))
+		return 1;
+
+	// nothing below U+0300 joins onto the previous character
+	if(after < 0x300 && before != UNI_ZWJ)
+		return 1;
+
+	// Hangul syllable sequences
+	if((h1 = hangul_type(before)) != 0 && (h2 = hangul_type(after)) != 0)
+	{
+		if(h1 == HANGUL_L)
+			return h2 == HANGUL_T;
+
+		if(h1 == HANGUL_V || h1 == HANGUL_LV)
+			return !(h2 == HANGUL_V || h2 == HANGUL_T);
+
+		return h2 != HANGUL_T;
+	}
+
+	// don't break before combining marks (or a zero-width-joiner)
+	if(in_range_table(extend_table, sizeof(extend_table) / sizeof(extend_table[0]), after))
+		return 0;
+
+	// emoji joined by a zero-width-joiner
+	if(before == UNI_ZWJ && in_range_table(pictographic_table, sizeof(pictographic_table) / sizeof(pictographic_table[0]), after))
+		return 0;
+
+	// flags are made from pairs of regional-indicators
+	if(UNI_IS_REGIONAL(before) && UNI_IS_REGIONAL(after))
+		return 0;
+
+	return 1;
+}
+
+//
+//	is_whitespace
+//
+//	Returns non-zero if the character has the Unicode White_Space
+//	property (which includes all of the line-break characters)
+//
+int is_whitespace(UTF32 ch32)
+{
+	if(ch32 <= 0x20)
+		return ch32 == 0x20 || (ch32 >= 0x09 && ch32 <= 0x0D);
+
+	return ch32 == 0x85   || ch32 == 0xA0   || ch32 == 0x1680 ||
+		  (ch32 >= 0x2000 && ch32 <= 0x200A) ||
+		   ch32 == 0x2028 || ch32 == 0x2029 || ch32 == 0x202F || 
+		   ch32 == 0x205F || ch32 == 0x3000;
+}
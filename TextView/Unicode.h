@@ -1,12 +1,19 @@
 #ifndef UNICODE_LIB_INCLUDED
 #define UNICODE_LIB_INCLUDED
 
+#include <limits.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Define the basic types for storing Unicode 
+// Define the basic types for storing Unicode (UTF32 is 32 bits
+// everywhere, unlike unsigned long on 64bit Unix)
+#if ULONG_MAX == 0xFFFFFFFF
 typedef unsigned long	UTF32;	
+#else
+typedef unsigned int	UTF32;
+#endif
 typedef unsigned short	UTF16;	
 typedef unsigned char	UTF8;	
 
@@ -22,7 +29,12 @@ typedef unsigned char	UTF8;
 #define UNI_SUR_LOW_START    (UTF32)0xDC00
 #define UNI_SUR_LOW_END      (UTF32)0xDFFF
 
-#define SWAPWORD(val) (((UTF16)(val) << 8) | ((UTF16)(val) >> 8))
+#define UNI_ZWJ				 (UTF32)0x200D
+#define UNI_IS_REGIONAL(ch)  ((ch) >= 0x1F1E6 && (ch) <= 0x1F1FF)
+
+#define SWAPWORD(val) ((UTF16)(((UTF16)(val) << 8) | ((UTF16)(val) >> 8)))
+#define SWAPDWORD(val) ((UTF32)((((UTF32)(val) & 0xFF) << 24) | (((UTF32)(val) & 0xFF00) << 8) | \
+						(((UTF32)(val) >> 8) & 0xFF00) | (((UTF32)(val) >> 24) & 0xFF)))
 
 //
 //	Conversions between UTF-8 and a single UTF-32 value
@@ -42,6 +54,8 @@ size_t  utf16_to_utf8(UTF16 *utf16str, size_t utf16len, UTF8 *utf8str,  size_t *
 size_t  utf16_to_utf32(UTF16 *utf16str,   size_t utf16len, UTF32 *utf32str, size_t *utf32len);
 size_t  utf32_to_utf16(UTF32 *utf32str,   size_t utf32len, UTF16 *utf16str, size_t *utf16len);
 size_t	utf16be_to_utf32(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len);
+size_t  utf32be_to_utf16(UTF32 *utf32str, size_t utf32len, UTF16 *utf16str, size_t *utf16len);
+size_t  utf16_to_utf32be(UTF16 *utf16str, size_t utf16len, UTF32 *utf32str, size_t *utf32len);
 
 
 //
@@ -56,6 +70,20 @@ size_t  utf16_to_ascii(UTF16 *utf16str, size_t utf16len, UTF8  *asciistr, size_t
 size_t	copy_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen);
 size_t	swap_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen);
 
+//
+//	Measuring UTF-8 text without converting it
+//
+size_t	utf8_count_utf16(UTF8 *utf8str, size_t utf8len, size_t *utf16len);
+size_t	utf8_complete_len(UTF8 *utf8str, size_t utf8len);
+size_t	utf32_count_utf16(UTF32 *utf32str, size_t utf32len, size_t *utf16len, int bigendian);
+size_t	utf8_validate(UTF8 *utf8str, size_t utf8len, size_t *multibyte);
+
+//
+//	Text segmentation
+//
+int		grapheme_break(UTF32 before, UTF32 after);
+int		is_whitespace(UTF32 ch32);
+
 
 
 #ifdef __cplusplus
@@ -1,4 +1,14 @@
 #ifndef CODEPAGES_INCLUDED
 #define CODEPAGES_INCLUDED
 
+//
+// currently supported Neatpad Codepages
+//
+#define NCP_ASCII		0
+#define NCP_UTF8		1
+#define NCP_UTF16		2
+#define NCP_UTF16BE		3
+#define NCP_UTF32		4
+#define NCP_UTF32BE		5
+
 #endif
\ No newline at end of file
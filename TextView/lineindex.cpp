@@ -0,0 +1,502 @@
+/*
+	lineindex.cpp
+
+	where each line of a document starts
+
+	www.catch22.net
+*/
+#include "portable.h"
+#include "lineindex.h"
+
+//
+//	Each node is one line. 'lines', 'bytes' and 'chars' are the totals
+//	for the node and everything below it
+//
+struct lineindex::node
+{
+	node	*left;
+	node	*right;
+	node	*parent;
+
+	ULONG	 priority;
+	ULONG	 lines;
+	ULONG	 bytes;
+	ULONG	 chars;
+	DOCLINE	 line;
+};
+
+// nodes are allocated this many at a time (or more, for a large build)
+#define NODE_BLOCK	1024
+
+// every change to any index gets a new number, so a cursor can't mistake one for another
+static volatile LONG last_generation = 0;
+
+lineindex::lineindex()
+{
+	root	  = 0;
+	seed	  = 0x2545F491;
+	freelist  = 0;
+	next_free = 0;
+	block_end = 0;
+	changed();
+}
+
+lineindex::lineindex(const lineindex &src)
+{
+	freelist  = 0;
+	next_free = 0;
+	block_end = 0;
+	seed	  = src.seed;
+
+	// the whole copy comes from one block
+	reserve(src.count());
+	root = clone(src.root, 0);
+	changed();
+}
+
+lineindex::~lineindex()
+{
+	release_all();
+}
+
+void lineindex::changed()
+{
+	generation = InterlockedIncrement(&last_generation);
+}
+
+void lineindex::clear()
+{
+	release_all();
+	root = 0;
+	changed();
+}
+
+//
+//	Make sure the next 'count' new nodes come one after the other
+//	from the same block. Whatever was left in the old block is wasted
+//
+void lineindex::reserve(size_t count)
+{
+	size_t size = max(count, (size_t)NODE_BLOCK);
+
+	if((size_t)(block_end - next_free) >= count)
+		return;
+
+	next_free = new node[size];
+	block_end = next_free + size;
+	blocks.push_back(next_free);
+}
+
+//
+//	Nodes that have been released are used again first, and are
+//	kept in a list joined by their 'left' pointers
+//
+lineindex::node *lineindex::alloc()
+{
+	node *n = freelist;
+
+	if(n)
+	{
+		freelist = n->left;
+		return n;
+	}
+
+	if(next_free == block_end)
+		reserve(1);
+
+	return next_free++;
+}
+
+// a node and everything below it
+void lineindex::release(node *n)
+{
+	while(n)
+	{
+		node *right = n->right;
+
+		release(n->left);
+		n->left	 = freelist;
+		freelist = n;
+		n		 = right;
+	}
+}
+
+void lineindex::release_all()
+{
+	for(size_t i = 0; i < blocks.size(); i++)
+		delete[] blocks[i];
+
+	blocks.clear();
+	freelist  = 0;
+	next_free = 0;
+	block_end = 0;
+}
+
+lineindex::node *lineindex::clone(const node *n, node *parent)
+{
+	node *c;
+
+	if(n == 0)
+		return 0;
+
+	c		  = alloc();
+	*c		  = *n;
+	c->parent = parent;
+	c->left   = clone(n->left, c);
+	c->right  = clone(n->right, c);
+
+	return c;
+}
+
+//
+//	Treap priorities (xorshift)
+//
+ULONG lineindex::random()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+//
+//	Add up a node's totals from its children, and point them back at it
+//
+void lineindex::total(node *n)
+{
+	n->lines = 1;
+	n->bytes = n->line.length_bytes;
+	n->chars = n->line.length_chars;
+
+	if(n->left)
+	{
+		n->lines += n->left->lines;
+		n->bytes += n->left->bytes;
+		n->chars += n->left->chars;
+		n->left->parent = n;
+	}
+
+	if(n->right)
+	{
+		n->lines += n->right->lines;
+		n->bytes += n->right->bytes;
+		n->chars += n->right->chars;
+		n->right->parent = n;
+	}
+}
+
+//
+//	Build a balanced tree from a run of lines in O(n). The priorities
+//	are random, but each one is swapped down the tree (like a heap)
+//	until it is no smaller than those below it
+//
+lineindex::node *lineindex::build(const DOCLINE *lines, size_t count)
+{
+	size_t mid = count / 2;
+	node  *n, *c;
+
+	if(count == 0)
+		return 0;
+
+	n			= alloc();
+	n->line		= lines[mid];
+	n->parent	= 0;
+	n->left		= build(lines, mid);
+	n->right	= build(lines + mid + 1, count - mid - 1);
+	n->priority = random();
+
+	total(n);
+
+	for(c = n; ; )
+	{
+		node *big = c;
+
+		if(c->left  && c->left->priority  > big->priority)	big = c->left;
+		if(c->right && c->right->priority > big->priority)	big = c->right;
+
+		if(big == c)
+			break;
+
+		std::swap(big->priority, c->priority);
+		c = big;
+	}
+
+	return n;
+}
+
+void lineindex::assign(const std::vector<DOCLINE> &lines)
+{
+	release_all();
+	reserve(lines.size());
+	root = lines.empty() ? 0 : build(&lines[0], lines.size());
+	changed();
+}
+
+//
+//	Split the tree 't' into its first 'count' lines and the rest
+//
+void lineindex::split(node *t, ULONG count, node **l, node **r)
+{
+	ULONG left;
+
+	if(t == 0)
+	{
+		*l = 0;
+		*r = 0;
+		return;
+	}
+
+	left = t->left ? t->left->lines : 0;
+
+	if(count <= left)
+	{
+		split(t->left, count, l, &t->left);
+		*r = t;
+	}
+	else
+	{
+		split(t->right, count - left - 1, &t->right, r);
+		*l = t;
+	}
+
+	total(t);
+	t->parent = 0;
+}
+
+//
+//	Join two trees, where all the lines in 'a' come before those in 'b'
+//
+lineindex::node *lineindex::merge(node *a, node *b)
+{
+	if(a == 0)
+		return b;
+
+	if(b == 0)
+		return a;
+
+	if(a->priority > b->priority)
+	{
+		a->right = merge(a->right, b);
+		total(a);
+		return a;
+	}
+	else
+	{
+		b->left = merge(a, b->left);
+		total(b);
+		return b;
+	}
+}
+
+void lineindex::replace(ULONG first, ULONG last, const std::vector<DOCLINE> &lines)
+{
+	node *a, *b, *c;
+
+	split(root, first, &a, &b);
+	split(b, last - first, &b, &c);
+	release(b);
+
+	b = lines.empty() ? 0 : build(&lines[0], lines.size());
+
+	if((root = merge(merge(a, b), c)) != 0)
+		root->parent = 0;
+
+	changed();
+}
+
+ULONG lineindex::count() const
+{
+	return root ? root->lines : 0;
+}
+
+ULONG lineindex::total_bytes() const
+{
+	return root ? root->bytes : 0;
+}
+
+ULONG lineindex::total_chars() const
+{
+	return root ? root->chars : 0;
+}
+
+//
+//	The line before or after a node
+//
+const lineindex::node *lineindex::step(const node *n, bool forwards)
+{
+	const node *c = forwards ? n->right : n->left;
+
+	if(c)
+	{
+		while((forwards ? c->left : c->right) != 0)
+			c = forwards ? c->left : c->right;
+
+		return c;
+	}
+
+	while(n->parent && (forwards ? n->parent->right : n->parent->left) == n)
+		n = n->parent;
+
+	return n->parent;
+}
+
+const DOCLINE *lineindex::line(ULONG lineno, ULONG *offset_bytes, ULONG *offset_chars, cursor *cur) const
+{
+	const node *n	  = root;
+	ULONG		bytes = 0;
+	ULONG		chars = 0;
+	ULONG		want  = lineno;
+
+	if(lineno >= count())
+	{
+		if(offset_bytes) *offset_bytes = total_bytes();
+		if(offset_chars) *offset_chars = total_chars();
+		return 0;
+	}
+
+	// the line before or after the last one looked up
+	if(cur && cur->n && cur->generation == generation && lineno + 1 >= cur->lineno && lineno <= cur->lineno + 1)
+	{
+		n	  = cur->n;
+		bytes = cur->offset_bytes;
+		chars = cur->offset_chars;
+
+		if(lineno > cur->lineno)
+		{
+			bytes += n->line.length_bytes;
+			chars += n->line.length_chars;
+			n	   = step(n, true);
+		}
+		else if(lineno < cur->lineno)
+		{
+			n	   = step(n, false);
+			bytes -= n->line.length_bytes;
+			chars -= n->line.length_chars;
+		}
+	}
+	else
+	{
+		for(;;)
+		{
+			ULONG left = n->left ? n->left->lines : 0;
+
+			if(want < left)
+			{
+				n = n->left;
+				continue;
+			}
+
+			if(n->left)
+			{
+				bytes += n->left->bytes;
+				chars += n->left->chars;
+			}
+
+			if(want == left)
+				break;
+
+			bytes += n->line.length_bytes;
+			chars += n->line.length_chars;
+			want  -= left + 1;
+			n	   = n->right;
+		}
+	}
+
+	if(cur)
+	{
+		cur->n			  = n;
+		cur->lineno		  = lineno;
+		cur->offset_bytes = bytes;
+		cur->offset_chars = chars;
+		cur->generation	  = generation;
+	}
+
+	if(offset_bytes) *offset_bytes = bytes;
+	if(offset_chars) *offset_chars = chars;
+
+	return &n->line;
+}
+
+//
+//	The lengths are part of the subtree totals so they mustn't be touched,
+//	but the rest of the line can be changed where it is
+//
+DOCLINE *lineindex::modify(ULONG lineno, ULONG *offset_bytes, ULONG *offset_chars, cursor *cur)
+{
+	return const_cast<DOCLINE *>(line(lineno, offset_bytes, offset_chars, cur));
+}
+
+ULONG lineindex::offset_bytes(ULONG lineno) const
+{
+	ULONG offset;
+
+	line(lineno, &offset, 0);
+	return offset;
+}
+
+ULONG lineindex::offset_chars(ULONG lineno) const
+{
+	ULONG offset;
+
+	line(lineno, 0, &offset);
+	return offset;
+}
+
+ULONG lineindex::lineno_from_bytes(ULONG offset) const
+{
+	const node *n	   = root;
+	ULONG		lineno = 0;
+
+	while(n)
+	{
+		ULONG left = n->left ? n->left->bytes : 0;
+
+		if(offset < left)
+		{
+			n = n->left;
+			continue;
+		}
+
+		offset -= left;
+		lineno += n->left ? n->left->lines : 0;
+
+		if(offset < n->line.length_bytes)
+			return lineno;
+
+		offset -= n->line.length_bytes;
+		lineno++;
+		n = n->right;
+	}
+
+	return lineno ? lineno - 1 : 0;
+}
+
+ULONG lineindex::lineno_from_chars(ULONG offset) const
+{
+	const node *n	   = root;
+	ULONG		lineno = 0;
+
+	while(n)
+	{
+		ULONG left = n->left ? n->left->chars : 0;
+
+		if(offset < left)
+		{
+			n = n->left;
+			continue;
+		}
+
+		offset -= left;
+		lineno += n->left ? n->left->lines : 0;
+
+		if(offset < n->line.length_chars)
+			return lineno;
+
+		offset -= n->line.length_chars;
+		lineno++;
+		n = n->right;
+	}
+
+	return lineno ? lineno - 1 : 0;
+}
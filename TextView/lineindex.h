@@ -0,0 +1,117 @@
+#ifndef LINEINDEX_INCLUDED
+#define LINEINDEX_INCLUDED
+
+#include <vector>
+
+//
+//	LINESTATS - what each line contains, for the document statistics
+//
+typedef struct
+{
+	ULONG	words;
+	ULONG	codepoints;		// including the line-break
+	BYTE	eol;			// how the line ends (EOL_xxx)
+
+} LINESTATS;
+
+//
+//	DOCLINE - one line of a document. Its position isn't stored anywhere,
+//	it is the total length of all the lines before it
+//
+typedef struct
+{
+	ULONG		length_bytes;	// including the line-break
+	ULONG		length_chars;
+	ULONG		width;			// tab-expanded display width
+	ULONG		width2;			// the same, with the document's second tab-size
+	LINESTATS	stats;
+
+} DOCLINE;
+
+//
+//	lineindex class - the lines of a document, in order.
+//
+//	The lines are kept in a treap ordered by line number, and each node
+//	only stores the length of its own line along with the totals for the
+//	subtree below it. Where a line starts is added up on the way down from
+//	the root, so replacing some lines never means moving all the lines after 
+//	them along - an edit costs O(log n), not O(lines). The nodes are carved
+//	out of large blocks rather than allocated one at a time, so that loading
+//	or copying a document with a million lines is a handful of allocations
+//
+class lineindex
+{
+public:
+	struct node;
+
+	//
+	//	Remembers the line it was last used to look up, so that looking up 
+	//	the line before or after it doesn't have to search from the top. It
+	//	knows when the index has changed since, and searches again
+	//
+	struct cursor
+	{
+		const node *n;
+		ULONG		lineno;
+		ULONG		offset_bytes;
+		ULONG		offset_chars;
+		LONG		generation;
+	};
+
+	lineindex();
+	lineindex(const lineindex &src);
+	~lineindex();
+
+	void		clear();
+	void		assign(const std::vector<DOCLINE> &lines);
+
+	// swap lines 'first' up to (but not including) 'last' for some new ones
+	void		replace(ULONG first, ULONG last, const std::vector<DOCLINE> &lines);
+
+	ULONG		count() const;
+	ULONG		total_bytes() const;
+	ULONG		total_chars() const;
+
+	// a line and where it starts - 'lineno' can be count(), for the end of the document
+	const DOCLINE *line(ULONG lineno, ULONG *offset_bytes = 0, ULONG *offset_chars = 0, cursor *cur = 0) const;
+	// the same, for changing anything but the line's lengths
+	DOCLINE *	modify(ULONG lineno, ULONG *offset_bytes = 0, ULONG *offset_chars = 0, cursor *cur = 0);
+
+	ULONG		offset_bytes(ULONG lineno) const;
+	ULONG		offset_chars(ULONG lineno) const;
+
+	// the line containing an offset (the last line for anything past the end)
+	ULONG		lineno_from_bytes(ULONG offset_bytes) const;
+	ULONG		lineno_from_chars(ULONG offset_chars) const;
+
+private:
+
+	void			reserve(size_t count);
+	node *			alloc();
+	void			release(node *n);
+	void			release_all();
+
+	node *			clone(const node *n, node *parent);
+	static void		total(node *n);
+	static const node *step(const node *n, bool forwards);
+
+	node *			build(const DOCLINE *lines, size_t count);
+	void			split(node *t, ULONG count, node **l, node **r);
+	node *			merge(node *a, node *b);
+	void			changed();
+	ULONG			random();
+
+	node	*root;
+	ULONG	 seed;
+	LONG	 generation;
+
+	// where the nodes come from
+	std::vector<node *> blocks;
+	node	*freelist;
+	node	*next_free;
+	node	*block_end;
+
+	lineindex & operator=(const lineindex &);
+};
+
+#endif
@@ -0,0 +1,378 @@
+/*
+	markers.cpp
+
+	positions which move with the text as it is edited
+
+	www.catch22.net
+*/
+#include "portable.h"
+#include "markers.h"
+
+//
+//	Each node's position is its parent's plus 'rel', so moving a whole
+//	subtree is just a change to the root of that subtree. 'flat' says
+//	that everything below a node has collapsed onto it, and is only
+//	passed on to the children (pushdown) when they are next looked at
+//
+struct markers::node
+{
+	node	*left;
+	node	*right;
+	node	*parent;
+
+	ULONG	 rel;
+	ULONG	 priority;
+	bool	 flat;
+	void	*param;
+};
+
+markers::markers()
+{
+	root  = 0;
+	count = 0;
+	seed  = 0x2545F491;
+}
+
+markers::~markers()
+{
+	clear();
+}
+
+void markers::clear()
+{
+	destroy(root);
+
+	root  = 0;
+	count = 0;
+}
+
+void markers::destroy(node *n)
+{
+	if(n)
+	{
+		destroy(n->left);
+		destroy(n->right);
+		delete n;
+	}
+}
+
+size_t markers::size() const
+{
+	return count;
+}
+
+void *markers::param(marker m)
+{
+	return m->param;
+}
+
+//
+//	Treap priorities (xorshift)
+//
+ULONG markers::random()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+//
+//	Hand a collapsed node's position on to its children
+//
+void markers::pushdown(node *n)
+{
+	if(n->flat)
+	{
+		if(n->left)
+		{
+			n->left->rel   = 0;
+			n->left->flat  = true;
+		}
+
+		if(n->right)
+		{
+			n->right->rel  = 0;
+			n->right->flat = true;
+		}
+
+		n->flat = false;
+	}
+}
+
+//
+//	Split the tree 't' (whose root's position is absolute) into the markers
+//	at or before 'position' and those after. Both halves come back with
+//	absolute positions in their roots
+//
+void markers::split(node *t, ULONG position, node **l, node **r)
+{
+	node *c;
+
+	if(t == 0)
+	{
+		*l = 0;
+		*r = 0;
+		return;
+	}
+
+	pushdown(t);
+
+	if(t->rel <= position)
+	{
+		if((c = t->right) != 0)
+		{
+			c->rel	 += t->rel;
+			c->parent = 0;
+		}
+
+		split(c, position, &t->right, r);
+
+		if(t->right)
+		{
+			t->right->rel	 -= t->rel;
+			t->right->parent  = t;
+		}
+
+		*l = t;
+	}
+	else
+	{
+		if((c = t->left) != 0)
+		{
+			c->rel	 += t->rel;
+			c->parent = 0;
+		}
+
+		split(c, position, l, &t->left);
+
+		if(t->left)
+		{
+			t->left->rel	-= t->rel;
+			t->left->parent  = t;
+		}
+
+		*r = t;
+	}
+
+	t->parent = 0;
+}
+
+//
+//	Join two trees, where everything in 'a' comes before everything in 'b'.
+//	Both roots' positions must be relative to the same place, and so is the result's
+//
+markers::node *markers::merge(node *a, node *b)
+{
+	node *c;
+
+	if(a == 0)
+		return b;
+
+	if(b == 0)
+		return a;
+
+	if(a->priority > b->priority)
+	{
+		pushdown(a);
+
+		if((c = a->right) != 0)
+			c->rel += a->rel;
+
+		c = merge(c, b);
+		c->rel	 -= a->rel;
+		c->parent = a;
+		a->right  = c;
+
+		return a;
+	}
+	else
+	{
+		pushdown(b);
+
+		if((c = b->left) != 0)
+			c->rel += b->rel;
+
+		c = merge(a, c);
+		c->rel	 -= b->rel;
+		c->parent = b;
+		b->left   = c;
+
+		return b;
+	}
+}
+
+//
+//	Add a new marker. It goes after any others at the same position
+//
+markers::marker markers::add(ULONG position, void *param)
+{
+	node *n = new node;
+	node *l, *r;
+
+	n->left		= 0;
+	n->right	= 0;
+	n->parent	= 0;
+	n->rel		= position;
+	n->priority = random();
+	n->flat		= false;
+	n->param	= param;
+
+	split(root, position, &l, &r);
+
+	root = merge(merge(l, n), r);
+	root->parent = 0;
+
+	count++;
+	return n;
+}
+
+void markers::remove(marker m)
+{
+	node *l, *r, *c;
+	node *p = m->parent;
+
+	pushpath(m);
+
+	// the children's positions become relative to the parent instead
+	if((l = m->left) != 0)
+	{
+		l->rel	 += m->rel;
+		l->parent = 0;
+	}
+
+	if((r = m->right) != 0)
+	{
+		r->rel	 += m->rel;
+		r->parent = 0;
+	}
+
+	if((c = merge(l, r)) != 0)
+		c->parent = p;
+
+	if(p == 0)
+		root = c;
+	else if(p->left == m)
+		p->left = c;
+	else
+		p->right = c;
+
+	delete m;
+	count--;
+}
+
+//
+//	Make sure nothing is still waiting to be pushed down onto 'n'
+//
+void markers::pushpath(node *n)
+{
+	if(n)
+	{
+		pushpath(n->parent);
+		pushdown(n);
+	}
+}
+
+ULONG markers::position(marker m)
+{
+	ULONG position = 0;
+
+	pushpath(m->parent);
+
+	for(node *n = m; n; n = n->parent)
+		position += n->rel;
+
+	return position;
+}
+
+markers::marker markers::first(ULONG position)
+{
+	node *n    = root;
+	node *best = 0;
+	ULONG base = 0;
+
+	while(n)
+	{
+		pushdown(n);
+		base += n->rel;
+
+		if(base >= position)
+		{
+			best = n;
+			n	 = n->left;
+		}
+		else
+		{
+			n	 = n->right;
+		}
+	}
+
+	return best;
+}
+
+markers::marker markers::next(marker m)
+{
+	node *n;
+
+	if(m->right)
+	{
+		for(n = m->right; n->left; )
+			n = n->left;
+
+		return n;
+	}
+
+	for(n = m; n->parent && n->parent->right == n; )
+		n = n->parent;
+
+	return n->parent;
+}
+
+void markers::update(ULONG position, ULONG erase_length, ULONG insert_length)
+{
+	node *a, *b, *c;
+
+	split(root, position, &a, &b);
+
+	// a marker at the end of the erased part is on the text after it (positions
+	// are whole numbers, so splitting at one before the end leaves it in 'c')
+	if(erase_length > 0)
+	{
+		split(b, position + erase_length - 1, &b, &c);
+	}
+	else
+	{
+		c = b;
+		b = 0;
+	}
+
+	// everything that was erased collapses onto the start of the edit
+	if(b)
+	{
+		b->rel  = position;
+		b->flat = true;
+	}
+
+	if(c)
+		c->rel += insert_length - erase_length;
+
+	if((root = merge(merge(a, b), c)) != 0)
+		root->parent = 0;
+}
+
+void markers::clamp(ULONG length)
+{
+	node *a, *b;
+
+	split(root, length, &a, &b);
+
+	if(b)
+	{
+		b->rel  = length;
+		b->flat = true;
+	}
+
+	if((root = merge(a, b)) != 0)
+		root->parent = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef MARKERS_INCLUDED
+#define MARKERS_INCLUDED
+
+//
+//	markers class - positions in a document (carets, bookmarks, search
+//	hits...) which move with the text as it is edited.
+//
+//	The markers are kept in a treap ordered by position, and each node
+//	only stores its position relative to its parent. Moving every marker
+//	after an edit therefore means changing just a few nodes, however many
+//	markers there are - an edit costs O(log n), not O(markers)
+//
+class markers
+{
+public:
+	// a marker handle - stays valid until the marker is removed
+	struct		node;
+	typedef		node *marker;
+
+	markers();
+	~markers();
+
+	marker		add(ULONG position, void *param = 0);
+	void		remove(marker m);
+	void		clear();
+
+	ULONG		position(marker m);
+	void *		param(marker m);
+	size_t		size() const;
+
+	// markers in position order, starting with the first at or after 'position'
+	marker		first(ULONG position = 0);
+	marker		next(marker m);
+
+	//
+	//	Move the markers along after an edit. Markers at 'position' stay
+	//	where they are, markers inside the erased part end up at 'position',
+	//	and markers from the end of the erased part onwards move with the text
+	//
+	void		update(ULONG position, ULONG erase_length, ULONG insert_length);
+
+	// bring any markers past the end back to 'length'
+	void		clamp(ULONG length);
+
+private:
+
+	static void		pushdown(node *n);
+	static void		pushpath(node *n);
+	static void		destroy(node *n);
+
+	void			split(node *t, ULONG position, node **l, node **r);
+	node *			merge(node *a, node *b);
+	ULONG			random();
+
+	node	*root;
+	size_t	 count;
+	ULONG	 seed;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PORTABLE_INCLUDED
+#define PORTABLE_INCLUDED
+
+//
+//	portable.h
+//
+//	The Win32 types that the document engine (TextDocument, sequence,
+//	markers, Unicode) is written with. Under Win32 they come from 
+//	<windows.h>, anywhere else they are defined here with the same sizes,
+//	so that the engine builds without the Platform SDK
+//
+
+#ifdef _WIN32
+
+#ifndef STRICT
+#define STRICT
+#endif
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+#include <tchar.h>
+
+#else
+
+#include <stddef.h>
+#include <string.h>
+
+// the standard headers use std::min and std::max, so they come before the macros
+#ifdef __cplusplus
+#include <algorithm>
+#include <vector>
+#include <map>
+#endif
+
+typedef unsigned char		BYTE;
+typedef unsigned short		WORD;
+typedef unsigned int		DWORD;
+typedef unsigned int		ULONG;
+typedef int					LONG;
+typedef unsigned int		UINT;
+typedef int					BOOL;
+typedef char				CCHAR;
+typedef unsigned long long	ULONGLONG;
+typedef long long			LONGLONG;
+
+// documents are always UTF-16 internally, whatever the size of wchar_t
+typedef unsigned short		WCHAR;
+typedef WCHAR				TCHAR;
+
+#define TRUE	1
+#define FALSE	0
+
+#ifndef min
+#define min(a, b)	(((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b)	(((a) > (b)) ? (a) : (b))
+#endif
+
+static inline LONG InterlockedIncrement(volatile LONG *value)
+{
+	return __sync_add_and_fetch(value, 1);
+}
+
+static inline LONG InterlockedDecrement(volatile LONG *value)
+{
+	return __sync_sub_and_fetch(value, 1);
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -6,7 +6,7 @@
 	Copyright J Brown 1999-2006
 	www.catch22.net
 */
-#include <windows.h>
+#include "portable.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include "sequence.h"
@@ -42,8 +42,8 @@ void debug(const char *fmt, ...)
 }
 
 #else
-#define debug
-#define odebug
+static inline void debug(const char *, ...) { }
+static inline void odebug(const char *, ...) { }
 #endif
 
 
@@ -53,6 +53,8 @@ sequence::sequence ()
 	
 	head = tail		= 0;
 	sequence_length = 0;
+	cache_span		= 0;
+	cache_index		= 0;
 	group_id		= 0;
 	group_refcount	= 0;
 
@@ -61,6 +63,15 @@ sequence::sequence ()
 	head->next		= tail;
 	tail->prev		= head;
 
+	undoroot		= new span_range();
+	undoroot->jump	= undoroot;
+	undopos			= undoroot;
+	undofloor		= undoroot;
+
+	extendbuffer_id	= -1;
+	restore_func	= 0;
+	restore_param	= 0;
+
 #ifdef DEBUG_SEQUENCE
 	SYSTEMTIME st;
 	GetLocalTime(&st);
@@ -74,6 +85,7 @@ sequence::~sequence ()
 
 	delete head;
 	delete tail;
+	delete undoroot;
 }
 
 bool sequence::init ()
@@ -93,14 +105,33 @@ bool sequence::init ()
 }
 
 bool sequence::init (const seqchar *buffer, size_t length)
+{
+	seqchar *data;
+
+	if((data = init_buffer(length)) == 0)
+		return false;
+
+	memcpy(data, buffer, length * sizeof(seqchar));
+	return true;
+}
+
+//
+//	Initialize with a buffer of the specified length, which the caller 
+//	fills in afterwards - a file can be read straight into it, instead 
+//	of being read somewhere else and then copied
+//
+seqchar * sequence::init_buffer (size_t length)
 {
 	clear();
 
 	if(!init())
-		return false;
+		return 0;
 
 	buffer_control *bc = alloc_modifybuffer(length);
-	memcpy(bc->buffer, buffer, length * sizeof(seqchar));
+
+	if(bc == 0)
+		return 0;
+
 	bc->length = length;
 
 	span *sptr = new span(0, length, bc->id, tail, head);
@@ -108,15 +139,45 @@ bool sequence::init (const seqchar *buffer, size_t length)
 	tail->prev = sptr;
 
 	sequence_length = length;
-	return true;
+	return bc->buffer;
 }
 
 //
-//	Initialize from an on-disk file
+//	Make 'dest' an independent copy of this sequence. Nothing in a buffer
+//	is ever changed once it has been written, so the copy shares all of our 
+//	buffers and only the span-list itself is duplicated. Each sequence then 
+//	adds to its own modify-buffer, beyond the end of anything the other can 
+//	see. The copy's undo/redo history starts out empty
 //
-bool sequence::open(TCHAR *filename, bool readonly)
+bool sequence::fork(sequence &dest) const
 {
-	return false;
+	span *sptr, *last;
+
+	if(&dest == this)
+		return false;
+
+	dest.clear();
+
+	for(size_t i = 0; i < buffer_list.size(); i++)
+	{
+		InterlockedIncrement(&buffer_list[i]->refcount);
+		dest.buffer_list.push_back(buffer_list[i]);
+	}
+
+	if(!dest.init())
+		return false;
+
+	last = dest.head;
+
+	for(sptr = head->next; sptr != tail; sptr = sptr->next)
+	{
+		last->next = new span(sptr->offset, sptr->length, sptr->buffer, dest.tail, last);
+		last	   = last->next;
+	}
+
+	dest.tail->prev		 = last;
+	dest.sequence_length = sequence_length;
+	return true;
 }
 
 //
@@ -136,15 +197,22 @@ void sequence::clear_vector (type &vectorobject)
 	}
 }
 
-void sequence::clearstack (eventstack &dest)
+//
+//	Throw away the whole undo tree
+//
+void sequence::clearhistory ()
 {
-	for(size_t i = 0; i < dest.size(); i++)
+	for(size_t i = 0; i < eventlist.size(); i++)
 	{
-		dest[i]->free();
-		delete dest[i];
+		eventlist[i]->free();
+		delete eventlist[i];
 	}
 
-	dest.clear();
+	eventlist.clear();
+
+	undoroot->redo = 0;
+	undopos		   = undoroot;
+	undofloor	   = undoroot;
 }
 
 void sequence::debug1 ()
@@ -154,7 +222,7 @@ void sequence::debug1 ()
 	for(sptr = head; sptr; sptr = sptr->next)
 	{
 		char *buffer = (char *)buffer_list[sptr->buffer]->buffer;
-		printf("%.*s", sptr->length, buffer + sptr->offset);
+		printf("%.*s", (int)sptr->length, buffer + sptr->offset);
 	}
 
 	printf("\n");
@@ -169,9 +237,9 @@ void sequence::debug2 ()
 	{
 		char *buffer = (char *)buffer_list[sptr->buffer]->buffer;
 		
-		printf("[%d] [%4d %4d] %.*s\n", sptr->id, 
-			sptr->offset, sptr->length,
-			sptr->length, buffer + sptr->offset);
+		printf("[%d] [%4lu %4lu] %.*s\n", sptr->id, 
+			(unsigned long)sptr->offset, (unsigned long)sptr->length,
+			(int)sptr->length, buffer + sptr->offset);
 	}
 
 	printf("-------------------------\n");
@@ -180,9 +248,9 @@ void sequence::debug2 ()
 	{
 		char *buffer = (char *)buffer_list[sptr->buffer]->buffer;
 		
-		printf("[%d] [%4d %4d] %.*s\n", sptr->id, 
-			sptr->offset, sptr->length,
-			sptr->length, buffer + sptr->offset);
+		printf("[%d] [%4lu %4lu] %.*s\n", sptr->id, 
+			(unsigned long)sptr->offset, (unsigned long)sptr->length,
+			(int)sptr->length, buffer + sptr->offset);
 	}
 
 	printf("**********************\n");
@@ -190,10 +258,10 @@ void sequence::debug2 ()
 	for(sptr = head; sptr; sptr = sptr->next)
 	{
 		char *buffer = (char *)buffer_list[sptr->buffer]->buffer;
-		printf("%.*s", sptr->length, buffer + sptr->offset);
+		printf("%.*s", (int)sptr->length, buffer + sptr->offset);
 	}
 
-	printf("\nsequence length = %d chars\n", sequence_length);
+	printf("\nsequence length = %lu chars\n", (unsigned long)sequence_length);
 	printf("\n\n");
 }
 
@@ -217,6 +285,7 @@ sequence::buffer_control* sequence::alloc_buffer (size_t maxsize)
 	bc->length  = 0;
 	bc->maxsize = maxsize;
 	bc->id		= buffer_list.size();		// assign the id
+	bc->refcount = 1;
 
 	buffer_list.push_back(bc);
 
@@ -258,8 +327,9 @@ bool sequence::import_buffer (const seqchar *buf, size_t len, size_t *buffer_off
 	if(bc == 0)
 		return false;
 
-	// import the data
-	memcpy(bc->buffer + bc->length, buf, len * sizeof(seqchar));
+	// import the data - unless it was written in place (see sequence::reserve)
+	if(buf != bc->buffer + bc->length)
+		memcpy(bc->buffer + bc->length, buf, len * sizeof(seqchar));
 	
 	*buffer_offset = bc->length;
 	bc->length += len;
@@ -267,28 +337,146 @@ bool sequence::import_buffer (const seqchar *buf, size_t len, size_t *buffer_off
 	return true;
 }
 
+//
+//	Return a pointer to the free space at the end of the modify-buffer, with
+//	room for at least 'length' items. Data written here can be passed straight 
+//	to insert/replace, which then don't need to make their own copy of it
+//
+seqchar * sequence::reserve (size_w length)
+{
+	buffer_control *bc;
+	
+	// get the current modify-buffer
+	bc = buffer_list[modifybuffer_id];
+
+	// if there isn't room then allocate a new modify-buffer
+	if(bc->length + length >= bc->maxsize)
+	{
+		if((bc = alloc_modifybuffer(length + 0x10000)) == 0)
+			return 0;
+		
+		// make sure that no old spans use this buffer
+		record_action(action_invalid, 0);
+	}
+
+	return bc->buffer + bc->length;
+}
+
+//
+//	Grow the sequence at the end with data that didn't come from an edit 
+//	(a file that is being appended to, for example). extend_reserve returns
+//	space for up to 'length' items, and extend then adds however many of 
+//	them were actually written. 
+//
+//	Data is kept in its own buffers, so consecutive extensions just lengthen 
+//	the last span - each one costs the same however many there have been
+//
+seqchar * sequence::extend_reserve (size_w length)
+{
+	buffer_control *bc = 0;
+
+	if(extendbuffer_id >= 0)
+		bc = buffer_list[extendbuffer_id];
+
+	if(bc == 0 || bc->length + length > bc->maxsize)
+	{
+		if((bc = alloc_buffer(length > EXTEND_BUFSIZE ? length : EXTEND_BUFSIZE)) == 0)
+			return 0;
+
+		extendbuffer_id = bc->id;
+	}
+
+	return bc->buffer + bc->length;
+}
+
+//
+//	Each extension is an event in the undo history like any other, so the
+//	history stays intact - but it can't be undone, because the data didn't
+//	come from an edit. Undo stops at the last extension, and the revisions
+//	before it can't be gone back to
+//
+bool sequence::extend (size_w length)
+{
+	buffer_control *bc;
+	span		   *last = tail->prev;
+	span_range	   *event;
+	span_range		newspans;
+
+	if(extendbuffer_id < 0)
+		return false;
+
+	bc = buffer_list[extendbuffer_id];
+
+	if(bc->length + length > bc->maxsize)
+		return false;
+
+	record_action(action_invalid, 0);
+	cache_span = 0;
+
+	// carry on from the last extension if nothing has happened since - its 
+	// span isn't part of any other state of the sequence
+	if(undopos == undofloor && undopos != undoroot && undopos->redo == 0 && 
+	   last->buffer == extendbuffer_id && last->offset + last->length == bc->length)
+	{
+		last->length	+= length;
+		undopos->length += length;
+	}
+	else
+	{
+		event = initundo(sequence_length, length, action_insert);
+		event->spanboundary(last, tail);
+		event->group_id = 0;
+
+		newspans.append(new span(bc->length, length, extendbuffer_id));
+		swap_spanrange(event, &newspans);
+
+		undofloor = event;
+	}
+
+	bc->length		+= length;
+	sequence_length += length;
+	return true;
+}
 
 //
 //	sequence::spanfromindex
 //
 //	search the spanlist for the span which encompasses the specified index position
 //
+//	The search starts from the span that was found last time, so reading
+//	through the sequence in order (or nearly in order) doesn't mean going 
+//	back to the start of the list every time
+//
 //	index		- character-position index
 //	*spanindex  - index of span within sequence
 //
 sequence::span* sequence::spanfromindex (size_w index, size_w *spanindex = 0) const
 {
-	span * sptr;
+	span * sptr   = head->next;
 	size_w curidx = 0;
+
+	if(cache_span)
+	{
+		sptr   = cache_span;
+		curidx = cache_index;
+
+		while(index < curidx && sptr->prev != head)
+		{
+			sptr	= sptr->prev;
+			curidx -= sptr->length;
+		}
+	}
 	
 	// scan the list looking for the span which holds the specified index
-	for(sptr = head->next; sptr->next; sptr = sptr->next)
+	for( ; sptr->next; sptr = sptr->next)
 	{
 		if(index >= curidx && index < curidx + sptr->length)
 		{
 			if(spanindex) 
 				*spanindex = curidx;
 
+			cache_span	= sptr;
+			cache_index = curidx;
 			return sptr;
 		}
 
@@ -334,8 +522,18 @@ void sequence::swap_spanrange(span_range *src, span_range *dest)
 	}
 }
 
-void sequence::restore_spanrange (span_range *range, bool undo_or_redo)
+void sequence::restore_spanrange (span_range *range)
 {
+	// every event is a plain insert or erase, so the change in length says which
+	size_w newlength = range->sequence_length;
+	size_w erased	 = sequence_length > newlength ? sequence_length - newlength : 0;
+	size_w inserted	 = newlength > sequence_length ? newlength - sequence_length : 0;
+
+	if(restore_func)
+		restore_func(restore_param, false, range->index, erased, inserted);
+
+	cache_span = 0;
+
 	if(range->boundary)
 	{
 		span *first = range->first->next;
@@ -391,71 +589,101 @@ void sequence::restore_spanrange (span_range *range, bool undo_or_redo)
 	std::swap(range->sequence_length,    sequence_length);
 	std::swap(range->quicksave,			 can_quicksave);
 
+	// the range that has reappeared, if anything
 	undoredo_index	= range->index;
+	undoredo_length = inserted;
 
-	if(range->act == action_erase && undo_or_redo == true || 
-		range->act != action_erase && undo_or_redo == false)
-	{
-		undoredo_length = range->length;
-	}
-	else
-	{
-		undoredo_length = 0;
-	}
+	if(restore_func)
+		restore_func(restore_param, true, range->index, erased, inserted);
+}
+
+//
+//	Be told about each event as it is undone or redone
+//
+void sequence::restore_callback (restorefunc func, void *param)
+{
+	restore_func  = func;
+	restore_param = param;
 }
 
 //
-//	sequence::undoredo
+//	sequence::undo_event
 //
-//	private routine used to undo/redo spanrange events to/from 
-//	the sequence - handles 'grouped' events
+//	undo the current event, moving back up the undo tree
 //
-bool sequence::undoredo (eventstack &source, eventstack &dest)
+void sequence::undo_event ()
+{
+	span_range *range = undopos;
+
+	restore_spanrange(range);
+
+	// redo will come back down this branch
+	range->parent->redo = range;
+	undopos = range->parent;
+}
+
+//
+//	sequence::redo_event
+//
+//	redo one of the current event's children
+//
+void sequence::redo_event (span_range *range)
+{
+	restore_spanrange(range);
+
+	undopos->redo = range;
+	undopos = range;
+}
+
+// 
+//	UNDO the last action - 'grouped' events are undone together
+//
+bool sequence::undo ()
 {
-	span_range *range = 0;
 	size_t group_id;
 
-	if(source.empty())
+	debug("Undo\n");
+
+	if(undopos == undoroot || undopos == undofloor)
 		return false;
 
 	// make sure that no "optimized" actions can occur
 	record_action(action_invalid, 0);
 
-	group_id = source.back()->group_id;
+	group_id = undopos->group_id;
 
 	do
 	{
-		// remove the next event from the source stack
-		range = source.back();
-		source.pop_back();
-
-		// add event onto the destination stack
-		dest.push_back(range);
-
-		// do the actual work
-		restore_spanrange(range, source == undostack ? true : false);
+		undo_event();
 	}
-	while(!source.empty() && (source.back()->group_id == group_id && group_id != 0));
+	while(undopos != undofloor && undopos->group_id == group_id && group_id != 0);
 
 	return true;
 }
 
-// 
-//	UNDO the last action
-//
-bool sequence::undo ()
-{
-	debug("Undo\n");
-	return undoredo(undostack, redostack);
-}
-
 //
-//	REDO the last UNDO
+//	REDO the last UNDO, following the branch that was last used
 //
 bool sequence::redo ()
 {
+	size_t group_id;
+
 	debug("Redo\n");
-	return undoredo(redostack, undostack);
+
+	if(undopos->redo == 0)
+		return false;
+
+	record_action(action_invalid, 0);
+
+	group_id = undopos->redo->group_id;
+
+	do
+	{
+		redo_event(undopos->redo);
+	}
+	while(undopos->redo && undopos->redo->group_id == group_id && group_id != 0);
+
+	return true;
 }
 
 //
@@ -463,7 +691,7 @@ bool sequence::redo ()
 //
 bool sequence::canundo () const
 {
-	return undostack.size() != 0;
+	return undopos != undoroot && undopos != undofloor;
 }
 
 //
@@ -471,21 +699,111 @@ bool sequence::canundo () const
 //
 bool sequence::canredo () const
 {
-	return redostack.size() != 0;
+	return undopos->redo != 0;
+}
+
+//
+//	The event which made the sequence what it is now
+//
+size_t sequence::revision () const
+{
+	return undopos->revision;
+}
+
+size_t sequence::revision_count () const
+{
+	return eventlist.size();
+}
+
+//
+//	sequence::goto_revision
+//
+//	Put the sequence back to how it was after the specified event, in 
+//	any branch of the undo tree. Events are undone back to the last one 
+//	that the two states have in common, and then redone from there - the 
+//	fewest restore_spanrange steps that will get there. Finding the 
+//	common event only takes O(log n) steps, however big the tree is
+//
+bool sequence::goto_revision (size_t revision)
+{
+	span_range *target, *common, *range;
+	eventstack	path;
+
+	if(revision > eventlist.size())
+		return false;
+
+	target = revision ? eventlist[revision - 1] : undoroot;
+
+	// never stop part-way through a group of events
+	while(target->redo && target->group_id != 0 && target->redo->group_id == target->group_id)
+		target = target->redo;
+
+	// nor before the last extension
+	if(common_ancestor(target, undofloor) != undofloor)
+		return false;
+
+	record_action(action_invalid, 0);
+	common = common_ancestor(undopos, target);
+
+	while(undopos != common)
+		undo_event();
+
+	for(range = target; range != common; range = range->parent)
+		path.push_back(range);
+
+	while(!path.empty())
+	{
+		redo_event(path.back());
+		path.pop_back();
+	}
+
+	return true;
+}
+
+//
+//	sequence::common_ancestor
+//
+//	Find the last event that two states of the sequence share. The deeper 
+//	event climbs up to the other's depth, and then both climb together. 
+//	Events at the same depth have jump pointers to the same depth, so
+//	whenever two jumps land on different events they can both be taken
+//
+sequence::span_range* sequence::common_ancestor (span_range *a, span_range *b)
+{
+	if(a->depth < b->depth)
+		std::swap(a, b);
+
+	while(a->depth > b->depth)
+		a = (a->jump->depth >= b->depth) ? a->jump : a->parent;
+
+	while(a != b)
+	{
+		if(a->jump != b->jump)
+		{
+			a = a->jump;
+			b = b->jump;
+		}
+		else
+		{
+			a = a->parent;
+			b = b->parent;
+		}
+	}
+
+	return a;
 }
 
 //
 //	Group repeated actions on the sequence (insert/erase etc)
-//	into a single 'undoable' action
+//	into a single 'undoable' action. Groups can be nested (a replace
+//	groups its erase and insert) - only the outermost one counts
 //
 void sequence::group()
 {
-	if(group_refcount == 0)
+	if(group_refcount++ == 0)
 	{
 		if(++group_id == 0)
 			++group_id;
-
-		group_refcount++;
 	}
 }
 
@@ -522,23 +840,39 @@ sequence::span_range* sequence::initundo (size_w index, size_w length, action ac
 								group_refcount ? group_id : 0
 								);
 
-	undostack.push_back(event);
+	span_range *parent = undopos;
+	span_range *jump   = parent->jump;
+
+	// the new event becomes a child of the current one - any other 
+	// branches are kept, but redo will follow this one from now on
+	event->parent	= parent;
+	event->depth	= parent->depth + 1;
+	event->revision = eventlist.size() + 1;
+
+	if(parent->depth - jump->depth == jump->depth - jump->jump->depth)
+		event->jump = jump->jump;
+	else
+		event->jump = parent;
+
+	eventlist.push_back(event);
+
+	parent->redo = event;
+	undopos		 = event;
 	
 	return event;
 }
 
-sequence::span_range* sequence::stackback(eventstack &source, size_t idx)
+//
+//	Return the current event, or one of the events before it
+//
+sequence::span_range* sequence::lastevent(size_t idx)
 {
-	size_t length = source.size();
-	
-	if(length > 0 && idx < length)
-	{
-		return source[length - idx - 1];
-	}
-	else
-	{
-		return 0;
-	}
+	span_range *event = undopos;
+
+	while(idx-- > 0 && event != undoroot)
+		event = event->parent;
+
+	return event != undoroot ? event : 0;
 }
 
 void sequence::record_action (action act, size_w index)
@@ -576,16 +910,19 @@ bool sequence::insert_worker (size_w index, const seqchar *buf, size_w length, a
 	if(!import_buffer(buf, length, &modbuf_offset))
 		return false;
 
+	// nothing before this span is going to change
+	cache_span	= sptr->prev != head ? sptr->prev : 0;
+	cache_index = spanindex - sptr->prev->length;
+
 	debug("Inserting: idx=%d len=%d %.*s\n", index, length, length, buf);
 
-	clearstack(redostack);
 	insoffset = index - spanindex;
 
 	// special-case #1: inserting at the end of a prior insertion, at a span-boundary
 	if(insoffset == 0 && can_optimize(act, index))
 	{
 		// simply extend the last span's length
-		span_range *event = undostack.back();
+		span_range *event = undopos;
 		sptr->prev->length	+= length;
 		event->length		+= length;
 	}
@@ -688,7 +1025,7 @@ void sequence::deletefromsequence(span **psptr)
 	sptr->prev->next = sptr->next;
 	sptr->next->prev = sptr->prev;
 
-	memset(sptr, 0, sizeof(span));
+	memset((void *)sptr, 0, sizeof(span));
 	delete sptr;
 	*psptr = 0;
 }
@@ -717,6 +1054,10 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 	if((sptr = spanfromindex(index, &spanindex)) == 0)
 		return false;
 
+	// nothing before this span is going to change
+	cache_span	= sptr->prev != head ? sptr->prev : 0;
+	cache_index = spanindex - sptr->prev->length;
+
 	// work out the offset relative to the start of the *span*
 	remoffset = index - spanindex;
 	removelen = length;
@@ -729,7 +1070,7 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 	//
 	if(index == spanindex && can_optimize(act, index))
 	{
-		event = stackback(undostack, act == action_replace ? 1 : 0);
+		event = lastevent(act == action_replace ? 1 : 0);
 		event->length	+= length;
 		append_spanrange = true;
 
@@ -745,7 +1086,7 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 			else
 			{
 				if(act == action_replace)
-					stackback(undostack, 0)->last = frag2->next;
+					lastevent(0)->last = frag2->next;
 
 				removelen	-= sptr->length;
 				sptr = sptr->next;
@@ -757,9 +1098,9 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 	//	special-case 2: 'backward-delete'
 	//	only erase operations can pass through here
 	//
-	else if(index + length == spanindex + sptr->length && can_optimize(action_erase, index+length))
+	else if(act == action_erase && index + length == spanindex + sptr->length && can_optimize(action_erase, index+length))
 	{
-		event = undostack.back();
+		event = undopos;
 		event->length	+= length;
 		event->index	-= length;
 		append_spanrange = false;
@@ -792,7 +1133,6 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 	//
 	//	general-case 2+3
 	//
-	clearstack(redostack);
 
 	// does the deletion *start* mid-way through a span?
 	if(remoffset != 0)
@@ -849,7 +1189,7 @@ bool sequence::erase_worker (size_w index, size_w length, action act)
 	// for replace operations, update the undo-event for the
 	// insertion so that it knows about the newly removed spans
 	if(act == action_replace && !oldspans.boundary)
-		stackback(undostack, 0)->last = oldspans.last->next;
+		lastevent(0)->last = oldspans.last->next;
 
 	swap_spanrange(&oldspans, &newspans);
 	sequence_length -= length;
@@ -930,7 +1270,9 @@ bool sequence::replace(size_w index, const seqchar *buf, size_w length, size_w e
 	if(insert_worker(index, buf, length, action_replace))
 	{
 		ungroup();
-		record_action(action_replace, index + length);
+
+		// the next replace can only carry on from this one if it erased something
+		record_action(remlen > 0 ? action_replace : action_invalid, index + length);
 		return true;
 	}
 	else
@@ -939,10 +1281,21 @@ bool sequence::replace(size_w index, const seqchar *buf, size_w length, size_w e
 		ungroup();
 		record_action(action_invalid, 0);
 
-		span_range *range = undostack.back();
-		undostack.pop_back();
-		restore_spanrange(range, true);
-		delete range;
+		if(remlen > 0)
+		{
+			span_range *range = undopos;
+			restorefunc func  = restore_func;
+
+			// the erase was never reported, so nor is this
+			restore_func = 0;
+			undo_event();
+			restore_func = func;
+
+			range->parent->redo = 0;
+			eventlist.pop_back();
+			range->free();
+			delete range;
+		}
 
 		return false;
 	}
@@ -997,6 +1350,8 @@ bool sequence::append (const seqchar val)
 bool sequence::clear ()
 {
 	span *sptr, *tmp;
+
+	cache_span = 0;
 	
 	// delete all spans in the sequence
 	for(sptr = head->next; sptr != tail; sptr = tmp)
@@ -1009,19 +1364,22 @@ bool sequence::clear ()
 	head->next = tail;
 	tail->prev = head;
 
-	// delete everything in the undo/redo stacks
-	clearstack(undostack);
-	clearstack(redostack);
+	// delete everything in the undo tree
+	clearhistory();
 
-	// delete all memory-buffers
+	// delete all memory-buffers (unless another sequence is still using them)
 	for(size_t i = 0; i < buffer_list.size(); i++)
 	{
-		delete[] buffer_list[i]->buffer;
-		delete   buffer_list[i];
+		if(InterlockedDecrement(&buffer_list[i]->refcount) == 0)
+		{
+			delete[] buffer_list[i]->buffer;
+			delete   buffer_list[i];
+		}
 	}
 
 	buffer_list.clear();
 	sequence_length = 0;
+	extendbuffer_id = -1;
 	return true;
 }
 
@@ -1064,6 +1422,65 @@ size_w sequence::render(size_w index, seqchar *dest, size_w length) const
 	return total;
 }
 
+//
+//	sequence::iterate
+//
+//	return an iterator positioned at the specified index - the 
+//	span-list is only searched once, however far the iterator goes
+//
+sequence::iterator sequence::iterate(size_w index) const
+{
+	size_w spanoffset = 0;
+	span  *sptr;
+
+	if((sptr = spanfromindex(index, &spanoffset)) == 0)
+		return iterator();
+
+	return iterator(this, sptr, index - spanoffset);
+}
+
+//
+//	sequence::iterator::data
+//
+//	return a pointer straight into the current span's buffer
+//
+const seqchar * sequence::iterator::data() const
+{
+	if(length() == 0)
+		return 0;
+
+	return seq->buffer_list[sptr->buffer]->buffer + sptr->offset + offset;
+}
+
+//
+//	sequence::iterator::length
+//
+//	number of elements that can be accessed contiguously through data()
+//
+size_w sequence::iterator::length() const
+{
+	return sptr ? sptr->length - offset : 0;
+}
+
+//
+//	sequence::iterator::advance
+//
+//	move forward by the specified number of elements, stepping
+//	onto the following span(s) when the current one runs out
+//
+void sequence::iterator::advance(size_w len)
+{
+	while(sptr && sptr->next && len >= sptr->length - offset)
+	{
+		len	  -= sptr->length - offset;
+		sptr   = sptr->next;
+		offset = 0;
+	}
+
+	if(sptr && sptr->next)
+		offset += len;
+}
+
 //
 //	sequence::peek
 //
@@ -19,6 +19,16 @@ typedef unsigned long	  size_w;
 
 const size_w MAX_SEQUENCE_LENGTH = ((size_w)(-1) / sizeof(seqchar));
 
+// size of each buffer used by sequence::extend
+const size_w EXTEND_BUFSIZE = 0x400000;
+
+//
+//	Called for each event that undo, redo or goto_revision puts back - first 
+//	with 'done' false while the sequence is still as it was, then with 'done' 
+//	true once it has changed. Each event either erased or inserted items at 'index'
+//
+typedef void (*restorefunc)(void *param, bool done, size_w index, size_w erase_length, size_w insert_length);
+
 //
 //	sequence class!
 //
@@ -31,7 +41,23 @@ public:
 	class			buffer_control;
 	class			iterator;
 	class			ref;
-	enum			action;
+
+	//
+	//	sequence::action
+	//
+	//	enumeration of the type of 'edit actions' our sequence supports.
+	//	only important when we try to 'optimize' repeated operations on the
+	//	sequence by coallescing them into a single span.
+	//
+	enum action
+	{ 
+		action_invalid, 
+		action_insert, 
+		action_erase, 
+		action_replace 
+	};
+
+	friend class iterator;
 
 public:
 
@@ -40,16 +66,21 @@ public:
 	~sequence();
 
 	//
-	// initialize with a file
+	// initialize as an empty sequence
 	//
 	bool		init();
-	bool		open(TCHAR *filename, bool readonly);
 	bool		clear();
 
 	//
 	// initialize from an in-memory buffer
 	//
 	bool		init(const seqchar *buffer, size_t length);
+	seqchar *	init_buffer(size_t length);
+
+	//
+	// make 'dest' a copy of this sequence, sharing our buffers
+	//
+	bool		fork(sequence &dest) const;
 
 	//
 	//	sequence statistics
@@ -71,6 +102,13 @@ public:
 	bool		append (const seqchar *buf, size_w len);
 	bool		append (const seqchar val);
 	void		breakopt();
+	seqchar *	reserve(size_w length);
+
+	//
+	// grow the sequence at the end - this can't be undone
+	//
+	seqchar *	extend_reserve(size_w length);
+	bool		extend(size_w length);
 
 	//
 	// undo/redo support
@@ -83,6 +121,16 @@ public:
 	void		ungroup();
 	size_w		event_index() const  { return undoredo_index; }
 	size_w		event_length() const { return undoredo_length; }
+	void		restore_callback(restorefunc func, void *param);
+
+	//
+	// the undo history is a tree - nothing is thrown away by editing after
+	// an undo, and the sequence can be put back into any state it has been
+	// in. Each event is numbered in order, with 0 the original state
+	//
+	size_t		revision() const;
+	size_t		revision_count() const;
+	bool		goto_revision(size_t revision);
 
 	// print out the sequence
 	void		debug1();
@@ -92,6 +140,7 @@ public:
 	// access and iteration
 	//
 	size_w		render(size_w index, seqchar *buf, size_w len) const;
+	iterator	iterate(size_w index) const;
 	seqchar		peek(size_w index) const;
 	bool		poke(size_w index, seqchar val);
 
@@ -116,23 +165,34 @@ private:
 	span		*	frag1;
 	span		*	frag2;
 
+	// the span spanfromindex found last, and where it starts (an edit
+	// moves it back before the spans it changes, an undo forgets it)
+	mutable span *	cache_span;
+	mutable size_w	cache_index;
+
 	
 	//
-	//	Undo and redo stacks
+	//	Undo tree
 	//
 	span_range *	initundo(size_w index, size_w length, action act);
-	void			restore_spanrange(span_range *range, bool undo_or_redo);
+	void			restore_spanrange(span_range *range);
 	void			swap_spanrange(span_range *src, span_range *dest);
-	bool			undoredo(eventstack &source, eventstack &dest);
-	void			clearstack(eventstack &source);
-	span_range *	stackback(eventstack &source, size_t idx);
-
-	eventstack		undostack;
-	eventstack		redostack;
+	void			undo_event();
+	void			redo_event(span_range *range);
+	void			clearhistory();
+	span_range *	lastevent(size_t idx);
+	span_range *	common_ancestor(span_range *a, span_range *b);
+
+	eventstack		eventlist;		// every event, in revision order
+	span_range *	undoroot;		// the original state (revision 0)
+	span_range *	undopos;		// the event which made the current state
+	span_range *	undofloor;		// undo can't go back past this (see extend)
 	size_t			group_id;
 	size_t			group_refcount;
 	size_w			undoredo_index;
 	size_w			undoredo_length;
+	restorefunc		restore_func;
+	void		*	restore_param;
 
 	//
 	//	File and memory buffer management
@@ -144,6 +204,7 @@ private:
 	bufferlist		buffer_list;
 	int				modifybuffer_id;
 	int				modifybuffer_pos;
+	int				extendbuffer_id;
 
 	//
 	//	Sequence manipulation
@@ -164,21 +225,6 @@ private:
 };
 
 
-//
-//	sequence::action
-//
-//	enumeration of the type of 'edit actions' our sequence supports.
-//	only important when we try to 'optimize' repeated operations on the
-//	sequence by coallescing them into a single span.
-//
-enum sequence::action
-{ 
-	action_invalid, 
-	action_insert, 
-	action_erase, 
-	action_replace 
-};
-
 //
 //	sequence::span
 //
@@ -188,6 +234,7 @@ class sequence::span
 {
 	friend class sequence;
 	friend class span_range;
+	friend class iterator;
 	
 public:
 	// constructor
@@ -222,9 +269,13 @@ private:
 //	sequence::span_range
 //
 //	private class to the sequence. Used to represent a contiguous range of spans.
-//	used by the undo/redo stacks to store state. A span-range effectively represents
+//	used by the undo tree to store state. A span-range effectively represents
 //	the range of spans affected by an event (operation) on the sequence
 //  
+//	Each event is linked to the one before it (its parent in the undo tree).
+//	'jump' points further up the tree, to an ancestor chosen so that any 
+//	ancestor - or the last event that two states have in common - can be 
+//	found in O(log n) steps (Myers' skew-binary jump pointers)
 //
 class sequence::span_range
 {
@@ -249,7 +300,12 @@ public:
 		length(len),
 		act(a),
 		quicksave(qs),
-		group_id(id)
+		group_id(id),
+		parent(0),
+		jump(0),
+		redo(0),
+		revision(0),
+		depth(0)
 	{
 	}
 		
@@ -364,6 +420,13 @@ private:
 	action	 act;
 	bool	 quicksave;
 	size_t	 group_id;
+
+	// position in the undo tree
+	span_range *parent;
+	span_range *jump;
+	span_range *redo;		// the branch that sequence::redo follows
+	size_t	 revision;
+	size_t	 depth;
 };
 
 //
@@ -377,8 +440,8 @@ class sequence::ref
 public:
 	ref(sequence *s, size_w i) 
 		:  
-		seq(s),  
-		index(i) 
+		index(i),  
+		seq(s) 
 	{
 	}
 
@@ -401,6 +464,9 @@ private:
 //
 //	buffer_control
 //
+//	buffers are only ever added to, so forked sequences can share them - 
+//	a buffer is freed when the last sequence using it lets go
+//
 class sequence::buffer_control
 {
 public:
@@ -408,12 +474,47 @@ public:
 	size_w	 length;
 	size_w	 maxsize;
 	int		 id;
+	LONG	 refcount;
 };
 
+//
+//	sequence::iterator
+//
+//	walks through the sequence a span at a time, giving direct
+//	(read-only) access to each span's data without copying it. 
+//	Any modification to the sequence invalidates the iterator
+//
 class sequence::iterator
 {
+	friend class sequence;
+
 public:
+	iterator() 
+		: seq(0), sptr(0), offset(0)
+	{
+	}
+
+	// data at the current position, and how much of it is contiguous
+	const seqchar *	data() const;
+	size_w			length() const;
+
+	// move forward through the sequence
+	void			advance(size_w len);
+
+	operator bool() const
+	{
+		return length() ? true : false;
+	}
+
+private:
+	iterator(const sequence *s, span *sp, size_w off) 
+		: seq(s), sptr(sp), offset(off)
+	{
+	}
 
+	const sequence *seq;
+	span		   *sptr;
+	size_w			offset;		// position within the current span
 };
 
 #endif
\ No newline at end of file
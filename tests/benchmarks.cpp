@@ -0,0 +1,903 @@
+//
+//	MODULE:		benchmarks.cpp
+//
+//	PURPOSE:	Timings for the document engine on a large file. These
+//				aren't run by ctest - "docbench" runs them all, or
+//				"docbench bench_edit" just the one
+//
+#include "test.h"
+#include "markers.h"
+#include "sequence.h"
+
+// the same conversions without SSE2 (unicode_scalar.cpp)
+namespace scalar
+{
+	size_t utf8_to_utf16(UTF8 *utf8str, size_t utf8len, UTF16 *utf16str, size_t *utf16len);
+	size_t swap_utf16(UTF16 *src, size_t srclen, UTF16 *dest, size_t *destlen);
+	size_t utf8_count_utf16(UTF8 *utf8str, size_t utf8len, size_t *utf16len);
+}
+
+typedef size_t (*UTF8_TO_UTF16)(UTF8 *, size_t, UTF16 *, size_t *);
+typedef size_t (*UTF8_COUNT_UTF16)(UTF8 *, size_t, size_t *);
+
+#define BENCH_TMPFILE	"docbench.tmp"
+#define BENCH_SIZE		(32 * 1024 * 1024)
+
+// the contents of a BENCH_SIZE file (short lines of plain text)
+static BYTESTR bench_file(int format)
+{
+	UTF16STR text;
+	ULONG	 lineno = 0;
+	char	 line[100];
+
+	while(text.size() < BENCH_SIZE / 2)
+	{
+		sprintf(line, "%u: the quick brown fox jumps over the lazy dog\t%u\r\n", lineno, lineno * 7);
+		UTF16STR more = utf16(line);
+
+		text.insert(text.end(), more.begin(), more.end());
+		lineno++;
+	}
+
+	return encode(text, format, format != NCP_ASCII);
+}
+
+//
+//	Text of one kind - plain ASCII, Latin with accents, CJK, or a chat
+//	log full of emoji (surrogate pairs) - in lines of about 60 characters
+//
+enum { CORPUS_ASCII, CORPUS_LATIN, CORPUS_CJK, CORPUS_EMOJI, CORPUS_COUNT };
+
+static const char *corpus_names[] = { "ascii", "latin", "cjk", "emoji" };
+
+static UTF16STR bench_corpus(int kind, ULONG length)
+{
+	static const TCHAR accents[] = { 0xE9, 0xE8, 0xE0, 0xFC, 0xF6, 0xE7, 0xF1, 0xDF };
+	UTF16STR text;
+
+	while(text.size() < length)
+	{
+		ULONG r = test_random(100);
+
+		if(text.size() % 60 == 59)
+			text.push_back('\n');
+		else if(kind == CORPUS_CJK)
+			text.push_back(r < 90 ? (TCHAR)(0x4E00 + test_random(0x5000)) : r < 95 ? 0x3002 : ' ');
+		else if(kind == CORPUS_LATIN && r < 12)
+			text.push_back(accents[test_random(sizeof(accents) / sizeof(TCHAR))]);
+		else if(kind == CORPUS_EMOJI && r < 30)
+		{
+			text.push_back(0xD83D);
+			text.push_back((TCHAR)(0xDE00 + test_random(0x50)));
+		}
+		else
+			text.push_back(r < 80 ? (TCHAR)('a' + test_random(26)) : ' ');
+	}
+
+	return text;
+}
+
+static TextDocument *bench_load(int format)
+{
+	if(!write_file(BENCH_TMPFILE, bench_file(format)))
+		return 0;
+
+	return load_document(BENCH_TMPFILE);
+}
+
+// how much memory the process is using (Linux only - 0 elsewhere)
+static size_t resident_bytes()
+{
+	FILE		 *fp = fopen("/proc/self/statm", "r");
+	unsigned long size = 0, resident = 0;
+
+	if(fp == 0)
+		return 0;
+
+	if(fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(fp);
+	return resident * 4096;
+}
+
+// the length of the document in UTF-16 code-units (size() is in bytes)
+static ULONG document_length(TextDocument *doc)
+{
+	ULONG offset = 0, length = 0;
+
+	doc->lineinfo_from_lineno(doc->linecount() - 1, &offset, &length, 0, 0);
+	return offset + length;
+}
+
+static void report(const char *what, double seconds, double count, const char *unit)
+{
+	if(seconds * 1e6 / count < 1.0)
+		printf("  %-32s %10.1f ns per %s\n", what, seconds * 1e9 / count, unit);
+	else
+		printf("  %-32s %10.2f us per %s\n", what, seconds * 1e6 / count, unit);
+
+	fflush(stdout);
+}
+
+TEST(bench_load)
+{
+	static const int   formats[] = { NCP_ASCII, NCP_UTF8, NCP_UTF16, NCP_UTF32 };
+	static const char *names[]	 = { "ascii", "utf-8", "utf-16", "utf-32" };
+
+	for(int i = 0; i < 4; i++)
+	{
+		REQUIRE(write_file(BENCH_TMPFILE, bench_file(formats[i])));
+
+		double		  t	  = test_time();
+		TextDocument *doc = load_document(BENCH_TMPFILE);
+		double		  elapsed = test_time() - t;
+
+		REQUIRE(doc);
+		printf("  load %-27s %10.1f MB/s (%u lines)\n", names[i], read_file(BENCH_TMPFILE).size() / elapsed / 1e6, doc->linecount());
+		doc->Release();
+	}
+
+	remove(BENCH_TMPFILE);
+}
+
+//
+//	Convert a whole file from UTF-8 a block at a time, the way gettext
+//	does, and return how long it took
+//
+static double time_utf8_to_utf16(UTF8_TO_UTF16 convert, BYTESTR &data, int repeat)
+{
+	static UTF16 out[0x10000];
+	double t = test_time();
+
+	for(int i = 0; i < repeat; i++)
+	{
+		size_t offset = 0;
+
+		while(offset < data.size())
+		{
+			size_t outlen = 0x10000;
+			offset += convert(&data[offset], data.size() - offset, out, &outlen);
+		}
+	}
+
+	return test_time() - t;
+}
+
+//
+//	Byte-swapping a big-endian UTF-16 file (64MB rather than the 500MB
+//	the change was aimed at, so that it doesn't take all day) with SSE2
+//	and with the old loop, then loading and saving one
+//
+static double time_swap_utf16(bool sse2, BYTESTR &data, int repeat)
+{
+	static UTF16 out[0x10000];
+	double t = test_time();
+
+	for(int i = 0; i < repeat; i++)
+	{
+		UTF16 *src = (UTF16 *)&data[0];
+		size_t len = data.size() / sizeof(UTF16);
+
+		while(len > 0)
+		{
+			size_t outlen = 0x10000;
+			size_t done	  = sse2 ? swap_utf16(src, len, out, &outlen) : scalar::swap_utf16(src, len, out, &outlen);
+
+			src += done;
+			len -= done;
+		}
+	}
+
+	return test_time() - t;
+}
+
+TEST(bench_swap)
+{
+	BYTESTR data = encode(bench_corpus(CORPUS_CJK, 0x2000000), NCP_UTF16BE, true);
+	double	t;
+
+	printf("  %-32s %10.1f MB/s (sse2) %8.1f MB/s (old loop)\n", "swap utf-16be",
+		data.size() * 5 / time_swap_utf16(true, data, 5) / 1e6, data.size() * 5 / time_swap_utf16(false, data, 5) / 1e6);
+
+	REQUIRE(write_file(BENCH_TMPFILE, data));
+
+	t = test_time();
+	TextDocument *doc = load_document(BENCH_TMPFILE);
+	printf("  %-32s %10.1f MB/s\n", "load utf-16be", data.size() / (test_time() - t) / 1e6);
+
+	REQUIRE(doc);
+
+	FILEHANDLE hFile = file_create(BENCH_TMPFILE ".out");
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	t = test_time();
+	CHECK(doc->save(hFile, NCP_UTF16BE, true));
+	printf("  %-32s %10.1f MB/s\n", "save utf-16be", data.size() / (test_time() - t) / 1e6);
+
+	file_close(hFile);
+	CHECK(read_file(BENCH_TMPFILE ".out") == data);
+
+	doc->Release();
+	remove(BENCH_TMPFILE);
+	remove(BENCH_TMPFILE ".out");
+}
+
+TEST(bench_transcode)
+{
+	for(int kind = 0; kind < CORPUS_COUNT; kind++)
+	{
+		BYTESTR data = encode(bench_corpus(kind, BENCH_SIZE / 4), NCP_UTF8, false);
+		double	sse2 = time_utf8_to_utf16(utf8_to_utf16, data, 10);
+		double	plain = time_utf8_to_utf16(scalar::utf8_to_utf16, data, 10);
+
+		printf("  utf-8 %-26s %10.1f MB/s (sse2) %8.1f MB/s (scalar)\n", corpus_names[kind],
+			data.size() * 10 / sse2 / 1e6, data.size() * 10 / plain / 1e6);
+	}
+}
+
+//
+//	Counting the UTF-16 code-units in runs of UTF-8 starting at random
+//	character boundaries, no longer than the 4KB between checkpoints,
+//	the way count_chars does. Returns the number of bytes counted
+//
+static size_t time_utf8_count(UTF8_COUNT_UTF16 count, BYTESTR &data, std::vector<ULONG> &starts, double *seconds)
+{
+	size_t total = 0;
+	double t	 = test_time();
+
+	for(size_t i = 0; i < starts.size(); i++)
+	{
+		size_t len = 0x1000;
+		total += count(&data[starts[i]], min(data.size() - starts[i], 0x1000), &len);
+	}
+
+	*seconds = test_time() - t;
+	return total;
+}
+
+TEST(bench_count_chars)
+{
+	for(int kind = 0; kind < CORPUS_COUNT; kind++)
+	{
+		BYTESTR				data = encode(bench_corpus(kind, BENCH_SIZE / 8), NCP_UTF8, false);
+		std::vector<ULONG>	starts;
+		double				sse2, plain;
+		char				what[40];
+
+		for(int i = 0; i < 100000; i++)
+		{
+			ULONG offset = test_random((ULONG)data.size());
+
+			while((data[offset] & 0xC0) == 0x80)
+				offset--;
+
+			starts.push_back(offset);
+		}
+
+		size_t bytes = time_utf8_count(utf8_count_utf16, data, starts, &sse2);
+		CHECK(time_utf8_count(scalar::utf8_count_utf16, data, starts, &plain) == bytes);
+
+		printf("  count %-26s %10.1f MB/s (sse2) %8.1f MB/s (scalar)\n", corpus_names[kind], bytes / sse2 / 1e6, bytes / plain / 1e6);
+
+		// the same counts through the document: a character offset goes to 
+		// the checkpoint before it, then count_chars does the rest (with a
+		// BOM, so the plain ASCII isn't loaded as an ASCII document)
+		data.insert(data.begin(), (BYTE *)"\xEF\xBB\xBF", (BYTE *)"\xEF\xBB\xBF" + 3);
+
+		TextDocument *doc = load_document(data);
+		REQUIRE(doc);
+
+		ULONG  length = document_length(doc);
+		double t	  = test_time();
+
+		for(int i = 0; i < 100000; i++)
+			doc->iterate(test_random(length));
+
+		sprintf(what, "%s offset to byte", corpus_names[kind]);
+		report(what, test_time() - t, 100000, "lookup");
+		doc->Release();
+	}
+}
+
+//
+//	Walking through a whole document with each of the bidirectional
+//	iterators, from the start to the end and back again
+//
+TEST(bench_iterators)
+{
+	for(int kind = 0; kind < CORPUS_COUNT; kind++)
+	{
+		TextDocument *doc = load_document(encode(bench_corpus(kind, BENCH_SIZE / 8), NCP_UTF8, true));
+		REQUIRE(doc);
+
+		ULONG  length = document_length(doc);
+		ULONG  ch32, lineno, offset, len;
+		ULONG  forward, backward;
+		char   what[40];
+		double t;
+
+		// code-points
+		CharIterator chars = doc->iterate_chars(0);
+
+		for(t = test_time(), forward = 0; chars.next(&ch32); forward++)
+			;
+
+		sprintf(what, "%s chars forward", corpus_names[kind]);
+		report(what, test_time() - t, forward, "char");
+		CHECK(chars.offset() == length);
+
+		for(t = test_time(), backward = 0; chars.prev(&ch32); backward++)
+			;
+
+		sprintf(what, "%s chars backward", corpus_names[kind]);
+		report(what, test_time() - t, backward, "char");
+		CHECK(backward == forward && chars.offset() == 0);
+
+		// grapheme clusters
+		GraphemeIterator graphemes = doc->iterate_graphemes(0);
+
+		for(t = test_time(), forward = 0; graphemes.next(&offset, &len); forward++)
+			;
+
+		sprintf(what, "%s graphemes forward", corpus_names[kind]);
+		report(what, test_time() - t, forward, "grapheme");
+		CHECK(graphemes.offset() == length);
+
+		for(t = test_time(), backward = 0; graphemes.prev(&offset, &len); backward++)
+			;
+
+		sprintf(what, "%s graphemes backward", corpus_names[kind]);
+		report(what, test_time() - t, backward, "grapheme");
+		CHECK(backward == forward && graphemes.offset() == 0);
+
+		// lines, with their text
+		LineIterator lines = doc->iterate_lines(0);
+		const TCHAR *text;
+
+		for(t = test_time(), forward = 0; lines.next_text(&lineno, &offset, &text, &len); forward++)
+			;
+
+		sprintf(what, "%s lines forward", corpus_names[kind]);
+		report(what, test_time() - t, forward, "line");
+		CHECK(forward == doc->linecount());
+
+		for(t = test_time(), backward = 0; lines.prev_text(&lineno, &offset, &text, &len); backward++)
+			;
+
+		sprintf(what, "%s lines backward", corpus_names[kind]);
+		report(what, test_time() - t, backward, "line");
+		CHECK(backward == forward && lines.lineno() == 0);
+
+		doc->Release();
+	}
+}
+
+//
+//	Typing in and deleting from random places in a large document
+//
+TEST(bench_edit)
+{
+	TCHAR text[] = { 'h', 'e', 'l', 'l', 'o', '\n' };
+	int	  count	 = 2000;
+	ULONG start, end;
+
+	TextDocument *doc = bench_load(NCP_UTF8);
+	REQUIRE(doc);
+
+	double t = test_time();
+
+	for(int i = 0; i < count; i++)
+	{
+		ULONG offset = test_random(doc->size());
+
+		if(i & 1)
+			doc->insert_text(offset, text, 6);
+		else
+			doc->erase_text(offset, 3);
+	}
+
+	report("insert/erase", test_time() - t, count, "edit");
+
+	// everything after an edit near the start has to be moved along
+	t = test_time();
+
+	for(int i = 0; i < count; i++)
+	{
+		ULONG offset = test_random(1000);
+
+		if(i & 1)
+			doc->insert_text(offset, text, 6);
+		else
+			doc->erase_text(offset, 3);
+	}
+
+	report("insert/erase near the start", test_time() - t, count, "edit");
+
+	t = test_time();
+
+	for(int i = 0; i < 100; i++)
+		doc->Undo(&start, &end);
+
+	report("undo", test_time() - t, 100, "undo");
+
+	t = test_time();
+
+	for(int i = 0; i < 100; i++)
+		doc->Redo(&start, &end);
+
+	report("redo", test_time() - t, 100, "redo");
+
+	t = test_time();
+
+	for(int i = 0; i < 10; i++)
+		doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end);
+
+	report("jump to a revision", test_time() - t, 10, "jump");
+
+	t = test_time();
+
+	for(int i = 0; i < 100000; i++)
+		doc->lineno_from_offset(test_random(doc->size()));
+
+	report("lineno_from_offset", test_time() - t, 100000, "lookup");
+
+	// two views with different tab-sizes, both repainting after each edit
+	doc->longestline(8);
+	t = test_time();
+
+	for(int i = 0; i < 20; i++)
+	{
+		doc->insert_text(test_random(doc->size()), text, 6);
+		doc->longestline(4);
+		doc->longestline(8);
+	}
+
+	report("edit, longestline(4) and (8)", test_time() - t, 20, "edit");
+
+	doc->Release();
+	remove(BENCH_TMPFILE);
+}
+
+static void count_change(void *param, DOCCHANGE *)
+{
+	(*(ULONG *)param)++;
+}
+
+//
+//	Jumping between revisions in a history of 100,000 events. Now and 
+//	again some of the edits are undone, or the document goes back to an
+//	earlier revision, so the next edit starts a new branch. The memory 
+//	used by the history should only grow with the text that was typed
+//
+TEST(bench_history)
+{
+	TCHAR  text[] = { 'e', 'd', 'i', 't', 'e', 'd', ' ', 0xE9, '\n' };
+	ULONG  start, end;
+	ULONG  typed  = 0;
+	ULONG  count  = 100000;
+	size_t before = resident_bytes();
+	double t;
+
+	TextDocument *doc = load_document(encode(bench_corpus(CORPUS_LATIN, 0x100000), NCP_UTF8, true));
+	REQUIRE(doc);
+
+	t = test_time();
+
+	while(doc->UndoRevisionCount() < count)
+	{
+		ULONG r = test_random(100);
+
+		if(r < 3)
+		{
+			for(r = 1 + test_random(20); r > 0; r--)
+				doc->Undo(&start, &end);
+		}
+		else if(r < 4)
+		{
+			doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end);
+		}
+		else if(r < 60)
+		{
+			ULONG len = 1 + test_random(9);
+
+			doc->insert_text(test_random(doc->size()), text, len);
+			typed += len;
+		}
+		else
+		{
+			doc->erase_text(test_random(doc->size()), 1 + test_random(5));
+		}
+	}
+
+	report("build a 100k-event history", test_time() - t, count, "event");
+
+	size_t used = resident_bytes() - before;
+	printf("  %-32s %10.1f bytes per event (%u chars typed)\n", "history memory", (double)used / count, typed);
+
+	// a few hundred bytes per event, not a copy of the document (1MB) each time
+	CHECK(used < count * 1024);
+
+	// every event that a jump puts back is one change
+	ULONG changes = 0;
+	int	  jumps	  = 1000;
+
+	doc->subscribe(count_change, &changes);
+	t = test_time();
+
+	for(int i = 0; i < jumps; i++)
+		doc->GotoRevision(test_random(count + 1), &start, &end);
+
+	t = test_time() - t;
+	report("jump to a random revision", t, jumps, "jump");
+	printf("  %-32s %10.1f events per jump, %.2f us each\n", "", (double)changes / jumps, t * 1e6 / changes);
+
+	// going back to where it was after a few undos only redoes those 
+	// few events - finding the way back doesn't depend on the history
+	double total = 0;
+
+	for(int i = 0; i < jumps; i++)
+	{
+		ULONG revision = doc->UndoRevision();
+
+		doc->Undo(&start, &end);
+		doc->Undo(&start, &end);
+		doc->Undo(&start, &end);
+
+		t = test_time();
+		doc->GotoRevision(revision, &start, &end);
+		total += test_time() - t;
+	}
+
+	report("jump back over three undos", total, jumps, "jump");
+	doc->unsubscribe(count_change, &changes);
+
+	doc->Release();
+}
+
+//
+//	Pasting a few MB of UTF-16 text into a UTF-8 document. The piece-table
+//	part is timed both ways: encoding the text 256 BYTEs at a time and
+//	inserting each slice (the way insert_text used to), and encoding it
+//	all straight into space reserved in the sequence's modify-buffer
+//
+TEST(bench_paste)
+{
+	UTF16STR paste = bench_corpus(CORPUS_LATIN, 0x200000);
+	BYTESTR	 data  = encode(bench_corpus(CORPUS_LATIN, 0x100000), NCP_UTF8, false);
+	int		 count = 10;
+	double	 t;
+
+	for(int kind = 0; kind < 2; kind++)
+	{
+		sequence seq;
+		REQUIRE(seq.init(&data[0], data.size()));
+
+		t = test_time();
+
+		for(int i = 0; i < count; i++)
+		{
+			size_w offset = test_random((ULONG)data.size());
+
+			if(kind == 0)
+			{
+				BYTE   buf[0x100];
+				size_t done = 0;
+
+				// grouped, so that the slices are undone together
+				seq.group();
+
+				while(done < paste.size())
+				{
+					size_t buflen = sizeof(buf);
+
+					done   += utf16_to_utf8((UTF16 *)&paste[done], paste.size() - done, buf, &buflen);
+					REQUIRE(seq.insert(offset, buf, buflen));
+					offset += buflen;
+				}
+
+				seq.ungroup();
+			}
+			else
+			{
+				size_t	 rawlen = paste.size() * 3;
+				seqchar *raw	= seq.reserve(rawlen);
+
+				REQUIRE(raw);
+				utf16_to_utf8((UTF16 *)&paste[0], paste.size(), raw, &rawlen);
+				REQUIRE(seq.insert(offset, raw, rawlen));
+			}
+
+			seq.undo();
+			CHECK(seq.size() == data.size());
+		}
+
+		printf("  paste %-26s %10.1f MB/s\n", kind == 0 ? "(256 BYTE slices)" : "(reserved)", 
+			paste.size() * sizeof(TCHAR) * count / (test_time() - t) / 1e6);
+	}
+
+	// and the whole thing, through the document
+	TextDocument *doc = load_document(encode(bench_corpus(CORPUS_LATIN, 0x100000), NCP_UTF8, true));
+	ULONG		  start, end;
+
+	REQUIRE(doc);
+	t = test_time();
+
+	for(int i = 0; i < count; i++)
+	{
+		doc->insert_text(test_random(doc->size() / 2), &paste[0], (ULONG)paste.size());
+		doc->Undo(&start, &end);
+	}
+
+	printf("  %-32s %10.1f MB/s\n", "insert_text", paste.size() * sizeof(TCHAR) * count / (test_time() - t) / 1e6);
+	t = test_time();
+
+	for(int i = 0; i < count; i++)
+	{
+		doc->replace_text(test_random(doc->size() / 2), &paste[0], (ULONG)paste.size(), 1000);
+		doc->Undo(&start, &end);
+	}
+
+	printf("  %-32s %10.1f MB/s\n", "replace_text", paste.size() * sizeof(TCHAR) * count / (test_time() - t) / 1e6);
+	doc->Release();
+}
+
+//
+//	Reading a whole document out through gettext (the way the display and 
+//	searching do), a line at a time with getline, and the way gettext used
+//	to - rendering 256 BYTEs at a time into a buffer and converting that.
+//	The document is read as loaded (one span), after 1,000 edits in random
+//	places, and after an edit every 80 characters or so all the way through 
+//	it, when it is in more than 200,000 small spans
+//
+static void read_document(TextDocument *doc, const char *layout)
+{
+	static TCHAR buf[0x10000];
+	char		 what[64];
+	ULONG		 size = doc->size();
+	ULONG		 len, offset, lineno, off;
+	double		 t;
+
+	t = test_time();
+	TextIterator itor = doc->iterate(0);
+
+	while(itor.gettext(buf, 0x10000) > 0)
+		;
+
+	sprintf(what, "gettext (%s)", layout);
+	printf("  %-32s %10.1f MB/s\n", what, size / (test_time() - t) / 1e6);
+	fflush(stdout);
+
+	t = test_time();
+
+	for(lineno = 0; lineno < doc->linecount(); lineno++)
+		doc->getline(lineno, buf, 0x10000, &off);
+
+	sprintf(what, "getline (%s)", layout);
+	printf("  %-32s %10.1f MB/s\n", what, size / (test_time() - t) / 1e6);
+	fflush(stdout);
+
+	t = test_time();
+
+	for(offset = 0; offset < size; )
+	{
+		BYTE   raw[0x100];
+		size_t rawlen = min(size - offset, 0x100);
+		size_t outlen = 0x10000;
+
+		doc->getdata(offset, raw, rawlen);
+
+		if(offset + rawlen < size)
+			rawlen = utf8_complete_len(raw, rawlen);
+
+		len		= (ULONG)utf8_to_utf16(raw, rawlen, (UTF16 *)buf, &outlen);
+		offset += len;
+	}
+
+	sprintf(what, "256 BYTE blocks (%s)", layout);
+	printf("  %-32s %10.1f MB/s\n", what, size / (test_time() - t) / 1e6);
+	fflush(stdout);
+}
+
+TEST(bench_gettext)
+{
+	TCHAR text[] = { 'x', 0xE9 };
+
+	TextDocument *doc = load_document(encode(bench_corpus(CORPUS_LATIN, 0x800000), NCP_UTF8, true));
+	REQUIRE(doc);
+
+	read_document(doc, "as loaded");
+
+	for(int i = 0; i < 1000; i++)
+		doc->insert_text(test_random(doc->size() / 2), text, 1 + (i & 1));
+
+	read_document(doc, "1k edits");
+
+	for(ULONG offset = 0; offset < doc->size() - 200; offset += 70 + test_random(20))
+		doc->insert_text(offset, text, 1 + (offset & 1));
+
+	read_document(doc, "100k edits");
+	doc->Release();
+}
+
+TEST(bench_fork)
+{
+	TCHAR text[] = { 'x' };
+
+	TextDocument *doc = bench_load(NCP_UTF8);
+	REQUIRE(doc);
+
+	double		  t	   = test_time();
+	TextDocument *copy = doc->fork();
+
+	report("fork", test_time() - t, 1, "fork");
+
+	t = test_time();
+	copy->insert_text(0, text, 1);
+	report("first edit of a fork", test_time() - t, 1, "edit");
+
+	copy->Release();
+	doc->Release();
+	remove(BENCH_TMPFILE);
+}
+
+TEST(bench_save)
+{
+	static const int   formats[] = { NCP_UTF8, NCP_UTF16, NCP_UTF32 };
+	static const char *names[]	 = { "utf-8", "utf-16", "utf-32" };
+	TCHAR text[] = { 'x' };
+
+	TextDocument *doc = bench_load(NCP_UTF8);
+	REQUIRE(doc);
+
+	// so that it isn't all one span
+	for(int i = 0; i < 1000; i++)
+		doc->insert_text(test_random(doc->size()), text, 1);
+
+	for(int i = 0; i < 3; i++)
+	{
+		FILEHANDLE hFile = file_create(BENCH_TMPFILE ".out");
+		double	   t	 = test_time();
+
+		REQUIRE(hFile != INVALID_FILEHANDLE);
+		CHECK(doc->save(hFile, formats[i], true));
+		file_close(hFile);
+
+		printf("  save as %-24s %10.1f MB/s\n", names[i], read_file(BENCH_TMPFILE ".out").size() / (test_time() - t) / 1e6);
+	}
+
+	doc->Release();
+	remove(BENCH_TMPFILE);
+	remove(BENCH_TMPFILE ".out");
+}
+
+//
+//	Reloading the file when it hasn't changed, and after a small change
+//
+TEST(bench_reload)
+{
+	TextDocument *doc  = bench_load(NCP_UTF8);
+	BYTESTR		  data = read_file(BENCH_TMPFILE);
+	UTF16STR	  name = utf16(BENCH_TMPFILE);
+
+	REQUIRE(doc);
+	name.push_back(0);
+
+	double t = test_time();
+	CHECK(doc->reload(&name[0]));
+	report("reload (unchanged)", test_time() - t, 1, "reload");
+
+	data[data.size() / 2] = '#';
+	data.push_back('\n');
+	REQUIRE(write_file(BENCH_TMPFILE, data));
+
+	t = test_time();
+	CHECK(doc->reload(&name[0]));
+	report("reload (one line changed)", test_time() - t, 1, "reload");
+
+	// nothing needs hashing until near the end
+	data[data.size() - 100] = '#';
+	REQUIRE(write_file(BENCH_TMPFILE, data));
+
+	t = test_time();
+	CHECK(doc->reload(&name[0]));
+	report("reload (near the end changed)", test_time() - t, 1, "reload");
+
+	doc->Release();
+	remove(BENCH_TMPFILE);
+}
+
+TEST(bench_append)
+{
+	TextDocument *doc	= bench_load(NCP_UTF8);
+	FILE		 *fp	= fopen(BENCH_TMPFILE, "ab");
+	int			  count = 1000;
+
+	REQUIRE(doc && fp);
+
+	double t = test_time();
+
+	for(int i = 0; i < count; i++)
+	{
+		fprintf(fp, "appended line %d\n", i);
+		fflush(fp);
+
+		FILEHANDLE hFile = file_open(BENCH_TMPFILE);
+		doc->append_file(hFile);
+		file_close(hFile);
+	}
+
+	report("append a line", test_time() - t, count, "append");
+
+	fclose(fp);
+	doc->Release();
+	remove(BENCH_TMPFILE);
+}
+
+#ifdef HAVE_ZLIB
+
+//
+//	Decompressing a gzip file: finding its size and seek-points, then
+//	loading it, then reading random parts of it through a file-handle.
+//	All the speeds are in uncompressed MB/s
+//
+TEST(bench_gzip)
+{
+	BYTESTR data = bench_file(NCP_UTF8);
+	double	t;
+
+	REQUIRE(write_file(BENCH_TMPFILE, gzip(data, 1)));
+
+	FILEHANDLE hFile = file_open(BENCH_TMPFILE);
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	t = test_time();
+	CHECK(file_size(hFile) == data.size());
+	printf("  %-32s %10.1f MB/s\n", "gzip index", data.size() / (test_time() - t) / 1e6);
+
+	BYTESTR buf(0x1000);
+	int		count = 1000;
+
+	t = test_time();
+
+	for(int i = 0; i < count; i++)
+		file_read(hFile, test_random((ULONG)data.size() - 0x1000), &buf[0], 0x1000);
+
+	report("gzip random 4K read", test_time() - t, count, "read");
+	file_close(hFile);
+
+	t = test_time();
+	TextDocument *doc = load_document(BENCH_TMPFILE);
+	printf("  %-32s %10.1f MB/s\n", "load gzip", data.size() / (test_time() - t) / 1e6);
+
+	REQUIRE(doc);
+	doc->Release();
+	remove(BENCH_TMPFILE);
+}
+
+#endif
+
+TEST(bench_markers)
+{
+	markers m;
+	ULONG	length = BENCH_SIZE;
+	int		count  = 1000000;
+
+	for(int i = 0; i < count; i++)
+		m.add(test_random(length));
+
+	double t = test_time();
+
+	for(int i = 0; i < 100000; i++)
+	{
+		ULONG offset = test_random(length);
+		ULONG erase	 = test_random(20);
+		ULONG insert = test_random(20);
+
+		erase = min(erase, length - offset);
+		m.update(offset, erase, insert);
+		length = length - erase + insert;
+	}
+
+	report("edit with 1M markers", test_time() - t, 100000, "edit");
+}
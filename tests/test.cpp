@@ -0,0 +1,471 @@
+//
+//	MODULE:		test.cpp
+//
+//	PURPOSE:	Test runner for the document engine, and the helpers
+//				that the tests share
+//
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static TESTCASE *testlist;
+static TESTCASE *testlast;
+static int		 failures;
+static ULONG	 randseed = 1;
+
+// name of the temporary file used by load_document
+#define TEST_TMPFILE	"doctests.tmp"
+
+TESTCASE::TESTCASE(const char *name, TESTFUNC func)
+	: name(name), func(func), next(0)
+{
+	// keep them in the order they appear
+	if(testlast)
+		testlast->next = this;
+	else
+		testlist = this;
+
+	testlast = this;
+}
+
+void test_fail(const char *file, int line, const char *expr)
+{
+	// a model check that goes wrong usually goes wrong many times over
+	if(failures++ < 20)
+		printf("  %s(%d): failed: %s\n", file, line, expr);
+}
+
+int test_failures()
+{
+	return failures;
+}
+
+void test_seed(ULONG seed)
+{
+	randseed = seed;
+}
+
+ULONG test_random()
+{
+	// xorshift32 - never zero as long as the seed isn't
+	randseed ^= randseed << 13;
+	randseed ^= randseed >> 17;
+	randseed ^= randseed << 5;
+	return randseed;
+}
+
+ULONG test_random(ULONG range)
+{
+	return range ? test_random() % range : 0;
+}
+
+double test_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+UTF16STR utf16(const char *ascii)
+{
+	UTF16STR str;
+
+	while(*ascii)
+		str.push_back((BYTE)*ascii++);
+
+	return str;
+}
+
+//
+//	A mixture of letters, spaces, tabs, every kind of line-break and 
+//	(where the format can hold them) characters from all over Unicode,
+//	including surrogate pairs - which are never split at the end
+//
+UTF16STR random_text(ULONG length, int format)
+{
+	static const TCHAR common[] = { ' ', ' ', '\t', '\r', '\n', '\n', 0xE9 };
+	static const TCHAR unicode[] = { 0x4E2D, 0x0430, 0x2028, 0x0301, 0x0085, 0x3000 };
+	UTF16STR text;
+
+	while(text.size() < length)
+	{
+		ULONG r = test_random(20);
+
+		if(r < 12)
+			text.push_back((TCHAR)('a' + test_random(26)));
+		else if(r < 17 || format == NCP_ASCII)
+			text.push_back(common[test_random(sizeof(common) / sizeof(TCHAR))]);
+		else if(r < 19 || text.size() + 1 == length)
+			text.push_back(unicode[test_random(sizeof(unicode) / sizeof(TCHAR))]);
+		else
+		{
+			text.push_back(0xD83D);
+			text.push_back((TCHAR)(0xDE00 + test_random(0x40)));
+		}
+	}
+
+	return text;
+}
+
+static void put16(BYTESTR &out, ULONG val, bool bigendian)
+{
+	out.push_back((BYTE)(bigendian ? val >> 8 : val));
+	out.push_back((BYTE)(bigendian ? val : val >> 8));
+}
+
+static void put32(BYTESTR &out, ULONG val, bool bigendian)
+{
+	put16(out, bigendian ? val >> 16 : val, bigendian);
+	put16(out, bigendian ? val : val >> 16, bigendian);
+}
+
+//
+//	Encode UTF-16 text in any of the NCP_xxx formats, without using the
+//	document engine's own conversions. ASCII is taken as Latin-1
+//
+BYTESTR encode(const UTF16STR &text, int format, bool bom)
+{
+	BYTESTR out;
+	size_t  i;
+
+	if(bom && format != NCP_ASCII)
+	{
+		static const BYTE boms[][4] = 
+		{
+			{ 0 }, { 0xEF, 0xBB, 0xBF }, { 0xFF, 0xFE }, { 0xFE, 0xFF }, 
+			{ 0xFF, 0xFE, 0, 0 }, { 0, 0, 0xFE, 0xFF } 
+		};
+		static const int bomlen[] = { 0, 3, 2, 2, 4, 4 };
+
+		out.insert(out.end(), boms[format], boms[format] + bomlen[format]);
+	}
+
+	for(i = 0; i < text.size(); i++)
+	{
+		ULONG ch = text[i];
+
+		if(format == NCP_UTF16 || format == NCP_UTF16BE)
+		{
+			put16(out, ch, format == NCP_UTF16BE);
+			continue;
+		}
+
+		if(ch >= 0xD800 && ch <= 0xDBFF && i + 1 < text.size())
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (text[++i] - 0xDC00);
+
+		switch(format)
+		{
+		case NCP_ASCII:
+			out.push_back(ch < 0x100 ? (BYTE)ch : '?');
+			break;
+
+		case NCP_UTF8:
+			if(ch < 0x80)
+			{
+				out.push_back((BYTE)ch);
+			}
+			else if(ch < 0x800)
+			{
+				out.push_back((BYTE)(0xC0 | (ch >> 6)));
+				out.push_back((BYTE)(0x80 | (ch & 0x3F)));
+			}
+			else if(ch < 0x10000)
+			{
+				out.push_back((BYTE)(0xE0 | (ch >> 12)));
+				out.push_back((BYTE)(0x80 | ((ch >> 6) & 0x3F)));
+				out.push_back((BYTE)(0x80 | (ch & 0x3F)));
+			}
+			else
+			{
+				out.push_back((BYTE)(0xF0 | (ch >> 18)));
+				out.push_back((BYTE)(0x80 | ((ch >> 12) & 0x3F)));
+				out.push_back((BYTE)(0x80 | ((ch >> 6) & 0x3F)));
+				out.push_back((BYTE)(0x80 | (ch & 0x3F)));
+			}
+			break;
+
+		case NCP_UTF32:
+		case NCP_UTF32BE:
+			put32(out, ch, format == NCP_UTF32BE);
+			break;
+		}
+	}
+
+	return out;
+}
+
+bool write_file(const char *filename, const BYTESTR &data)
+{
+	FILE *fp;
+	bool  success;
+
+	if((fp = fopen(filename, "wb")) == 0)
+		return false;
+
+	success = data.empty() || fwrite(&data[0], 1, data.size(), fp) == data.size();
+	return fclose(fp) == 0 && success;
+}
+
+BYTESTR read_file(const char *filename)
+{
+	BYTESTR data;
+	BYTE	buf[0x1000];
+	size_t	len;
+	FILE   *fp;
+
+	if((fp = fopen(filename, "rb")) == 0)
+		return data;
+
+	while((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + len);
+
+	fclose(fp);
+	return data;
+}
+
+#ifdef HAVE_ZLIB
+
+BYTESTR gzip(const BYTESTR &data, ULONG members)
+{
+	BYTESTR	 out;
+	z_stream strm;
+	size_t	 start, end;
+
+	for(ULONG i = 0; i < members; i++)
+	{
+		start = data.size() * i / members;
+		end	  = data.size() * (i + 1) / members;
+
+		memset(&strm, 0, sizeof(strm));
+
+		// 31 = largest window, with a gzip header
+		if(deflateInit2(&strm, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return BYTESTR();
+
+		size_t pos = out.size();
+		out.resize(pos + deflateBound(&strm, (uLong)(end - start)));
+
+		strm.next_in   = end > start ? (Bytef *)&data[start] : 0;
+		strm.avail_in  = (uInt)(end - start);
+		strm.next_out  = &out[pos];
+		strm.avail_out = (uInt)(out.size() - pos);
+
+		deflate(&strm, Z_FINISH);
+		out.resize(out.size() - strm.avail_out);
+		deflateEnd(&strm);
+	}
+
+	return out;
+}
+
+#endif
+
+TextDocument *load_document(const char *filename)
+{
+	TextDocument *doc = new TextDocument();
+
+	if(!doc->init(file_open(filename)))
+	{
+		doc->Release();
+		return 0;
+	}
+
+	return doc;
+}
+
+//
+//	Empty contents make an empty document, rather than failing to load
+//
+TextDocument *load_document(const BYTESTR &data)
+{
+	TextDocument *doc;
+
+	if(data.empty())
+	{
+		doc = new TextDocument();
+		doc->EmptyDoc();
+		return doc;
+	}
+
+	if(!write_file(TEST_TMPFILE, data))
+		return 0;
+
+	doc = load_document(TEST_TMPFILE);
+	remove(TEST_TMPFILE);
+
+	return doc;
+}
+
+UTF16STR document_text(TextDocument *doc)
+{
+	LineIterator itor = doc->iterate_lines(0);
+	UTF16STR	 text;
+	const TCHAR *line;
+	ULONG		 lineno, offset, length;
+
+	while(itor.next_text(&lineno, &offset, &line, &length))
+		text.insert(text.end(), line, line + length);
+
+	return text;
+}
+
+static bool is_linebreak(TCHAR ch)
+{
+	return ch == '\r' || ch == '\n' || ch == 0x0B || ch == 0x0C || ch == 0x85 || ch == 0x2028 || ch == 0x2029;
+}
+
+//
+//	The longest line in the model, with tabs of the specified size
+//
+ULONG longest_line(const UTF16STR &model, int tabwidth)
+{
+	ULONG width = 0, longest = 0;
+
+	for(size_t i = 0; i < model.size(); i++)
+	{
+		if(model[i] == '\t')
+			width += tabwidth - width % tabwidth;
+		else if(!is_linebreak(model[i]))
+			width++;
+		else
+			width = 0;
+
+		// the low surrogate doesn't take up a column of its own
+		if(model[i] >= 0xDC00 && model[i] <= 0xDFFF && i > 0 && model[i - 1] >= 0xD800 && model[i - 1] <= 0xDBFF)
+			width--;
+
+		longest = max(longest, width);
+	}
+
+	return longest;
+}
+
+//
+//	Work out the lines, their widths and the BYTE offset of every
+//	character from the model, and compare them with the document's
+//
+bool check_document(TextDocument *doc, const UTF16STR &model, int format)
+{
+	int				   before = test_failures();
+	std::vector<ULONG> linestart;
+	std::vector<ULONG> bytepos;
+	ULONG			   width = 0, longest = 0;
+	size_t			   i;
+
+	UTF16STR text = document_text(doc);
+
+	if(text != model)
+	{
+		for(i = 0; i < text.size() && i < model.size() && text[i] == model[i]; )
+			i++;
+
+		printf("  text differs at %u (%u chars, expected %u)\n", (ULONG)i, (ULONG)text.size(), (ULONG)model.size());
+		CHECK(text == model);
+		return false;
+	}
+
+	linestart.push_back(0);
+	bytepos.push_back(0);
+
+	for(i = 0; i < model.size(); i++)
+	{
+		bool  pair = model[i] >= 0xD800 && model[i] <= 0xDBFF && i + 1 < model.size();
+		ULONG len  = (ULONG)encode(UTF16STR(model.begin() + i, model.begin() + i + (pair ? 2 : 1)), format, false).size();
+
+		// the middle of a surrogate pair is never a line boundary
+		if(pair)
+			bytepos.push_back(bytepos[i++]);
+
+		bytepos.push_back(bytepos.back() + len);
+
+		if(model[i] == '\t')
+			width += 4 - width % 4;
+		else if(!is_linebreak(model[i]))
+			width++;
+		else
+		{
+			if(model[i] == '\r' && i + 1 < model.size() && model[i + 1] == '\n')
+			{
+				i++;
+				bytepos.push_back(bytepos.back() + (ULONG)encode(utf16("\n"), format, false).size());
+			}
+
+			linestart.push_back((ULONG)i + 1);
+			longest = max(longest, width);
+			width	= 0;
+		}
+	}
+
+	longest = max(longest, width);
+
+	// an empty document has no lines at all
+	if(model.empty())
+		linestart.clear();
+
+	CHECK(doc->linecount() == linestart.size());
+	CHECK(doc->longestline(0) == longest);
+
+	for(i = 0; i < linestart.size() && i < doc->linecount(); i++)
+	{
+		ULONG offc, lenc, offb, lenb;
+		ULONG end = i + 1 < linestart.size() ? linestart[i + 1] : (ULONG)model.size();
+
+		CHECK(doc->lineinfo_from_lineno((ULONG)i, &offc, &lenc, &offb, &lenb));
+		CHECK(offc == linestart[i]);
+		CHECK(lenc == end - linestart[i]);
+		CHECK(offb == bytepos[linestart[i]]);
+		CHECK(lenb == bytepos[end] - bytepos[linestart[i]]);
+
+		if(test_failures() != before)
+		{
+			printf("  line %u of %u is wrong\n", (ULONG)i, (ULONG)linestart.size());
+			return false;
+		}
+	}
+
+	// look up some character offsets
+	for(i = 0; i < 20 && linestart.size(); i++)
+	{
+		ULONG offset = test_random((ULONG)model.size() + 1);
+		ULONG lineno = (ULONG)(std::upper_bound(linestart.begin(), linestart.end(), offset) - linestart.begin()) - 1;
+
+		CHECK(doc->lineno_from_offset(offset) == lineno);
+	}
+
+	return test_failures() == before;
+}
+
+int main(int argc, char **argv)
+{
+	TESTCASE *test;
+	int		  run = 0;
+	int		  i;
+
+	for(test = testlist; test; test = test->next)
+	{
+		bool wanted = argc < 2;
+
+		for(i = 1; i < argc; i++)
+			wanted |= strncmp(test->name, argv[i], strlen(argv[i])) == 0;
+
+		if(!wanted)
+			continue;
+
+		int before = failures;
+
+		test_seed(1);
+		test->func();
+		run++;
+
+		printf("%s %s\n", failures == before ? "ok  " : "FAIL", test->name);
+		fflush(stdout);
+	}
+
+	printf("%d tests, %d failures\n", run, failures);
+	return failures || run == 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef TEST_INCLUDED
+#define TEST_INCLUDED
+
+//
+//	test.h - a minimal test harness for the document engine. Each TEST is 
+//	registered when the program starts, and run by name (or by the start of
+//	its name) from the command-line: "doctests markers" runs every test
+//	whose name begins with "markers"
+//
+#include "portable.h"
+#include <stdio.h>
+#include <vector>
+#include "TextDocument.h"
+#include "Unicode.h"
+
+typedef void (*TESTFUNC)();
+
+struct TESTCASE
+{
+	TESTCASE(const char *name, TESTFUNC func);
+
+	const char *name;
+	TESTFUNC	func;
+	TESTCASE   *next;
+};
+
+#define TEST(name)											\
+	static void test_##name();								\
+	static TESTCASE testcase_##name(#name, test_##name);	\
+	static void test_##name()
+
+// record a failure and carry on
+#define CHECK(expr)											\
+	do { if(!(expr)) test_fail(__FILE__, __LINE__, #expr); } while(0)
+
+// record a failure and leave the test
+#define REQUIRE(expr)										\
+	do { if(!(expr)) { test_fail(__FILE__, __LINE__, #expr); return; } } while(0)
+
+void	test_fail(const char *file, int line, const char *expr);
+int		test_failures();
+
+//
+//	A fixed sequence of pseudo-random numbers, so that every run is the same
+//
+void	test_seed(ULONG seed);
+ULONG	test_random();
+ULONG	test_random(ULONG range);
+
+// seconds since some fixed point, for the benchmarks
+double	test_time();
+
+//
+//	Text helpers. UTF16STR is the model that documents are checked against
+//
+typedef std::vector<TCHAR> UTF16STR;
+typedef std::vector<BYTE>  BYTESTR;
+
+UTF16STR	utf16(const char *ascii);
+UTF16STR	random_text(ULONG length, int format);
+BYTESTR		encode(const UTF16STR &text, int format, bool bom);
+
+bool		write_file(const char *filename, const BYTESTR &data);
+BYTESTR		read_file(const char *filename);
+
+#ifdef HAVE_ZLIB
+// gzip compressed, as a number of members one after the other
+BYTESTR		gzip(const BYTESTR &data, ULONG members);
+#endif
+
+// load a document from a file, or from the given contents (via a temporary file)
+TextDocument *load_document(const char *filename);
+TextDocument *load_document(const BYTESTR &data);
+
+// the whole document (decoded to UTF-16) from the line-iterator
+UTF16STR	document_text(TextDocument *doc);
+
+// the widest line in the model, with tabs of the specified size
+ULONG		longest_line(const UTF16STR &model, int tabwidth);
+
+// the text, every line's position and the char/byte offsets all agree with the model
+bool		check_document(TextDocument *doc, const UTF16STR &model, int format);
+
+#endif
\ No newline at end of file
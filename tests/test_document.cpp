@@ -0,0 +1,874 @@
+//
+//	MODULE:		test_document.cpp
+//
+//	PURPOSE:	TextDocument editing, undo and forking in every file
+//				format, checked against a UTF-16 copy of the text
+//
+#include "test.h"
+#include <map>
+
+static const int formats[] = { NCP_ASCII, NCP_UTF8, NCP_UTF16, NCP_UTF16BE, NCP_UTF32, NCP_UTF32BE };
+#define NUM_FORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+//
+//	Move an offset back so it doesn't land in the middle of a surrogate pair
+//
+static ULONG boundary(const UTF16STR &model, ULONG offset)
+{
+	if(offset > 0 && offset < model.size() && model[offset] >= 0xDC00 && model[offset] <= 0xDFFF)
+		offset--;
+
+	return offset;
+}
+
+static TextDocument *load_text(const UTF16STR &text, int format)
+{
+	TextDocument *doc = load_document(encode(text, format, format != NCP_ASCII));
+
+	if(doc && doc->getformat() != format)
+	{
+		printf("  loaded as format %d, expected %d\n", doc->getformat(), format);
+		doc->Release();
+		return 0;
+	}
+
+	return doc;
+}
+
+//
+//	One random insert, erase or replace, made to both the document and the model.
+//	Returns where the edit was made and how much was erased and inserted
+//
+static void random_edit(TextDocument *doc, UTF16STR &model, int format, ULONG *where = 0, ULONG *erased = 0, ULONG *inserted = 0)
+{
+	ULONG	 offset = boundary(model, test_random((ULONG)model.size() + 1));
+	ULONG	 erase	= test_random(12);
+	UTF16STR text	= random_text(1 + test_random(10), format);
+
+	// min is a macro, so the random number can't be picked inside it
+	erase = boundary(model, min(offset + erase, (ULONG)model.size())) - offset;
+
+	switch(test_random(3))
+	{
+	case 0:
+		erase = 0;
+		CHECK(doc->insert_text(offset, &text[0], (ULONG)text.size()) != 0);
+		model.insert(model.begin() + offset, text.begin(), text.end());
+		break;
+
+	case 1:
+		doc->erase_text(offset, erase);
+		model.erase(model.begin() + offset, model.begin() + offset + erase);
+		text.clear();
+		break;
+
+	default:
+		CHECK(doc->replace_text(offset, &text[0], (ULONG)text.size(), erase) != 0);
+		model.erase(model.begin() + offset, model.begin() + offset + erase);
+		model.insert(model.begin() + offset, text.begin(), text.end());
+		break;
+	}
+
+	if(where)
+	{
+		*where	  = offset;
+		*erased	  = erase;
+		*inserted = (ULONG)text.size();
+	}
+}
+
+TEST(document_load)
+{
+	for(size_t f = 0; f < NUM_FORMATS; f++)
+	{
+		UTF16STR	  model = random_text(5000, formats[f]);
+		TextDocument *doc	= load_text(model, formats[f]);
+
+		REQUIRE(doc);
+		CHECK(check_document(doc, model, formats[f]));
+		doc->Release();
+	}
+
+	// an empty document has no lines
+	TextDocument *doc = load_document(BYTESTR());
+	CHECK(doc->linecount() == 0);
+	CHECK(check_document(doc, UTF16STR(), NCP_ASCII));
+	doc->Release();
+}
+
+//
+//	Files without a byte-order-mark, each labelled with the format it
+//	should be guessed as and how confident the guess should be
+//
+static void check_sniff(const char *name, const BYTESTR &data, int format, int minconf, int maxconf)
+{
+	TextDocument *doc = load_document(data);
+	int			  confidence = -1;
+
+	REQUIRE(doc);
+
+	if(doc->getformat(&confidence) != format || confidence < minconf || confidence > maxconf)
+	{
+		printf("  %s: loaded as format %d (%d%%), expected %d (%d-%d%%)\n", 
+			name, doc->getformat(), confidence, format, minconf, maxconf);
+		CHECK(!"wrong format");
+	}
+
+	doc->Release();
+}
+
+TEST(document_sniff)
+{
+	UTF16STR ascii	 = utf16("plain seven-bit text, nothing more\r\n");
+	UTF16STR latin	 = random_text(20000, NCP_ASCII);
+	UTF16STR unicode = random_text(20000, NCP_UTF8);
+	UTF16STR lone	 = latin;
+	BYTESTR	 binary;
+
+	while(ascii.size() < 20000)
+		ascii.insert(ascii.end(), ascii.begin(), ascii.end());
+
+	for(int i = 0; i < 20000; i++)
+		binary.push_back((BYTE)test_random(256));
+
+	// a surrogate with nothing to pair with, near the start
+	lone[100] = 0xDC00;
+
+	check_sniff("ascii",			encode(ascii,	NCP_ASCII,	 false), NCP_ASCII,	  100, 100);
+	check_sniff("latin-1",			encode(latin,	NCP_ASCII,	 false), NCP_ASCII,	  55, 95);
+	check_sniff("binary",			binary,								 NCP_ASCII,	  0, 10);
+	check_sniff("utf-8",			encode(unicode, NCP_UTF8,	 false), NCP_UTF8,	  70, 99);
+	check_sniff("utf-16le",			encode(latin,	NCP_UTF16,	 false), NCP_UTF16,	  95, 95);
+	check_sniff("utf-16be",			encode(latin,	NCP_UTF16BE, false), NCP_UTF16BE, 95, 95);
+	check_sniff("utf-16le pairs",	encode(unicode, NCP_UTF16,	 false), NCP_UTF16,	  75, 95);
+	check_sniff("utf-16be pairs",	encode(unicode, NCP_UTF16BE, false), NCP_UTF16BE, 75, 95);
+	check_sniff("utf-16le unpaired", encode(lone,	NCP_UTF16,	 false), NCP_UTF16,	  40, 40);
+	check_sniff("utf-16be unpaired", encode(lone,	NCP_UTF16BE, false), NCP_UTF16BE, 40, 40);
+	check_sniff("utf-8 with bom",	encode(unicode, NCP_UTF8,	 true),	 NCP_UTF8,	  100, 100);
+
+	// the guess is made from a few samples, so it shouldn't add anything
+	// noticeable to loading a large file compared with one that has a BOM
+	UTF16STR big = random_text(0x400000, NCP_ASCII);
+	double	 fastest[2] = { 1e9, 1e9 };
+
+	for(int i = 0; i < 6; i++)
+	{
+		REQUIRE(write_file("doctests.sniff", encode(big, NCP_UTF16, (i & 1) != 0)));
+
+		double		  t	  = test_time();
+		TextDocument *doc = load_document("doctests.sniff");
+
+		t = test_time() - t;
+		REQUIRE(doc);
+		CHECK(doc->getformat() == NCP_UTF16);
+		doc->Release();
+
+		fastest[i & 1] = min(fastest[i & 1], t);
+	}
+
+	CHECK(fastest[0] < fastest[1] * 1.25 + 0.005);
+	remove("doctests.sniff");
+}
+
+//
+//	A document big enough to have plenty of char/byte checkpoints, with
+//	edits that erase several of them at once and inserts that leave gaps
+//	needing to be split again. Text read from random character offsets 
+//	has to match the model
+//
+TEST(document_checkpoints)
+{
+	static const int varwidth[] = { NCP_UTF8, NCP_UTF32, NCP_UTF32BE };
+
+	for(int f = 0; f < 3; f++)
+	{
+		int		 format = varwidth[f];
+		UTF16STR model	= random_text(60000, format);
+		ULONG	 start, end;
+
+		TextDocument *doc = load_text(model, format);
+		REQUIRE(doc);
+
+		for(int i = 0; i < 200; i++)
+		{
+			ULONG	 offset = boundary(model, test_random((ULONG)model.size() + 1));
+			ULONG	 erase	= test_random(i & 1 ? 10 : 12000);
+			UTF16STR text	= random_text(1 + test_random(i & 2 ? 10 : 12000), format);
+
+			erase = boundary(model, min(offset + erase, (ULONG)model.size())) - offset;
+
+			doc->erase_text(offset, erase);
+			model.erase(model.begin() + offset, model.begin() + offset + erase);
+
+			if(i % 3)
+			{
+				CHECK(doc->insert_text(offset, &text[0], (ULONG)text.size()) != 0);
+				model.insert(model.begin() + offset, text.begin(), text.end());
+			}
+
+			if(i % 50 == 49)
+			{
+				doc->Undo(&start, &end);
+				doc->Redo(&start, &end);
+			}
+
+			for(int j = 0; j < 5; j++)
+			{
+				ULONG		 pos  = boundary(model, test_random((ULONG)model.size() + 1));
+				TCHAR		 buf[16];
+				TextIterator itor = doc->iterate(pos);
+				ULONG		 len  = itor.gettext(buf, 16);
+
+				// a surrogate pair isn't split at the end of the buffer
+				CHECK(len + 1 >= min(16, model.size() - pos));
+				CHECK(std::equal(buf, buf + len, model.begin() + pos));
+			}
+
+			if(i % 20 == 0)
+				REQUIRE(check_document(doc, model, format));
+		}
+
+		CHECK(check_document(doc, model, format));
+		doc->Release();
+	}
+}
+
+//
+//	Two views with different tab-sizes asking for the longest line in
+//	turn, with a third size now and again, and a fork with its own
+//
+TEST(document_tabwidths)
+{
+	UTF16STR model = random_text(3000, NCP_UTF8);
+	UTF16STR forked;
+
+	TextDocument *doc = load_text(model, NCP_UTF8);
+	TextDocument *fork;
+	REQUIRE(doc);
+
+	for(int i = 0; i < 200; i++)
+	{
+		random_edit(doc, model, NCP_UTF8);
+
+		CHECK(doc->longestline(4) == longest_line(model, 4));
+		CHECK(doc->longestline(8) == longest_line(model, 8));
+
+		if(i % 20 == 0)
+		{
+			CHECK(doc->longestline(3) == longest_line(model, 3));
+			CHECK(doc->longestline(0) == longest_line(model, 3));
+		}
+	}
+
+	// check_document expects the default tab-size
+	CHECK(doc->longestline(4) == longest_line(model, 4));
+	CHECK(check_document(doc, model, NCP_UTF8));
+
+	fork   = doc->fork();
+	forked = model;
+	REQUIRE(fork);
+
+	random_edit(fork, forked, NCP_UTF8);
+	CHECK(fork->longestline(5) == longest_line(forked, 5));
+	CHECK(fork->longestline(8) == longest_line(forked, 8));
+	CHECK(doc->longestline(8) == longest_line(model, 8));
+	CHECK(doc->longestline(2) == longest_line(model, 2));
+	CHECK(fork->longestline(4) == longest_line(forked, 4));
+
+	fork->Release();
+	doc->Release();
+}
+
+//
+//	Random edits, undos, redos and jumps around the undo history. The text
+//	of every revision is remembered, so wherever the document ends up
+//	can be checked
+//
+TEST(document_edit_undo)
+{
+	for(size_t f = 0; f < NUM_FORMATS; f++)
+	{
+		int		 format = formats[f];
+		UTF16STR model	= random_text(3000, format);
+		ULONG	 start, end;
+		std::map<ULONG, UTF16STR> snapshot;
+
+		TextDocument *doc = load_text(model, format);
+		REQUIRE(doc);
+
+		snapshot[doc->UndoRevision()] = model;
+
+		for(int i = 0; i < 600; i++)
+		{
+			ULONG op = test_random(10);
+
+			if(op < 6)
+			{
+				random_edit(doc, model, format);
+				snapshot[doc->UndoRevision()] = model;
+			}
+			else
+			{
+				if(op == 6)
+					doc->Undo(&start, &end);
+				else if(op == 7)
+					doc->Redo(&start, &end);
+				else
+					CHECK(doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end));
+
+				REQUIRE(snapshot.count(doc->UndoRevision()));
+				model = snapshot[doc->UndoRevision()];
+			}
+
+			if(i % 20 == 0 || op >= 6)
+				REQUIRE(check_document(doc, model, format));
+		}
+
+		REQUIRE(check_document(doc, model, format));
+
+		// every revision can be visited
+		for(ULONG rev = 0; rev <= doc->UndoRevisionCount(); rev += 7)
+		{
+			CHECK(doc->GotoRevision(rev, &start, &end));
+			REQUIRE(snapshot.count(doc->UndoRevision()));
+			REQUIRE(check_document(doc, snapshot[doc->UndoRevision()], format));
+		}
+
+		doc->Release();
+	}
+}
+
+//
+//	Count the words, code-points and each type of line-ending in the model
+//	for ourselves, and compare them with the document's running totals
+//
+static bool check_stats(TextDocument *doc, const UTF16STR &model)
+{
+	int	  before = test_failures();
+	ULONG words = 0, codepoints = 0;
+	ULONG eols[EOL_TYPES] = { 0 };
+	ULONG docwords, doccodepoints, doceols[EOL_TYPES];
+	bool  lastspace = true;
+
+	for(size_t i = 0; i < model.size(); i++)
+	{
+		ULONG ch  = model[i];
+		int	  eol = EOL_NONE;
+
+		if(ch >= 0xD800 && ch <= 0xDBFF && i + 1 < model.size())
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (model[++i] - 0xDC00);
+
+		codepoints++;
+
+		if(ch == '\r' && i + 1 < model.size() && model[i + 1] == '\n')
+		{
+			codepoints++;
+			i++;
+			eol = EOL_CRLF;
+		}
+		else if(ch == '\r')
+			eol = EOL_CR;
+		else if(ch == '\n')
+			eol = EOL_LF;
+		else if(ch == 0x0B || ch == 0x0C || ch == 0x85 || ch == 0x2028 || ch == 0x2029)
+			eol = EOL_OTHER;
+
+		// words don't carry on over a line-break
+		if(eol != EOL_NONE)
+		{
+			eols[eol]++;
+			lastspace = true;
+		}
+		else
+		{
+			bool space = is_whitespace(ch) != 0;
+
+			words	 += lastspace && !space;
+			lastspace = space;
+		}
+	}
+
+	// the last line ends with the document
+	if(!model.empty())
+		eols[EOL_NONE]++;
+
+	doc->getstats(&docwords, &doccodepoints, doceols);
+
+	CHECK(docwords == words);
+	CHECK(doccodepoints == codepoints);
+
+	for(int e = 0; e < EOL_TYPES; e++)
+		CHECK(doceols[e] == eols[e]);
+
+	CHECK(doc->linecount() == eols[EOL_NONE] + eols[EOL_CRLF] + eols[EOL_LF] + eols[EOL_CR] + eols[EOL_OTHER]);
+
+	if(test_failures() != before)
+		printf("  %u words, %u code-points (expected %u, %u)\n", docwords, doccodepoints, words, codepoints);
+
+	return test_failures() == before;
+}
+
+//
+//	The document statistics (TXM_GETSTATS) stay right through edits, undo
+//	and redo. Every kind of line-ending and white-space gets typed, and
+//	CRs and LFs land next to each other, joining and splitting CR/LF pairs
+//
+TEST(document_stats)
+{
+	static const TCHAR extra[] = { '\r', '\n', 0x0B, 0x0C, 0xA0, 0x2029, 0x2003, 0x0085 };
+
+	for(size_t f = 0; f < NUM_FORMATS; f++)
+	{
+		int		 format = formats[f];
+		ULONG	 nextra = format == NCP_ASCII ? 5 : sizeof(extra) / sizeof(extra[0]);
+		UTF16STR model	= random_text(2000, format);
+		ULONG	 start, end;
+		std::map<ULONG, UTF16STR> snapshot;
+
+		TextDocument *doc = load_text(model, format);
+		REQUIRE(doc);
+		REQUIRE(check_stats(doc, model));
+
+		snapshot[doc->UndoRevision()] = model;
+
+		for(int i = 0; i < 400; i++)
+		{
+			ULONG op = test_random(10);
+
+			if(op < 4)
+			{
+				random_edit(doc, model, format);
+				snapshot[doc->UndoRevision()] = model;
+			}
+			else if(op < 7)
+			{
+				ULONG offset = boundary(model, test_random((ULONG)model.size() + 1));
+				TCHAR ch	 = extra[test_random(nextra)];
+
+				CHECK(doc->insert_text(offset, &ch, 1) != 0);
+				model.insert(model.begin() + offset, ch);
+				snapshot[doc->UndoRevision()] = model;
+			}
+			else
+			{
+				if(op == 7)
+					doc->Undo(&start, &end);
+				else if(op == 8)
+					doc->Redo(&start, &end);
+				else
+					CHECK(doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end));
+
+				REQUIRE(snapshot.count(doc->UndoRevision()));
+				model = snapshot[doc->UndoRevision()];
+			}
+
+			REQUIRE(check_stats(doc, model));
+
+			if(i % 50 == 0)
+				REQUIRE(check_document(doc, model, format));
+		}
+
+		REQUIRE(check_document(doc, model, format));
+		doc->Release();
+	}
+}
+
+//
+//	A fork and its original can be edited independently, and the
+//	fork carries on working after the original has gone
+//
+TEST(document_fork)
+{
+	for(size_t f = 0; f < NUM_FORMATS; f++)
+	{
+		int		 format = formats[f];
+		UTF16STR ma		= random_text(2000, format);
+		UTF16STR mb;
+
+		TextDocument *a = load_text(ma, format);
+		REQUIRE(a);
+
+		random_edit(a, ma, format);
+
+		TextDocument *b = a->fork();
+		REQUIRE(b);
+		mb = ma;
+
+		CHECK(check_document(b, mb, format));
+
+		for(int i = 0; i < 200; i++)
+		{
+			if(i & 1)
+				random_edit(a, ma, format);
+			else
+				random_edit(b, mb, format);
+		}
+
+		CHECK(check_document(a, ma, format));
+		CHECK(check_document(b, mb, format));
+
+		a->Release();
+		CHECK(check_document(b, mb, format));
+		b->Release();
+	}
+}
+
+//
+//	Markers move with the text as it is edited
+//
+TEST(document_markers)
+{
+	UTF16STR model = random_text(2000, NCP_UTF8);
+	std::vector<markers::marker> handles;
+	std::vector<ULONG> pos;
+
+	TextDocument *doc = load_text(model, NCP_UTF8);
+	REQUIRE(doc);
+
+	for(int i = 0; i < 1000; i++)
+	{
+		if(test_random(4) == 0)
+		{
+			ULONG offset = test_random((ULONG)model.size() + 1);
+
+			handles.push_back(doc->add_marker(offset));
+			pos.push_back(offset);
+			continue;
+		}
+
+		ULONG offset, erase, insert;
+		random_edit(doc, model, NCP_UTF8, &offset, &erase, &insert);
+
+		// markers up to the edit stay put, the erased ones end up at the start
+		for(size_t m = 0; m < pos.size(); m++)
+		{
+			if(pos[m] <= offset)
+				continue;
+			else if(pos[m] < offset + erase)
+				pos[m] = offset;
+			else
+				pos[m] = pos[m] - erase + insert;
+		}
+	}
+
+	for(size_t m = 0; m < pos.size(); m++)
+		CHECK(doc->marker_offset(handles[m]) == pos[m]);
+
+	doc->Release();
+}
+
+//
+//	A listener which keeps its own copy of the text up-to-date from
+//	nothing but the changes it is told about
+//
+struct MIRROR
+{
+	TextDocument *doc;
+	UTF16STR	  text;
+	ULONG		  lines;
+	ULONG		  changes;
+};
+
+static void mirror_change(void *param, DOCCHANGE *change)
+{
+	MIRROR	*mirror = (MIRROR *)param;
+	UTF16STR now	= document_text(mirror->doc);
+
+	CHECK(!change->reset);
+	CHECK(change->offset_chars + change->erase_chars <= mirror->text.size());
+	CHECK(change->offset_chars + change->insert_chars <= now.size());
+
+	if(change->offset_chars + change->erase_chars <= mirror->text.size() &&
+	   change->offset_chars + change->insert_chars <= now.size())
+	{
+		mirror->text.erase(mirror->text.begin() + change->offset_chars, mirror->text.begin() + change->offset_chars + change->erase_chars);
+		mirror->text.insert(mirror->text.begin() + change->offset_chars, now.begin() + change->offset_chars, now.begin() + change->offset_chars + change->insert_chars);
+	}
+
+	CHECK(mirror->text == now);
+
+	// an empty document has no lines, otherwise the lines replaced are all there is to go on
+	if(mirror->lines == 0 || now.empty())
+		mirror->lines = mirror->doc->linecount();
+	else
+		mirror->lines = mirror->lines - change->erase_lines + change->insert_lines;
+
+	CHECK(mirror->lines == mirror->doc->linecount());
+	mirror->changes++;
+}
+
+//
+//	Undo, redo and jumping between revisions report each event that is
+//	put back as an ordinary change, and markers move with the text
+//
+TEST(document_undo_changes)
+{
+	for(size_t f = 0; f < NUM_FORMATS; f++)
+	{
+		int		 format = formats[f];
+		UTF16STR model	= random_text(1000, format);
+		ULONG	 start, end;
+		MIRROR	 mirror;
+		std::map<ULONG, UTF16STR> snapshot;
+		std::vector<markers::marker> handles;
+
+		TextDocument *doc = load_text(model, format);
+		REQUIRE(doc);
+
+		snapshot[doc->UndoRevision()] = model;
+
+		mirror.doc	   = doc;
+		mirror.text	   = model;
+		mirror.lines   = doc->linecount();
+		mirror.changes = 0;
+		doc->subscribe(mirror_change, &mirror);
+
+		// markers at the very start stay there, whatever happens
+		handles.push_back(doc->add_marker(0));
+
+		for(int i = 0; i < 300; i++)
+		{
+			ULONG op = test_random(10);
+
+			if(op < 5)
+			{
+				random_edit(doc, model, format);
+				snapshot[doc->UndoRevision()] = model;
+			}
+			else
+			{
+				bool moved;
+
+				if(op < 7)
+					moved = doc->Undo(&start, &end);
+				else if(op < 9)
+					moved = doc->Redo(&start, &end);
+				else
+					moved = doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end);
+
+				REQUIRE(snapshot.count(doc->UndoRevision()));
+				model = snapshot[doc->UndoRevision()];
+
+				if(moved)
+					CHECK(start <= end && end <= model.size());
+			}
+
+			if(test_random(10) == 0)
+				handles.push_back(doc->add_marker(test_random((ULONG)model.size() + 1)));
+
+			REQUIRE(mirror.text == model);
+
+			for(size_t m = 0; m < handles.size(); m++)
+				CHECK(doc->marker_offset(handles[m]) <= model.size());
+		}
+
+		CHECK(doc->marker_offset(handles[0]) == 0);
+		CHECK(mirror.changes > 0);
+		REQUIRE(check_document(doc, model, format));
+
+		doc->unsubscribe(mirror_change, &mirror);
+		doc->Release();
+	}
+}
+
+//
+//	Text that is typed and then undone takes the markers inside it back
+//	to where it was, and redoing it leaves them there
+//
+TEST(document_undo_markers)
+{
+	TCHAR	 text[] = { 'h', 'e', 'l', 'l', 'o' };
+	UTF16STR model	= utf16("one two three");
+	ULONG	 start, end;
+
+	TextDocument *doc = load_text(model, NCP_UTF8);
+	REQUIRE(doc);
+
+	markers::marker before = doc->add_marker(3);
+	markers::marker after  = doc->add_marker(8);
+
+	doc->insert_text(4, text, 5);
+	markers::marker inside = doc->add_marker(6);
+
+	CHECK(doc->marker_offset(after) == 13);
+
+	CHECK(doc->Undo(&start, &end));
+	CHECK(doc->marker_offset(before) == 3);
+	CHECK(doc->marker_offset(inside) == 4);
+	CHECK(doc->marker_offset(after) == 8);
+
+	CHECK(doc->Redo(&start, &end));
+	CHECK(start == 4 && end == 9);
+	CHECK(doc->marker_offset(before) == 3);
+	CHECK(doc->marker_offset(inside) == 4);
+	CHECK(doc->marker_offset(after) == 13);
+
+	doc->Release();
+}
+
+//
+//	Malformed UTF-8 can decode differently once an edit puts other bytes
+//	next to it - a lead-byte and some stray trail-bytes turn into a single
+//	character when the text between them is erased. The document is kept
+//	as raw bytes here, and compared with the same bytes loaded from scratch
+//
+static const BYTE bom8[] = { 0xEF, 0xBB, 0xBF };
+
+static bool same_document(TextDocument *doc, const BYTESTR &data)
+{
+	BYTESTR file(bom8, bom8 + 3);
+	int		before = test_failures();
+
+	file.insert(file.end(), data.begin(), data.end());
+
+	TextDocument *fresh = load_document(file);
+
+	if(fresh == 0)
+		return false;
+
+	CHECK(document_text(doc) == document_text(fresh));
+	CHECK(doc->size() == fresh->size());
+	CHECK(doc->linecount() == fresh->linecount());
+
+	for(ULONG i = 0; i < doc->linecount() && i < fresh->linecount(); i++)
+	{
+		ULONG a[4], b[4];
+
+		CHECK(doc->lineinfo_from_lineno(i, &a[0], &a[1], &a[2], &a[3]));
+		CHECK(fresh->lineinfo_from_lineno(i, &b[0], &b[1], &b[2], &b[3]));
+		CHECK(a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3]);
+	}
+
+	fresh->Release();
+	return test_failures() == before;
+}
+
+// the length of the document in UTF-16 code-units, from the line index
+static ULONG length_chars(TextDocument *doc)
+{
+	ULONG offset = 0, length = 0;
+
+	if(doc->linecount())
+		doc->lineinfo_from_lineno(doc->linecount() - 1, &offset, &length, 0, 0);
+
+	return offset + length;
+}
+
+// where each character starts, and how many UTF-16 code-units it is
+static void utf8_chars(const BYTESTR &data, std::vector<ULONG> &start, std::vector<ULONG> &units)
+{
+	size_t pos = 0;
+
+	start.clear();
+	units.clear();
+
+	while(pos < data.size())
+	{
+		UTF32  ch32;
+		size_t len = utf8_to_utf32((UTF8 *)&data[pos], data.size() - pos, &ch32);
+
+		start.push_back((ULONG)pos);
+		units.push_back(ch32 > 0xFFFF && ch32 <= 0x10FFFF ? 2 : 1);
+		pos += len;
+	}
+
+	start.push_back((ULONG)data.size());
+}
+
+TEST(document_malformed)
+{
+	static const char example[] = "hello\xE4" "a\xB8\xADworld\nline two\n";
+	BYTESTR data((BYTE *)example, (BYTE *)example + sizeof(example) - 1);
+	BYTESTR file(bom8, bom8 + 3);
+	ULONG	start, end;
+
+	file.insert(file.end(), data.begin(), data.end());
+
+	// erasing the 'a' joins the three bytes around it into one character
+	TextDocument *doc = load_document(file);
+	REQUIRE(doc);
+
+	CHECK(length_chars(doc) == 24);
+	doc->erase_text(6, 1);
+	data.erase(data.begin() + 6);
+	CHECK(length_chars(doc) == 21);
+	CHECK(same_document(doc, data));
+
+	// and putting it back splits them up again
+	CHECK(doc->Undo(&start, &end));
+	data.insert(data.begin() + 6, 'a');
+	CHECK(same_document(doc, data));
+
+	doc->Release();
+
+	// random edits to text with plenty of damage
+	for(int round = 0; round < 20; round++)
+	{
+		std::map<ULONG, BYTESTR> snapshot;
+		std::vector<ULONG> chars, units;
+
+		data = encode(random_text(300, NCP_UTF8), NCP_UTF8, false);
+
+		for(int i = test_random(30); i >= 0; i--)
+			data[test_random((ULONG)data.size())] = (BYTE)(0x80 + test_random(0x80));
+
+		file.assign(bom8, bom8 + 3);
+		file.insert(file.end(), data.begin(), data.end());
+
+		doc = load_document(file);
+		REQUIRE(doc);
+
+		snapshot[doc->UndoRevision()] = data;
+
+		for(int i = 0; i < 100; i++)
+		{
+			ULONG op = test_random(10);
+
+			utf8_chars(data, chars, units);
+
+			ULONG c = test_random((ULONG)chars.size());
+			ULONG n = test_random(4);
+			ULONG offset = 0, length = 0, k;
+
+			n = min(n, (ULONG)chars.size() - 1 - c);
+
+			for(k = 0; k < c; k++)
+				offset += units[k];
+
+			for(k = c; k < c + n; k++)
+				length += units[k];
+
+			if(op < 4)
+			{
+				doc->erase_text(offset, length);
+				data.erase(data.begin() + chars[c], data.begin() + chars[c + n]);
+				snapshot[doc->UndoRevision()] = data;
+			}
+			else if(op < 6)
+			{
+				UTF16STR text	 = random_text(1 + test_random(3), NCP_UTF8);
+				BYTESTR	 encoded = encode(text, NCP_UTF8, false);
+
+				doc->insert_text(offset, &text[0], (ULONG)text.size());
+				data.insert(data.begin() + chars[c], encoded.begin(), encoded.end());
+				snapshot[doc->UndoRevision()] = data;
+			}
+			else
+			{
+				if(op < 8)
+					doc->Undo(&start, &end);
+				else if(op < 9)
+					doc->Redo(&start, &end);
+				else
+					doc->GotoRevision(test_random(doc->UndoRevisionCount() + 1), &start, &end);
+
+				REQUIRE(snapshot.count(doc->UndoRevision()));
+				data = snapshot[doc->UndoRevision()];
+			}
+
+			REQUIRE(same_document(doc, data));
+		}
+
+		doc->Release();
+	}
+}
@@ -0,0 +1,304 @@
+//
+//	MODULE:		test_file.cpp
+//
+//	PURPOSE:	Following a file that is being appended to, reloading
+//				a file that has changed underneath a document, and
+//				loading a compressed file
+//
+#include <errno.h>
+#include "test.h"
+#include "FileZip.h"
+
+#define FILE_TMPFILE	"doctests.file"
+#define FILE_GZFILE		"doctests.gz"
+
+// the filename as a TCHAR string, for TextDocument::reload
+static UTF16STR tfilename()
+{
+	UTF16STR name = utf16(FILE_TMPFILE);
+
+	name.push_back(0);
+	return name;
+}
+
+static bool append_file(TextDocument *doc, ULONG expected)
+{
+	FILEHANDLE hFile = file_open(FILE_TMPFILE);
+	ULONG	   added;
+
+	if(hFile == INVALID_FILEHANDLE)
+		return false;
+
+	added = doc->append_file(hFile);
+	file_close(hFile);
+
+	return added == expected;
+}
+
+//
+//	Text added to the end of the file is added to the end of the document,
+//	except for a character that hasn't been completely written yet
+//
+TEST(file_append)
+{
+	UTF16STR model = random_text(3000, NCP_UTF8);
+	BYTESTR	 data  = encode(model, NCP_UTF8, true);
+
+	REQUIRE(write_file(FILE_TMPFILE, data));
+
+	TextDocument *doc = load_document(FILE_TMPFILE);
+	REQUIRE(doc);
+
+	// nothing new
+	CHECK(append_file(doc, 0));
+
+	for(int i = 0; i < 50; i++)
+	{
+		UTF16STR more	 = random_text(1 + test_random(200), NCP_UTF8);
+		BYTESTR	 encoded = encode(more, NCP_UTF8, false);
+		bool	 pair	 = more.back() >= 0xDC00 && more.back() <= 0xDFFF;
+		ULONG	 last	 = (ULONG)encode(UTF16STR(more.end() - (pair ? 2 : 1), more.end()), NCP_UTF8, false).size();
+		ULONG	 part	 = last > 1 && test_random(2) ? 1 + test_random(last - 1) : 0;
+
+		// write part of the last character first, which has to wait until it has all arrived
+		if(part)
+		{
+			BYTESTR partial = data;
+
+			partial.insert(partial.end(), encoded.begin(), encoded.end() - last + part);
+			REQUIRE(write_file(FILE_TMPFILE, partial));
+			REQUIRE(append_file(doc, (ULONG)encoded.size() - last));
+		}
+
+		data.insert(data.end(), encoded.begin(), encoded.end());
+		REQUIRE(write_file(FILE_TMPFILE, data));
+		REQUIRE(append_file(doc, part ? last : (ULONG)encoded.size()));
+
+		model.insert(model.end(), more.begin(), more.end());
+		REQUIRE(check_document(doc, model, NCP_UTF8));
+	}
+
+	// an edit after the appends can be undone, but the appends can't
+	TCHAR typed[] = { 'x' };
+	ULONG start, end;
+
+	doc->insert_text(0, typed, 1);
+	CHECK(doc->Undo(&start, &end));
+	CHECK(!doc->Undo(&start, &end));
+	CHECK(check_document(doc, model, NCP_UTF8));
+
+	// a shorter file can't be appended to
+	data.resize(data.size() / 2);
+	REQUIRE(write_file(FILE_TMPFILE, data));
+	CHECK(append_file(doc, FILE_BADSIZE));
+
+	doc->Release();
+	remove(FILE_TMPFILE);
+}
+
+//
+//	Change the file in a few places and reload it. Only the changes are
+//	made to the document, and they can be undone
+//
+TEST(file_reload)
+{
+	for(int round = 0; round < 20; round++)
+	{
+		int		 format = round & 1 ? NCP_UTF16 : NCP_UTF8;
+		UTF16STR before = random_text(50000 + test_random(50000), format);
+		UTF16STR model	= before;
+		UTF16STR name	= tfilename();
+		ULONG	 start, end;
+
+		REQUIRE(write_file(FILE_TMPFILE, encode(model, format, true)));
+
+		TextDocument *doc = load_document(FILE_TMPFILE);
+		REQUIRE(doc);
+
+		// something typed into the document is thrown away by the reload
+		if(round & 2)
+		{
+			TCHAR typed[] = { 't', 'y', 'p', 'e', 'd' };
+			ULONG offset  = test_random((ULONG)model.size());
+
+			if(model[offset] >= 0xDC00 && model[offset] <= 0xDFFF)
+				offset--;
+
+			doc->insert_text(offset, typed, 5);
+		}
+
+		for(ULONG i = 1 + test_random(4); i > 0; i--)
+		{
+			ULONG	 offset = test_random((ULONG)model.size());
+			ULONG	 erase	= test_random(3000);
+			UTF16STR text	= random_text(test_random(3000), format);
+
+			erase = min(erase, (ULONG)model.size() - offset);
+
+			// not in the middle of a surrogate pair
+			if(model[offset] >= 0xDC00 && model[offset] <= 0xDFFF)
+				offset--;
+
+			if(offset + erase < model.size() && model[offset + erase] >= 0xDC00 && model[offset + erase] <= 0xDFFF)
+				erase++;
+
+			model.erase(model.begin() + offset, model.begin() + offset + erase);
+			model.insert(model.begin() + offset, text.begin(), text.end());
+		}
+
+		// a file's timestamp can be quite coarse, so make sure the size changes
+		if(model.size() == before.size())
+			model.push_back('x');
+
+		REQUIRE(write_file(FILE_TMPFILE, encode(model, format, true)));
+
+		CHECK(doc->reload(&name[0]));
+		REQUIRE(check_document(doc, model, format));
+
+		// and reloading again changes nothing
+		ULONG revision = doc->revision();
+
+		CHECK(doc->reload(&name[0]));
+		CHECK(doc->revision() == revision);
+		REQUIRE(check_document(doc, model, format));
+
+		// the reload was a single undo action
+		CHECK(doc->Undo(&start, &end));
+
+		if(round & 2)
+			CHECK(doc->Undo(&start, &end));
+
+		REQUIRE(check_document(doc, before, format));
+
+		doc->Release();
+	}
+
+	remove(FILE_TMPFILE);
+}
+
+#ifdef HAVE_ZLIB
+
+//
+//	A gzip file loads as the text inside it, read-only. Any part of
+//	it can be read, and a file cut short keeps what could be decompressed
+//
+TEST(file_gzip)
+{
+	UTF16STR model = random_text(200000, NCP_UTF8);
+	BYTESTR	 data  = encode(model, NCP_UTF8, true);
+	BYTESTR	 zip   = gzip(data, 3);
+	TCHAR	 typed[] = { 'x' };
+
+	REQUIRE(write_file(FILE_GZFILE, zip));
+
+	TextDocument *doc = load_document(FILE_GZFILE);
+	REQUIRE(doc);
+
+	CHECK(check_document(doc, model, NCP_UTF8));
+	CHECK(doc->readonly());
+	CHECK(doc->insert_text(0, typed, 1) == 0);
+	doc->Release();
+
+	FILEHANDLE hFile = file_open(FILE_GZFILE);
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	CHECK(file_compressed(hFile));
+	CHECK(file_size(hFile) == data.size());
+	CHECK(file_size_raw(hFile) == zip.size());
+
+	for(int i = 0; i < 100; i++)
+	{
+		ULONG	offset = test_random((ULONG)data.size());
+		ULONG	length = 1 + test_random(10000);
+		BYTESTR buf(length);
+
+		length = min(length, (ULONG)data.size() - offset);
+
+		CHECK(file_read(hFile, offset, &buf[0], length) == length);
+		CHECK(memcmp(&buf[0], &data[offset], length) == 0);
+	}
+
+	file_close(hFile);
+
+	// the last member is cut in half
+	zip.resize(zip.size() - zip.size() / 6);
+	REQUIRE(write_file(FILE_GZFILE, zip));
+
+	hFile = file_open(FILE_GZFILE);
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	ULONG	length = file_size(hFile);
+	BYTESTR buf(length);
+
+	CHECK(length >= data.size() * 2 / 3 && length < data.size());
+	CHECK(file_read(hFile, 0, &buf[0], length) == length);
+	CHECK(memcmp(&buf[0], &data[0], length) == 0);
+
+	file_close(hFile);
+	remove(FILE_GZFILE);
+}
+
+//
+//	A gzip file says how big it is, so it can be read straight through
+//	without decompressing it first - but only if it has just the one member.
+//	One that decompresses to more than ZIP_MAXSIZE is turned away
+//
+TEST(file_gzip_size)
+{
+	UTF16STR model = random_text(100000, NCP_UTF8);
+	BYTESTR	 data  = encode(model, NCP_UTF8, true);
+	BYTESTR	 buf(data.size() + 1);
+
+	REQUIRE(write_file(FILE_GZFILE, gzip(data, 1)));
+
+	FILEHANDLE hFile = file_open(FILE_GZFILE);
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	CHECK(file_size_hint(hFile) == data.size());
+
+	for(ULONG offset = 0, len; offset < data.size(); offset += len)
+	{
+		len = min((ULONG)data.size() - offset, 1 + test_random(20000));
+		CHECK(file_read(hFile, offset, &buf[offset], len) == len);
+	}
+
+	CHECK(memcmp(&buf[0], &data[0], data.size()) == 0);
+	file_close(hFile);
+
+	// the size at the end is only the last member's
+	REQUIRE(write_file(FILE_GZFILE, gzip(data, 2)));
+
+	hFile = file_open(FILE_GZFILE);
+	REQUIRE(hFile != INVALID_FILEHANDLE);
+
+	ULONG hint = file_size_hint(hFile);
+
+	CHECK(hint < data.size());
+	CHECK(file_read(hFile, 0, &buf[0], hint) == 0);
+	CHECK(file_size(hFile) == data.size());
+	CHECK(file_read(hFile, 0, &buf[0], (ULONG)data.size()) == data.size());
+	file_close(hFile);
+
+	TextDocument *doc = load_document(FILE_GZFILE);
+	REQUIRE(doc);
+	CHECK(check_document(doc, model, NCP_UTF8));
+	doc->Release();
+
+	// the same 16Mb of zeros, over and over
+	BYTESTR zeros = gzip(BYTESTR(0x1000000), 1);
+	BYTESTR bomb;
+
+	for(ULONG i = 0; i <= ZIP_MAXSIZE / 0x1000000; i++)
+		bomb.insert(bomb.end(), zeros.begin(), zeros.end());
+
+	REQUIRE(write_file(FILE_GZFILE, bomb));
+
+	errno = 0;
+	CHECK(load_document(FILE_GZFILE) == 0);
+#ifndef _WIN32
+	CHECK(errno == EFBIG);
+#endif
+	remove(FILE_GZFILE);
+}
+
+#endif
@@ -0,0 +1,143 @@
+//
+//	MODULE:		test_lineindex.cpp
+//
+//	PURPOSE:	The line treap, checked against a plain list of line lengths
+//
+#include "test.h"
+#include "lineindex.h"
+
+static DOCLINE random_line(bool last)
+{
+	DOCLINE line;
+
+	// only the last line can be empty
+	line.length_chars = (last ? 0 : 1) + test_random(80);
+	line.length_bytes = line.length_chars + test_random(line.length_chars + 1);
+	line.width		  = test_random(200);
+	line.stats.words  = test_random(10);
+	line.stats.codepoints = line.length_chars;
+	line.stats.eol	  = (BYTE)test_random(EOL_TYPES);
+
+	return line;
+}
+
+static bool check_lines(lineindex &index, const std::vector<DOCLINE> &model)
+{
+	int				  before = test_failures();
+	ULONG			  bytes	 = 0, chars = 0;
+	ULONG			  offset_bytes, offset_chars;
+	lineindex::cursor cur;
+	size_t			  i;
+
+	memset(&cur, 0, sizeof(cur));
+	CHECK(index.count() == model.size());
+
+	// forwards, with the cursor
+	for(i = 0; i < model.size(); i++)
+	{
+		const DOCLINE *line = index.line((ULONG)i, &offset_bytes, &offset_chars, &cur);
+
+		if(line == 0)
+			return false;
+
+		CHECK(offset_bytes == bytes && offset_chars == chars);
+		CHECK(line->length_bytes == model[i].length_bytes && line->width == model[i].width);
+		CHECK(line->stats.eol == model[i].stats.eol);
+
+		bytes += model[i].length_bytes;
+		chars += model[i].length_chars;
+	}
+
+	CHECK(index.total_bytes() == bytes && index.total_chars() == chars);
+	CHECK(index.line((ULONG)model.size(), &offset_bytes, &offset_chars) == 0);
+	CHECK(offset_bytes == bytes && offset_chars == chars);
+
+	// and backwards
+	for(i = model.size(); i > 0; i--)
+	{
+		bytes -= model[i - 1].length_bytes;
+		index.line((ULONG)i - 1, &offset_bytes, 0, &cur);
+		CHECK(offset_bytes == bytes);
+	}
+
+	// looking up offsets, including the very end
+	for(i = 0; i < 50 && model.size(); i++)
+	{
+		ULONG offset = test_random(index.total_chars() + 1);
+		ULONG lineno = index.lineno_from_chars(offset);
+
+		if(lineno >= model.size())
+			return false;
+
+		CHECK(index.offset_chars(lineno) <= offset);
+		CHECK(lineno + 1 == model.size() || index.offset_chars(lineno + 1) > offset);
+
+		offset = test_random(index.total_bytes() + 1);
+		lineno = index.lineno_from_bytes(offset);
+
+		if(lineno >= model.size())
+			return false;
+
+		CHECK(index.offset_bytes(lineno) <= offset);
+		CHECK(lineno + 1 == model.size() || index.offset_bytes(lineno + 1) > offset);
+	}
+
+	return test_failures() == before;
+}
+
+TEST(lineindex_model)
+{
+	for(ULONG round = 0; round < 10; round++)
+	{
+		lineindex			 index;
+		std::vector<DOCLINE> model;
+		ULONG				 i;
+
+		for(i = test_random(500); i > 0; i--)
+			model.push_back(random_line(i == 1));
+
+		index.assign(model);
+		REQUIRE(check_lines(index, model));
+
+		for(int edit = 0; edit < 500; edit++)
+		{
+			std::vector<DOCLINE> lines;
+			ULONG first = test_random((ULONG)model.size() + 1);
+			ULONG last	= test_random(10);
+
+			// min is a macro, so the random number can't be picked inside it
+			last = min(first + last, (ULONG)model.size());
+
+			for(i = test_random(10); i > 0; i--)
+				lines.push_back(random_line(false));
+
+			// a cursor from before the change is never trusted afterwards
+			lineindex::cursor cur;
+
+			memset(&cur, 0, sizeof(cur));
+
+			if(model.size())
+				index.line(test_random((ULONG)model.size()), 0, 0, &cur);
+
+			index.replace(first, last, lines);
+			model.erase(model.begin() + first, model.begin() + last);
+			model.insert(model.begin() + first, lines.begin(), lines.end());
+
+			if(cur.n && cur.lineno < model.size())
+				CHECK(index.line(cur.lineno, 0, 0, &cur)->length_bytes == model[cur.lineno].length_bytes);
+
+			if(edit % 50 == 0)
+				REQUIRE(check_lines(index, model));
+		}
+
+		REQUIRE(check_lines(index, model));
+
+		// a copy is separate from the original
+		lineindex copy(index);
+		std::vector<DOCLINE> none;
+
+		index.replace(0, index.count(), none);
+		CHECK(index.count() == 0 && index.total_bytes() == 0);
+		CHECK(check_lines(copy, model));
+	}
+}
@@ -0,0 +1,131 @@
+//
+//	MODULE:		test_markers.cpp
+//
+//	PURPOSE:	The marker treap, checked against a plain list of positions
+//
+#include "test.h"
+#include "markers.h"
+
+TEST(markers_update)
+{
+	markers m;
+	markers::marker a = m.add(30);
+	markers::marker b = m.add(31);
+	markers::marker c = m.add(40);
+
+	// the marker at the end of the erased part moves with the text after it
+	m.update(30, 1, 24);
+	CHECK(m.position(a) == 30);
+	CHECK(m.position(b) == 54);
+	CHECK(m.position(c) == 63);
+
+	// an insertion at a marker leaves it where it is
+	m.update(30, 0, 5);
+	CHECK(m.position(a) == 30);
+	CHECK(m.position(b) == 59);
+
+	// everything inside an erased part ends up at its start
+	m.update(20, 50, 0);
+	CHECK(m.position(a) == 20);
+	CHECK(m.position(b) == 20);
+	CHECK(m.position(c) == 20);
+}
+
+//
+//	Random adds, removes, edits and clamps. Now and again every
+//	position is checked, along with iterating from a random place
+//
+TEST(markers_model)
+{
+	for(ULONG round = 0; round < 10; round++)
+	{
+		markers m;
+		std::vector<markers::marker> handles;
+		std::vector<ULONG> pos;
+		ULONG length = 1000;
+
+		for(int i = 0; i < 20000; i++)
+		{
+			ULONG op = test_random(10);
+			size_t n;
+
+			if(op < 3)
+			{
+				ULONG p = test_random(length + 1);
+
+				handles.push_back(m.add(p, (void *)handles.size()));
+				pos.push_back(p);
+			}
+			else if(op < 4 && handles.size())
+			{
+				n = test_random((ULONG)handles.size());
+
+				if(handles[n])
+				{
+					m.remove(handles[n]);
+					handles[n] = 0;
+				}
+			}
+			else if(op < 9)
+			{
+				ULONG p		 = test_random(length + 1);
+				ULONG erase	 = test_random(30);
+				ULONG insert = test_random(30);
+
+				// min is a macro, so the random number can't be picked inside it
+				erase = min(erase, length - p);
+
+				m.update(p, erase, insert);
+
+				for(n = 0; n < pos.size(); n++)
+				{
+					if(pos[n] <= p)
+						continue;
+					else if(pos[n] < p + erase)
+						pos[n] = p;
+					else
+						pos[n] = pos[n] - erase + insert;
+				}
+
+				length = length - erase + insert;
+			}
+			else
+			{
+				length = test_random(length + 1);
+				m.clamp(length);
+
+				for(n = 0; n < pos.size(); n++)
+					pos[n] = min(pos[n], length);
+			}
+
+			if(i % 97 == 0)
+			{
+				size_t live = 0, found = 0, want = 0;
+				ULONG  from = test_random(length + 1), prev = 0;
+
+				for(n = 0; n < handles.size(); n++)
+				{
+					if(handles[n] == 0)
+						continue;
+
+					live++;
+					REQUIRE(m.position(handles[n]) == pos[n]);
+					CHECK(m.param(handles[n]) == (void *)n);
+
+					if(pos[n] >= from)
+						want++;
+				}
+
+				CHECK(m.size() == live);
+
+				for(markers::marker k = m.first(from); k; k = m.next(k), found++)
+				{
+					CHECK(m.position(k) >= from && m.position(k) >= prev);
+					prev = m.position(k);
+				}
+
+				CHECK(found == want);
+			}
+		}
+	}
+}
@@ -0,0 +1,130 @@
+//
+//	MODULE:		test_save.cpp
+//
+//	PURPOSE:	Saving a document in every format, from every format,
+//				compared byte-for-byte with an independent encoder
+//
+#include "test.h"
+
+static const int formats[] = { NCP_ASCII, NCP_UTF8, NCP_UTF16, NCP_UTF16BE, NCP_UTF32, NCP_UTF32BE };
+#define NUM_FORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+#define SAVE_TMPFILE	"doctests.save"
+
+static BYTESTR save_document(TextDocument *doc, int format, bool bom)
+{
+	FILEHANDLE hFile = file_create(SAVE_TMPFILE);
+	BYTESTR	   data;
+
+	if(hFile == INVALID_FILEHANDLE)
+		return data;
+
+	CHECK(doc->save(hFile, format, bom));
+	file_close(hFile);
+
+	data = read_file(SAVE_TMPFILE);
+	remove(SAVE_TMPFILE);
+
+	return data;
+}
+
+//
+//	Load the text in one format and save it in another. Text with characters
+//	outside Latin-1 isn't saved as ASCII. The document is edited first (at the
+//	start, middle and end) so that it is in more than one piece
+//
+static void round_trip(const UTF16STR &text, int from, int to)
+{
+	UTF16STR model = text;
+	TCHAR	 edit[] = { 'x', 0xE9, '\n' };
+	ULONG	 editlen = 3;
+
+	TextDocument *doc = load_document(encode(model, from, from != NCP_ASCII));
+	REQUIRE(doc);
+
+	for(int i = 0; i < 3; i++)
+	{
+		ULONG offset = (ULONG)model.size() * i / 2;
+
+		// not in the middle of a surrogate pair
+		if(offset > 0 && offset < model.size() && model[offset] >= 0xDC00 && model[offset] <= 0xDFFF)
+			offset--;
+
+		doc->insert_text(offset, edit, editlen);
+		model.insert(model.begin() + offset, edit, edit + editlen);
+	}
+
+	REQUIRE(check_document(doc, model, from));
+
+	for(int bom = 0; bom < 2; bom++)
+	{
+		if(to == NCP_ASCII && bom)
+			continue;
+
+		BYTESTR saved = save_document(doc, to, bom != 0);
+
+		if(saved != encode(model, to, bom != 0))
+		{
+			printf("  format %d -> %d (bom %d) differs\n", from, to, bom);
+			CHECK(saved == encode(model, to, bom != 0));
+		}
+	}
+
+	doc->Release();
+}
+
+TEST(save_formats)
+{
+	UTF16STR latin	 = random_text(40000, NCP_ASCII);
+	UTF16STR unicode = random_text(40000, NCP_UTF8);
+
+	for(size_t from = 0; from < NUM_FORMATS; from++)
+	{
+		for(size_t to = 0; to < NUM_FORMATS; to++)
+		{
+			round_trip(latin, formats[from], formats[to]);
+
+			if(formats[from] != NCP_ASCII && formats[to] != NCP_ASCII)
+				round_trip(unicode, formats[from], formats[to]);
+		}
+	}
+}
+
+//
+//	CR, LF and CR/LF are all turned into the same thing,
+//	and the other line-breaks are left alone
+//
+TEST(save_lineendings)
+{
+	static const char *eolstr[] = { 0, "\r\n", "\n", "\r" };
+	UTF16STR text = random_text(5000, NCP_UTF8);
+
+	for(int eol = EOL_CRLF; eol <= EOL_CR; eol++)
+	{
+		UTF16STR model;
+		UTF16STR newline = utf16(eolstr[eol]);
+		size_t	 i;
+
+		TextDocument *doc = load_document(encode(text, NCP_UTF8, true));
+		REQUIRE(doc);
+
+		for(i = 0; i < text.size(); i++)
+		{
+			if(text[i] == '\r' || text[i] == '\n')
+			{
+				if(text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n')
+					i++;
+
+				model.insert(model.end(), newline.begin(), newline.end());
+			}
+			else
+			{
+				model.push_back(text[i]);
+			}
+		}
+
+		doc->setlineending(eol);
+		CHECK(save_document(doc, NCP_UTF8, true) == encode(model, NCP_UTF8, true));
+		doc->Release();
+	}
+}
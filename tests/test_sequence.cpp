@@ -0,0 +1,225 @@
+//
+//	MODULE:		test_sequence.cpp
+//
+//	PURPOSE:	The piece-table and its undo tree, checked against a
+//				copy of the text kept in a std::string
+//
+#include <string>
+#include <map>
+#include "test.h"
+#include "sequence.h"
+
+static std::string sequence_text(sequence *seq)
+{
+	std::string text(seq->size(), '\0');
+
+	if(text.size())
+		seq->render(0, (seqchar *)&text[0], text.size());
+
+	return text;
+}
+
+//
+//	Random edits, undos, redos and jumps. Every revision's text is
+//	remembered, so wherever the sequence ends up can be checked
+//
+TEST(sequence_undo_tree)
+{
+	static const seqchar buf[] = "abcdefgh";
+
+	for(int round = 0; round < 100; round++)
+	{
+		sequence seq;
+		std::map<size_t, std::string> snapshot;
+		std::string model;
+		size_w		last = 0;
+
+		seq.init();
+		snapshot[0] = model;
+
+		for(int i = 0; i < 400; i++)
+		{
+			size_w len	 = model.size();
+			size_w pos	 = test_random(3) == 0 ? min(last, len) : test_random((ULONG)len + 1);
+			size_w count = 1 + test_random(7);
+			size_w erase = test_random(6);
+			int	   op	 = test_random(8);
+
+			switch(op)
+			{
+			case 0:
+				seq.insert(pos, buf, count);
+				model.insert(pos, (char *)buf, count);
+				snapshot[seq.revision()] = model;
+				last = pos + count;
+				break;
+
+			case 1:
+				if(erase && pos + erase <= len)
+				{
+					seq.erase(pos, erase);
+					model.erase(pos, erase);
+					snapshot[seq.revision()] = model;
+				}
+
+				last = pos;
+				break;
+
+			case 2:
+				seq.replace(pos, buf, count, erase);
+				model.replace(pos, min(erase, len - pos), (char *)buf, count);
+				snapshot[seq.revision()] = model;
+				last = pos + count;
+				break;
+
+			case 3:
+				CHECK(seq.canundo() == (seq.revision() != 0));
+				seq.undo();
+				break;
+
+			case 4:
+				seq.redo();
+				break;
+
+			case 5:
+				// a group is a single revision
+				seq.breakopt();
+				seq.group();
+				seq.insert(pos, buf, count);
+				seq.erase(pos, 1);
+				seq.ungroup();
+				seq.breakopt();
+				model.insert(pos, (char *)buf + 1, count - 1);
+				snapshot[seq.revision()] = model;
+				break;
+
+			default:
+				CHECK(seq.goto_revision(test_random((ULONG)seq.revision_count() + 1)));
+				CHECK(!seq.goto_revision(seq.revision_count() + 1));
+				break;
+			}
+
+			// undo, redo and jumps only ever land on a remembered revision
+			if(op >= 3)
+			{
+				REQUIRE(snapshot.count(seq.revision()));
+				model = snapshot[seq.revision()];
+			}
+
+			REQUIRE(sequence_text(&seq) == model);
+		}
+
+		// every revision can be visited
+		for(size_t rev = 0; rev <= seq.revision_count(); rev++)
+		{
+			seq.goto_revision(rev);
+			REQUIRE(snapshot.count(seq.revision()));
+			CHECK(sequence_text(&seq) == snapshot[seq.revision()]);
+		}
+	}
+}
+
+//
+//	A fork shares its buffers but not its history, and
+//	the two can then be edited independently
+//
+TEST(sequence_fork)
+{
+	sequence	a, b;
+	std::string ma, mb;
+
+	a.init((const seqchar *)"hello world", 11);
+	a.insert(5, (const seqchar *)",", 1);
+	ma = "hello, world";
+
+	REQUIRE(a.fork(b));
+	mb = ma;
+
+	CHECK(sequence_text(&b) == mb);
+	CHECK(!b.canundo());
+
+	for(int i = 0; i < 500; i++)
+	{
+		sequence	*seq   = i & 1 ? &a : &b;
+		std::string &model = i & 1 ? ma : mb;
+		size_w		 pos   = test_random((ULONG)model.size() + 1);
+
+		if(test_random(3) || model.empty())
+		{
+			seq->insert(pos, (const seqchar *)"xyz", 3);
+			model.insert(pos, "xyz");
+		}
+		else
+		{
+			size_w erase = test_random(5);
+
+			// min is a macro, so the random number can't be picked inside it
+			erase = min(erase, model.size() - pos);
+
+			seq->erase(pos, erase);
+			model.erase(pos, erase);
+		}
+	}
+
+	CHECK(sequence_text(&a) == ma);
+	CHECK(sequence_text(&b) == mb);
+
+	// the fork outlives the original's buffers
+	a.clear();
+	CHECK(sequence_text(&b) == mb);
+}
+//
+//	Data added with extend can't be undone, and the undo stops there - 
+//	but edits after it are undone and redone as usual
+//
+TEST(sequence_extend)
+{
+	sequence	seq;
+	std::string before, after;
+	seqchar    *buf;
+
+	seq.init((const seqchar *)"hello", 5);
+	seq.insert(5, (const seqchar *)" world", 6);
+	seq.breakopt();
+	seq.erase(0, 1);
+	before = sequence_text(&seq);
+
+	REQUIRE((buf = seq.extend_reserve(4)) != 0);
+	memcpy(buf, "\nabc", 4);
+	REQUIRE(seq.extend(4));
+
+	// a second extension straight afterwards carries on from the first
+	REQUIRE((buf = seq.extend_reserve(3)) != 0);
+	memcpy(buf, "def", 3);
+	REQUIRE(seq.extend(3));
+
+	CHECK(sequence_text(&seq) == before + "\nabcdef");
+	CHECK(!seq.canundo());
+	CHECK(!seq.undo());
+	CHECK(!seq.goto_revision(0));
+	CHECK(sequence_text(&seq) == before + "\nabcdef");
+
+	seq.insert(0, (const seqchar *)"H", 1);
+	after = sequence_text(&seq);
+
+	CHECK(seq.undo());
+	CHECK(sequence_text(&seq) == before + "\nabcdef");
+	CHECK(!seq.undo());
+	CHECK(seq.redo());
+	CHECK(sequence_text(&seq) == after);
+
+	// another extension after the edit
+	REQUIRE((buf = seq.extend_reserve(3)) != 0);
+	memcpy(buf, "ghi", 3);
+	REQUIRE(seq.extend(3));
+
+	CHECK(sequence_text(&seq) == after + "ghi");
+	CHECK(!seq.undo());
+
+	// every revision from the last extension on can still be visited
+	for(size_t rev = 0; rev <= seq.revision_count(); rev++)
+	{
+		if(seq.goto_revision(rev))
+			CHECK(sequence_text(&seq) == after + "ghi");
+	}
+}
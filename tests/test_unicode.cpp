@@ -0,0 +1,145 @@
+//
+//	MODULE:		test_unicode.cpp
+//
+//	PURPOSE:	The Unicode conversion routines, checked against the
+//				straightforward encoder in test.cpp
+//
+#include "test.h"
+
+//
+//	UTF-8 <-> UTF-16 in both directions, with output buffers of every
+//	size so that the vectorised loops stop at every possible place
+//
+TEST(unicode_utf8)
+{
+	for(int round = 0; round < 200; round++)
+	{
+		UTF16STR text = random_text(1 + test_random(300), NCP_UTF8);
+		BYTESTR  utf8 = encode(text, NCP_UTF8, false);
+		UTF16STR out(text.size() + 1);
+		BYTESTR  back(utf8.size() + 1);
+		size_t	 len, pos, outpos, used;
+
+		len = out.size();
+		CHECK(utf8_to_utf16(&utf8[0], utf8.size(), (UTF16 *)&out[0], &len) == utf8.size());
+		CHECK(len == text.size() && UTF16STR(out.begin(), out.begin() + len) == text);
+
+		len = back.size();
+		CHECK(utf16_to_utf8((UTF16 *)&text[0], text.size(), &back[0], &len) == text.size());
+		CHECK(len == utf8.size() && BYTESTR(back.begin(), back.begin() + len) == utf8);
+
+		// the same again, a few UTF16s at a time
+		for(pos = 0, outpos = 0; pos < utf8.size(); pos += used, outpos += len)
+		{
+			len  = 1 + test_random(20);
+			used = utf8_to_utf16(&utf8[pos], utf8.size() - pos, (UTF16 *)&out[outpos], &len);
+
+			// only a surrogate pair can fail to fit
+			REQUIRE(used > 0 || len == 0);
+
+			if(used == 0)
+			{
+				len  = 2;
+				used = utf8_to_utf16(&utf8[pos], utf8.size() - pos, (UTF16 *)&out[outpos], &len);
+			}
+		}
+
+		CHECK(outpos == text.size() && UTF16STR(out.begin(), out.begin() + outpos) == text);
+
+		// measuring without converting
+		len = (size_t)-1;
+		CHECK(utf8_count_utf16(&utf8[0], utf8.size(), &len) == utf8.size() && len == text.size());
+		CHECK(utf8_complete_len(&utf8[0], utf8.size()) == utf8.size());
+	}
+}
+
+//
+//	Malformed UTF-8 becomes replacement characters - and measuring it
+//	must give the same answer as converting it
+//
+TEST(unicode_utf8_malformed)
+{
+	for(int round = 0; round < 500; round++)
+	{
+		BYTESTR  data = encode(random_text(1 + test_random(64), NCP_UTF8), NCP_UTF8, false);
+		UTF16STR out(data.size() * 2 + 2);
+		size_t	 len, count;
+		int		 i;
+
+		// damage a few BYTEs
+		for(i = test_random(4); i >= 0; i--)
+			data[test_random((ULONG)data.size())] = (BYTE)(0x80 + test_random(0x80));
+
+		len = out.size();
+		CHECK(utf8_to_utf16(&data[0], data.size(), (UTF16 *)&out[0], &len) == data.size());
+		count = (size_t)-1;
+		CHECK(utf8_count_utf16(&data[0], data.size(), &count) == data.size());
+		CHECK(count == len);
+	}
+}
+
+//
+//	UTF-16 byte-swapping, at every alignment and length
+//
+TEST(unicode_swap)
+{
+	for(size_t length = 0; length < 80; length++)
+	{
+		for(size_t align = 0; align < 4; align++)
+		{
+			UTF16STR text = random_text((ULONG)length + align, NCP_UTF16);
+			UTF16STR out(text.size() + 1);
+			size_t	 len = length;
+			size_t	 i;
+
+			CHECK(swap_utf16((UTF16 *)&text[align], length, (UTF16 *)&out[0], &len) == length);
+			CHECK(len == length);
+
+			for(i = 0; i < length; i++)
+				CHECK(out[i] == SWAPWORD(text[align + i]));
+
+			// in place
+			len = length;
+			swap_utf16((UTF16 *)&out[0], length, (UTF16 *)&out[0], &len);
+			CHECK(UTF16STR(out.begin(), out.begin() + length) == UTF16STR(text.begin() + align, text.begin() + align + length));
+		}
+	}
+}
+
+//
+//	UTF-32 and UTF-32BE <-> UTF-16
+//
+TEST(unicode_utf32)
+{
+	for(int round = 0; round < 200; round++)
+	{
+		UTF16STR text = random_text(1 + test_random(200), NCP_UTF32);
+		BYTESTR  le	  = encode(text, NCP_UTF32, false);
+		BYTESTR  be	  = encode(text, NCP_UTF32BE, false);
+		size_t	 n32  = le.size() / sizeof(UTF32);
+		std::vector<UTF32> utf32(n32 + 1);
+		UTF16STR out(text.size() + 1);
+		size_t	 len;
+
+		CHECK(sizeof(UTF32) == 4);
+
+		len = out.size();
+		CHECK(utf32_to_utf16((UTF32 *)&le[0], n32, (UTF16 *)&out[0], &len) == n32);
+		CHECK(len == text.size() && UTF16STR(out.begin(), out.begin() + len) == text);
+
+		len = out.size();
+		CHECK(utf32be_to_utf16((UTF32 *)&be[0], n32, (UTF16 *)&out[0], &len) == n32);
+		CHECK(len == text.size() && UTF16STR(out.begin(), out.begin() + len) == text);
+
+		len = utf32.size();
+		CHECK(utf16_to_utf32((UTF16 *)&text[0], text.size(), &utf32[0], &len) == text.size());
+		CHECK(len == n32 && memcmp(&utf32[0], &le[0], le.size()) == 0);
+
+		len = utf32.size();
+		CHECK(utf16_to_utf32be((UTF16 *)&text[0], text.size(), &utf32[0], &len) == text.size());
+		CHECK(len == n32 && memcmp(&utf32[0], &be[0], be.size()) == 0);
+
+		len = (size_t)-1;
+		CHECK(utf32_count_utf16((UTF32 *)&be[0], n32, &len, 1) == n32 && len == text.size());
+	}
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+//
+//	MODULE:		unicode_scalar.cpp
+//
+//	PURPOSE:	The Unicode routines compiled a second time without SSE2,
+//				in their own namespace, so that docbench can time the
+//				vectorised conversions against the plain loops
+//
+#include "portable.h"
+#include "Unicode.h"
+
+namespace scalar
+{
+#define UNICODE_NO_SSE2
+#include "Unicode.c"
+}